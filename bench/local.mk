@@ -0,0 +1,104 @@
+# Benchmarks are not built by default; run them with 'make bench'
+EXTRA_PROGRAMS = \
+	%D%/record_alloc \
+	%D%/random_id \
+	%D%/probe_workers \
+	%D%/parse_records \
+	%D%/post_http
+
+%C%_record_alloc_SOURCES = %D%/record_alloc.c
+%C%_record_alloc_CFLAGS = \
+	$(AM_CFLAGS)
+%C%_record_alloc_LDADD = $(top_builddir)/src/libtelemetry.la
+
+%C%_random_id_SOURCES = %D%/random_id.c
+%C%_random_id_CFLAGS = \
+	$(AM_CFLAGS)
+%C%_random_id_LDADD = $(top_builddir)/src/libtelem-shared.la
+
+%C%_probe_workers_SOURCES = \
+	%D%/probe_workers.c \
+	src/telemdaemon.c \
+	src/iorecord.c \
+	src/journal/journal.c
+%C%_probe_workers_CFLAGS = \
+	$(AM_CFLAGS) \
+	$(CURL_CFLAGS)
+%C%_probe_workers_LDADD = \
+	$(CURL_LIBS) \
+	$(top_builddir)/src/libtelem-shared.la \
+	-lpthread
+
+if LOG_SYSTEMD
+if HAVE_SYSTEMD_JOURNAL
+%C%_probe_workers_CFLAGS += \
+	$(SYSTEMD_JOURNAL_CFLAGS)
+%C%_probe_workers_LDADD += \
+	$(SYSTEMD_JOURNAL_LIBS)
+endif
+endif
+
+%C%_parse_records_SOURCES = \
+	%D%/parse_records.c \
+	src/iorecord.c
+%C%_parse_records_CFLAGS = \
+	$(AM_CFLAGS)
+%C%_parse_records_LDADD = $(top_builddir)/src/libtelem-shared.la
+
+if LOG_SYSTEMD
+if HAVE_SYSTEMD_JOURNAL
+%C%_parse_records_CFLAGS += \
+	$(SYSTEMD_JOURNAL_CFLAGS)
+%C%_parse_records_LDADD += \
+	$(SYSTEMD_JOURNAL_LIBS)
+endif
+endif
+
+%C%_post_http_SOURCES = \
+	%D%/post_http.c \
+	src/telempostdaemon.c \
+	src/spool.c \
+	src/iorecord.c \
+	src/retention.c \
+	src/post_batch.c \
+	src/post_queue.c \
+	src/post_compress.c \
+	src/journal/journal.c
+%C%_post_http_CFLAGS = \
+	$(AM_CFLAGS) \
+	$(CURL_CFLAGS) \
+	$(ZLIB_CFLAGS)
+%C%_post_http_LDADD = \
+	$(CURL_LIBS) \
+	$(JSON_C_LIBS) \
+	$(ZLIB_LIBS) \
+	$(top_builddir)/src/libtelem-shared.la \
+	-lpthread
+
+if HAVE_ZSTD
+%C%_post_http_CFLAGS += \
+	$(ZSTD_CFLAGS)
+%C%_post_http_LDADD += \
+	$(ZSTD_LIBS)
+endif
+
+if LOG_SYSTEMD
+if HAVE_SYSTEMD_JOURNAL
+%C%_post_http_CFLAGS += \
+	$(SYSTEMD_JOURNAL_CFLAGS)
+%C%_post_http_LDADD += \
+	$(SYSTEMD_JOURNAL_LIBS)
+endif
+endif
+
+CLEANFILES = $(EXTRA_PROGRAMS)
+
+bench: $(EXTRA_PROGRAMS)
+	@for b in $(EXTRA_PROGRAMS); do \
+		echo "$$b:"; \
+		./$$b || exit 1; \
+	done
+
+.PHONY: bench
+
+# vim: filetype=automake tabstop=8 shiftwidth=8 noexpandtab
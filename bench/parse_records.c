@@ -0,0 +1,112 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Measures how many staged records per second telempostd parses, from the
+ * records of the test corpus or from the files given as arguments. Records
+ * are parsed in place, so each one is copied to the parse buffer first, as
+ * telempostd does for records of the staging log.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iorecord.h"
+
+#define ROUNDS 1000000
+
+static const char *corpus[] = {
+        ABSTOPSRCDIR "/tests/telempostd/correct_message",
+        ABSTOPSRCDIR "/tests/telempostd/incorrect_headers",
+};
+
+static double elapsed_s(const struct timespec *start)
+{
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        return (double)(end.tv_sec - start->tv_sec) +
+               (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int run(const char *path, char *buf, char *record)
+{
+        struct staged_record parsed;
+        struct timespec start;
+        size_t size;
+        FILE *fp;
+
+        fp = fopen(path, "r");
+        if (fp == NULL) {
+                perror(path);
+                return -1;
+        }
+        size = fread(record, 1, STAGED_RECORD_SIZE, fp);
+        fclose(fp);
+
+        memcpy(buf, record, size);
+        if (!parse_record(buf, size, &parsed)) {
+                printf("%s: rejected\n", path);
+                return 0;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ROUNDS; i++) {
+                memcpy(buf, record, size);
+                parse_record(buf, size, &parsed);
+        }
+        printf("%s: %10.0f records/s\n", path, (double)ROUNDS / elapsed_s(&start));
+
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        const char **paths = corpus;
+        int count = sizeof(corpus) / sizeof(corpus[0]);
+        char *buf;
+        char *record;
+        int ret = EXIT_SUCCESS;
+
+        if (argc > 1) {
+                paths = (const char **)argv + 1;
+                count = argc - 1;
+        }
+
+        buf = malloc(STAGED_RECORD_SIZE + 1);
+        record = malloc(STAGED_RECORD_SIZE);
+        if (buf == NULL || record == NULL) {
+                perror("malloc");
+                return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < count; i++) {
+                if (run(paths[i], buf, record) < 0) {
+                        ret = EXIT_FAILURE;
+                }
+        }
+
+        free(buf);
+        free(record);
+
+        return ret;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,399 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Measures how many records per second telempostd posts to a local HTTP
+ * stand-in for the backend, when each post starts over with a new libcurl
+ * handle and connection, when the handle is kept between posts, and when
+ * records are posted in batches. The stand-in speaks plain HTTP, so the TLS
+ * handshake a kept connection also saves is not part of the measurement.
+ *
+ * The stand-in answers with the status of each record it received, and
+ * refuses one record in REJECT_EVERY, so that batches also check that each
+ * record gets its own result. Last, the stand-in takes SLOW_REPLY_US to
+ * answer, and records are posted one at a time, then POSTS_IN_FLIGHT at
+ * once over as many connections, HTTP/2 needing TLS to be negotiated.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "configuration.h"
+#include "telempostdaemon.h"
+#include "wire.h"
+
+#define RECORDS 2000
+#define BATCH_RECORDS 50
+#define REJECT_EVERY 100
+#define SLOW_REPLY_US 2000
+#define POSTS_IN_FLIGHT 8
+
+static const char headers[] =
+        "record_format_version: 4\n"
+        "classification: org.clearlinux/bench/post_http\n"
+        "severity: 1\n"
+        "machine_id: 0123456789abcdef0123456789abcdef\n"
+        "creation_timestamp: 1418672344\n"
+        "arch: x86_64\n"
+        "host_type: bench\n"
+        "build: 200\n"
+        "kernel_version: 6.0\n"
+        "payload_format_version: 1\n"
+        "system_name: clear-linux-os\n"
+        "board_name: bench\n"
+        "cpu_model: bench\n"
+        "bios_version: bench\n"
+        "event_id: 3a2d799826edc6266d72824d2aac6763\n";
+
+static char payload[] = "bench payload";
+
+/* Not used, post_record_http() is called directly */
+bool (*post_record_ptr)(const struct wire_headers *, char *,
+                        const struct config_snapshot *, size_t *) = post_record_http;
+
+static unsigned long connections;
+static unsigned long rejected;
+static unsigned long served;
+static int accepted;
+/* time the stand-in takes to answer */
+static useconds_t reply_delay;
+
+static double elapsed_s(const struct timespec *start)
+{
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        return (double)(end.tv_sec - start->tv_sec) +
+               (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Answers a request with the status of each record in body */
+static int reply(int fd, const char *body)
+{
+        char *results = NULL;
+        char *response = NULL;
+        size_t size = 0;
+        int len;
+        int ret;
+        FILE *fp;
+
+        fp = open_memstream(&results, &size);
+        if (fp == NULL) {
+                return -1;
+        }
+        fputc('[', fp);
+        for (const char *p = body; (p = strstr(p, "\"payload\"")) != NULL; p++) {
+                bool reject = (__atomic_add_fetch(&served, 1, __ATOMIC_RELAXED) %
+                               REJECT_EVERY == 0);
+
+                if (reject) {
+                        __atomic_add_fetch(&rejected, 1, __ATOMIC_RELAXED);
+                }
+                fprintf(fp, "%s%d", ftell(fp) > 1 ? "," : "", reject ? 500 : 201);
+        }
+        fputc(']', fp);
+        fclose(fp);
+        if (reply_delay > 0) {
+                usleep(reply_delay);
+        }
+
+        len = asprintf(&response, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n%s",
+                       size, results);
+        ret = (len < 0 || write(fd, response, (size_t)len) != len) ? -1 : 0;
+        free(response);
+        free(results);
+
+        return ret;
+}
+
+/* Answers the requests of one connection until the client closes it */
+static void serve_connection(int fd)
+{
+        char buf[16384];
+        size_t len = 0;
+        ssize_t n;
+        char *end;
+        char *field;
+        char *request;
+        size_t body;
+        size_t part;
+        static const char proceed[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+        while (1) {
+                buf[len] = '\0';
+                end = strstr(buf, "\r\n\r\n");
+                if (end == NULL) {
+                        if (len == sizeof(buf) - 1) {
+                                return;
+                        }
+                        n = read(fd, buf + len, sizeof(buf) - 1 - len);
+                        if (n <= 0) {
+                                return;
+                        }
+                        len += (size_t)n;
+                        continue;
+                }
+
+                *end = '\0';
+                field = strcasestr(buf, "\r\nContent-Length:");
+                body = field ? strtoul(field + strlen("\r\nContent-Length:"), NULL, 10) : 0;
+                if (strcasestr(buf, "\r\nExpect: 100-continue") != NULL &&
+                    write(fd, proceed, sizeof(proceed) - 1) < 0) {
+                        return;
+                }
+
+                /* Read the body, keeping what follows it */
+                request = malloc(body + 1);
+                if (request == NULL) {
+                        return;
+                }
+                len -= (size_t)(end + 4 - buf);
+                part = len < body ? len : body;
+                memcpy(request, end + 4, part);
+                memmove(buf, end + 4 + part, len - part);
+                len -= part;
+                while (part < body) {
+                        n = read(fd, request + part, body - part);
+                        if (n <= 0) {
+                                free(request);
+                                return;
+                        }
+                        part += (size_t)n;
+                }
+                request[body] = '\0';
+
+                n = reply(fd, request);
+                free(request);
+                if (n < 0) {
+                        return;
+                }
+        }
+}
+
+static void *serve_client(void *arg)
+{
+        int fd = (int)(intptr_t)arg;
+
+        serve_connection(fd);
+        close(fd);
+
+        return NULL;
+}
+
+/* Serves each connection in a thread of its own, as posts in flight come
+ * over several connections at once */
+static void *serve(void *arg)
+{
+        int listenfd = *(int *)arg;
+        pthread_t thread;
+        int fd;
+
+        while ((fd = accept(listenfd, NULL, NULL)) >= 0) {
+                __atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED);
+                if (pthread_create(&thread, NULL, serve_client, (void *)(intptr_t)fd) != 0) {
+                        close(fd);
+                        continue;
+                }
+                pthread_detach(thread);
+        }
+
+        return NULL;
+}
+
+static int start_server(pthread_t *thread, int *listenfd)
+{
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+
+        *listenfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (*listenfd < 0) {
+                return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(*listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(*listenfd, 16) != 0 ||
+            getsockname(*listenfd, (struct sockaddr *)&addr, &len) != 0) {
+                return -1;
+        }
+
+        if (pthread_create(thread, NULL, serve, listenfd) != 0) {
+                return -1;
+        }
+
+        return ntohs(addr.sin_port);
+}
+
+static int run(const char *name, const struct wire_headers *parsed, int records, bool keep)
+{
+        struct timespec start;
+        unsigned long before = connections;
+        double s;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = 0; i < records; i++) {
+                if (!post_record_http(parsed, payload, NULL, NULL)) {
+                        fprintf(stderr, "Failed to post record %d\n", i);
+                        return -1;
+                }
+                if (!keep) {
+                        release_http_delivery();
+                }
+        }
+        release_http_delivery();
+        s = elapsed_s(&start);
+
+        printf("%-10s %8.0f records/s, %lu connection(s)\n", name, (double)records / s,
+               __atomic_load_n(&connections, __ATOMIC_RELAXED) - before);
+
+        return 0;
+}
+
+static void count_accepted(void *data, bool sent, size_t size)
+{
+        if (sent) {
+                accepted++;
+        }
+}
+
+static int run_batch(const char *name, const struct wire_headers *parsed, int records,
+                     enum batch_format format, struct post_queue *queue)
+{
+        struct timespec start;
+        struct post_batch batch;
+        unsigned long before = connections;
+        unsigned long refused = rejected;
+        char *json_body;
+        int ret = 0;
+        double s;
+
+        json_body = create_json_message(parsed, payload);
+        if (json_body == NULL ||
+            post_batch_init(&batch, format, BATCH_RECORDS, 256 * 1024,
+                            queue != NULL ? queue_batch_http : post_batch_http, queue) < 0) {
+                fprintf(stderr, "Failed to prepare the batch\n");
+                free(json_body);
+                return -1;
+        }
+        accepted = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = 0; i < records; i++) {
+                post_batch_add(&batch, json_body, strlen(json_body), count_accepted, NULL);
+        }
+        post_batch_flush(&batch);
+        if (queue != NULL) {
+                post_queue_release(queue);
+        }
+        release_http_delivery();
+        s = elapsed_s(&start);
+
+        /* The answer to a single record is not looked at */
+        refused = format == BATCH_NONE ? 0 :
+                  __atomic_load_n(&rejected, __ATOMIC_RELAXED) - refused;
+        printf("%-10s %8.0f records/s, %lu connection(s), %d accepted\n", name,
+               (double)records / s, __atomic_load_n(&connections, __ATOMIC_RELAXED) - before,
+               accepted);
+        if ((unsigned long)accepted != (unsigned long)records - refused) {
+                fprintf(stderr, "Expected %lu records to be accepted\n",
+                        (unsigned long)records - refused);
+                ret = -1;
+        }
+
+        post_batch_free(&batch);
+        free(json_body);
+
+        return ret;
+}
+
+int main(int argc, char **argv)
+{
+        char conf[] = "/tmp/post_http.conf.XXXXXX";
+        struct wire_headers parsed;
+        struct post_queue queue;
+        int records = RECORDS;
+        pthread_t thread;
+        int listenfd;
+        int port;
+        FILE *fp;
+        int fd;
+        int ret = EXIT_SUCCESS;
+
+        if (argc > 1) {
+                records = atoi(argv[1]);
+        }
+
+        if (wire_parse_text(headers, sizeof(headers) - 1, &parsed) < 0) {
+                fprintf(stderr, "Invalid record headers\n");
+                return EXIT_FAILURE;
+        }
+
+        port = start_server(&thread, &listenfd);
+        if (port < 0) {
+                perror("Failed to start the HTTP stand-in");
+                return EXIT_FAILURE;
+        }
+
+        fd = mkstemp(conf);
+        if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+                perror("mkstemp");
+                return EXIT_FAILURE;
+        }
+        fprintf(fp, "[settings]\nserver=http://127.0.0.1:%d/v2/collector\n", port);
+        fclose(fp);
+        set_config_file(conf);
+
+        if (run("per record", &parsed, records, false) < 0 ||
+            run("kept", &parsed, records, true) < 0 ||
+            run_batch("json", &parsed, records, BATCH_JSON, NULL) < 0 ||
+            run_batch("ndjson", &parsed, records, BATCH_NDJSON, NULL) < 0) {
+                ret = EXIT_FAILURE;
+        }
+
+        printf("Server answering in %d us:\n", SLOW_REPLY_US);
+        reply_delay = SLOW_REPLY_US;
+        post_queue_init(&queue, POSTS_IN_FLIGHT);
+        if (run_batch("serial", &parsed, records, BATCH_NONE, NULL) < 0 ||
+            run_batch("in flight", &parsed, records, BATCH_NONE, &queue) < 0 ||
+            run_batch("json", &parsed, records, BATCH_JSON, &queue) < 0) {
+                ret = EXIT_FAILURE;
+        }
+
+        unlink(conf);
+        shutdown(listenfd, SHUT_RDWR);
+        close(listenfd);
+        pthread_join(thread, NULL);
+
+        return ret;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,223 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Measures how many records per second telemprobd receives and stages with
+ * a growing number of staging workers. Clients are socket pairs, and records
+ * are staged to a temporary spool directory, which is given as argument to
+ * measure a particular disk.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "configuration.h"
+#include "telemdaemon.h"
+
+#define CLIENTS 8
+#define ROUNDS 64
+/* Records written by a client before the daemon reads them */
+#define BURST 16
+
+static const char headers[] =
+        "record_format_version: 4\n"
+        "classification: org.clearlinux/bench/probe_workers\n"
+        "severity: 1\n"
+        "machine_id: 0\n"
+        "creation_timestamp: 1418672344\n"
+        "arch: x86_64\n"
+        "host_type: bench\n"
+        "build: 200\n"
+        "kernel_version: 6.0\n"
+        "payload_format_version: 1\n"
+        "system_name: clear-linux-os\n"
+        "board_name: bench\n"
+        "cpu_model: bench\n"
+        "bios_version: bench\n"
+        "event_id: 3a2d799826edc6266d72824d2aac6763\n";
+
+static const char payload[] = "bench payload";
+
+static char *serialize_record(size_t *size)
+{
+        uint32_t header_size = sizeof(headers) - 1;
+        uint32_t record_size;
+        char *data;
+
+        record_size = (uint32_t)(2 * sizeof(uint32_t) + header_size + sizeof(payload));
+        data = malloc(record_size);
+        if (data == NULL) {
+                return NULL;
+        }
+
+        memcpy(data, &record_size, sizeof(record_size));
+        memcpy(data + sizeof(uint32_t), &header_size, sizeof(header_size));
+        memcpy(data + 2 * sizeof(uint32_t), headers, header_size);
+        memcpy(data + 2 * sizeof(uint32_t) + header_size, payload, sizeof(payload));
+        *size = record_size;
+
+        return data;
+}
+
+static void empty_spool(const char *path)
+{
+        struct dirent *entry;
+        char *name;
+        DIR *dir;
+
+        dir = opendir(path);
+        if (dir == NULL) {
+                return;
+        }
+        while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.') {
+                        continue;
+                }
+                if (asprintf(&name, "%s/%s", path, entry->d_name) > 0) {
+                        unlink(name);
+                        free(name);
+                }
+        }
+        closedir(dir);
+}
+
+static double elapsed_s(const struct timespec *start)
+{
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        return (double)(end.tv_sec - start->tv_sec) +
+               (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int run(int workers, const char *record, size_t record_size)
+{
+        TelemDaemon daemon;
+        struct timespec start;
+        client *cl[CLIENTS];
+        int peer[CLIENTS];
+        int sv[2];
+        double s;
+
+        initialize_probe_daemon(&daemon);
+        daemon.machine_id_override = strdup("0123456789abcdef0123456789abcdef");
+        refresh_machine_id(&daemon);
+
+        for (int i = 0; i < CLIENTS; i++) {
+                if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) != 0) {
+                        perror("socketpair");
+                        return -1;
+                }
+                cl[i] = add_client(&daemon.client_head, sv[0]);
+                peer[i] = sv[1];
+                watch_fd(&daemon, &cl[i]->watch, EPOLLIN);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        start_workers(&daemon, workers);
+
+        for (int r = 0; r < ROUNDS; r++) {
+                for (int i = 0; i < CLIENTS; i++) {
+                        for (int b = 0; b < BURST; b++) {
+                                if (write(peer[i], record, record_size) != (ssize_t)record_size) {
+                                        perror("write");
+                                        return -1;
+                                }
+                        }
+                        handle_client(&daemon, cl[i]);
+                }
+        }
+
+        /* Includes staging whatever is still queued */
+        stop_workers(&daemon);
+        s = elapsed_s(&start);
+
+        printf("%2d worker(s): %8.0f records/s\n", workers,
+               (double)(CLIENTS * ROUNDS * BURST) / s);
+
+        for (int i = 0; i < CLIENTS; i++) {
+                close(peer[i]);
+                remove_client(&daemon.client_head, cl[i]);
+        }
+        buffer_pool_trim(&daemon.client_bufs);
+        free(daemon.machine_id_override);
+        close(daemon.epfd);
+
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        char spool[] = "/tmp/probe_workers.XXXXXX";
+        char conf[] = "/tmp/probe_workers.conf.XXXXXX";
+        const char *spool_dir = spool;
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t record_size;
+        char *record;
+        FILE *fp;
+        int fd;
+        int ret = EXIT_SUCCESS;
+
+        if (argc > 1) {
+                spool_dir = argv[1];
+        } else if (mkdtemp(spool) == NULL) {
+                perror("mkdtemp");
+                return EXIT_FAILURE;
+        }
+
+        fd = mkstemp(conf);
+        if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+                perror("mkstemp");
+                return EXIT_FAILURE;
+        }
+        fprintf(fp, "[settings]\nspool_dir=%s\n", spool_dir);
+        fclose(fp);
+        set_config_file(conf);
+
+        record = serialize_record(&record_size);
+        if (record == NULL) {
+                return EXIT_FAILURE;
+        }
+
+        for (int workers = 0; workers <= 2 * cpus && workers <= TM_MAX_STAGING_WORKERS;
+             workers = workers ? workers * 2 : 1) {
+                if (run(workers, record, record_size) < 0) {
+                        ret = EXIT_FAILURE;
+                        break;
+                }
+                empty_spool(spool_dir);
+        }
+
+        free(record);
+        unlink(conf);
+        if (spool_dir == spool) {
+                rmdir(spool);
+        }
+
+        return ret;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
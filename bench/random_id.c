@@ -0,0 +1,108 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Measures how many random ids per second random_id() generates, next to
+ * the former way of getting one: open /dev/urandom, read 16 bytes, close
+ * it and format them with asprintf().
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "random_id.h"
+
+#define DEFAULT_IDS 1000000
+
+static int urandom_id(char **id)
+{
+        uint64_t bytes[2];
+        int fd;
+        int ret = -1;
+
+        fd = open("/dev/urandom", O_RDONLY | O_NOFOLLOW);
+        if (fd < 0) {
+                return -1;
+        }
+
+        if (read(fd, bytes, sizeof(bytes)) == sizeof(bytes) &&
+            asprintf(id, "%.16" PRIx64 "%.16" PRIx64, bytes[0], bytes[1]) == RANDOM_ID_LEN) {
+                ret = 0;
+        }
+        close(fd);
+
+        return ret;
+}
+
+static double elapsed_s(const struct timespec *start)
+{
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        return (double)(end.tv_sec - start->tv_sec) +
+               (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+        struct timespec start;
+        char id[RANDOM_ID_LEN + 1];
+        char *old_id;
+        long ids = DEFAULT_IDS;
+        long i;
+        double s;
+
+        if (argc > 1) {
+                ids = strtol(argv[1], NULL, 10);
+                if (ids <= 0) {
+                        fprintf(stderr, "Usage: %s [ids]\n", argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < ids; i++) {
+                if (random_id(id) != 0) {
+                        fprintf(stderr, "random_id() failed\n");
+                        return EXIT_FAILURE;
+                }
+        }
+        s = elapsed_s(&start);
+        printf("random_id:        %.0f ids/s\n", (double)ids / s);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < ids; i++) {
+                if (urandom_id(&old_id) != 0) {
+                        fprintf(stderr, "reading /dev/urandom failed\n");
+                        return EXIT_FAILURE;
+                }
+                free(old_id);
+        }
+        s = elapsed_s(&start);
+        printf("urandom+asprintf: %.0f ids/s\n", (double)ids / s);
+
+        return EXIT_SUCCESS;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
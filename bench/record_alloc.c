@@ -0,0 +1,137 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Counts the heap allocations libtelemetry makes for the life cycle of a
+ * record (tm_create_record, tm_set_payload, tm_free_record), and how long
+ * that life cycle takes. The allocator entry points are interposed here,
+ * which also catches the calls made inside libc on behalf of the library
+ * (asprintf, strdup, ...).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "telemetry.h"
+
+#define DEFAULT_RECORDS 100000
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t mallocs = 0;
+static uint64_t reallocs = 0;
+static uint64_t frees = 0;
+
+void *malloc(size_t size)
+{
+        __atomic_add_fetch(&mallocs, 1, __ATOMIC_RELAXED);
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+        __atomic_add_fetch(&mallocs, 1, __ATOMIC_RELAXED);
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        __atomic_add_fetch(&reallocs, 1, __ATOMIC_RELAXED);
+        return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+        if (ptr != NULL) {
+                __atomic_add_fetch(&frees, 1, __ATOMIC_RELAXED);
+        }
+        __libc_free(ptr);
+}
+
+static int record_cycle(char *payload)
+{
+        struct telem_ref *t_ref = NULL;
+        int ret;
+
+        ret = tm_create_record(&t_ref, 2, "org.clearlinux/bench/alloc", 1);
+        if (ret < 0) {
+                return ret;
+        }
+
+        ret = tm_set_payload(t_ref, payload);
+        tm_free_record(t_ref);
+
+        return ret;
+}
+
+int main(int argc, char **argv)
+{
+        struct timespec start, end;
+        char payload[1024];
+        long records = DEFAULT_RECORDS;
+        long i;
+        double ns;
+        int ret;
+
+        if (argc > 1) {
+                records = strtol(argv[1], NULL, 10);
+                if (records <= 0) {
+                        fprintf(stderr, "Usage: %s [records]\n", argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        memset(payload, 'x', sizeof(payload) - 1);
+        payload[sizeof(payload) - 1] = '\0';
+
+        /* The first record builds the per-process host header snapshot */
+        if ((ret = record_cycle(payload)) < 0) {
+                fprintf(stderr, "Failed to create record: %s\n", strerror(-ret));
+                return EXIT_FAILURE;
+        }
+
+        mallocs = reallocs = frees = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < records; i++) {
+                if ((ret = record_cycle(payload)) < 0) {
+                        fprintf(stderr, "Failed to create record: %s\n", strerror(-ret));
+                        return EXIT_FAILURE;
+                }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        ns = (double)(end.tv_sec - start.tv_sec) * 1e9 +
+             (double)(end.tv_nsec - start.tv_nsec);
+
+        printf("records:              %ld\n", records);
+        printf("malloc+calloc/record: %.2f\n", (double)mallocs / (double)records);
+        printf("realloc/record:       %.2f\n", (double)reallocs / (double)records);
+        printf("free/record:          %.2f\n", (double)frees / (double)records);
+        printf("ns/record:            %.0f\n", ns / (double)records);
+
+        return EXIT_SUCCESS;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,268 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "admission.h"
+#include "common.h"
+#include "log.h"
+
+/* Longest "uid:pid" key */
+#define CLIENT_KEY_LEN 24
+
+struct bucket {
+        double tokens;
+        /* when tokens was last brought up to date */
+        double updated;
+        /* records dropped since the client was last told to wait */
+        uint32_t rejected;
+        /* longest wait among them, in seconds */
+        uint32_t wait;
+};
+
+static double now_s(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* A limit of 0 would drop every record, so it means no limit as -1 does */
+static void set_limit(struct admission_limit *limit, int64_t records, int window)
+{
+        limit->limit = records > 0 ? records : -1;
+        limit->rate = records > 0 ? (double)records / (double)window : 0;
+}
+
+int admission_init(struct admission *adm, int64_t client_limit,
+                   int64_t classification_limit, int window)
+{
+        if (window <= 0) {
+                return -EINVAL;
+        }
+
+        adm->clients = nc_hashmap_new_full(nc_string_hash, nc_string_compare, free, free);
+        adm->classifications = nc_hashmap_new_full(nc_string_hash, nc_string_compare,
+                                                   free, free);
+        if (adm->clients == NULL || adm->classifications == NULL) {
+                admission_free(adm);
+                return -ENOMEM;
+        }
+
+        pthread_mutex_init(&adm->lock, NULL);
+        set_limit(&adm->client, client_limit, window);
+        set_limit(&adm->classification, classification_limit, window);
+        adm->rejected = 0;
+
+        return 0;
+}
+
+void admission_free(struct admission *adm)
+{
+        if (adm->clients != NULL) {
+                nc_hashmap_free(adm->clients);
+                adm->clients = NULL;
+        }
+        if (adm->classifications != NULL) {
+                nc_hashmap_free(adm->classifications);
+                adm->classifications = NULL;
+        }
+        pthread_mutex_destroy(&adm->lock);
+}
+
+static void refill(const struct admission_limit *limit, struct bucket *b, double now)
+{
+        b->tokens += (now - b->updated) * limit->rate;
+        if (b->tokens > (double)limit->limit) {
+                b->tokens = (double)limit->limit;
+        }
+        b->updated = now;
+}
+
+/* Drops the buckets that are full again, which carry no state */
+static void prune(NcHashmap *map, const struct admission_limit *limit, double now)
+{
+        NcHashmapIter iter;
+        void *key;
+        void *value;
+        char **full;
+        int count = 0;
+
+        full = malloc((size_t)nc_hashmap_size(map) * sizeof(char *));
+        if (full == NULL) {
+                return;
+        }
+
+        nc_hashmap_iter_init(map, &iter);
+        while (nc_hashmap_iter_next(&iter, &key, &value)) {
+                struct bucket *b = value;
+
+                refill(limit, b, now);
+                if (b->tokens >= (double)limit->limit && b->rejected == 0) {
+                        full[count++] = key;
+                }
+        }
+
+        for (int i = 0; i < count; i++) {
+                nc_hashmap_remove(map, full[i]);
+        }
+        free(full);
+}
+
+/* Bucket of key, created full if there is none. NULL if there is no room
+ * for another one, in which case the key is not limited. */
+static struct bucket *get_bucket(NcHashmap *map, const struct admission_limit *limit,
+                                 const char *key, double now)
+{
+        struct bucket *b;
+        char *k;
+
+        b = nc_hashmap_get(map, key);
+        if (b != NULL) {
+                refill(limit, b, now);
+                return b;
+        }
+
+        if (nc_hashmap_size(map) >= ADMISSION_MAX_KEYS) {
+                prune(map, limit, now);
+                if (nc_hashmap_size(map) >= ADMISSION_MAX_KEYS) {
+                        return NULL;
+                }
+        }
+
+        b = calloc(1, sizeof(struct bucket));
+        k = strdup(key);
+        if (b == NULL || k == NULL || !nc_hashmap_put(map, k, b)) {
+                free(b);
+                free(k);
+                return NULL;
+        }
+        b->tokens = (double)limit->limit;
+        b->updated = now;
+
+        return b;
+}
+
+/* Seconds until the bucket has a token again, rounded up */
+static uint32_t wait_time(const struct admission_limit *limit, const struct bucket *b)
+{
+        if (b == NULL || b->tokens >= 1) {
+                return 0;
+        }
+
+        return (uint32_t)((1 - b->tokens) / limit->rate) + 1;
+}
+
+static void client_key(char *key, const struct ucred *cred)
+{
+        snprintf(key, CLIENT_KEY_LEN, "%u:%d", (unsigned)cred->uid, (int)cred->pid);
+}
+
+bool admission_admit(struct admission *adm, const struct ucred *cred,
+                     const char *classification, size_t len)
+{
+        char ckey[CLIENT_KEY_LEN];
+        char class_key[MAX_CLASS_LENGTH + 1];
+        struct bucket *client = NULL;
+        struct bucket *class = NULL;
+        uint32_t wait;
+        double now = now_s();
+        bool admit;
+
+        if (len > MAX_CLASS_LENGTH) {
+                len = MAX_CLASS_LENGTH;
+        }
+        memcpy(class_key, classification, len);
+        class_key[len] = '\0';
+
+        pthread_mutex_lock(&adm->lock);
+
+        if (cred != NULL && adm->client.limit >= 0) {
+                client_key(ckey, cred);
+                client = get_bucket(adm->clients, &adm->client, ckey, now);
+        }
+        if (adm->classification.limit >= 0) {
+                class = get_bucket(adm->classifications, &adm->classification,
+                                   class_key, now);
+        }
+
+        admit = (client == NULL || client->tokens >= 1) &&
+                (class == NULL || class->tokens >= 1);
+        if (admit) {
+                if (client != NULL) {
+                        client->tokens -= 1;
+                }
+                if (class != NULL) {
+                        class->tokens -= 1;
+                }
+                goto out;
+        }
+
+        adm->rejected++;
+        if (client != NULL) {
+                wait = wait_time(&adm->client, client);
+                if (wait_time(&adm->classification, class) > wait) {
+                        wait = wait_time(&adm->classification, class);
+                }
+                if (client->rejected++ == 0) {
+                        telem_log(LOG_WARNING, "Dropping records of client %s\n", ckey);
+                }
+                if (wait > client->wait) {
+                        client->wait = wait;
+                }
+        } else if (class != NULL && class->rejected++ == 0) {
+                telem_log(LOG_WARNING, "Dropping records of classification %s\n", class_key);
+        }
+
+out:
+        pthread_mutex_unlock(&adm->lock);
+
+        return admit;
+}
+
+uint32_t admission_notice(struct admission *adm, const struct ucred *cred)
+{
+        char key[CLIENT_KEY_LEN];
+        struct bucket *b;
+        uint32_t wait = 0;
+
+        client_key(key, cred);
+
+        pthread_mutex_lock(&adm->lock);
+
+        b = nc_hashmap_get(adm->clients, key);
+        if (b != NULL && b->rejected > 0) {
+                telem_log(LOG_INFO, "Dropped %u records of client %s\n", b->rejected, key);
+                /* Asked to wait at least a second */
+                wait = b->wait > 0 ? b->wait : 1;
+                b->rejected = 0;
+                b->wait = 0;
+        }
+
+        pthread_mutex_unlock(&adm->lock);
+
+        return wait;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,113 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Admission control of records in telemprobd.
+ *
+ * Every record takes a token from the bucket of the client that sent it,
+ * keyed by the uid and pid of the peer (SO_PEERCRED), and from the bucket
+ * of its classification. A bucket holds up to limit tokens and regains
+ * limit tokens per window, so a client may send a burst of limit records
+ * and then limit records per window. A record finding either bucket empty
+ * is dropped before it is staged, which keeps a flooding probe from
+ * filling the spool and keeping telempostd busy.
+ *
+ * A client whose records were dropped is told how long to wait with an
+ * admission_notice (see common.h) on its connection. Records taken from
+ * the shared memory ring have no peer, so only their classification is
+ * limited.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "nica/hashmap.h"
+
+/* Buckets kept per kind at most; full buckets are dropped past that */
+#define ADMISSION_MAX_KEYS 4096
+
+struct admission_limit {
+        /* size of a bucket, -1 for no limit */
+        int64_t limit;
+        /* tokens regained per second */
+        double rate;
+};
+
+/* Used by the event loop of telemprobd, locked so it may be shared */
+struct admission {
+        pthread_mutex_t lock;
+        struct admission_limit client;
+        struct admission_limit classification;
+        /* buckets by "uid:pid" */
+        NcHashmap *clients;
+        /* buckets by classification */
+        NcHashmap *classifications;
+        /* records dropped so far */
+        uint64_t rejected;
+};
+
+/**
+ * Initialize admission control.
+ *
+ * @param adm The admission control.
+ * @param client_limit Records a client may send per window, or -1 (or 0)
+ *    for no limit.
+ * @param classification_limit Records of a classification per window, or -1
+ *    (or 0) for no limit.
+ * @param window Length of the window in seconds.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int admission_init(struct admission *adm, int64_t client_limit,
+                   int64_t classification_limit, int window);
+
+/**
+ * Release admission control.
+ *
+ * @param adm The admission control.
+ */
+void admission_free(struct admission *adm);
+
+/**
+ * Take a token for a record from the buckets of its client and of its
+ * classification. No token is taken unless both buckets have one.
+ *
+ * @param adm The admission control.
+ * @param cred The peer that sent the record, or NULL if it is not known.
+ * @param classification Classification of the record, not null terminated.
+ * @param len Length of the classification.
+ *
+ * @return true if the record may be staged, false if it is to be dropped.
+ */
+bool admission_admit(struct admission *adm, const struct ucred *cred,
+                     const char *classification, size_t len);
+
+/**
+ * Seconds a client should wait before sending again, if records it sent
+ * were dropped since the last call for that client.
+ *
+ * @param adm The admission control.
+ * @param cred The peer.
+ *
+ * @return The time to wait in seconds, or 0 if no record was dropped.
+ */
+uint32_t admission_notice(struct admission *adm, const struct ucred *cred);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,361 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Background sending of records for libtelemetry.
+ *
+ * Records are handed over through a bounded multi-producer queue (a ring of
+ * sequence-numbered cells, as described by Dmitry Vyukov) and sent by a
+ * single worker thread over a persistent session. Two semaphores count the
+ * free and the used cells, so that producers only block or drop when the
+ * ring is full and the worker only sleeps when it is empty.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include "telemetry.h"
+#include "log.h"
+
+#define TM_ASYNC_DEFAULT_QUEUE_LEN 1024
+
+/* Maximum number of records sent to the daemon at once */
+#define TM_ASYNC_BATCH 32
+
+struct async_cell {
+        size_t seq;
+        struct telem_ref *t_ref;
+};
+
+struct async_queue {
+        struct async_cell *cells;
+        size_t mask;
+        /* keep the consumer and producer positions on separate cache lines */
+        char pad0[64];
+        size_t head;
+        char pad1[64];
+        size_t tail;
+        char pad2[64];
+        sem_t free_cells;
+        sem_t used_cells;
+        int policy;
+        pthread_t worker;
+        uint64_t queued;
+        uint64_t sent;
+        uint64_t dropped;
+        uint64_t failed;
+};
+
+static struct async_queue *async = NULL;
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool atfork_registered = false;
+
+static size_t round_up_pow2(size_t n)
+{
+        size_t p = 1;
+
+        while (p < n) {
+                p <<= 1;
+        }
+
+        return p;
+}
+
+static void queue_push(struct async_queue *q, struct telem_ref *t_ref)
+{
+        struct async_cell *cell;
+        size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+        /* A free cell is guaranteed by the free_cells semaphore */
+        while (1) {
+                cell = &q->cells[pos & q->mask];
+                size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+                if (seq == pos) {
+                        if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1,
+                                                        true, __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+                                break;
+                        }
+                } else {
+                        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+                }
+        }
+
+        cell->t_ref = t_ref;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static struct telem_ref *queue_pop(struct async_queue *q)
+{
+        struct async_cell *cell;
+        struct telem_ref *t_ref;
+        size_t pos = q->head;
+
+        /* Only the worker pops; a used cell is guaranteed by used_cells,
+         * but its producer may still be storing the record */
+        cell = &q->cells[pos & q->mask];
+        while (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+                sched_yield();
+        }
+
+        t_ref = cell->t_ref;
+        __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+        q->head = pos + 1;
+
+        return t_ref;
+}
+
+static void *async_worker(void *arg)
+{
+        struct async_queue *q = arg;
+        struct telem_session *session = NULL;
+        struct telem_ref *batch[TM_ASYNC_BATCH];
+        bool stop = false;
+        size_t count;
+        size_t i;
+        int ret;
+
+        while (!stop) {
+                while (sem_wait(&q->used_cells) != 0) {
+                        ;
+                }
+
+                /*
+                 * Producers claim a cell before they post, so a post with
+                 * no claimed cell behind it can only be the extra one from
+                 * tm_async_shutdown(), which comes after every record.
+                 */
+                if (q->head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+                        break;
+                }
+
+                count = 0;
+                batch[count++] = queue_pop(q);
+                while (count < TM_ASYNC_BATCH && sem_trywait(&q->used_cells) == 0) {
+                        if (q->head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+                                stop = true;
+                                break;
+                        }
+                        batch[count++] = queue_pop(q);
+                }
+
+                if (session == NULL && (ret = tm_session_open(&session)) < 0) {
+                        session = NULL;
+                } else {
+                        ret = tm_session_send_records(session, batch, count);
+                }
+
+                if (ret < 0) {
+                        telem_log(LOG_ERR, "Failed to send %zu record(s): %s\n",
+                                  count, strerror(-ret));
+                        __atomic_add_fetch(&q->failed, count, __ATOMIC_RELAXED);
+                } else {
+                        __atomic_add_fetch(&q->sent, count, __ATOMIC_RELAXED);
+                }
+
+                for (i = 0; i < count; i++) {
+                        tm_free_record(batch[i]);
+                        sem_post(&q->free_cells);
+                }
+        }
+
+        tm_session_close(session);
+
+        return NULL;
+}
+
+static void async_forget(void)
+{
+        /* The worker thread does not exist in a forked child, and the
+         * records it had queued belong to the parent */
+        async = NULL;
+        pthread_mutex_init(&async_lock, NULL);
+}
+
+static int async_start(size_t queue_len, int policy)
+{
+        struct async_queue *q;
+        size_t size;
+        size_t i;
+        int ret;
+
+        if (queue_len == 0) {
+                queue_len = TM_ASYNC_DEFAULT_QUEUE_LEN;
+        }
+
+        if (queue_len > SEM_VALUE_MAX) {
+                return -EINVAL;
+        }
+
+        q = calloc(1, sizeof(struct async_queue));
+        if (!q) {
+                return -ENOMEM;
+        }
+
+        size = round_up_pow2(queue_len);
+        q->cells = calloc(size, sizeof(struct async_cell));
+        if (!q->cells) {
+                free(q);
+                return -ENOMEM;
+        }
+
+        for (i = 0; i < size; i++) {
+                q->cells[i].seq = i;
+        }
+        q->mask = size - 1;
+        q->policy = policy;
+
+        /* Capacity is what was asked for, not the rounded ring size */
+        sem_init(&q->free_cells, 0, (unsigned int)queue_len);
+        sem_init(&q->used_cells, 0, 0);
+
+        ret = pthread_create(&q->worker, NULL, async_worker, q);
+        if (ret != 0) {
+                sem_destroy(&q->free_cells);
+                sem_destroy(&q->used_cells);
+                free(q->cells);
+                free(q);
+                return -ret;
+        }
+
+        if (!atfork_registered) {
+                pthread_atfork(NULL, NULL, async_forget);
+                atfork_registered = true;
+        }
+
+        __atomic_store_n(&async, q, __ATOMIC_RELEASE);
+
+        return 0;
+}
+
+int tm_async_init(size_t queue_len, int policy)
+{
+        int ret;
+
+        if (policy != TM_ASYNC_DROP && policy != TM_ASYNC_BLOCK) {
+                return -EINVAL;
+        }
+
+        pthread_mutex_lock(&async_lock);
+        if (async != NULL) {
+                ret = -EALREADY;
+        } else {
+                ret = async_start(queue_len, policy);
+        }
+        pthread_mutex_unlock(&async_lock);
+
+        return ret;
+}
+
+int tm_send_record_async(struct telem_ref *t_ref)
+{
+        struct async_queue *q;
+        int ret = 0;
+
+        if (t_ref == NULL) {
+                return -EINVAL;
+        }
+
+        if (tm_is_opted_in() == 0) {
+                return -ECONNREFUSED;
+        }
+
+        q = __atomic_load_n(&async, __ATOMIC_ACQUIRE);
+        if (q == NULL) {
+                /* Start with the defaults on first use */
+                pthread_mutex_lock(&async_lock);
+                if (async == NULL) {
+                        ret = async_start(0, TM_ASYNC_DROP);
+                }
+                q = async;
+                pthread_mutex_unlock(&async_lock);
+                if (ret < 0) {
+                        return ret;
+                }
+        }
+
+        if (q->policy == TM_ASYNC_BLOCK) {
+                while (sem_wait(&q->free_cells) != 0) {
+                        ;
+                }
+        } else if (sem_trywait(&q->free_cells) != 0) {
+                __atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+                return -EAGAIN;
+        }
+
+        queue_push(q, t_ref);
+        __atomic_add_fetch(&q->queued, 1, __ATOMIC_RELAXED);
+        sem_post(&q->used_cells);
+
+        return 0;
+}
+
+int tm_async_stats(struct tm_async_stats *stats)
+{
+        struct async_queue *q;
+
+        if (stats == NULL) {
+                return -EINVAL;
+        }
+
+        memset(stats, 0, sizeof(struct tm_async_stats));
+
+        q = __atomic_load_n(&async, __ATOMIC_ACQUIRE);
+        if (q == NULL) {
+                return 0;
+        }
+
+        stats->queued = __atomic_load_n(&q->queued, __ATOMIC_RELAXED);
+        stats->sent = __atomic_load_n(&q->sent, __ATOMIC_RELAXED);
+        stats->dropped = __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+        stats->failed = __atomic_load_n(&q->failed, __ATOMIC_RELAXED);
+        stats->pending = stats->queued - stats->sent - stats->failed;
+
+        return 0;
+}
+
+void tm_async_shutdown(void)
+{
+        struct async_queue *q;
+
+        pthread_mutex_lock(&async_lock);
+        q = async;
+        if (q == NULL) {
+                pthread_mutex_unlock(&async_lock);
+                return;
+        }
+
+        /* The worker sends whatever is still queued before it exits */
+        sem_post(&q->used_cells);
+        pthread_join(q->worker, NULL);
+
+        __atomic_store_n(&async, NULL, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&async_lock);
+
+        sem_destroy(&q->free_cells);
+        sem_destroy(&q->used_cells);
+        free(q->cells);
+        free(q);
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,97 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <assert.h>
+
+#include "buffer_pool.h"
+
+void buffer_pool_init(struct buffer_pool *pool, size_t buf_size, size_t max_free)
+{
+        assert(buf_size >= sizeof(void *));
+
+        pool->buf_size = buf_size;
+        pool->max_free = max_free;
+        pool->nfree = 0;
+        pool->free_list = NULL;
+}
+
+void *buffer_pool_get(struct buffer_pool *pool)
+{
+        void *buf = pool->free_list;
+
+        if (buf == NULL) {
+                return malloc(pool->buf_size);
+        }
+
+        pool->free_list = *(void **)buf;
+        pool->nfree--;
+
+        return buf;
+}
+
+void buffer_pool_put(struct buffer_pool *pool, void *buf)
+{
+        if (buf == NULL) {
+                return;
+        }
+
+        if (pool->nfree >= pool->max_free) {
+                free(buf);
+                return;
+        }
+
+        *(void **)buf = pool->free_list;
+        pool->free_list = buf;
+        pool->nfree++;
+}
+
+void buffer_pool_trim(struct buffer_pool *pool)
+{
+        void *buf;
+
+        while ((buf = pool->free_list) != NULL) {
+                pool->free_list = *(void **)buf;
+                free(buf);
+        }
+        pool->nfree = 0;
+}
+
+int buffer_pool_idle_trim(struct buffer_pool *pool, time_t last_activity,
+                          int idle_time, bool *trimmed)
+{
+        time_t idle;
+
+        if (idle_time <= 0 || *trimmed) {
+                return -1;
+        }
+
+        idle = time(NULL) - last_activity;
+        if (idle < idle_time) {
+                return (int)(idle_time - idle);
+        }
+
+        buffer_pool_trim(pool);
+        malloc_trim(0);
+        *trimmed = true;
+
+        return -1;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
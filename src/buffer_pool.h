@@ -0,0 +1,93 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Pool of fixed-size buffers for the daemons.
+ *
+ * Buffers given back to the pool are kept on a free list, up to a limit, so
+ * that busy clients and bursts of staged records do not go through malloc
+ * and free for every record. The daemons release the cached buffers, and
+ * hand free heap memory back to the kernel, only once they have been idle
+ * for a while (see buffer_pool_idle_trim()). A pool is used by one thread.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+struct buffer_pool {
+        size_t buf_size;
+        /* number of buffers kept for reuse at most */
+        size_t max_free;
+        size_t nfree;
+        /* free buffers, linked through their first bytes */
+        void *free_list;
+};
+
+/**
+ * Initialize a pool. No buffer is allocated until one is needed.
+ *
+ * @param pool The pool.
+ * @param buf_size Size of each buffer, at least sizeof(void *).
+ * @param max_free Number of buffers to keep for reuse, 0 to free buffers as
+ *    soon as they are put back.
+ */
+void buffer_pool_init(struct buffer_pool *pool, size_t buf_size, size_t max_free);
+
+/**
+ * Take a buffer from the pool, or allocate one if none is free.
+ *
+ * @param pool The pool.
+ *
+ * @return A buffer of pool->buf_size bytes with undefined contents, or NULL
+ *    if out of memory.
+ */
+void *buffer_pool_get(struct buffer_pool *pool);
+
+/**
+ * Give a buffer back to the pool, which frees it if it already holds
+ * max_free buffers.
+ *
+ * @param pool The pool.
+ * @param buf A buffer from buffer_pool_get() on the same pool, or NULL.
+ */
+void buffer_pool_put(struct buffer_pool *pool, void *buf);
+
+/**
+ * Free all buffers kept for reuse.
+ *
+ * @param pool The pool.
+ */
+void buffer_pool_trim(struct buffer_pool *pool);
+
+/**
+ * Trim the pool and return free heap memory to the kernel once the caller
+ * has been idle for idle_time seconds. Only trims once per idle period.
+ *
+ * @param pool The pool.
+ * @param last_activity When the caller last did some work.
+ * @param idle_time Seconds of inactivity before trimming, 0 to never trim.
+ * @param trimmed Whether the current idle period was already trimmed; set
+ *    when trimming, and to be cleared by the caller on activity.
+ *
+ * @return The number of seconds until the pool should be trimmed, or -1 if
+ *    there is nothing left to do until the next activity.
+ */
+int buffer_pool_idle_trim(struct buffer_pool *pool, time_t last_activity,
+                          int idle_time, bool *trimmed);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
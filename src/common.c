@@ -40,10 +40,72 @@ static const char *header_names[] = {
         TM_EVENT_ID_STR
 };
 
+static const unsigned char header_name_lens[] = {
+        sizeof(TM_RECORD_VERSION_STR) - 1,
+        sizeof(TM_CLASSIFICATION_STR) - 1,
+        sizeof(TM_SEVERITY_STR) - 1,
+        sizeof(TM_MACHINE_ID_STR) - 1,
+        sizeof(TM_TIMESTAMP_STR) - 1,
+        sizeof(TM_ARCH_STR) - 1,
+        sizeof(TM_HOST_TYPE_STR) - 1,
+        sizeof(TM_SYSTEM_BUILD_STR) - 1,
+        sizeof(TM_KERNEL_VERSION_STR) - 1,
+        sizeof(TM_PAYLOAD_VERSION_STR) - 1,
+        sizeof(TM_SYSTEM_NAME_STR) - 1,
+        sizeof(TM_BOARD_NAME_STR) - 1,
+        sizeof(TM_CPU_MODEL_STR) - 1,
+        sizeof(TM_BIOS_VERSION_STR) - 1,
+        sizeof(TM_EVENT_ID_STR) - 1
+};
+
+/* Perfect hash of the header names: the first character and the length of
+ * a name are enough to tell it apart from the others. Keep check_probd's
+ * check_header_ids passing when adding a header. */
+#define HEADER_SLOTS 32
+#define HEADER_HASH(first, len) \
+        (((unsigned)(first) + 4 * (unsigned)(len)) & (HEADER_SLOTS - 1))
+#define HEADER_SLOT(first, name) [HEADER_HASH(first, sizeof(name) - 1)]
+
+/* Id of the header hashed to each slot plus one, 0 for unused slots */
+static const unsigned char header_slots[HEADER_SLOTS] = {
+        HEADER_SLOT('r', TM_RECORD_VERSION_STR) = TM_RECORD_VERSION + 1,
+        HEADER_SLOT('c', TM_CLASSIFICATION_STR) = TM_CLASSIFICATION + 1,
+        HEADER_SLOT('s', TM_SEVERITY_STR) = TM_SEVERITY + 1,
+        HEADER_SLOT('m', TM_MACHINE_ID_STR) = TM_MACHINE_ID + 1,
+        HEADER_SLOT('c', TM_TIMESTAMP_STR) = TM_TIMESTAMP + 1,
+        HEADER_SLOT('a', TM_ARCH_STR) = TM_ARCH + 1,
+        HEADER_SLOT('h', TM_HOST_TYPE_STR) = TM_HOST_TYPE + 1,
+        HEADER_SLOT('b', TM_SYSTEM_BUILD_STR) = TM_SYSTEM_BUILD + 1,
+        HEADER_SLOT('k', TM_KERNEL_VERSION_STR) = TM_KERNEL_VERSION + 1,
+        HEADER_SLOT('p', TM_PAYLOAD_VERSION_STR) = TM_PAYLOAD_VERSION + 1,
+        HEADER_SLOT('s', TM_SYSTEM_NAME_STR) = TM_SYSTEM_NAME + 1,
+        HEADER_SLOT('b', TM_BOARD_NAME_STR) = TM_BOARD_NAME + 1,
+        HEADER_SLOT('c', TM_CPU_MODEL_STR) = TM_CPU_MODEL + 1,
+        HEADER_SLOT('b', TM_BIOS_VERSION_STR) = TM_BIOS_VERSION + 1,
+        HEADER_SLOT('e', TM_EVENT_ID_STR) = TM_EVENT_ID + 1
+};
+
 const char *get_header_name(int ind)
 {
         assert(ind >= 0 && ind < NUM_HEADERS);
         return header_names[ind];
 }
 
+int get_header_id(const char *name, size_t len)
+{
+        int id;
+
+        if (len == 0) {
+                return -1;
+        }
+
+        id = header_slots[HEADER_HASH(name[0], len)] - 1;
+        if (id < 0 || header_name_lens[id] != len ||
+            memcmp(header_names[id], name, len) != 0) {
+                return -1;
+        }
+
+        return id;
+}
+
 /* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
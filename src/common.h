@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define SMALL_LINE_BUF 80
@@ -107,11 +108,29 @@ static const uint32_t RECORD_FORMAT_VERSION = 4;
 #define CFG_PREFIX_LENGTH 4
 #define CFG_PREFIX_32BIT  0x3a474643
 
-/* Very simple structure. Array of header strings and a payload. Calling
+/* Sent by telemprobd on a client connection once records it sent were
+ * dropped by admission control (see admission.h), asking it to wait */
+#define ADMISSION_NOTICE 0x574f4c53     /* "SLOW" */
+
+struct admission_notice {
+        uint32_t magic;
+        /* seconds to wait before sending more records */
+        uint32_t wait;
+};
+
+/* A record lives in a single allocation, the arena: all headers back to back
+ * in the binary wire format v5 (see wire.h), followed by the payload and its
+ * terminating null byte. Each header is its TM_* id in one byte, then its
+ * value: a fixed width number for numeric headers, or a 16 bit length and
+ * that many bytes for the others. The arena is therefore sent as is after
+ * the size fields. header_off and header_len locate the encoded header of
+ * an id, id byte included; wire_parse_binary() decodes them all. Calling
  * program is reponsible for passing in the payload as a simple string.
  */
 struct telem_record {
-        char *headers[NUM_HEADERS];
+        char *arena;
+        size_t header_off[NUM_HEADERS];
+        size_t header_len[NUM_HEADERS];
         char *payload;
         size_t header_size;
         size_t payload_size;
@@ -119,5 +138,8 @@ struct telem_record {
 
 const char *get_header_name(int ind);
 
+/* Id of the header with the given name, or -1 if there is none */
+int get_header_id(const char *name, size_t len);
+
 
 /* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
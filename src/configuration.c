@@ -38,13 +38,24 @@ static char *etc_config_file = "/etc/telemetrics/telemetrics.conf";
 static NcHashmap *keyfile = NULL;
 static bool cmd_line_cfg = false;
 
+/* Snapshots of the configuration files records come with, most recently
+ * used first */
+static LIST_HEAD(config_snapshots, config_snapshot) snapshots =
+        LIST_HEAD_INITIALIZER(snapshots);
+static int snapshot_count = 0;
+
 /* Conf strings, integers, and booleans expected in the conf file */
 static const char *config_key_str[] = { "server",
                                         "socket_path",
                                         "spool_dir",
                                         "rate_limit_strategy",
                                         "cainfo",
-                                        "tidheader"};
+                                        "tidheader",
+                                        "seqpacket_socket_path",
+                                        "staging_backend",
+                                        "handoff_socket_path",
+                                        "batch_format",
+                                        "compression" };
 
 static const char *config_key_int[] = { "record_expiry",
                                         "spool_max_size",
@@ -52,24 +63,47 @@ static const char *config_key_int[] = { "record_expiry",
                                         "record_window_length",
                                         "byte_window_length",
                                         "record_burst_limit",
-                                        "byte_burst_limit" };
+                                        "byte_burst_limit",
+                                        "shm_ring_slots",
+                                        "buffer_pool_size",
+                                        "idle_trim_time",
+                                        "staging_workers",
+                                        "staging_segment_size",
+                                        "admission_client_limit",
+                                        "admission_classification_limit",
+                                        "admission_window_length",
+                                        "batch_max_records",
+                                        "batch_max_size",
+                                        "posts_in_flight",
+                                        "compression_level" };
 
 static const char *config_key_bool[] = { "rate_limit_enabled",
                                          "daemon_recycling_enabled",
                                          "record_retention_enabled",
-                                         "record_server_delivery_enabled" };
+                                         "record_server_delivery_enabled",
+                                         "shm_ring_enabled",
+                                         "handoff_enabled",
+                                         "admission_enabled" };
 
 static const char *config_str_default[] = { DEFAULT_SERVER_ADDR,
                                             DEFAULT_SOCKET_PATH,
                                             DEFAULT_SPOOL_DIR,
                                             DEFAULT_RATE_LIMIT_STRATEGY,
                                             DEFAULT_CAINFO,
-                                            DEFAULT_TIDHEADER };
+                                            DEFAULT_TIDHEADER,
+                                            DEFAULT_SEQPACKET_SOCKET_PATH,
+                                            DEFAULT_STAGING_BACKEND,
+                                            DEFAULT_HANDOFF_SOCKET_PATH,
+                                            DEFAULT_BATCH_FORMAT,
+                                            DEFAULT_COMPRESSION };
 
 static const bool config_bool_default[] = { DEFAULT_RATE_LIMIT_ENABLED,
                                             DEFAULT_DAEMON_RECYCLING_ENABLED,
                                             DEFAULT_RECORD_RETENTION_ENABLED,
-                                            DEFAULT_RECORD_SERVER_DELIVERY_ENABLED };
+                                            DEFAULT_RECORD_SERVER_DELIVERY_ENABLED,
+                                            DEFAULT_SHM_RING_ENABLED,
+                                            DEFAULT_HANDOFF_ENABLED,
+                                            DEFAULT_ADMISSION_ENABLED };
 
 static const int config_int_default[] = { DEFAULT_RECORD_EXPIRY,
                                           DEFAULT_SPOOL_MAX_SIZE,
@@ -77,7 +111,19 @@ static const int config_int_default[] = { DEFAULT_RECORD_EXPIRY,
                                           DEFAULT_RECORD_WINDOW_LENGTH,
                                           DEFAULT_BYTE_WINDOW_LENGTH,
                                           DEFAULT_RECORD_BURST_LIMIT,
-                                          DEFAULT_BYTE_BURST_LIMIT };
+                                          DEFAULT_BYTE_BURST_LIMIT,
+                                          DEFAULT_SHM_RING_SLOTS,
+                                          DEFAULT_BUFFER_POOL_SIZE,
+                                          DEFAULT_IDLE_TRIM_TIME,
+                                          DEFAULT_STAGING_WORKERS,
+                                          DEFAULT_STAGING_SEGMENT_SIZE,
+                                          DEFAULT_ADMISSION_CLIENT_LIMIT,
+                                          DEFAULT_ADMISSION_CLASSIFICATION_LIMIT,
+                                          DEFAULT_ADMISSION_WINDOW_LENGTH,
+                                          DEFAULT_BATCH_MAX_RECORDS,
+                                          DEFAULT_BATCH_MAX_SIZE,
+                                          DEFAULT_POSTS_IN_FLIGHT,
+                                          DEFAULT_COMPRESSION_LEVEL };
 
 
 static struct configuration config = { { 0 }, { 0 }, { 0 }, false, NULL };
@@ -271,9 +317,186 @@ void reload_config(void)
         initialize_config();
 }
 
+static void free_snapshot(struct config_snapshot *snapshot)
+{
+        for (int i = 0; i < CONF_STR_MAX; i++) {
+                free(snapshot->config.strValues[i]);
+        }
+        free(snapshot->path);
+        free(snapshot);
+}
+
+/* The snapshot is freed once the records holding it are done with it */
+static void uncache_snapshot(struct config_snapshot *snapshot)
+{
+        LIST_REMOVE(snapshot, entries);
+        snapshot->cached = false;
+        snapshot_count--;
+        if (snapshot->refs == 0) {
+                free_snapshot(snapshot);
+        }
+}
+
+static bool snapshot_is_current(const struct config_snapshot *snapshot,
+                                const struct stat *st)
+{
+        return snapshot->mtime.tv_sec == st->st_mtim.tv_sec &&
+               snapshot->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+               snapshot->size == st->st_size && snapshot->ino == st->st_ino;
+}
+
+static void cache_snapshot(struct config_snapshot *snapshot)
+{
+        struct config_snapshot *entry;
+        struct config_snapshot *unused = NULL;
+
+        /* Records name any file, the least recently used snapshot no
+         * record holds makes room */
+        if (snapshot_count >= TM_MAX_CONFIG_SNAPSHOTS) {
+                LIST_FOREACH(entry, &snapshots, entries) {
+                        if (entry->refs == 0) {
+                                unused = entry;
+                        }
+                }
+                if (unused == NULL) {
+                        return;
+                }
+                uncache_snapshot(unused);
+        }
+
+        LIST_INSERT_HEAD(&snapshots, snapshot, entries);
+        snapshot->cached = true;
+        snapshot_count++;
+}
+
+struct config_snapshot *config_snapshot_get(const char *filename)
+{
+        struct config_snapshot *snapshot;
+        struct stat st;
+
+        if (filename[0] != '/' || stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) {
+                return NULL;
+        }
+
+        LIST_FOREACH(snapshot, &snapshots, entries) {
+                if (strcmp(snapshot->path, filename) == 0) {
+                        break;
+                }
+        }
+        if (snapshot != NULL && snapshot_is_current(snapshot, &st)) {
+                LIST_REMOVE(snapshot, entries);
+                LIST_INSERT_HEAD(&snapshots, snapshot, entries);
+                snapshot->refs++;
+                return snapshot;
+        } else if (snapshot != NULL) {
+                uncache_snapshot(snapshot);
+        }
+
+        snapshot = calloc(1, sizeof(struct config_snapshot));
+        if (snapshot == NULL) {
+                return NULL;
+        }
+        snapshot->path = strdup(filename);
+        if (snapshot->path == NULL ||
+            !read_config_from_file(snapshot->path, &snapshot->config)) {
+                telem_log(LOG_ERR, "Failed to read configuration file %s\n", filename);
+                free_snapshot(snapshot);
+                return NULL;
+        }
+        snapshot->config.initialized = true;
+        snapshot->mtime = st.st_mtim;
+        snapshot->size = st.st_size;
+        snapshot->ino = st.st_ino;
+        snapshot->refs = 1;
+        cache_snapshot(snapshot);
+
+        return snapshot;
+}
+
+void config_snapshot_put(struct config_snapshot *snapshot)
+{
+        if (snapshot == NULL) {
+                return;
+        }
+
+        snapshot->refs--;
+        if (snapshot->refs == 0 && !snapshot->cached) {
+                free_snapshot(snapshot);
+        }
+}
+
+const char *config_snapshot_server_addr(const struct config_snapshot *snapshot)
+{
+        if (snapshot == NULL) {
+                return server_addr_config();
+        }
+        return (const char *)snapshot->config.strValues[CONF_SERVER_ADDR];
+}
+
+const char *config_snapshot_cainfo(const struct config_snapshot *snapshot)
+{
+        if (snapshot == NULL) {
+                return get_cainfo_config();
+        }
+        return (const char *)snapshot->config.strValues[CONF_CAINFO];
+}
+
+const char *config_snapshot_tidheader(const struct config_snapshot *snapshot)
+{
+        if (snapshot == NULL) {
+                return get_tidheader_config();
+        }
+        return (const char *)snapshot->config.strValues[CONF_TIDHEADER];
+}
+
+/* Snapshots are shared, the value is not lowercased in place */
+static const char *valid_compression(const char *val)
+{
+        if (strcasecmp(val, "gzip") == 0) {
+                return "gzip";
+        } else if (strcasecmp(val, "zstd") == 0) {
+                return "zstd";
+        } else if (strcasecmp(val, "none") == 0) {
+                return "none";
+        }
+
+        return DEFAULT_COMPRESSION;
+}
+
+static int valid_compression_level(int64_t val)
+{
+        if (val < 0) {
+                val = DEFAULT_COMPRESSION_LEVEL;
+        } else if (val > TM_MAX_COMPRESSION_LEVEL) {
+                val = TM_MAX_COMPRESSION_LEVEL;
+        }
+
+        return (int)val;
+}
+
+const char *config_snapshot_compression(const struct config_snapshot *snapshot)
+{
+        if (snapshot == NULL) {
+                return compression_config();
+        }
+        return valid_compression(snapshot->config.strValues[CONF_COMPRESSION]);
+}
+
+int config_snapshot_compression_level(const struct config_snapshot *snapshot)
+{
+        if (snapshot == NULL) {
+                return compression_level_config();
+        }
+        return valid_compression_level(snapshot->config.intValues[CONF_COMPRESSION_LEVEL]);
+}
+
 __attribute__((destructor))
 void free_configuration(void)
 {
+        while (!LIST_EMPTY(&snapshots)) {
+                uncache_snapshot(LIST_FIRST(&snapshots));
+        }
+
         if (!config.initialized) {
                 return;
         }
@@ -307,6 +530,12 @@ const char *socket_path_config()
         return (const char *)config.strValues[CONF_SOCKET_PATH];
 }
 
+const char *seqpacket_socket_path_config()
+{
+        initialize_config();
+        return (const char *)config.strValues[CONF_SEQPACKET_SOCKET_PATH];
+}
+
 const char *spool_dir_config()
 {
         initialize_config();
@@ -462,4 +691,244 @@ bool record_server_delivery_enabled_config(void)
         initialize_config();
         return config.boolValues[CONF_RECORD_SERVER_DELIVERY_ENABLED];
 }
+
+bool shm_ring_enabled_config(void)
+{
+        initialize_config();
+        return config.boolValues[CONF_SHM_RING_ENABLED];
+}
+
+int shm_ring_slots_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_SHM_RING_SLOTS];
+
+        /* The ring itself rounds and clamps the slot count */
+        if (val < 0) {
+                val = DEFAULT_SHM_RING_SLOTS;
+        } else if (val > INT_MAX) {
+                val = INT_MAX;
+        }
+
+        return (int)val;
+}
+
+int buffer_pool_size_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_BUFFER_POOL_SIZE];
+
+        if (val < 0) {
+                val = DEFAULT_BUFFER_POOL_SIZE;
+        } else if (val > TM_MAX_BUFFER_POOL_SIZE) {
+                val = TM_MAX_BUFFER_POOL_SIZE;
+        }
+
+        return (int)val;
+}
+
+int idle_trim_time_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_IDLE_TRIM_TIME];
+
+        /* 0 disables trimming */
+        if (val < 0) {
+                val = DEFAULT_IDLE_TRIM_TIME;
+        } else if (val > INT_MAX) {
+                val = INT_MAX;
+        }
+
+        return (int)val;
+}
+
+int staging_workers_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_STAGING_WORKERS];
+
+        /* 0 stages records in the thread receiving them */
+        if (val < 0) {
+                val = DEFAULT_STAGING_WORKERS;
+        } else if (val > TM_MAX_STAGING_WORKERS) {
+                val = TM_MAX_STAGING_WORKERS;
+        }
+
+        return (int)val;
+}
+
+const char *staging_backend_config(void)
+{
+        initialize_config();
+        char *val = NULL;
+        size_t k = 0;
+
+        val = config.strValues[CONF_STAGING_BACKEND];
+        k = strlen(val);
+
+        for (int i = 0; i < k; i++) {
+                val[i] = (char)tolower(val[i]);
+        }
+
+        if ((strcmp(val, "files") != 0) && (strcmp(val, "log") != 0)) {
+                val = DEFAULT_STAGING_BACKEND;
+        }
+
+        return val;
+}
+
+int staging_segment_size_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_STAGING_SEGMENT_SIZE];
+
+        /* 0 starts a segment for every record */
+        if (val < 0) {
+                val = DEFAULT_STAGING_SEGMENT_SIZE;
+        } else if (val > INT_MAX) {
+                val = INT_MAX;
+        }
+
+        return (int)val;
+}
+
+bool handoff_enabled_config(void)
+{
+        initialize_config();
+        return config.boolValues[CONF_HANDOFF_ENABLED];
+}
+
+const char *handoff_socket_path_config(void)
+{
+        initialize_config();
+        return (const char *)config.strValues[CONF_HANDOFF_SOCKET_PATH];
+}
+
+bool admission_enabled_config(void)
+{
+        initialize_config();
+        return config.boolValues[CONF_ADMISSION_ENABLED];
+}
+
+int64_t admission_client_limit_config(void)
+{
+        initialize_config();
+        return config.intValues[CONF_ADMISSION_CLIENT_LIMIT];
+}
+
+int64_t admission_classification_limit_config(void)
+{
+        initialize_config();
+        return config.intValues[CONF_ADMISSION_CLASSIFICATION_LIMIT];
+}
+
+int admission_window_length_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_ADMISSION_WINDOW_LENGTH];
+
+        if (val <= 0) {
+                val = DEFAULT_ADMISSION_WINDOW_LENGTH;
+        } else if (val > INT_MAX) {
+                val = INT_MAX;
+        }
+
+        return (int)val;
+}
+
+const char *batch_format_config(void)
+{
+        initialize_config();
+        char *val = NULL;
+        size_t k = 0;
+
+        val = config.strValues[CONF_BATCH_FORMAT];
+        k = strlen(val);
+
+        for (int i = 0; i < k; i++) {
+                val[i] = (char)tolower(val[i]);
+        }
+
+        if ((strcmp(val, "none") != 0) && (strcmp(val, "json") != 0) &&
+            (strcmp(val, "ndjson") != 0)) {
+                val = DEFAULT_BATCH_FORMAT;
+        }
+
+        return val;
+}
+
+int batch_max_records_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_BATCH_MAX_RECORDS];
+
+        if (val <= 0) {
+                val = DEFAULT_BATCH_MAX_RECORDS;
+        } else if (val > TM_MAX_BATCH_RECORDS) {
+                val = TM_MAX_BATCH_RECORDS;
+        }
+
+        return (int)val;
+}
+
+int batch_max_size_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_BATCH_MAX_SIZE];
+
+        if (val <= 0) {
+                val = DEFAULT_BATCH_MAX_SIZE;
+        } else if (val > INT_MAX / 1024) {
+                val = INT_MAX / 1024;
+        }
+
+        return (int)val;
+}
+
+int posts_in_flight_config(void)
+{
+        initialize_config();
+        int64_t val = 0;
+
+        val = config.intValues[CONF_POSTS_IN_FLIGHT];
+
+        if (val < 0) {
+                val = DEFAULT_POSTS_IN_FLIGHT;
+        } else if (val > TM_MAX_POSTS_IN_FLIGHT) {
+                val = TM_MAX_POSTS_IN_FLIGHT;
+        }
+
+        return (int)val;
+}
+
+const char *compression_config(void)
+{
+        initialize_config();
+
+        return valid_compression(config.strValues[CONF_COMPRESSION]);
+}
+
+int compression_level_config(void)
+{
+        initialize_config();
+
+        return valid_compression_level(config.intValues[CONF_COMPRESSION_LEVEL]);
+}
+
 /* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
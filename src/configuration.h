@@ -17,14 +17,22 @@
 #pragma once
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
+#include <sys/queue.h>
+#include <sys/types.h>
 
 /* Default configuration settings */
 #define DEFAULT_SERVER_ADDR BACKEND_ADDR
 #define DEFAULT_SOCKET_PATH "/run/telem-0"
+#define DEFAULT_SEQPACKET_SOCKET_PATH "/run/telem-0-seq"
 #define DEFAULT_SPOOL_DIR LOCALSTATEDIR "/spool/telemetry"
 #define DEFAULT_RATE_LIMIT_STRATEGY "spool"
 #define DEFAULT_CAINFO ""
 #define DEFAULT_TIDHEADER "X-Telemetry-TID: 6907c830-eed9-4ce9-81ae-76daf8d88f0f"
+#define DEFAULT_STAGING_BACKEND "files"
+#define DEFAULT_HANDOFF_SOCKET_PATH "/run/telem-post"
+#define DEFAULT_BATCH_FORMAT "none"
+#define DEFAULT_COMPRESSION "none"
 
 #define DEFAULT_RECORD_EXPIRY 1200
 #define DEFAULT_SPOOL_MAX_SIZE 5120
@@ -33,13 +41,34 @@
 #define DEFAULT_BYTE_WINDOW_LENGTH 20
 #define DEFAULT_RECORD_BURST_LIMIT 1000
 #define DEFAULT_BYTE_BURST_LIMIT -1
+#define DEFAULT_SHM_RING_SLOTS 256
+#define DEFAULT_BUFFER_POOL_SIZE 8
+#define DEFAULT_IDLE_TRIM_TIME 60
+#define DEFAULT_STAGING_WORKERS 2
+#define DEFAULT_STAGING_SEGMENT_SIZE 4096
+#define DEFAULT_ADMISSION_CLIENT_LIMIT 1000
+#define DEFAULT_ADMISSION_CLASSIFICATION_LIMIT 500
+#define DEFAULT_ADMISSION_WINDOW_LENGTH 60
+#define DEFAULT_BATCH_MAX_RECORDS 50
+#define DEFAULT_BATCH_MAX_SIZE 256
+#define DEFAULT_POSTS_IN_FLIGHT 0
+#define DEFAULT_COMPRESSION_LEVEL 0
 
 #define DEFAULT_RATE_LIMIT_ENABLED true
 #define DEFAULT_DAEMON_RECYCLING_ENABLED true
 #define DEFAULT_RECORD_RETENTION_ENABLED false
 #define DEFAULT_RECORD_SERVER_DELIVERY_ENABLED true
+#define DEFAULT_SHM_RING_ENABLED false
+#define DEFAULT_HANDOFF_ENABLED false
+#define DEFAULT_ADMISSION_ENABLED false
 
 #define TM_MAX_WINDOW_LENGTH (1 /*h*/ * 60 /*m*/)
+#define TM_MAX_BUFFER_POOL_SIZE 1024
+#define TM_MAX_STAGING_WORKERS 64
+#define TM_MAX_BATCH_RECORDS 1000
+#define TM_MAX_POSTS_IN_FLIGHT 64
+#define TM_MAX_CONFIG_SNAPSHOTS 16
+#define TM_MAX_COMPRESSION_LEVEL 22
 
 enum config_str_keys {
         CONF_SERVER_ADDR = 0,
@@ -48,6 +77,11 @@ enum config_str_keys {
         CONF_RATE_LIMIT_STRATEGY,
         CONF_CAINFO,
         CONF_TIDHEADER,
+        CONF_SEQPACKET_SOCKET_PATH,
+        CONF_STAGING_BACKEND,
+        CONF_HANDOFF_SOCKET_PATH,
+        CONF_BATCH_FORMAT,
+        CONF_COMPRESSION,
         CONF_STR_MAX
 };
 
@@ -59,6 +93,18 @@ enum config_int_keys {
         CONF_BYTE_WINDOW_LENGTH,
         CONF_RECORD_BURST_LIMIT,
         CONF_BYTE_BURST_LIMIT,
+        CONF_SHM_RING_SLOTS,
+        CONF_BUFFER_POOL_SIZE,
+        CONF_IDLE_TRIM_TIME,
+        CONF_STAGING_WORKERS,
+        CONF_STAGING_SEGMENT_SIZE,
+        CONF_ADMISSION_CLIENT_LIMIT,
+        CONF_ADMISSION_CLASSIFICATION_LIMIT,
+        CONF_ADMISSION_WINDOW_LENGTH,
+        CONF_BATCH_MAX_RECORDS,
+        CONF_BATCH_MAX_SIZE,
+        CONF_POSTS_IN_FLIGHT,
+        CONF_COMPRESSION_LEVEL,
         CONF_INT_MAX
 };
 
@@ -67,6 +113,9 @@ enum config_bool_keys {
         CONF_DAEMON_RECYCLING_ENABLED,
         CONF_RECORD_RETENTION_ENABLED,
         CONF_RECORD_SERVER_DELIVERY_ENABLED,
+        CONF_SHM_RING_ENABLED,
+        CONF_HANDOFF_ENABLED,
+        CONF_ADMISSION_ENABLED,
         CONF_BOOL_MAX
 };
 
@@ -78,6 +127,21 @@ typedef struct configuration {
         char *config_file;
 } configuration;
 
+/* A configuration file parsed once and shared, unchanged, by the records
+ * that come with it, see config_snapshot_get() */
+struct config_snapshot {
+        struct configuration config;
+        char *path;
+        /* version of the file that was parsed */
+        struct timespec mtime;
+        off_t size;
+        ino_t ino;
+        /* freed once no longer cached and no reference is left */
+        int refs;
+        bool cached;
+        LIST_ENTRY(config_snapshot) entries;
+};
+
 /* Sets the configuration file to be used later */
 int set_config_file(const char *filename);
 
@@ -96,6 +160,26 @@ bool read_config_from_file(char *filename, struct configuration *config);
 /* Causes the daemon to read the configuration file */
 void reload_config(void);
 
+/* Gets a snapshot of a configuration file, parsed again only if the file
+ * changed since, or NULL if the file cannot be read. The snapshot is
+ * released with config_snapshot_put() */
+struct config_snapshot *config_snapshot_get(const char *filename);
+
+/* Releases a snapshot from config_snapshot_get(), NULL is ignored */
+void config_snapshot_put(struct config_snapshot *snapshot);
+
+/* Getters for the values of a snapshot, or of the configuration in use if
+ * the snapshot is NULL */
+const char *config_snapshot_server_addr(const struct config_snapshot *snapshot);
+
+const char *config_snapshot_cainfo(const struct config_snapshot *snapshot);
+
+const char *config_snapshot_tidheader(const struct config_snapshot *snapshot);
+
+const char *config_snapshot_compression(const struct config_snapshot *snapshot);
+
+int config_snapshot_compression_level(const struct config_snapshot *snapshot);
+
 /* Getters for the configuration values */
 
 /* Gets the server address to send the telemetry records */
@@ -104,6 +188,12 @@ const char *server_addr_config(void);
 /* Gets the path for the unix domain socket */
 const char *socket_path_config(void);
 
+/*
+ * Gets the path for the message oriented (SOCK_SEQPACKET) unix domain socket,
+ * or an empty string if it is disabled
+ */
+const char *seqpacket_socket_path_config(void);
+
 /* Gets the path for the spool directory */
 const char *spool_dir_config(void);
 
@@ -152,4 +242,62 @@ bool record_retention_enabled_config(void);
 /* Gets whether records should be sent to server_addr */
 bool record_server_delivery_enabled_config(void);
 
+/* Gets whether telemprobd hands out a shared memory ring to local clients */
+bool shm_ring_enabled_config(void);
+
+/* Gets the number of record slots in the shared memory ring */
+int shm_ring_slots_config(void);
+
+/* Gets the number of record buffers each daemon keeps for reuse */
+int buffer_pool_size_config(void);
+
+/* Gets the idle time in seconds after which the daemons release memory */
+int idle_trim_time_config(void);
+
+/* Gets the number of threads telemprobd stages records with */
+int staging_workers_config(void);
+
+/* Gets how telemprobd hands records to telempostd, "files" or "log" */
+const char *staging_backend_config(void);
+
+/* Gets the size in KB after which telemprobd starts a new staging log segment */
+int staging_segment_size_config(void);
+
+/* Gets whether telemprobd hands records to telempostd rather than staging them */
+bool handoff_enabled_config(void);
+
+/* Gets the path of the socket telempostd takes records from telemprobd on */
+const char *handoff_socket_path_config(void);
+
+/* Gets whether telemprobd drops records of clients sending too many */
+bool admission_enabled_config(void);
+
+/* Gets the number of records a client may send per admission window */
+int64_t admission_client_limit_config(void);
+
+/* Gets the number of records of a classification per admission window */
+int64_t admission_classification_limit_config(void);
+
+/* Gets the length of the admission window in seconds */
+int admission_window_length_config(void);
+
+/* Gets how telempostd batches records, "none", "json" or "ndjson" */
+const char *batch_format_config(void);
+
+/* Gets the number of records telempostd posts at most in one request */
+int batch_max_records_config(void);
+
+/* Gets the size in KB of the largest request body of a batch */
+int batch_max_size_config(void);
+
+/* Gets the number of posts telempostd makes in parallel, 0 for one at a
+ * time while the daemon waits */
+int posts_in_flight_config(void);
+
+/* Gets how telempostd compresses request bodies, "none", "gzip" or "zstd" */
+const char *compression_config(void);
+
+/* Gets the compression level of request bodies, 0 for the default level */
+int compression_level_config(void);
+
 /* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -24,6 +24,7 @@ EXTRA_DIST += \
 	%D%/libtelemetry.pc.in \
 	%D%/telempostd.service.in \
 	%D%/telempostd.path.in \
+	%D%/telempostd.socket.in \
 	%D%/telemprobd.service.in \
 	%D%/telemprobd.socket.in \
 	%D%/telemprobd-update-trigger.service.in \
@@ -61,7 +62,8 @@ systemdunit_DATA = \
 	%D%/telemprobd.socket \
 	%D%/telemprobd-update-trigger.service \
 	%D%/telempostd.service \
-	%D%/telempostd.path
+	%D%/telempostd.path \
+	%D%/telempostd.socket
 
 %D%/hprobe.service: %D%/hprobe.service.in
 	$(pathfix) < $< > $@
@@ -87,6 +89,9 @@ systemdunit_DATA = \
 %D%/telempostd.service: %D%/telempostd.service.in
 	$(pathfix) < $< > $@
 
+%D%/telempostd.socket: %D%/telempostd.socket.in
+	$(pathfix) < $< > $@
+
 %D%/telemprobd.service: %D%/telemprobd.service.in
 	$(pathfix) < $< > $@
 
@@ -110,6 +115,7 @@ clean-local:
 		%D%/telemprobd.socket \
 		%D%/telempostd.service \
 		%D%/telempostd.path \
+		%D%/telempostd.socket \
 		%D%/telemprobd-update-trigger.service \
 		%D%/telemetrics.conf \
 		%D%/telemetrics-dirs.conf \
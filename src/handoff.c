@@ -0,0 +1,177 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+
+static int set_address(struct sockaddr_un *addr, const char *path)
+{
+        if (strlen(path) >= sizeof(addr->sun_path)) {
+                return -ENAMETOOLONG;
+        }
+
+        memset(addr, 0, sizeof(*addr));
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path);
+
+        return 0;
+}
+
+int handoff_init(struct handoff *handoff, const char *path)
+{
+        handoff->path = strdup(path);
+        if (handoff->path == NULL) {
+                return -ENOMEM;
+        }
+        pthread_mutex_init(&handoff->lock, NULL);
+        handoff->fd = -1;
+        handoff->retry = 0;
+
+        return 0;
+}
+
+static int handoff_connect(struct handoff *handoff)
+{
+        struct sockaddr_un addr;
+        int ret;
+        int fd;
+
+        ret = set_address(&addr, handoff->path);
+        if (ret < 0) {
+                return ret;
+        }
+
+        fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+                return -errno;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                ret = -errno;
+                close(fd);
+                return ret;
+        }
+        handoff->fd = fd;
+
+        return 0;
+}
+
+int handoff_send(struct handoff *handoff, const void *record, size_t size)
+{
+        int ret = 0;
+
+        if (size > HANDOFF_MAX_RECORD) {
+                return -EMSGSIZE;
+        }
+
+        pthread_mutex_lock(&handoff->lock);
+
+        if (handoff->fd < 0) {
+                if (time(NULL) < handoff->retry) {
+                        ret = -ENOTCONN;
+                        goto out;
+                }
+                ret = handoff_connect(handoff);
+                if (ret < 0) {
+                        handoff->retry = time(NULL) + HANDOFF_RETRY_TIME;
+                        goto out;
+                }
+        }
+
+        if (send(handoff->fd, record, size, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+                ret = -errno;
+                /* telempostd is busy, unless it went away */
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        close(handoff->fd);
+                        handoff->fd = -1;
+                }
+        }
+
+out:
+        pthread_mutex_unlock(&handoff->lock);
+
+        return ret;
+}
+
+void handoff_close(struct handoff *handoff)
+{
+        if (handoff->fd >= 0) {
+                close(handoff->fd);
+                handoff->fd = -1;
+        }
+        pthread_mutex_destroy(&handoff->lock);
+        free(handoff->path);
+        handoff->path = NULL;
+}
+
+int handoff_listen(const char *path)
+{
+        struct sockaddr_un addr;
+        int ret;
+        int fd;
+
+        ret = set_address(&addr, path);
+        if (ret < 0) {
+                return ret;
+        }
+
+        fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+                return -errno;
+        }
+
+        if ((unlink(path) != 0 && errno != ENOENT) ||
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            chmod(path, S_IRUSR | S_IWUSR) != 0 ||
+            listen(fd, SOMAXCONN) != 0) {
+                ret = -errno;
+                close(fd);
+                return ret;
+        }
+
+        return fd;
+}
+
+int handoff_accept(int listenfd)
+{
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        int fd;
+
+        fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+                return -errno;
+        }
+
+        /* Records may only come from telemprobd */
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+            cred.uid != getuid()) {
+                close(fd);
+                return -EPERM;
+        }
+
+        return fd;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
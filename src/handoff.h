@@ -0,0 +1,97 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Hand-off of records from telemprobd to telempostd.
+ *
+ * telempostd listens on a SOCK_SEQPACKET socket, and telemprobd sends it
+ * every record as a single message, formatted as it would be staged in a
+ * file. Sending never blocks: a record telempostd cannot take right away,
+ * because it is not running or has not read the records sent before, is
+ * staged by telemprobd as usual.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Longest record sent over the socket, longer ones are staged */
+#define HANDOFF_MAX_RECORD (64 * 1024)
+
+/* Seconds before connecting again once telempostd could not be reached */
+#define HANDOFF_RETRY_TIME 5
+
+/* Sending end, shared by the threads of telemprobd */
+struct handoff {
+        pthread_mutex_t lock;
+        char *path;
+        /* connection to telempostd, -1 when there is none */
+        int fd;
+        /* when to try connecting again */
+        time_t retry;
+};
+
+/**
+ * Prepare to hand records off, connecting on the first one.
+ *
+ * @param handoff The hand-off.
+ * @param path The socket telempostd listens on.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int handoff_init(struct handoff *handoff, const char *path);
+
+/**
+ * Send a record to telempostd, connecting first if needed.
+ *
+ * @param handoff The hand-off.
+ * @param record The record, as staged in a file of its own.
+ * @param size Size of the record, at most HANDOFF_MAX_RECORD.
+ *
+ * @return 0 once telempostd has the record, or a negative errno-style value
+ *    if the record must be staged instead.
+ */
+int handoff_send(struct handoff *handoff, const void *record, size_t size);
+
+/**
+ * Close the connection and release the hand-off.
+ *
+ * @param handoff The hand-off.
+ */
+void handoff_close(struct handoff *handoff);
+
+/**
+ * Create the socket telempostd listens on. Only connections from processes
+ * running as the same user are accepted.
+ *
+ * @param path Where to create the socket.
+ *
+ * @return The listening socket, or a negative errno-style value.
+ */
+int handoff_listen(const char *path);
+
+/**
+ * Accept a connection from telemprobd.
+ *
+ * @param listenfd The listening socket.
+ *
+ * @return The non-blocking connection, or a negative errno-style value if
+ *    there is none or it comes from another user.
+ */
+int handoff_accept(int listenfd);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -17,127 +17,105 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
-#include <limits.h>
 #include <stdbool.h>
-#include <sys/stat.h>
 
 #include "log.h"
 #include "util.h"
 #include "common.h"
 #include "iorecord.h"
 
-bool _fgets(char *s, int n, FILE *stream)
+bool parse_record(char *buf, size_t size, struct staged_record *record)
 {
-        char *i;
-
-        if (!fgets(s, n, stream)) {
-                return false;
-        }
-        if ((i = strchr(s, '\n')) != NULL) {
-                *i = '\0';
-        }
-
-        return true;
-}
-
-bool read_record(char *fullpath, char *headers[], char **body, char **cfg_file)
-{
-        int i = 0;
-        bool result = false;
-        FILE *fp = NULL;
-        long offset;
-#if (LINE_MAX > PATH_MAX)
-        char line[LINE_MAX+1] = { 0 };
-#else
-        char line[PATH_MAX+1] = { 0 };
-#endif
-        long size;
+        char *end = buf + size;
+        char *headers = buf;
+        char *eol = NULL;
         uint32_t cfg_prefix = 0;
-
-        fp = fopen(fullpath, "r");
-        if (fp == NULL) {
-                telem_log(LOG_ERR, "Unable to open file %s in staging\n", fullpath);
-                return false;
-        }
-
-        // Get the file size
-        fseek(fp, 0 , SEEK_END);
-        size = ftell(fp);
-        fseek(fp, 0 , SEEK_SET);
+        size_t body_size;
 
         // First line may contain configuration file path
-        if (fread(&cfg_prefix, CFG_PREFIX_LENGTH, 1, fp) != 1) {
-                telem_log(LOG_ERR, "Error while parsing staged record configuration info.\n");
-                goto read_error;
+        if (size >= CFG_PREFIX_LENGTH) {
+                memcpy(&cfg_prefix, buf, CFG_PREFIX_LENGTH);
         }
-
+        record->cfg_file = NULL;
         if (cfg_prefix == CFG_PREFIX_32BIT) {
-                if (!_fgets(line, sizeof(line), fp)) {
+                eol = memchr(buf, '\n', size);
+                if (eol == NULL) {
                         telem_log(LOG_ERR, "Error while parsing staged record [%x]\n", cfg_prefix);
-                        goto read_error;
-                }
-
-                size_t pathlen = strlen(line);
-                *cfg_file = malloc(pathlen + 1);
-                if (*cfg_file == NULL) {
-                        telem_log(LOG_ERR, "Could not allocate memory for config file path\n");
-                        goto read_error;
+                        return false;
                 }
-                strcpy (*cfg_file, line);
-                telem_debug("DEBUG: cfg_file specified: %s\n", *cfg_file);
-        } else {
-                telem_debug("DEBUG: no user cfg file specified, cfg_prefix: %08x\n", cfg_prefix);
-                *cfg_file = NULL;
-                rewind(fp);
+                *eol = '\0';
+                record->cfg_file = buf + CFG_PREFIX_LENGTH;
+                headers = eol + 1;
+                telem_debug("DEBUG: cfg_file specified: %s\n", record->cfg_file);
         }
 
-        for (i = 0; i < NUM_HEADERS; i++) {
-                const char *header_name = get_header_name(i);
-                if (!_fgets(line, sizeof(line), fp)) {
+        // Headers are the next NUM_HEADERS lines, the body is the rest
+        eol = headers - 1;
+        for (int i = 0; i < NUM_HEADERS; i++) {
+                eol = memchr(eol + 1, '\n', (size_t)(end - eol - 1));
+                if (eol == NULL) {
                         telem_log(LOG_ERR, "Error while parsing staged record\n");
-                        fclose(fp);
                         return false;
                 }
-                //Get rid of trailing newline
-                result = get_header(line, header_name, &headers[i]);
-                if (!result) {
-                        telem_log(LOG_ERR, "read_record: Incorrect"
-                                  " headers in record\n");
-                        goto read_error;
-                }
         }
 
-        offset = ftell(fp);
-        if (offset == -1) {
-                telem_perror("Failed to get staged file offset of record payload");
-                result = false;
-                goto read_error;
+        if (wire_parse_text(headers, (size_t)(eol - headers), &record->headers) < 0) {
+                telem_log(LOG_ERR, "read_record: Incorrect headers in record\n");
+                return false;
         }
 
-        size = size - offset + 1;
-        *body = malloc((size_t)size);
-        if (*body == NULL) {
-                telem_log(LOG_ERR, "Could not allocate memory for payload from staged file\n");
-                result = false;
-                goto read_error;
+        body_size = (size_t)(end - eol - 1);
+        if (body_size == 0) {
+                telem_log(LOG_ERR, "Staged record has no payload\n");
+                return false;
+        }
+        if (body_size + 1 > STAGED_BODY_SIZE) {
+                telem_log(LOG_ERR, "Staged record payload is too large\n");
+                return false;
         }
-        memset(*body, 0, (size_t)size);
+        record->body = eol + 1;
+        record->body[body_size] = '\0';
+
+        return true;
+}
+
+bool read_record(const char *fullpath, char *buf, struct staged_record *record)
+{
+        size_t size = 0;
+        ssize_t len;
+        int fd;
 
-        //read rest of file. '-1' ensures it's null terminated
-        size_t newlen = fread(*body, sizeof(char), (size_t)size - 1, fp);
-        if (newlen == 0) {
-                telem_perror("Error reading staged file");
-                result = false;
-                goto read_error;
-        } else {
-                result = true;
+        fd = open(fullpath, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                telem_log(LOG_ERR, "Unable to open file %s in staging\n", fullpath);
+                return false;
         }
 
-read_error:
-        if (fp) {
-                fclose(fp);
+        // One byte more than the largest record tells a larger one apart
+        do {
+                len = read(fd, buf + size, STAGED_RECORD_SIZE + 1 - size);
+                if (len < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (len < 0) {
+                        telem_perror("Error reading staged file");
+                        close(fd);
+                        return false;
+                }
+                size += (size_t)len;
+        } while (len > 0 && size <= STAGED_RECORD_SIZE);
+        close(fd);
+
+        if (size > STAGED_RECORD_SIZE) {
+                telem_log(LOG_ERR, "Staged record %s is too large\n", fullpath);
+                return false;
         }
 
-        return result;
+        return parse_record(buf, size, record);
 }
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
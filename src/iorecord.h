@@ -14,15 +14,51 @@
  * details.
  */
 
+#include <stdio.h>
 #include <stdbool.h>
+#include <limits.h>
+
+#include "common.h"
+#include "wire.h"
+
+/* Largest body of a staged record, with its newline and a null byte */
+#define STAGED_BODY_SIZE (MAX_PAYLOAD_LENGTH + 2)
+
+/* Largest staged record: configuration file path, headers and body */
+#define STAGED_RECORD_SIZE (CFG_PREFIX_LENGTH + PATH_MAX + 1 + \
+                            NUM_HEADERS * LINE_MAX + STAGED_BODY_SIZE)
+
+/* A staged record, pointing into the buffer it was parsed from */
+struct staged_record {
+        struct wire_headers headers;
+        /* configuration file the record was sent with, or NULL */
+        char *cfg_file;
+        /* null terminated */
+        char *body;
+};
+
+/**
+ * Parses a telemetry record in place, as staged in a file of its own. The
+ * headers may come in any order. The configuration file path and the body
+ * are null terminated within buf.
+ *
+ * @param buf the record, followed by room for a null byte
+ * @param size size of the record
+ * @param record set to the parts of the record
+ *
+ * @return true if successful otherwise false
+ */
+bool parse_record(char *buf, size_t size, struct staged_record *record);
 
 /**
  * Reads a telemetry record
  *
  * @param fullpath pointer to full path file name
- * @param headers pointer to array of headers and values
- * @param body record message content
+ * @param buf where to read the record, STAGED_RECORD_SIZE + 1 bytes
+ * @param record set to the parts of the record, pointing into buf
  *
  * @return true if successful otherwise false
  */
-bool read_record(char *fullpath, char *headers[], char **body, char **cfg);
+bool read_record(const char *fullpath, char *buf, struct staged_record *record);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -35,6 +35,7 @@
 #include "log.h"
 #include "util.h"
 #include "common.h"
+#include "random_id.h"
 #include "journal.h"
 
 /*
@@ -549,7 +550,7 @@ int new_journal_entry(TelemJournal *telem_journal, char *classification,
 {
         int rc = 1;
         char boot_id[BOOTID_LEN] = { '\0' };
-        char *record_id = NULL;
+        char record_id[RANDOM_ID_LEN + 1];
         struct JournalEntry *entry = NULL;
 
         if (telem_journal == NULL) {
@@ -575,7 +576,7 @@ int new_journal_entry(TelemJournal *telem_journal, char *classification,
         entry->event_id = NULL;
         entry->boot_id = NULL;
 
-        if (get_random_id(&record_id) != 0) {
+        if (random_id(record_id) != 0) {
                 telem_log(LOG_ERR, "Erorr: Unable to generate random id\n");
                 goto quit;
         }
@@ -592,7 +593,9 @@ int new_journal_entry(TelemJournal *telem_journal, char *classification,
                 goto quit;
         }
 
-        entry->record_id = record_id;
+        if ((entry->record_id = strdup(record_id)) == NULL) {
+                goto quit;
+        }
         /* boot_id includes \n at the end, strip RC during duplication */
         entry->boot_id = strndup(boot_id, BOOTID_LEN - 1);
         entry->timestamp = timestamp;
@@ -22,7 +22,8 @@ bin_PROGRAMS = \
 
 %C%_telemprobd_LDADD = $(CURL_LIBS) \
 	%D%/libtelem-shared.la \
-	%D%/libtelemetry.la
+	%D%/libtelemetry.la \
+	-lpthread
 
 %C%_telemprobd_CFLAGS = \
 	$(AM_CFLAGS)
@@ -58,15 +59,29 @@ endif
 	%D%/spool.c \
 	%D%/retention.h \
 	%D%/retention.c \
+	%D%/post_batch.h \
+	%D%/post_batch.c \
+	%D%/post_queue.h \
+	%D%/post_queue.c \
+	%D%/post_compress.h \
+	%D%/post_compress.c \
 	%D%/iorecord.c \
 	%D%/iorecord.h
 
-%C%_telempostd_LDADD = $(CURL_LIBS) $(JSON_C_LIBS) \
+%C%_telempostd_LDADD = $(CURL_LIBS) $(JSON_C_LIBS) $(ZLIB_LIBS) \
 	%D%/libtelem-shared.la \
 	%D%/libtelemetry.la
 
 %C%_telempostd_CFLAGS = \
-	$(AM_CFLAGS)
+	$(AM_CFLAGS) \
+	$(ZLIB_CFLAGS)
+
+if HAVE_ZSTD
+%C%_telempostd_CFLAGS += \
+	$(ZSTD_CFLAGS)
+%C%_telempostd_LDADD += \
+	$(ZSTD_LIBS)
+endif
 
 %C%_telempostd_LDFLAGS = \
 	$(AM_LDFLAGS) \
@@ -90,7 +105,7 @@ endif
 
 # set library version info
 SHAREDLIB_CURRENT=4
-SHAREDLIB_REVISION=1
+SHAREDLIB_REVISION=2
 SHAREDLIB_AGE=0
 
 noinst_LTLIBRARIES = %D%/libtelem-shared.la
@@ -98,12 +113,26 @@ noinst_LTLIBRARIES = %D%/libtelem-shared.la
 %C%_libtelem_shared_la_SOURCES = \
 	%D%/util.c \
 	%D%/util.h \
+	%D%/admission.c \
+	%D%/admission.h \
 	%D%/configuration.c \
 	%D%/nica/inifile.c \
 	%D%/nica/hashmap.c \
 	%D%/configuration.h \
 	%D%/common.c \
-	%D%/common.h
+	%D%/common.h \
+	%D%/buffer_pool.c \
+	%D%/buffer_pool.h \
+	%D%/handoff.c \
+	%D%/handoff.h \
+	%D%/random_id.c \
+	%D%/random_id.h \
+	%D%/shm_ring.c \
+	%D%/shm_ring.h \
+	%D%/staging_log.c \
+	%D%/staging_log.h \
+	%D%/wire.c \
+	%D%/wire.h
 
 %C%_libtelem_shared_la_CFLAGS = \
 	$(AM_CFLAGS)
@@ -115,7 +144,8 @@ lib_LTLIBRARIES = \
 	%D%/libtelemetry.la
 
 %C%_libtelemetry_la_SOURCES = \
-	%D%/telemetry.c
+	%D%/telemetry.c \
+	%D%/async.c
 
 include_HEADERS = %D%/telemetry.h
 
@@ -134,6 +164,7 @@ EXTRA_DIST += \
 
 %C%_libtelemetry_la_LIBADD = \
 	%D%/libtelem-shared.la \
-	-ldl
+	-ldl \
+	-lpthread
 
 # vim: filetype=automake tabstop=8 shiftwidth=8 noexpandtab
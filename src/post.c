@@ -33,7 +33,8 @@
  *  using pointer to a fake function.
  */
 
-bool (*post_record_ptr)(char *[], char *, char *) = post_record_http;
+bool (*post_record_ptr)(const struct wire_headers *, char *,
+                        const struct config_snapshot *, size_t *) = post_record_http;
 
 void print_usage(char *prog)
 {
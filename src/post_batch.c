@@ -0,0 +1,257 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <json-c/json.h>
+
+#include "post_batch.h"
+#include "log.h"
+
+int post_batch_init(struct post_batch *batch, enum batch_format format, int max_records,
+                    size_t max_size, batch_post_fn post, void *post_data)
+{
+        if (format == BATCH_NONE) {
+                max_records = 1;
+        }
+        batch->entries = calloc((size_t)max_records, sizeof(struct batch_entry));
+        if (batch->entries == NULL) {
+                return -ENOMEM;
+        }
+        batch->format = format;
+        batch->post = post;
+        batch->post_data = post_data;
+        batch->max_records = max_records;
+        batch->max_size = max_size;
+        batch->body = NULL;
+        batch->len = 0;
+        batch->size = 0;
+        batch->count = 0;
+
+        return 0;
+}
+
+void post_batch_free(struct post_batch *batch)
+{
+        free(batch->body);
+        batch->body = NULL;
+        batch->size = 0;
+        free(batch->entries);
+        batch->entries = NULL;
+}
+
+/* Size of the body once the record is added: a separator or newline, and
+ * the closing bracket of an array */
+static size_t body_size_with(struct post_batch *batch, size_t len)
+{
+        return batch->len + len + 2;
+}
+
+static int reserve(struct post_batch *batch, size_t size)
+{
+        size_t new_size = batch->size ? batch->size : 4096;
+        char *body;
+
+        if (size <= batch->size) {
+                return 0;
+        }
+        while (new_size < size) {
+                new_size *= 2;
+        }
+        body = realloc(batch->body, new_size);
+        if (body == NULL) {
+                return -ENOMEM;
+        }
+        batch->body = body;
+        batch->size = new_size;
+
+        return 0;
+}
+
+int post_batch_add(struct post_batch *batch, const char *record, size_t len,
+                   batch_done_fn done, void *data)
+{
+        int ret;
+
+        if (batch->count > 0 && body_size_with(batch, len) > batch->max_size) {
+                post_batch_flush(batch);
+        }
+
+        /* and a null byte */
+        ret = reserve(batch, body_size_with(batch, len) + 1);
+        if (ret < 0) {
+                return ret;
+        }
+
+        if (batch->format == BATCH_NONE) {
+                memcpy(batch->body, record, len);
+                batch->len = len;
+        } else if (batch->format == BATCH_JSON) {
+                batch->body[batch->len++] = batch->count == 0 ? '[' : ',';
+                memcpy(batch->body + batch->len, record, len);
+                batch->len += len;
+        } else {
+                memcpy(batch->body + batch->len, record, len);
+                batch->len += len;
+                batch->body[batch->len++] = '\n';
+        }
+        batch->entries[batch->count].done = done;
+        batch->entries[batch->count].data = data;
+        batch->entries[batch->count].len = len;
+        batch->count++;
+
+        if (batch->count == batch->max_records) {
+                post_batch_flush(batch);
+        }
+
+        return 0;
+}
+
+static bool record_accepted(json_object *result)
+{
+        json_object *status = result;
+        int code;
+
+        if (json_object_is_type(result, json_type_object) &&
+            !json_object_object_get_ex(result, "status", &status)) {
+                return false;
+        }
+        if (json_object_is_type(status, json_type_boolean)) {
+                return json_object_get_boolean(status);
+        }
+        if (!json_object_is_type(status, json_type_int)) {
+                return false;
+        }
+        code = json_object_get_int(status);
+
+        return code == 200 || code == 201;
+}
+
+/* Whether each record of an accepted batch was accepted, see post_batch.h */
+static void map_results(const char *response, int count, bool *sent)
+{
+        json_object *results;
+
+        for (int i = 0; i < count; i++) {
+                sent[i] = true;
+        }
+        if (response == NULL || (results = json_tokener_parse(response)) == NULL) {
+                return;
+        }
+
+        if (json_object_is_type(results, json_type_array) &&
+            json_object_array_length(results) == (size_t)count) {
+                for (int i = 0; i < count; i++) {
+                        sent[i] = record_accepted(json_object_array_get_idx(results,
+                                                                            (size_t)i));
+                }
+        } else {
+                telem_log(LOG_DEBUG, "No result per record, batch accepted as a whole\n");
+        }
+        json_object_put(results);
+}
+
+void post_batch_flush(struct post_batch *batch)
+{
+        struct batch_request *request;
+        size_t entries_size = (size_t)batch->count * sizeof(struct batch_entry);
+
+        if (batch->count == 0) {
+                return;
+        }
+
+        if (batch->format == BATCH_JSON) {
+                batch->body[batch->len++] = ']';
+        }
+
+        /* The request outlives the batch body, which takes the next records
+         * while it is in flight */
+        request = malloc(sizeof(struct batch_request) + entries_size + batch->len + 1);
+        if (request == NULL) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
+        }
+        request->entries = (struct batch_entry *)(request + 1);
+        memcpy(request->entries, batch->entries, entries_size);
+        request->count = batch->count;
+        request->body = (char *)request->entries + entries_size;
+        memcpy(request->body, batch->body, batch->len);
+        request->body[batch->len] = '\0';
+        request->len = batch->len;
+        request->sent_len = batch->len;
+        request->format = batch->format;
+        request->content_type = batch->format == BATCH_NDJSON ? "application/x-ndjson" :
+                                "application/json";
+
+        batch->len = 0;
+        batch->count = 0;
+
+        batch->post(request, batch->post_data);
+}
+
+/* Share of the request as sent taken by a record, as much as the record
+ * takes of the records in the body, rounded up */
+static size_t record_share(const struct batch_request *request, size_t len, size_t total)
+{
+        if (total == 0) {
+                return request->sent_len;
+        }
+
+        return (request->sent_len * len + total - 1) / total;
+}
+
+void post_batch_complete(struct batch_request *request, bool posted, const char *response)
+{
+        bool *sent;
+        int accepted = 0;
+        size_t total = 0;
+
+        sent = calloc((size_t)request->count, sizeof(bool));
+        if (sent == NULL) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
+        }
+
+        /* The answer to a single record is not looked at */
+        if (posted && request->format == BATCH_NONE) {
+                sent[0] = true;
+        } else if (posted) {
+                map_results(response, request->count, sent);
+        }
+
+        for (int i = 0; i < request->count; i++) {
+                total += request->entries[i].len;
+        }
+        for (int i = 0; i < request->count; i++) {
+                if (sent[i]) {
+                        accepted++;
+                }
+                request->entries[i].done(request->entries[i].data, sent[i],
+                                         record_share(request, request->entries[i].len,
+                                                      total));
+        }
+        if (request->format != BATCH_NONE) {
+                telem_log(LOG_DEBUG, "Batch of %d records posted, %d accepted\n",
+                          request->count, accepted);
+        }
+        free(sent);
+        free(request);
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,162 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Batches of records posted by telempostd in a single request.
+ *
+ * Records, each a JSON object as posted on its own, are added to the body of
+ * the next request, either as the elements of a JSON array or one per line
+ * (NDJSON). The batch is posted once it holds as many records as allowed,
+ * once the next record would make the body too large, or when flushed.
+ * Without batches, each record is posted alone, as is.
+ *
+ * The server answers a batch it accepted with 200 or 201, as it does for a
+ * single record. The body of the answer may be a JSON array with an element
+ * per record, in order, giving the HTTP status of the record or an object
+ * with a "status" member; a record is accepted when its status is 200 or
+ * 201, or true. Any other answer to an accepted batch accepts every record,
+ * while a batch that could not be posted fails every record.
+ *
+ * A request may still be in flight once flushed, its records are done with
+ * when post_batch_complete() is called for it.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum batch_format {
+        /* a single record per request */
+        BATCH_NONE,
+        BATCH_JSON,
+        BATCH_NDJSON
+};
+
+/**
+ * Called for each record once the request holding it completed.
+ *
+ * @param data The data passed to post_batch_add().
+ * @param sent Whether the server accepted the record.
+ * @param size Bytes of the request posted for the record, its share of the
+ *    body as sent.
+ */
+typedef void (*batch_done_fn)(void *data, bool sent, size_t size);
+
+struct batch_entry {
+        batch_done_fn done;
+        void *data;
+        /* length of the record in the body */
+        size_t len;
+};
+
+/* A batch being posted, see post_batch_complete() */
+struct batch_request {
+        /* null terminated request body */
+        char *body;
+        size_t len;
+        /* size of the body as sent, set by the post function if it is
+         * compressed */
+        size_t sent_len;
+        const char *content_type;
+        enum batch_format format;
+        /* records in the body, in order */
+        struct batch_entry *entries;
+        int count;
+};
+
+/**
+ * Posts the body of a batch. Once the server answered, or the request
+ * failed, post_batch_complete() is called for the request, either before
+ * the function returns or later on.
+ *
+ * @param request The request, owned by the function until completed.
+ * @param data The data passed to post_batch_init().
+ */
+typedef void (*batch_post_fn)(struct batch_request *request, void *data);
+
+struct post_batch {
+        enum batch_format format;
+        batch_post_fn post;
+        void *post_data;
+        int max_records;
+        size_t max_size;
+        /* request body, with room for the closing bracket of an array */
+        char *body;
+        size_t len;
+        size_t size;
+        /* records in the body, in order */
+        struct batch_entry *entries;
+        int count;
+};
+
+/**
+ * Prepare an empty batch.
+ *
+ * @param batch The batch.
+ * @param format How records are laid out in the body.
+ * @param max_records Number of records posted at most in one request, 1
+ *    if the format is BATCH_NONE.
+ * @param max_size Size of the largest body, unless it holds a single record.
+ * @param post Posts the body.
+ * @param post_data Passed to post.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int post_batch_init(struct post_batch *batch, enum batch_format format, int max_records,
+                    size_t max_size, batch_post_fn post, void *post_data);
+
+/**
+ * Release a batch, which must have been flushed. Requests in flight are
+ * not affected.
+ *
+ * @param batch The batch.
+ */
+void post_batch_free(struct post_batch *batch);
+
+/**
+ * Add a record to the batch. The batch is posted first if the record does
+ * not fit, and right after if it is full.
+ *
+ * @param batch The batch.
+ * @param record The record as a JSON object.
+ * @param len Length of the record.
+ * @param done Called once the request holding the record completed.
+ * @param data Passed to done.
+ *
+ * @return 0 if successful, or a negative errno-style value if the record
+ *    could not be added, in which case done is not called.
+ */
+int post_batch_add(struct post_batch *batch, const char *record, size_t len,
+                   batch_done_fn done, void *data);
+
+/**
+ * Post the records of the batch, if any.
+ *
+ * @param batch The batch.
+ */
+void post_batch_flush(struct post_batch *batch);
+
+/**
+ * Complete a request, calling the done function of each of its records,
+ * and release it.
+ *
+ * @param request The request handed to the post function.
+ * @param posted Whether the server accepted the request.
+ * @param response The null terminated body of the answer, or NULL.
+ */
+void post_batch_complete(struct batch_request *request, bool posted, const char *response);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
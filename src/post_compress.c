@@ -0,0 +1,157 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <zlib.h>
+
+#include "config.h"
+
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "post_compress.h"
+
+int post_compress_encoding(const char *name, enum body_encoding *encoding)
+{
+        if (strcmp(name, "none") == 0) {
+                *encoding = ENCODING_IDENTITY;
+        } else if (strcmp(name, "gzip") == 0) {
+                *encoding = ENCODING_GZIP;
+        } else if (strcmp(name, "zstd") == 0) {
+#ifdef HAVE_ZSTD_H
+                *encoding = ENCODING_ZSTD;
+#else
+                return -ENOTSUP;
+#endif
+        } else {
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+const char *post_compress_name(enum body_encoding encoding)
+{
+        switch (encoding) {
+        case ENCODING_GZIP:
+                return "gzip";
+        case ENCODING_ZSTD:
+                return "zstd";
+        default:
+                return NULL;
+        }
+}
+
+static int compress_gzip(int level, const char *body, size_t size, char **out,
+                         size_t *out_size)
+{
+        z_stream stream;
+        char *buf;
+        uLong bound;
+        int ret;
+
+        if (size > UINT_MAX) {
+                return -EFBIG;
+        }
+        if (level <= 0) {
+                level = Z_DEFAULT_COMPRESSION;
+        } else if (level > Z_BEST_COMPRESSION) {
+                level = Z_BEST_COMPRESSION;
+        }
+
+        memset(&stream, 0, sizeof(stream));
+        /* 16 more window bits for a gzip header and trailer */
+        if (deflateInit2(&stream, level, Z_DEFLATED, MAX_WBITS + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+                return -ENOMEM;
+        }
+
+        /* The whole body is compressed in a single call */
+        bound = deflateBound(&stream, (uLong)size);
+        buf = malloc(bound);
+        if (buf == NULL) {
+                deflateEnd(&stream);
+                return -ENOMEM;
+        }
+        stream.next_in = (Bytef *)body;
+        stream.avail_in = (uInt)size;
+        stream.next_out = (Bytef *)buf;
+        stream.avail_out = (uInt)bound;
+
+        ret = deflate(&stream, Z_FINISH);
+        deflateEnd(&stream);
+        if (ret != Z_STREAM_END) {
+                free(buf);
+                return -EIO;
+        }
+        *out = buf;
+        *out_size = stream.total_out;
+
+        return 0;
+}
+
+#ifdef HAVE_ZSTD_H
+static int compress_zstd(int level, const char *body, size_t size, char **out,
+                         size_t *out_size)
+{
+        size_t bound = ZSTD_compressBound(size);
+        size_t ret;
+        char *buf;
+
+        if (level <= 0) {
+                level = ZSTD_CLEVEL_DEFAULT;
+        } else if (level > ZSTD_maxCLevel()) {
+                level = ZSTD_maxCLevel();
+        }
+
+        buf = malloc(bound);
+        if (buf == NULL) {
+                return -ENOMEM;
+        }
+        ret = ZSTD_compress(buf, bound, body, size, level);
+        if (ZSTD_isError(ret)) {
+                free(buf);
+                return -EIO;
+        }
+        *out = buf;
+        *out_size = ret;
+
+        return 0;
+}
+#endif
+
+int post_compress(enum body_encoding encoding, int level, const char *body, size_t size,
+                  char **out, size_t *out_size)
+{
+        switch (encoding) {
+        case ENCODING_GZIP:
+                return compress_gzip(level, body, size, out, out_size);
+#ifdef HAVE_ZSTD_H
+        case ENCODING_ZSTD:
+                return compress_zstd(level, body, size, out, out_size);
+#endif
+        default:
+                return -EINVAL;
+        }
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,72 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Compression of the request bodies telempostd posts.
+ *
+ * A body is compressed as the configuration of the server it is posted to
+ * asks, and sent with a Content-Encoding header naming the encoding: gzip,
+ * or zstd if telempostd was built with it. The server must accept the
+ * encoding; nothing is negotiated over HTTP before a post.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+enum body_encoding {
+        /* the body is sent as is */
+        ENCODING_IDENTITY,
+        ENCODING_GZIP,
+        ENCODING_ZSTD
+};
+
+/**
+ * Get the encoding a configuration names.
+ *
+ * @param name "none", "gzip" or "zstd".
+ * @param encoding Set to the encoding.
+ *
+ * @return 0 if successful, -ENOTSUP if telempostd was built without the
+ *    encoding, or -EINVAL if there is no such encoding.
+ */
+int post_compress_encoding(const char *name, enum body_encoding *encoding);
+
+/**
+ * Get the Content-Encoding of a body.
+ *
+ * @param encoding The encoding.
+ *
+ * @return The name of the encoding, or NULL for ENCODING_IDENTITY.
+ */
+const char *post_compress_name(enum body_encoding encoding);
+
+/**
+ * Compress a request body.
+ *
+ * @param encoding The encoding, other than ENCODING_IDENTITY.
+ * @param level The compression level, 0 for the default of the encoding.
+ *    Levels out of the range of the encoding are clamped.
+ * @param body The body.
+ * @param size Size of the body.
+ * @param out Set to the compressed body, to be freed.
+ * @param out_size Set to the size of the compressed body.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int post_compress(enum body_encoding encoding, int level, const char *body, size_t size,
+                  char **out, size_t *out_size);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
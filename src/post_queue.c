@@ -0,0 +1,293 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <stdbool.h>
+
+#include "post_queue.h"
+#include "log.h"
+
+/* Milliseconds waited at most for a transfer to complete, so that a queue
+ * waiting on its own still notices timeouts of libcurl */
+#define TRANSFER_WAIT 1000
+
+/* Set as the private pointer of the easy handle of a transfer */
+struct transfer {
+        post_done_fn done;
+        void *data;
+};
+
+void post_queue_init(struct post_queue *queue, int max_requests)
+{
+        queue->multi = NULL;
+        queue->share = NULL;
+        queue->max_requests = max_requests > 0 ? max_requests : 1;
+        queue->requests = 0;
+        queue->last_post = 0;
+}
+
+static int start_multi(struct post_queue *queue)
+{
+        curl_global_init(CURL_GLOBAL_ALL);
+
+        queue->multi = curl_multi_init();
+        if (queue->multi == NULL) {
+                curl_global_cleanup();
+                return -ENOMEM;
+        }
+
+        /* Requests share a connection over HTTP/2, and each needs one of its
+         * own otherwise */
+        if (curl_multi_setopt(queue->multi, CURLMOPT_PIPELINING,
+                              CURLPIPE_MULTIPLEX) != CURLM_OK ||
+            curl_multi_setopt(queue->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                              (long)queue->max_requests) != CURLM_OK) {
+                telem_log(LOG_WARNING, "curl_multi_setopt(): Failed to set one or more options\n");
+        }
+
+        /* Transfers run on this thread only, so the share needs no locks.
+         * Posts go on without it if it can not be set up. */
+        queue->share = curl_share_init();
+        if (queue->share == NULL) {
+                telem_log(LOG_WARNING, "curl_share_init(): Unable to share TLS sessions\n");
+        } else if (curl_share_setopt(queue->share, CURLSHOPT_SHARE,
+                                     CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK ||
+                   curl_share_setopt(queue->share, CURLSHOPT_SHARE,
+                                     CURL_LOCK_DATA_DNS) != CURLSHE_OK) {
+                telem_log(LOG_WARNING, "curl_share_setopt(): Failed to set one or more options\n");
+        }
+
+        return 0;
+}
+
+/* Moves the transfers along, and completes those that are done */
+static void run_transfers(struct post_queue *queue)
+{
+        struct transfer *transfer;
+        CURLMsg *msg;
+        CURLcode result;
+        CURL *curl;
+        int running;
+        int left;
+
+        curl_multi_perform(queue->multi, &running);
+
+        while ((msg = curl_multi_info_read(queue->multi, &left)) != NULL) {
+                if (msg->msg != CURLMSG_DONE) {
+                        continue;
+                }
+                curl = msg->easy_handle;
+                result = msg->data.result;
+                transfer = NULL;
+                curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&transfer);
+                curl_multi_remove_handle(queue->multi, curl);
+                queue->requests--;
+
+                transfer->done(curl, result, transfer->data);
+                curl_easy_cleanup(curl);
+                free(transfer);
+        }
+}
+
+/* Waits for a transfer to make progress, returns false on error */
+static bool wait_transfers(struct post_queue *queue)
+{
+        CURLMcode ret;
+
+        ret = curl_multi_wait(queue->multi, NULL, 0, TRANSFER_WAIT, NULL);
+        if (ret != CURLM_OK) {
+                telem_log(LOG_ERR, "curl_multi_wait(): %s\n", curl_multi_strerror(ret));
+                return false;
+        }
+        run_transfers(queue);
+
+        return true;
+}
+
+CURL *post_queue_handle(struct post_queue *queue)
+{
+        CURL *curl;
+
+        if (queue->multi == NULL && start_multi(queue) < 0) {
+                return NULL;
+        }
+
+        curl = curl_easy_init();
+        if (curl != NULL && queue->share != NULL &&
+            curl_easy_setopt(curl, CURLOPT_SHARE, queue->share) != CURLE_OK) {
+                telem_log(LOG_WARNING, "curl_easy_setopt(): Unable to share TLS sessions\n");
+        }
+
+        return curl;
+}
+
+int post_queue_add(struct post_queue *queue, CURL *curl, post_done_fn done, void *data)
+{
+        struct transfer *transfer;
+
+        while (queue->requests >= queue->max_requests) {
+                if (!wait_transfers(queue)) {
+                        return -EIO;
+                }
+        }
+
+        transfer = malloc(sizeof(struct transfer));
+        if (transfer == NULL) {
+                return -ENOMEM;
+        }
+        transfer->done = done;
+        transfer->data = data;
+
+        if (curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer) != CURLE_OK ||
+            curl_multi_add_handle(queue->multi, curl) != CURLM_OK) {
+                free(transfer);
+                return -EIO;
+        }
+        queue->requests++;
+        queue->last_post = time(NULL);
+
+        /* Connect right away rather than on the next poll */
+        run_transfers(queue);
+
+        return 0;
+}
+
+static int remaining_ms(const struct timespec *deadline)
+{
+        struct timespec now;
+        long long ms;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ms = (long long)(deadline->tv_sec - now.tv_sec) * 1000 +
+             (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+        if (ms <= 0) {
+                return 0;
+        }
+
+        return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+static short to_curl_events(short events)
+{
+        return (short)(((events & POLLIN) ? CURL_WAIT_POLLIN : 0) |
+                       ((events & POLLPRI) ? CURL_WAIT_POLLPRI : 0) |
+                       ((events & POLLOUT) ? CURL_WAIT_POLLOUT : 0));
+}
+
+static short from_curl_events(short events)
+{
+        return (short)(((events & CURL_WAIT_POLLIN) ? POLLIN : 0) |
+                       ((events & CURL_WAIT_POLLPRI) ? POLLPRI : 0) |
+                       ((events & CURL_WAIT_POLLOUT) ? POLLOUT : 0));
+}
+
+int post_queue_poll(struct post_queue *queue, struct pollfd *fds, nfds_t nfds, int timeout)
+{
+        struct curl_waitfd waitfds[POST_QUEUE_MAX_FDS];
+        struct timespec deadline;
+        CURLMcode ret;
+        int ready = 0;
+        int wait;
+
+        assert(nfds <= POST_QUEUE_MAX_FDS);
+
+        if (queue->requests == 0) {
+                return poll(fds, nfds, timeout);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (timeout % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+        }
+
+        /* Transfers complete along the way, the wait is only over once the
+         * caller has an event or the timeout elapsed */
+        do {
+                for (nfds_t i = 0; i < nfds; i++) {
+                        waitfds[i].fd = fds[i].fd;
+                        waitfds[i].events = to_curl_events(fds[i].events);
+                        waitfds[i].revents = 0;
+                }
+                wait = remaining_ms(&deadline);
+                ret = curl_multi_wait(queue->multi, waitfds, (unsigned int)nfds, wait, NULL);
+                if (ret != CURLM_OK) {
+                        telem_log(LOG_ERR, "curl_multi_wait(): %s\n", curl_multi_strerror(ret));
+                        errno = EIO;
+                        return -1;
+                }
+                run_transfers(queue);
+
+                for (nfds_t i = 0; i < nfds; i++) {
+                        fds[i].revents = fds[i].fd < 0 ? 0 :
+                                         from_curl_events(waitfds[i].revents);
+                        if (fds[i].revents != 0) {
+                                ready++;
+                        }
+                }
+        } while (ready == 0 && queue->requests > 0 && remaining_ms(&deadline) > 0);
+
+        if (ready == 0 && (wait = remaining_ms(&deadline)) > 0) {
+                return poll(fds, nfds, wait);
+        }
+
+        return ready;
+}
+
+void post_queue_wait(struct post_queue *queue)
+{
+        while (queue->requests > 0) {
+                if (!wait_transfers(queue)) {
+                        break;
+                }
+        }
+}
+
+void post_queue_release(struct post_queue *queue)
+{
+        if (queue->multi == NULL) {
+                return;
+        }
+
+        post_queue_wait(queue);
+        curl_multi_cleanup(queue->multi);
+        queue->multi = NULL;
+        /* Every easy handle using the share is cleaned up by now */
+        if (queue->share != NULL) {
+                curl_share_cleanup(queue->share);
+                queue->share = NULL;
+        }
+        curl_global_cleanup();
+}
+
+void post_queue_release_idle(struct post_queue *queue, int idle_time)
+{
+        if (queue->multi != NULL && queue->requests == 0 && idle_time > 0 &&
+            difftime(time(NULL), queue->last_post) >= idle_time) {
+                telem_log(LOG_DEBUG, "Closing idle connections to the server\n");
+                post_queue_release(queue);
+        }
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,129 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Posts telempostd makes in parallel on a libcurl multi handle.
+ *
+ * Up to max_requests transfers are in flight at once. They share the
+ * connections of the multi handle, several requests being multiplexed on
+ * a connection when the server speaks HTTP/2, and share TLS sessions and DNS
+ * lookups so that a new connection resumes the session of an earlier one
+ * instead of a full handshake. Transfers make progress while
+ * the daemon polls its own file descriptors with post_queue_poll(), and call
+ * their done function once complete.
+ */
+
+#pragma once
+
+#include <poll.h>
+#include <time.h>
+#include <curl/curl.h>
+
+/* File descriptors post_queue_poll() waits on at most, besides libcurl's */
+#define POST_QUEUE_MAX_FDS 8
+
+/**
+ * Called once a transfer completed, before its easy handle is cleaned up.
+ *
+ * @param curl The easy handle of the transfer.
+ * @param result The outcome of the transfer.
+ * @param data The data passed to post_queue_add().
+ */
+typedef void (*post_done_fn)(CURL *curl, CURLcode result, void *data);
+
+struct post_queue {
+        /* NULL until the first post, and once released */
+        CURLM *multi;
+        /* TLS sessions and DNS cache of the transfers, NULL if unavailable */
+        CURLSH *share;
+        int max_requests;
+        /* transfers in flight */
+        int requests;
+        time_t last_post;
+};
+
+/**
+ * Prepare an empty queue.
+ *
+ * @param queue The queue.
+ * @param max_requests Number of transfers in flight at most.
+ */
+void post_queue_init(struct post_queue *queue, int max_requests);
+
+/**
+ * Create the easy handle of a transfer, sharing the TLS sessions and DNS
+ * cache of the queue.
+ *
+ * @param queue The queue.
+ *
+ * @return The handle, or NULL if it could not be created.
+ */
+CURL *post_queue_handle(struct post_queue *queue);
+
+/**
+ * Start a transfer, once one of those in flight completed if there are
+ * already max_requests of them.
+ *
+ * @param queue The queue.
+ * @param curl An easy handle from post_queue_handle() with the options of
+ *    the request set, cleaned up by the queue once the transfer completed.
+ * @param done Called once the transfer completed.
+ * @param data Passed to done.
+ *
+ * @return 0 if successful, or a negative errno-style value if the transfer
+ *    could not be started, in which case the handle is left to the caller
+ *    and done is not called.
+ */
+int post_queue_add(struct post_queue *queue, CURL *curl, post_done_fn done, void *data);
+
+/**
+ * Wait for events on file descriptors like poll(2), while transfers make
+ * progress and complete.
+ *
+ * @param queue The queue.
+ * @param fds The file descriptors, POST_QUEUE_MAX_FDS at most.
+ * @param nfds Number of file descriptors.
+ * @param timeout Milliseconds to wait for an event at most.
+ *
+ * @return The number of file descriptors with events, 0 once the timeout
+ *    elapsed without any, or -1 with errno set on error.
+ */
+int post_queue_poll(struct post_queue *queue, struct pollfd *fds, nfds_t nfds, int timeout);
+
+/**
+ * Wait for every transfer in flight to complete.
+ *
+ * @param queue The queue.
+ */
+void post_queue_wait(struct post_queue *queue);
+
+/**
+ * Wait for every transfer in flight to complete, then close the
+ * connections and release the multi and share handles. The next post
+ * starts over.
+ *
+ * @param queue The queue.
+ */
+void post_queue_release(struct post_queue *queue);
+
+/**
+ * Release the multi handle once nothing was posted for a while.
+ *
+ * @param queue The queue.
+ * @param idle_time Seconds without a post, 0 to keep the handle.
+ */
+void post_queue_release_idle(struct post_queue *queue, int idle_time);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -14,6 +14,7 @@
  * details.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
@@ -29,7 +30,6 @@
 #include <unistd.h>
 #include <sys/signalfd.h>
 #include <signal.h>
-#include <malloc.h>
 
 #include "telemetry.h"
 #include "config.h"
@@ -50,6 +50,7 @@
 #include "log.h"
 #include "telemdaemon.h"
 #include "configuration.h"
+#include "shm_ring.h"
 
 void print_usage(char *prog)
 {
@@ -59,15 +60,124 @@ void print_usage(char *prog)
         printf("  -V,  --version        Print the program version\n");
 }
 
-int main(int argc, char **argv)
+/**
+ * Create a unix domain socket listening on the given path.
+ *
+ * @param path The path to bind the socket to
+ * @param type SOCK_STREAM or SOCK_SEQPACKET
+ *
+ * @return The listening socket. Exits on failure.
+ */
+static int create_listener(const char *path, int type)
 {
         struct sockaddr_un addr;
-        int sockfd, fd, sigfd;
+        int sockfd;
+        int ret;
+
+        sockfd = socket(AF_UNIX, type, 0);
+        if (sockfd < 0) {
+                telem_perror("Socket creation failed");
+                exit(EXIT_FAILURE);
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        addr.sun_path[sizeof(addr.sun_path) - 1] = 0;
+
+        ret = unlink(addr.sun_path);
+        if (ret == -1 && errno != ENOENT) {
+                telem_perror("Failed to unlink socket");
+                exit(EXIT_FAILURE);
+        }
+
+        if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+                telem_perror("Failed to bind socket to address");
+                exit(EXIT_FAILURE);
+        }
+
+        if (chmod(addr.sun_path, 0666) == -1) {
+                telem_perror("Failed to change socket permissions");
+                exit(EXIT_FAILURE);
+        }
+
+        if (listen(sockfd, SOMAXCONN) == -1) {
+                telem_perror("Failed to mark socket as passive");
+                exit(EXIT_FAILURE);
+        }
+
+        return sockfd;
+}
+
+/**
+ * Watch a listening socket for new connections.
+ *
+ * @param daemon The pointer to the daemon
+ * @param w The watch to register for the socket
+ * @param fd The listening socket
+ */
+static void watch_listener(TelemDaemon *daemon, watch *w, int fd)
+{
+        /* Connections are accepted until EAGAIN, see accept_clients */
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+                telem_perror("Failed to set listening socket as nonblocking");
+                exit(EXIT_FAILURE);
+        }
+
+        w->type = WATCH_LISTENER;
+        w->fd = fd;
+        watch_fd(daemon, w, EPOLLIN);
+}
+
+/**
+ * Accept every pending connection on a listening socket.
+ *
+ * @param daemon The pointer to the daemon
+ * @param listener The listening socket
+ * @param seqpacket Whether the listener is the SOCK_SEQPACKET one
+ */
+static void accept_clients(TelemDaemon *daemon, int listener, bool seqpacket)
+{
+        client *new_client = NULL;
+        int fd;
+
+        while (1) {
+                fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                                telem_perror("Failed to accept socket");
+                        }
+                        return;
+                }
+                telem_log(LOG_INFO, "New client %d connected\n", fd);
+
+                /* Add the fd to the client list */
+                new_client = add_client(&(daemon->client_head), fd);
+                if (!new_client) {
+                        telem_log(LOG_ERR, "Unable to add the client to list\n");
+                        exit(EXIT_FAILURE);
+                }
+                new_client->seqpacket = seqpacket;
+
+                watch_fd(daemon, &new_client->watch, EPOLLIN | EPOLLPRI);
+        }
+}
+
+int main(int argc, char **argv)
+{
+        int sockfd = -1, seqfd = -1, sigfd;
         int ret = 0;
+        int timeout;
+        int trim_timeout;
         TelemDaemon daemon;
-        nfds_t i;
+        struct epoll_event events[TM_EPOLL_EVENTS];
+        watch sig_watch;
+        watch listen_watch[2];
+        watch *w;
         client *cl = NULL;
-        client *current_client = NULL;
         int c;
         int opt_index = 0;
         sigset_t mask;
@@ -134,81 +244,65 @@ int main(int argc, char **argv)
                 exit(EXIT_FAILURE);
         }
 
-        sigfd = signalfd(-1, &mask, 0);
+        sigfd = signalfd(-1, &mask, SFD_CLOEXEC);
         if (sigfd == -1) {
                 telem_perror("Error creating the signalfd");
                 exit(EXIT_FAILURE);
         }
-        add_pollfd(&daemon, sigfd, POLLIN);
+        sig_watch.type = WATCH_SIGNAL;
+        sig_watch.fd = sigfd;
+        watch_fd(&daemon, &sig_watch, EPOLLIN);
 
 #ifdef HAVE_SYSTEMD_SD_DAEMON_H
         ret = sd_listen_fds(0);
         telem_log(LOG_INFO, "Number of file descriptors from systemd: %d\n",
                   ret);
 
-        if (ret >= 1) {
-                fd = SD_LISTEN_FDS_START + 0;
+        if (ret < 0) {
+                telem_log(LOG_ERR, "sd_listen_fds() failed: %s\n", strerror(-ret));
+                exit(EXIT_FAILURE);
+        }
+
+        for (int k = 0; k < ret; k++) {
+                int fd = SD_LISTEN_FDS_START + k;
 
                 /* Check if the socket is of correct type */
-                if (sd_is_socket_unix(fd, SOCK_STREAM, 1, socket_path_config(), 0)) {
+                if (sd_is_socket(fd, AF_UNIX, SOCK_SEQPACKET, 1) > 0) {
+                        telem_log(LOG_INFO, "Socket of type SOCK_SEQPACKET passed by systemd\n");
+                        seqfd = fd;
+                } else if (sd_is_socket_unix(fd, SOCK_STREAM, 1, socket_path_config(), 0)) {
                         telem_log(LOG_INFO, "Socket of type AF_UNIX passed by systemd\n");
-                        add_pollfd(&daemon, fd, POLLIN | POLLPRI);
+                        sockfd = fd;
                 } else if (sd_is_socket(fd, AF_UNSPEC, 0, -1)) {
                         telem_log(LOG_INFO, "Socket of type SOCKET passed by systemd\n");
-                        add_pollfd(&daemon, fd, POLLIN | POLLPRI);
+                        sockfd = fd;
                 } else {
                         telem_log(LOG_ERR, "File descriptor other than socket passed by systemd\n");
                         exit(EXIT_FAILURE);
                 }
-
-                sockfd = fd;
-        } else if (ret < 0) {
-                telem_log(LOG_ERR, "sd_listen_fds() failed: %s\n", strerror(-ret));
-                exit(EXIT_FAILURE);
-        } else
+        }
 #endif
-        {
-                sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-                if (sockfd < 0) {
-                        telem_perror("Socket creation failed");
-                        exit(EXIT_FAILURE);
-                }
-
-                memset(&addr, 0, sizeof(addr));
-                addr.sun_family = AF_UNIX;
-                strncpy(addr.sun_path, socket_path_config(), sizeof(addr.sun_path) - 1);
-                addr.sun_path[sizeof(addr.sun_path) - 1] = 0;
-
-                ret = unlink(addr.sun_path);
-                if (ret == -1 && errno != ENOENT) {
-                        telem_perror("Failed to unlink socket");
-                        exit(EXIT_FAILURE);
-                }
-
-                if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-                        telem_perror("Failed to bind socket to address");
-                        exit(EXIT_FAILURE);
-                }
-
-                if (chmod(addr.sun_path, 0666) == -1) {
-                        telem_perror("Failed to change socket permissions");
-                        exit(EXIT_FAILURE);
-                }
+        if (sockfd < 0) {
+                sockfd = create_listener(socket_path_config(), SOCK_STREAM);
+        }
 
-                if (listen(sockfd, SOMAXCONN) == -1) {
-                        telem_perror("Failed to mark socket as passive");
-                        exit(EXIT_FAILURE);
-                }
+        /* Records are sent one per message on this one, see handle_client */
+        if (seqfd < 0 && seqpacket_socket_path_config()[0] != '\0') {
+                seqfd = create_listener(seqpacket_socket_path_config(), SOCK_SEQPACKET);
+        }
 
-                /*Add listener fd to array of pollfds */
-                add_pollfd(&daemon, sockfd, POLLIN | POLLPRI);
+        watch_listener(&daemon, &listen_watch[0], sockfd);
+        if (seqfd >= 0) {
+                watch_listener(&daemon, &listen_watch[1], seqfd);
         }
 
         telem_log(LOG_INFO, "Listening on socket...\n");
 
         bool daemon_recycling_enabled = daemon_recycling_enabled_config();
         int spool_process_time = spool_process_time_config();
+        int idle_trim_time = idle_trim_time_config();
         time_t last_record_received = time(NULL);
+        bool trimmed = false;
 
         ret = update_machine_id();
         if (ret == -1) {
@@ -216,22 +310,47 @@ int main(int argc, char **argv)
         }
 
         /* Read the static machine id file if it exists.*/
+        watch_machine_id(&daemon);
         daemon.machine_id_override = read_machine_id_override();
+        refresh_machine_id(&daemon);
+
+        open_staging_log(&daemon);
+        open_handoff(&daemon);
+        open_admission(&daemon);
+        start_workers(&daemon, staging_workers_config());
 
         time_t last_refresh_time = time(NULL);
 
         /* Loop to accept clients */
         while (1) {
-                malloc_trim(0);
-                ret = poll(daemon.pollfds, daemon.nfds, spool_process_time * 1000);
+                /* Wake up in time to drop clients stuck in a record */
+                timeout = expire_clients(&daemon, time(NULL));
+                if (timeout < 0 || timeout > spool_process_time) {
+                        timeout = spool_process_time;
+                }
+
+                /* and to release memory once idle */
+                trim_timeout = buffer_pool_idle_trim(&daemon.client_bufs,
+                                                     last_record_received,
+                                                     idle_trim_time, &trimmed);
+                if (trim_timeout >= 0 && trim_timeout < timeout) {
+                        timeout = trim_timeout;
+                }
+
+                ret = epoll_wait(daemon.epfd, events, TM_EPOLL_EVENTS,
+                                 timeout * 1000);
                 if (ret == -1) {
-                        telem_perror("Failed to poll daemon file descriptors");
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        telem_perror("Failed to wait for daemon file descriptors");
                         break;
                 } else if (ret != 0) {
-                        for (i = 0; i < daemon.nfds; i++) {
+                        for (int k = 0; k < ret; k++) {
+                                w = events[k].data.ptr;
 
-                                /* Check if a signal was received */
-                                if (daemon.pollfds[0].revents != 0) {
+                                switch (w->type) {
+                                case WATCH_SIGNAL: {
                                         struct signalfd_siginfo fdsi;
                                         ssize_t s;
 
@@ -250,63 +369,49 @@ int main(int argc, char **argv)
 
                                         if (fdsi.ssi_signo == SIGHUP) {
                                                 telem_log(LOG_INFO, "Received a SIGHUP signal\n");
-                                                /* reload configuration file */
+                                                /* reload configuration file, which
+                                                 * the workers use while staging */
+                                                stop_workers(&daemon);
+                                                close_staging_log(&daemon);
+                                                close_handoff(&daemon);
+                                                close_admission(&daemon);
                                                 reload_config();
+                                                open_staging_log(&daemon);
+                                                open_handoff(&daemon);
+                                                open_admission(&daemon);
+                                                start_workers(&daemon, staging_workers_config());
                                         }
+                                        break;
                                 }
-
-                                if (daemon.pollfds[i].revents == 0) {
-                                        continue;
-                                }
-
-                                /* Accept connection if data arrives on listening socket */
-                                if (daemon.pollfds[i].fd == sockfd) {
-                                        if ((fd = accept(daemon.pollfds[i].fd, NULL, NULL)) == -1) {
-                                                telem_perror("Failed to accept socket");
-                                                //exit(EXIT_FAILURE);
-                                                break;
-                                        }
-                                        telem_log(LOG_INFO, "New client %d connected\n", fd);
-
-                                        /* set socket to non-blocking */
-                                        if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
-                                                telem_perror("Failed to set socket as nonblocking");
-                                                close(fd);
-                                                break;
+                                case WATCH_LISTENER:
+                                        accept_clients(&daemon, w->fd, w->fd == seqfd);
+                                        break;
+                                case WATCH_RING:
+                                        /* A client wrote to the idle ring */
+                                        if (handle_ring(&daemon)) {
+                                                last_record_received = time(NULL);
+                                                trimmed = false;
                                         }
-
-                                        struct timeval timeout;
-                                        timeout.tv_sec = 10;
-                                        timeout.tv_usec = 0;
-
-                                        if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
-                                                       sizeof(timeout)) < 0) {
-                                                telem_perror("Failed to set socket timeout");
-                                        }
-
-                                        /* Add the fd to the client list */
-                                        if (!add_client(&(daemon.client_head), fd)) {
-                                                telem_log(LOG_ERR, "Unable to add the client to list\n");
-                                                exit(EXIT_FAILURE);
-                                        }
-
-                                        /* Add fd to the poll array */
-                                        add_pollfd(&daemon, fd, POLLIN | POLLPRI);
-                                } else if (i != 0) {
-                                        /* Lookup client and handle data on client */
-                                        LIST_FOREACH(cl, &(daemon.client_head), client_ptrs) {
-                                                if (cl->fd == daemon.pollfds[i].fd) {
-                                                        current_client = cl;
-                                                        telem_log(LOG_INFO, "Client found: %d\n",
-                                                                  current_client->fd);
-                                                }
-                                        }
-                                        assert(current_client);
-                                        handle_client(&daemon, i, current_client);
+                                        break;
+                                case WATCH_MACHINE_ID:
+                                        handle_machine_id_change(&daemon);
+                                        break;
+                                case WATCH_CLIENT:
+                                        /* The client itself comes with the event, and
+                                         * only its own event can terminate it */
+                                        handle_client(&daemon, client_of(w));
                                         last_record_received = time(NULL);
+                                        trimmed = false;
+                                        break;
                                 }
                         }
                 } else {
+                        /* Skip ring slots whose producer went away */
+                        if (handle_ring(&daemon)) {
+                                last_record_received = time(NULL);
+                                trimmed = false;
+                        }
+
                         time_t now = time(NULL);
                         /* time to recycle the daemon has elapsed*/
                         if (daemon_recycling_enabled &&
@@ -321,6 +426,8 @@ int main(int argc, char **argv)
                         int ret = update_machine_id();
                         if (ret == -1) {
                                 telem_log(LOG_ERR, "Unable to update machine id\n");
+                        } else if (ret == 1) {
+                                refresh_machine_id(&daemon);
                         }
                         last_refresh_time = time(NULL);
                 }
@@ -328,12 +435,22 @@ int main(int argc, char **argv)
 
 clean_exit:
 
+        /* Clients fall back to the socket, and reach the next instance */
+        close_ring(&daemon);
+        stop_workers(&daemon);
+        close_staging_log(&daemon);
+        close_handoff(&daemon);
+        close_admission(&daemon);
+
         /* Free memory before exiting */
         while ((cl = LIST_FIRST(&(daemon.client_head))) != NULL) {
                 remove_client(&(daemon.client_head), cl);
         }
-        free(daemon.pollfds);
+        buffer_pool_trim(&daemon.client_bufs);
+        close_machine_id_watch(&daemon);
+        close(daemon.epfd);
         free(daemon.machine_id_override);
+        free(daemon.msg_buf);
         if (LIST_EMPTY(&(daemon.client_head))) {
                 telem_log(LOG_INFO, "Client list cleared\n");
         }
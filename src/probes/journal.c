@@ -47,6 +47,12 @@ static uint32_t severity = 2;
 static uint32_t payload_version = 1;
 static char error_class[30] = "org.clearlinux/journal/error";
 static sd_journal *journal = NULL;
+static struct telem_session *session = NULL;
+
+/* Records are sent to the daemon in batches of up to this many */
+#define JOURNAL_BATCH_SIZE 32
+static struct telem_ref *batch[JOURNAL_BATCH_SIZE];
+static size_t batch_len = 0;
 
 static inline void tm_journal_err(const char *msg, int ret)
 {
@@ -69,7 +75,35 @@ static void add_to_payload(const void *data, size_t length)
         }
 }
 
-static bool send_data(char *class)
+static bool flush_records(void)
+{
+        int ret;
+        bool sent = true;
+
+        if (batch_len == 0) {
+                return true;
+        }
+
+        /* Keep the daemon connection open across batches */
+        if (session == NULL && (ret = tm_session_open(&session)) < 0) {
+                telem_log(LOG_ERR, "Failed to open session: %s\n", strerror(-ret));
+                sent = false;
+        } else if ((ret = tm_session_send_records(session, batch, batch_len)) < 0) {
+                telem_log(LOG_ERR, "Failed to send records: %s\n", strerror(-ret));
+                tm_session_close(session);
+                session = NULL;
+                sent = false;
+        }
+
+        for (size_t i = 0; i < batch_len; i++) {
+                tm_free_record(batch[i]);
+        }
+        batch_len = 0;
+
+        return sent;
+}
+
+static bool queue_data(char *class)
 {
         struct telem_ref *handle = NULL;
         int ret;
@@ -94,13 +128,11 @@ static bool send_data(char *class)
 
         free(payload_str);
 
-        if ((ret = tm_send_record(handle)) < 0) {
-                telem_log(LOG_ERR, "Failed to send record: %s\n", strerror(-ret));
-                tm_free_record(handle);
-                goto fail;
+        batch[batch_len++] = handle;
+        if (batch_len == JOURNAL_BATCH_SIZE) {
+                return flush_records();
         }
 
-        tm_free_record(handle);
         return true;
 fail:
         return false;
@@ -117,24 +149,31 @@ static int read_new_entries(sd_journal *journal)
                 ret = sd_journal_get_data(journal, "MESSAGE", &data, &length);
                 if (ret < 0) {
                         tm_journal_err("Failed to read journal entry", ret);
+                        flush_records();
                         return -1;
                 }
 
                 add_to_payload(data, length);
 
-                // For now, we send one record per log message, in case the
+                // For now, we create one record per log message, in case the
                 // there is a large backlog of messages and we exceed the
-                // payload size limit (8KB). And ignore errors, hoping that it's
-                // a transient problem.
+                // payload size limit (8KB). Records are sent to the daemon in
+                // batches. And ignore errors, hoping that it's a transient
+                // problem.
 
-                if (!send_data(error_class)) {
+                if (!queue_data(error_class)) {
                         telem_log(LOG_ERR, "Failed to send data. Ignoring.\n");
+                        flush_records();
                         return num_entries;
                 }
 
                 num_entries++;
         }
 
+        if (!flush_records()) {
+                telem_log(LOG_ERR, "Failed to send data. Ignoring.\n");
+        }
+
         /* Since the newest entry in the journal might not match our filters,
          * the 0 return code either indicates that we've processed the last
          * journal entry, or it was skipped, and we're now positioned at the
@@ -383,6 +422,8 @@ fail:
                 nc_string_free(payload);
         }
 
+        tm_session_close(session);
+
         return ret;
 }
 
@@ -21,7 +21,6 @@
 #include <sys/klog.h>
 #include <errno.h>
 #include <unistd.h>
-#include <malloc.h>
 #include <signal.h>
 
 #include "log.h"
@@ -66,7 +65,6 @@ int main(void)
         while (1) {
                 int bytes_read;
  
-                malloc_trim(0);
                 memset(bufp, 0, buflen);
                 bytes_read = klogctl(SYSLOG_ACTION_READ, bufp, (int)buflen);
                 if (bytes_read < 0) {
@@ -34,6 +34,9 @@ static bool oops_processed = false;
 
 static uint32_t version = 1;
 
+/* The probe is long-running, keep one connection to the daemon */
+static struct telem_session *session = NULL;
+
 static bool send_data(char *backtrace, char *class, uint32_t severity)
 {
         struct telem_ref *handle = NULL;
@@ -56,8 +59,16 @@ static bool send_data(char *backtrace, char *class, uint32_t severity)
                 return false;
         }
 
-        if ((ret = tm_send_record(handle)) < 0) {
+        if (session == NULL && (ret = tm_session_open(&session)) < 0) {
+                telem_log(LOG_ERR, "Failed to open session: %s", strerror(-ret));
+                tm_free_record(handle);
+                return false;
+        }
+
+        if ((ret = tm_session_send(session, handle)) < 0) {
                 telem_log(LOG_ERR, "Failed to send record: %s", strerror(-ret));
+                tm_session_close(session);
+                session = NULL;
                 tm_free_record(handle);
                 return false;
         }
@@ -23,7 +23,9 @@ endif
 %C%_telem_record_gen_SOURCES = %D%/telem_record_gen.c
 %C%_telem_record_gen_CFLAGS = \
 	$(AM_CFLAGS)
-%C%_telem_record_gen_LDADD = $(top_builddir)/src/libtelemetry.la
+%C%_telem_record_gen_LDADD = \
+	$(top_builddir)/src/libtelemetry.la \
+	$(top_builddir)/src/libtelem-shared.la
 %C%_telem_record_gen_LDFLAGS = \
 	$(AM_LDFLAGS) \
 	-pie
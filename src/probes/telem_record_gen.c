@@ -31,6 +31,7 @@
 #include "log.h"
 #include "common.h"
 #include "telemetry.h"
+#include "wire.h"
 
 static uint32_t severity = 1;
 static char *opt_class = NULL;
@@ -383,16 +384,24 @@ out:
 static int print_record(char *payload)
 {
         struct telem_ref *t_ref = NULL;
+        struct wire_headers headers;
         int ret;
 
         if ((ret = instanciate_record(&t_ref, payload)) == 0) {
-                int i;
-                for (i = 0; i < NUM_HEADERS; i++) {
-                        fprintf(stdout, "%s", t_ref->record->headers[i]);
+                /* Headers are kept in the binary wire format */
+                ret = wire_parse_binary(t_ref->record->arena,
+                                        t_ref->record->header_size, &headers);
+                if (ret < 0) {
+                        goto out;
+                }
+                for (int i = 0; i < NUM_HEADERS; i++) {
+                        fprintf(stdout, "%s: %.*s\n", get_header_name(i),
+                                (int)headers.len[i], headers.value[i]);
                 }
                 fprintf(stdout, "%s\n", t_ref->record->payload);
         }
 
+out:
         tm_free_record(t_ref);
         return ret;
 }
@@ -0,0 +1,163 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "config.h"
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
+
+#include "common.h"
+#include "random_id.h"
+
+/* Random bytes drawn from the kernel at once, enough for 32 ids */
+#define POOL_SIZE 512
+
+#define ID_BYTES (RANDOM_ID_LEN / 2)
+
+struct id_pool {
+        uint8_t bytes[POOL_SIZE];
+        /* bytes not handed out yet, at the end of the pool */
+        size_t avail;
+        /* fork_generation the bytes were drawn in */
+        unsigned int generation;
+};
+
+static __thread struct id_pool pool;
+
+static unsigned int fork_generation = 0;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void forget_pools(void)
+{
+        /* Only the forking thread lives on in the child, and its pool is
+         * a copy of the parent's */
+        fork_generation++;
+}
+
+static void register_atfork(void)
+{
+        pthread_atfork(NULL, NULL, forget_pools);
+}
+
+static int read_urandom(uint8_t *buf, size_t len)
+{
+        ssize_t ret;
+        size_t done = 0;
+        int fd;
+
+        fd = open("/dev/urandom", O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+                return -errno;
+        }
+
+        while (done < len) {
+                ret = read(fd, buf + done, len - done);
+                if (ret < 0 && errno == EINTR) {
+                        continue;
+                } else if (ret <= 0) {
+                        ret = ret < 0 ? -errno : -EIO;
+                        close(fd);
+                        return (int)ret;
+                }
+                done += (size_t)ret;
+        }
+
+        close(fd);
+
+        return 0;
+}
+
+static int fill_pool(void)
+{
+#ifdef HAVE_GETRANDOM
+        ssize_t ret;
+        size_t done = 0;
+
+        /*
+         * Do not block early in boot until the entropy pool is ready: ids
+         * only need to be unique, and /dev/urandom never blocked either.
+         */
+        while (done < POOL_SIZE) {
+                ret = getrandom(pool.bytes + done, POOL_SIZE - done, GRND_NONBLOCK);
+                if (ret < 0 && errno == EINTR) {
+                        continue;
+                } else if (ret < 0) {
+                        break;
+                }
+                done += (size_t)ret;
+        }
+
+        if (done < POOL_SIZE) {
+                int res = read_urandom(pool.bytes + done, POOL_SIZE - done);
+                if (res < 0) {
+                        return res;
+                }
+        }
+#else
+        int res = read_urandom(pool.bytes, POOL_SIZE);
+        if (res < 0) {
+                return res;
+        }
+#endif
+        pool.avail = POOL_SIZE;
+
+        return 0;
+}
+
+int random_id(char *id)
+{
+        static const char hex[] = EVENT_ID_ALPHAB;
+        unsigned int generation;
+        uint8_t *bytes;
+        size_t i;
+        int ret;
+
+        pthread_once(&atfork_once, register_atfork);
+
+        generation = __atomic_load_n(&fork_generation, __ATOMIC_RELAXED);
+        if (pool.generation != generation) {
+                pool.avail = 0;
+                pool.generation = generation;
+        }
+
+        if (pool.avail < ID_BYTES && (ret = fill_pool()) < 0) {
+                return ret;
+        }
+
+        bytes = pool.bytes + POOL_SIZE - pool.avail;
+        for (i = 0; i < ID_BYTES; i++) {
+                id[2 * i] = hex[bytes[i] >> 4];
+                id[2 * i + 1] = hex[bytes[i] & 0xf];
+        }
+        id[RANDOM_ID_LEN] = '\0';
+
+        /* Bytes are never handed out twice */
+        memset(bytes, 0, ID_BYTES);
+        pool.avail -= ID_BYTES;
+
+        return 0;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,35 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#pragma once
+
+/* Number of hex characters in an id (128 random bits) */
+#define RANDOM_ID_LEN 32
+
+/**
+ * Generate a random id: event ids of records, journal record ids and
+ * machine ids. Random bytes are drawn from the kernel in blocks, kept in a
+ * pool per thread, and the pool is discarded in the child after a fork so
+ * that parent and child never hand out the same id.
+ *
+ * @param id Buffer of at least RANDOM_ID_LEN + 1 bytes, set to
+ *    RANDOM_ID_LEN lowercase hex characters and a null byte.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int random_id(char *id);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
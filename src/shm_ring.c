@@ -0,0 +1,348 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "shm_ring.h"
+
+/* Largest slot a client accepts from the daemon */
+#define SHM_RING_MAX_SLOT_SIZE (1024 * 1024)
+
+#define CACHE_LINE 64
+
+static size_t slot_stride(uint32_t slot_size)
+{
+        size_t size = sizeof(struct shm_ring_slot) + slot_size;
+
+        /* Neighbouring producers do not share cache lines */
+        return (size + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+}
+
+static struct shm_ring_slot *slot_at(struct shm_ring *ring, uint64_t pos)
+{
+        return (struct shm_ring_slot *)(ring->slots + (pos & ring->mask) * ring->stride);
+}
+
+static int map_ring(struct shm_ring *ring, uint32_t slot_count, uint32_t slot_size)
+{
+        void *addr;
+
+        ring->stride = slot_stride(slot_size);
+        ring->map_size = sizeof(struct shm_ring_header) + slot_count * ring->stride;
+        ring->mask = slot_count - 1;
+        ring->slot_size = slot_size;
+
+        addr = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    ring->memfd, 0);
+        if (addr == MAP_FAILED) {
+                return -errno;
+        }
+
+        ring->hdr = addr;
+        ring->slots = (uint8_t *)addr + sizeof(struct shm_ring_header);
+
+        return 0;
+}
+
+int shm_ring_create(struct shm_ring **ring, uint32_t slot_count, uint32_t slot_size)
+{
+        struct shm_ring *r;
+        uint32_t count = SHM_RING_MIN_SLOTS;
+        uint32_t i;
+        int ret;
+
+        while (count < slot_count && count < SHM_RING_MAX_SLOTS) {
+                count <<= 1;
+        }
+
+        r = calloc(1, sizeof(struct shm_ring));
+        if (!r) {
+                return -ENOMEM;
+        }
+        r->efd = -1;
+
+        r->memfd = memfd_create("telemetry-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (r->memfd < 0) {
+                ret = -errno;
+                goto fail;
+        }
+
+        if (ftruncate(r->memfd, (off_t)(sizeof(struct shm_ring_header) +
+                                         count * slot_stride(slot_size))) < 0) {
+                ret = -errno;
+                goto fail;
+        }
+
+        /* Clients map the ring writable; they must not be able to shrink it
+         * and have the daemon fault on a read */
+        if (fcntl(r->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+                ret = -errno;
+                goto fail;
+        }
+
+        r->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (r->efd < 0) {
+                ret = -errno;
+                goto fail;
+        }
+
+        if ((ret = map_ring(r, count, slot_size)) < 0) {
+                goto fail;
+        }
+
+        r->hdr->magic = SHM_RING_MAGIC;
+        r->hdr->version = SHM_RING_VERSION;
+        r->hdr->slot_count = count;
+        r->hdr->slot_size = slot_size;
+        /* Nothing to read yet, so the first record wakes the reader */
+        r->hdr->sleeping = 1;
+
+        for (i = 0; i < count; i++) {
+                slot_at(r, i)->seq = i;
+        }
+
+        *ring = r;
+
+        return 0;
+
+fail:
+        shm_ring_free(r);
+        return ret;
+}
+
+int shm_ring_attach(struct shm_ring **ring, int memfd, int efd)
+{
+        struct shm_ring_header hdr;
+        struct shm_ring *r;
+        struct stat st;
+        int ret;
+
+        r = calloc(1, sizeof(struct shm_ring));
+        if (!r) {
+                close(memfd);
+                close(efd);
+                return -ENOMEM;
+        }
+        r->memfd = memfd;
+        r->efd = efd;
+
+        if (fstat(memfd, &st) < 0) {
+                ret = -errno;
+                goto fail;
+        }
+
+        if (pread(memfd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+                ret = -EPROTO;
+                goto fail;
+        }
+
+        if (hdr.magic != SHM_RING_MAGIC || hdr.version != SHM_RING_VERSION ||
+            hdr.slot_count < SHM_RING_MIN_SLOTS || hdr.slot_count > SHM_RING_MAX_SLOTS ||
+            (hdr.slot_count & (hdr.slot_count - 1)) != 0 ||
+            hdr.slot_size == 0 || hdr.slot_size > SHM_RING_MAX_SLOT_SIZE ||
+            (size_t)st.st_size != sizeof(hdr) + hdr.slot_count * slot_stride(hdr.slot_size)) {
+                ret = -EPROTO;
+                goto fail;
+        }
+
+        if ((ret = map_ring(r, hdr.slot_count, hdr.slot_size)) < 0) {
+                goto fail;
+        }
+
+        *ring = r;
+
+        return 0;
+
+fail:
+        shm_ring_free(r);
+        return ret;
+}
+
+void shm_ring_free(struct shm_ring *ring)
+{
+        if (ring == NULL) {
+                return;
+        }
+
+        if (ring->hdr != NULL) {
+                munmap(ring->hdr, ring->map_size);
+        }
+        if (ring->memfd >= 0) {
+                close(ring->memfd);
+        }
+        if (ring->efd >= 0) {
+                close(ring->efd);
+        }
+        free(ring);
+}
+
+int shm_ring_push(struct shm_ring *ring, const struct iovec *iov, size_t iovcnt,
+                  size_t len)
+{
+        uint64_t pos;
+        int ret;
+
+        ret = shm_ring_claim(ring, len, &pos);
+        if (ret < 0) {
+                return ret;
+        }
+
+        return shm_ring_commit(ring, pos, iov, iovcnt, len);
+}
+
+int shm_ring_claim(struct shm_ring *ring, size_t len, uint64_t *pos)
+{
+        struct shm_ring_slot *slot;
+        uint64_t seq;
+
+        if (len > ring->slot_size) {
+                return -EMSGSIZE;
+        }
+
+        if (__atomic_load_n(&ring->hdr->closed, __ATOMIC_ACQUIRE)) {
+                return -EPIPE;
+        }
+
+        *pos = __atomic_load_n(&ring->hdr->tail, __ATOMIC_RELAXED);
+        while (1) {
+                slot = slot_at(ring, *pos);
+                seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+                if (seq == *pos) {
+                        if (__atomic_compare_exchange_n(&ring->hdr->tail, pos, *pos + 1,
+                                                        true, __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+                                return 0;
+                        }
+                } else if (seq == SHM_RING_SKIPPED) {
+                        /* Only a ring the reader gave up on has one */
+                        return -EPIPE;
+                } else if ((int64_t)(seq - *pos) < 0) {
+                        /* The reader did not release this slot yet */
+                        return -EAGAIN;
+                } else {
+                        *pos = __atomic_load_n(&ring->hdr->tail, __ATOMIC_RELAXED);
+                }
+        }
+}
+
+int shm_ring_commit(struct shm_ring *ring, uint64_t pos, const struct iovec *iov,
+                    size_t iovcnt, size_t len)
+{
+        struct shm_ring_slot *slot = slot_at(ring, pos);
+        uint64_t seq = pos;
+        uint64_t one = 1;
+        uint8_t *p;
+        size_t i;
+
+        p = slot->data;
+        for (i = 0; i < iovcnt; i++) {
+                memcpy(p, iov[i].iov_base, iov[i].iov_len);
+                p += iov[i].iov_len;
+        }
+        slot->len = (uint32_t)len;
+
+        /* Pairs with shm_ring_sleep(): either the reader sees this slot
+         * before it sleeps, or we see that it sleeps and wake it. Fails if
+         * the reader skipped the slot while it was written. */
+        if (!__atomic_compare_exchange_n(&slot->seq, &seq, pos + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                return -EPIPE;
+        }
+        if (__atomic_exchange_n(&ring->hdr->sleeping, 0, __ATOMIC_SEQ_CST) != 0) {
+                if (write(ring->efd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                        return -errno;
+                }
+        }
+
+        return 0;
+}
+
+const uint8_t *shm_ring_peek(struct shm_ring *ring, size_t *len)
+{
+        struct shm_ring_slot *slot = slot_at(ring, ring->head);
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->head + 1) {
+                return NULL;
+        }
+
+        /* Producers are not trusted to stay within the slot */
+        *len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+        if (*len > ring->slot_size) {
+                *len = 0;
+        }
+
+        return slot->data;
+}
+
+void shm_ring_release(struct shm_ring *ring)
+{
+        struct shm_ring_slot *slot = slot_at(ring, ring->head);
+
+        __atomic_store_n(&slot->seq, ring->head + ring->mask + 1, __ATOMIC_RELEASE);
+        ring->head++;
+}
+
+bool shm_ring_skip(struct shm_ring *ring)
+{
+        struct shm_ring_slot *slot = slot_at(ring, ring->head);
+        uint64_t seq = ring->head;
+
+        if (!__atomic_compare_exchange_n(&slot->seq, &seq, SHM_RING_SKIPPED, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return false;
+        }
+        ring->head++;
+
+        return true;
+}
+
+bool shm_ring_stalled(struct shm_ring *ring)
+{
+        struct shm_ring_slot *slot = slot_at(ring, ring->head);
+
+        return __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE) != ring->head &&
+               __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->head + 1;
+}
+
+bool shm_ring_sleep(struct shm_ring *ring)
+{
+        struct shm_ring_slot *slot = slot_at(ring, ring->head);
+
+        __atomic_store_n(&ring->hdr->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == ring->head + 1) {
+                __atomic_store_n(&ring->hdr->sleeping, 0, __ATOMIC_RELAXED);
+                return false;
+        }
+
+        return true;
+}
+
+void shm_ring_close(struct shm_ring *ring)
+{
+        __atomic_store_n(&ring->hdr->closed, 1, __ATOMIC_RELEASE);
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,228 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Shared memory ring between the library and telemprobd.
+ *
+ * The ring lives in a memfd created by telemprobd, and is handed to clients
+ * together with an eventfd over the daemon socket. Any number of processes
+ * write records into its slots (multi-producer) and telemprobd is the only
+ * reader. Slots carry sequence numbers, as in the queue of async.c, so no
+ * lock is shared between processes. telemprobd sleeps on the eventfd and a
+ * producer only signals it when the daemon announced it is about to sleep,
+ * i.e. when the ring went from empty to non-empty.
+ *
+ * A slot holds one record framed exactly as on the sockets, size prefix
+ * included, so the daemon parses both the same way.
+ *
+ * A producer that claimed a slot and never wrote it holds up the reader.
+ * After a while the reader marks the slot skipped, and stops using the
+ * ring: the producer may still be alive and write the slot, which must not
+ * have been handed to another producer by then. A producer finding its
+ * slot skipped sends the record some other way.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Sent by a client in place of a record size to ask for the ring. It can
+ * not be mistaken for a record, since it is larger than any record.
+ */
+#define SHM_RING_REQUEST 0x474e4952     /* "RING" */
+
+#define SHM_RING_MAGIC 0x47524d54       /* "TMRG" */
+#define SHM_RING_VERSION 1
+
+#define SHM_RING_MIN_SLOTS 16
+#define SHM_RING_MAX_SLOTS 4096
+
+/* Sequence number of a slot the reader gave up waiting for */
+#define SHM_RING_SKIPPED UINT64_MAX
+
+struct shm_ring_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slot_count;
+        uint32_t slot_size;
+        /* set by telemprobd when it stops reading the ring */
+        uint32_t closed;
+        char pad0[44];
+        /* next position claimed by a producer */
+        uint64_t tail;
+        char pad1[56];
+        /* set by telemprobd before it waits on the eventfd */
+        uint32_t sleeping;
+        char pad2[60];
+};
+
+struct shm_ring_slot {
+        uint64_t seq;
+        uint32_t len;
+        uint32_t reserved;
+        uint8_t data[];
+};
+
+struct shm_ring {
+        struct shm_ring_header *hdr;
+        uint8_t *slots;
+        size_t map_size;
+        size_t stride;
+        uint64_t mask;
+        uint32_t slot_size;
+        /* next position to read, only used by telemprobd */
+        uint64_t head;
+        int memfd;
+        int efd;
+};
+
+/**
+ * Create a ring in a new memfd, along with the eventfd used to wake the
+ * reader. The memfd is sealed against resizing, so that a client can not
+ * shrink it under the daemon.
+ *
+ * @param ring Set to the new ring.
+ * @param slot_count Number of slots, rounded up to a power of two and
+ *    clamped to [SHM_RING_MIN_SLOTS, SHM_RING_MAX_SLOTS].
+ * @param slot_size Largest record a slot can hold, size prefix included.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int shm_ring_create(struct shm_ring **ring, uint32_t slot_count, uint32_t slot_size);
+
+/**
+ * Map a ring received from telemprobd. The ring takes ownership of both
+ * file descriptors, also on failure.
+ *
+ * @param ring Set to the mapped ring.
+ * @param memfd The memfd holding the ring.
+ * @param efd The eventfd used to wake telemprobd.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int shm_ring_attach(struct shm_ring **ring, int memfd, int efd);
+
+/**
+ * Unmap a ring and close its file descriptors.
+ *
+ * @param ring The ring, may be NULL.
+ */
+void shm_ring_free(struct shm_ring *ring);
+
+/**
+ * Copy one framed record into a free slot, and wake telemprobd if it is
+ * waiting for records. Same as shm_ring_claim() then shm_ring_commit().
+ *
+ * @param ring The ring.
+ * @param iov The buffers of the framed record.
+ * @param iovcnt Number of entries in iov.
+ * @param len Total length of the buffers.
+ *
+ * @return 0 if successful, -EAGAIN if the ring is full, -EMSGSIZE if the
+ *    record does not fit in a slot, or -EPIPE if telemprobd closed the ring
+ *    or skipped the slot, in which case the record is not in the ring.
+ */
+int shm_ring_push(struct shm_ring *ring, const struct iovec *iov, size_t iovcnt,
+                  size_t len);
+
+/**
+ * Claim a free slot for a record.
+ *
+ * @param ring The ring.
+ * @param len Length of the record.
+ * @param pos Set to the position of the slot.
+ *
+ * @return 0 if successful, or an error as shm_ring_push().
+ */
+int shm_ring_claim(struct shm_ring *ring, size_t len, uint64_t *pos);
+
+/**
+ * Copy one framed record into a slot claimed with shm_ring_claim(), and
+ * make it readable.
+ *
+ * @param ring The ring.
+ * @param pos The position of the slot.
+ * @param iov The buffers of the framed record.
+ * @param iovcnt Number of entries in iov.
+ * @param len Total length of the buffers.
+ *
+ * @return 0 if successful, or -EPIPE if telemprobd skipped the slot in the
+ *    meantime.
+ */
+int shm_ring_commit(struct shm_ring *ring, uint64_t pos, const struct iovec *iov,
+                    size_t iovcnt, size_t len);
+
+/**
+ * Get the next record written to the ring, if its producer is done with it.
+ * The slot stays owned by the reader until shm_ring_release() is called.
+ *
+ * @param ring The ring.
+ * @param len Set to the length of the record.
+ *
+ * @return The record, or NULL if there is none yet.
+ */
+const uint8_t *shm_ring_peek(struct shm_ring *ring, size_t *len);
+
+/**
+ * Give the slot returned by shm_ring_peek() back to the producers.
+ *
+ * @param ring The ring.
+ */
+void shm_ring_release(struct shm_ring *ring);
+
+/**
+ * Skip the next slot, claimed by a producer that did not write it. The
+ * slot is not given back to the producers, so the ring is to be closed
+ * once the slots after it are read.
+ *
+ * @param ring The ring.
+ *
+ * @return true if the slot was skipped, false if it was written after all
+ *    and is to be read.
+ */
+bool shm_ring_skip(struct shm_ring *ring);
+
+/**
+ * Check whether a producer claimed a slot that is not readable yet.
+ *
+ * @param ring The ring.
+ *
+ * @return true if the next slot is claimed but not written yet.
+ */
+bool shm_ring_stalled(struct shm_ring *ring);
+
+/**
+ * Announce that the reader is about to wait on the eventfd. A record that
+ * was written concurrently is caught here rather than missed.
+ *
+ * @param ring The ring.
+ *
+ * @return true if the reader may wait, false if a record is readable and
+ *    the ring should be read again.
+ */
+bool shm_ring_sleep(struct shm_ring *ring);
+
+/**
+ * Mark the ring closed, so that producers stop writing to it.
+ *
+ * @param ring The ring.
+ */
+void shm_ring_close(struct shm_ring *ring);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -33,10 +33,19 @@
 #include "configuration.h"
 #include "util.h"
 #include "common.h"
+#include "iorecord.h"
+
+/* A spooled record posted in a batch */
+struct spooled_record {
+        struct spool_run *run;
+        char *path;
+        blkcnt_t blocks;
+};
 
 int directory_filter(const struct dirent *entry)
 {
-        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
+        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0) ||
+            staging_log_file(entry->d_name)) {
                 return 0;
         } else {
                 return 1;
@@ -82,13 +91,16 @@ long get_spool_dir_size()
         return dir_size;
 }
 
-void spool_records_loop(long *current_spool_size)
+void spool_records_loop(TelemPostDaemon *daemon)
 {
         const char *spool_dir_path;
         int numentries;
         struct dirent **namelist;
-        int records_processed = 0;
-        int records_sent = 0;
+        struct post_batch *batch = daemon->batch;
+        struct spool_run run = { &daemon->current_spool_size, batch, 0, 0, false };
+
+        /* A record in flight is not posted twice */
+        complete_record_delivery(daemon);
 
         spool_dir_path = spool_dir_config();
         numentries = scandir(spool_dir_path, &namelist, directory_filter, NULL);
@@ -107,20 +119,22 @@ void spool_records_loop(long *current_spool_size)
         for (int i = 0; i < numentries; i++) {
                 telem_log(LOG_DEBUG, "Processing spool record: %s\n",
                           namelist[i]->d_name);
-                process_spooled_record(spool_dir_path, namelist[i]->d_name,
-                                       &records_processed, &records_sent, current_spool_size);
+                process_spooled_record(spool_dir_path, namelist[i]->d_name, &run);
 
                 /* If the first send attempt fails, we assume that future send
-                 * attempts may also fail, so abort early.
+                 * attempts may also fail, so abort early. Batched records
+                 * are only sent with their batch.
                  */
-                if (records_sent == 0) {
+                if (batch == NULL ? run.records_sent == 0 : run.post_failed) {
                         break;
                 }
 
-                if (records_processed == TM_SPOOL_MAX_PROCESS_RECORDS) {
+                if (run.records_processed == TM_SPOOL_MAX_PROCESS_RECORDS) {
                         break;
                 }
         }
+        /* The run is over once its records are done with */
+        complete_record_delivery(daemon);
 
         for (int i = 0; i < numentries; i++) {
                 free(namelist[i]);
@@ -128,9 +142,87 @@ void spool_records_loop(long *current_spool_size)
         free(namelist);
 }
 
-void process_spooled_record(const char *spool_dir, char *name,
-                            int *records_processed, int *records_sent,
-                            long *current_spool_size)
+static void spooled_record_sent(struct spool_run *run, blkcnt_t blocks)
+{
+        run->records_sent++;
+
+        /* if spooled record is sent, deduct from tm_spool_dir_size */
+        if (*run->current_spool_size > 0) {
+                *run->current_spool_size -= (blocks * 512);
+        }
+        /*
+         * If getting the directory size failed earlier due to
+         * EMFILE/ENFILE, try to calculate again.
+         * EMFILE - too many file descriptors in use by process
+         * ENFILE - too many files are open in the system
+         */
+        if (*run->current_spool_size < 0) {
+                *run->current_spool_size = get_spool_dir_size();
+        }
+}
+
+static void finish_spooled_record(void *data, bool sent, size_t size)
+{
+        struct spooled_record *spooled = data;
+
+        if (!sent) {
+                telem_log(LOG_DEBUG, "Spool record %s not accepted\n", spooled->path);
+                spooled->run->post_failed = true;
+        } else {
+                unlink(spooled->path);
+                telem_log(LOG_DEBUG, "Spool record %s transmitted\n", spooled->path);
+                spooled_record_sent(spooled->run, spooled->blocks);
+        }
+        free(spooled->path);
+        free(spooled);
+}
+
+/* Adds a spooled record to the batch, returns false if it is to be posted
+ * on its own */
+static bool batch_spooled_record(struct spool_run *run, char *record_path, blkcnt_t blocks)
+{
+        struct staged_record record;
+        struct spooled_record *spooled = NULL;
+        char *json_body = NULL;
+        char *buf = NULL;
+        bool ret = false;
+
+        buf = malloc(STAGED_RECORD_SIZE + 1);
+        if (!buf) {
+                telem_log(LOG_ERR, "Could not allocate memory for record\n");
+                return false;
+        }
+
+        /* A record with a configuration of its own is posted alone */
+        if (!read_record(record_path, buf, &record) || record.cfg_file != NULL) {
+                goto done;
+        }
+
+        json_body = create_json_message(&record.headers, record.body);
+        spooled = malloc(sizeof(struct spooled_record));
+        if (json_body == NULL || spooled == NULL) {
+                free(spooled);
+                goto done;
+        }
+        spooled->run = run;
+        spooled->path = strdup(record_path);
+        spooled->blocks = blocks;
+        if (spooled->path == NULL ||
+            post_batch_add(run->batch, json_body, strlen(json_body),
+                           finish_spooled_record, spooled) != 0) {
+                free(spooled->path);
+                free(spooled);
+                goto done;
+        }
+        ret = true;
+done:
+        free(json_body);
+        free(buf);
+
+        return ret;
+}
+
+void process_spooled_record(const char *spool_dir, char *name, struct spool_run *run)
 {
         char *record_name;
         int ret;
@@ -149,7 +241,7 @@ void process_spooled_record(const char *spool_dir, char *name,
                 exit(EXIT_FAILURE);
         }
 
-        (*records_processed)++;
+        run->records_processed++;
         // Use file descriptor to mitigate TOCTOU
         int fd = open(record_name, O_RDONLY|O_NOFOLLOW);
         if (fd == -1) {
@@ -177,29 +269,20 @@ void process_spooled_record(const char *spool_dir, char *name,
             (current_time - buf.st_mtime > (record_expiry_config() * 60)) ||
             (buf.st_uid != getuid())) {
                 unlink(record_name);
-        } else if (post_succeeded && *records_sent <= TM_SPOOL_MAX_SEND_RECORDS) {
-                transmit_spooled_record(record_name, &post_succeeded, buf.st_size);
+        } else if (post_succeeded && run->records_sent <= TM_SPOOL_MAX_SEND_RECORDS) {
+                if (run->batch != NULL &&
+                    batch_spooled_record(run, record_name, buf.st_blocks)) {
+                        goto exit;
+                }
+                transmit_spooled_record(record_name, &post_succeeded);
 
                 if (!post_succeeded) {
                         telem_log(LOG_DEBUG, "Unable to connect to the server\n");
+                        run->post_failed = true;
                 } else {
                         telem_log(LOG_DEBUG, "Spool record %s transmitted\n",
                                   record_name);
-                        (*records_sent)++;
-
-                        /* if spooled record is sent, deduct from tm_spool_dir_size */
-                        if (*current_spool_size > 0) {
-                                *current_spool_size -= (buf.st_blocks * 512);
-                        }
-                        /*
-                         * If getting the directory size failed earlier due to
-                         * EMFILE/ENFILE, try to calculate again.
-                         * EMFILE - too many file descriptors in use by process
-                         * ENFILE - too many files are open in the system
-                         */
-                        if (*current_spool_size < 0) {
-                                *current_spool_size = get_spool_dir_size();
-                        }
+                        spooled_record_sent(run, buf.st_blocks);
                 }
         }
 exit:
@@ -208,119 +291,44 @@ clean:
         free(record_name);
 }
 
-void transmit_spooled_record(char *record_path, bool *post_succeeded, long size)
+void transmit_spooled_record(char *record_path, bool *post_succeeded)
 {
-        FILE *fp = NULL;
-        char *headers[NUM_HEADERS];
-        char *payload = NULL;
-        int num_headers = 0, k;
-#if (LINE_MAX > PATH_MAX)
-        char line[LINE_MAX+1] = { 0 };
-#else
-        char line[PATH_MAX+1] = { 0 };
-#endif
-        long offset;
-        char *cfg_file = NULL;
-        uint32_t cfg_prefix = 0;
-
-        fp = fopen(record_path, "r");
-        if (fp == NULL) {
-                telem_log(LOG_ERR, "Unable to open file %s in spool\n", record_path);
+        struct staged_record record;
+        struct config_snapshot *cfg = NULL;
+        char *buf = NULL;
+
+        buf = malloc(STAGED_RECORD_SIZE + 1);
+        if (!buf) {
+                telem_log(LOG_ERR, "Could not allocate memory for record\n");
                 return;
         }
 
-        // First line optionally contains configuration file path
-        if (fread(&cfg_prefix, CFG_PREFIX_LENGTH, 1, fp) != 1) {
-                telem_log(LOG_ERR, "Error while parsing spooled record configuration info.\n");
+        if (!read_record(record_path, buf, &record)) {
+                telem_log(LOG_ERR, "transmit_spooled_record: Incorrect record %s\n",
+                          record_path);
                 goto read_error;
         }
 
-        if (cfg_prefix == CFG_PREFIX_32BIT) {
-                size_t pathlen;
-                char *nl;
-
-                if (!fgets(line, sizeof(line), fp)) {
-                        telem_log(LOG_ERR, "Error while parsing record file\n");
+        if (record.cfg_file != NULL) {
+                cfg = config_snapshot_get(record.cfg_file);
+                if (cfg == NULL) {
+                        // Not sent with other settings than requested, but
+                        // removed as if it was
+                        telem_log(LOG_ERR, "Failed to load configuration %s, record dropped\n",
+                                  record.cfg_file);
+                        *post_succeeded = true;
+                        unlink(record_path);
                         goto read_error;
                 }
-
-                if ((nl = strchr(line, '\n')) != NULL) {
-                        *nl = '\0';
-                }
-
-                pathlen = strlen(line);
-                cfg_file = malloc(pathlen + 1);
-                if (cfg_file == NULL) {
-                        telem_log(LOG_ERR, "Could not allocate memory for config file path\n");
-                        goto read_error;
-                }
-                strcpy (cfg_file, line);
-                telem_debug("DEBUG: cfg_file: %s\n", cfg_file);
-        } else {
-                cfg_file = NULL;
-                rewind(fp);
-        }
-
-        for (num_headers = 0; num_headers < NUM_HEADERS; num_headers++) {
-                const char *header_name = get_header_name(num_headers);
-                if (!fgets(line, sizeof(line), fp)) {
-                        telem_log(LOG_ERR, "Error while parsing record file\n");
-                        goto read_error;
-                }
-                //Get rid of trailing newline
-                strtok(line, "\n");
-                if (get_header(line, header_name, &headers[num_headers])) {
-                        continue;
-                } else {
-                        telem_log(LOG_ERR, "transmit_spooled_record: Incorrect"
-                                  " headers in record\n");
-                        goto read_error;
-                }
-        }
-
-        offset = ftell(fp);
-
-        if (offset == -1) {
-                telem_perror("Failed to get file offset of record payload");
-                goto read_error;
-        }
-
-        size = size - offset + 1;
-        payload = malloc((size_t)size);
-
-        if (!payload) {
-                telem_log(LOG_ERR, "Could not allocate memory for payload\n");
-                goto read_error;
-        }
-        memset(payload, 0, (size_t)size);
-
-        //read rest of file
-        size_t newlen = fread(payload, sizeof(char), (size_t)size, fp);
-        if (newlen == 0) {
-                telem_perror("Error reading spool file");
-                goto read_error;
         }
 
-        *post_succeeded = post_record_http(headers, payload, cfg_file);
+        *post_succeeded = post_record_http(&record.headers, record.body, cfg, NULL);
+        config_snapshot_put(cfg);
         if (*post_succeeded) {
                 unlink(record_path);
         }
 read_error:
-        if (payload) {
-                free(payload);
-        }
-
-        if (fp) {
-                fclose(fp);
-        }
-
-        for (k = 0; k < num_headers; k++) {
-                free(headers[k]);
-        }
-
-        if (cfg_file) {
-                free(cfg_file);
-        }
+        free(buf);
 }
 
 int spool_record_compare(const void *entrya, const void *entryb, void *path)
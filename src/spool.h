@@ -16,31 +16,50 @@
 
 #pragma once
 
+#include <stdbool.h>
+
+struct post_batch;
+struct TelemPostDaemon;
+
+/* Progress of a run over the spooled records */
+struct spool_run {
+        long *current_spool_size;
+        /* records posted in batches, NULL to post them one by one while
+         * the run waits */
+        struct post_batch *batch;
+        /* Number of records processed till now */
+        int records_processed;
+        /* Number of records sent to the backend */
+        int records_sent;
+        /* set once a record could not be sent */
+        bool post_failed;
+};
+
 /**
- * Run the spool record loop periodically
+ * Run the spool record loop periodically, once the posts in flight
+ * completed, and wait for the records of the run to be posted
+ *
+ * @param daemon The daemon, whose spool size is updated as records are sent
  */
-void spool_records_loop(long *current_spool_size);
+void spool_records_loop(struct TelemPostDaemon *daemon);
 
 /**
  * Process the spooled record
  *
  * @param spool_dir Path of the spool directory
  * @param name File name of the spooled record
- * @param records_processed Number of records processed till now
- * @param records_sent Number of records sent to the backend
+ * @param run Progress of the run, a batched record is only counted once
+ *        its request completed
  */
-void process_spooled_record(const char *spool_dir, char *name,
-                            int *records_processed, int *records_sent,
-                            long *current_spool_size);
+void process_spooled_record(const char *spool_dir, char *name, struct spool_run *run);
 
 /**
  * Send the spooled record to the backend
  *
  * @param record_path Path of the spooled record
  * @param post_succeeded bool indicating if the previous post was successful
- * @param sz Size of the file in bytes
  */
-void transmit_spooled_record(char *record_path, bool *post_succeeded, long sz);
+void transmit_spooled_record(char *record_path, bool *post_succeeded);
 
 /**
  * Comparison function used for qsort
@@ -0,0 +1,482 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "staging_log.h"
+#include "log.h"
+
+/* Records read between two saves of the cursor */
+#define CURSOR_SAVE_INTERVAL 64
+
+/* Large enough for any complete record */
+#define READ_BUF_SIZE (sizeof(struct staging_log_record) + STAGING_LOG_MAX_RECORD)
+
+struct cursor_data {
+        uint64_t seq;
+        uint64_t offset;
+        uint32_t check;
+        uint32_t unused;
+};
+
+/* FNV-1a */
+static uint32_t checksum(const void *data, size_t size)
+{
+        const unsigned char *p = data;
+        uint32_t hash = 2166136261u;
+
+        for (size_t i = 0; i < size; i++) {
+                hash ^= p[i];
+                hash *= 16777619u;
+        }
+
+        return hash;
+}
+
+bool staging_log_file(const char *name)
+{
+        return strncmp(name, STAGING_LOG_PREFIX, strlen(STAGING_LOG_PREFIX)) == 0;
+}
+
+static bool segment_seq(const char *name, uint64_t *seq)
+{
+        const char *digits = name + strlen(STAGING_LOG_PREFIX);
+        char *end;
+
+        if (!staging_log_file(name) || strlen(digits) != 16 ||
+            strspn(digits, "0123456789abcdef") != 16) {
+                return false;
+        }
+        *seq = strtoull(digits, &end, 16);
+
+        return true;
+}
+
+static int segment_filter(const struct dirent *entry)
+{
+        uint64_t seq;
+
+        return segment_seq(entry->d_name, &seq);
+}
+
+/* Segments in order, as their sequence numbers have a fixed width */
+static int list_segments(const char *dir, struct dirent ***segments)
+{
+        int count;
+
+        count = scandir(dir, segments, segment_filter, alphasort);
+        if (count < 0) {
+                return -errno;
+        }
+
+        return count;
+}
+
+static void free_segments(struct dirent **segments, int count)
+{
+        for (int i = 0; i < count; i++) {
+                free(segments[i]);
+        }
+        free(segments);
+}
+
+static char *segment_path(const char *dir, uint64_t seq)
+{
+        char *path;
+
+        if (asprintf(&path, "%s/" STAGING_LOG_PREFIX "%016" PRIx64, dir, seq) < 0) {
+                return NULL;
+        }
+
+        return path;
+}
+
+static int read_cursor(int fd, uint64_t *seq, uint64_t *offset)
+{
+        struct cursor_data cursor;
+
+        if (pread(fd, &cursor, sizeof(cursor), 0) != sizeof(cursor) ||
+            cursor.check != checksum(&cursor, offsetof(struct cursor_data, check))) {
+                return -EINVAL;
+        }
+        *seq = cursor.seq;
+        *offset = cursor.offset;
+
+        return 0;
+}
+
+static int load_cursor(const char *dir, uint64_t *seq, uint64_t *offset)
+{
+        char *path;
+        int ret;
+        int fd;
+
+        if (asprintf(&path, "%s/" STAGING_LOG_CURSOR, dir) < 0) {
+                return -ENOMEM;
+        }
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        free(path);
+        if (fd < 0) {
+                return -errno;
+        }
+        ret = read_cursor(fd, seq, offset);
+        close(fd);
+
+        return ret;
+}
+
+int staging_log_open(struct staging_log *log, const char *dir, uint64_t max_size)
+{
+        struct dirent **segments;
+        uint64_t cursor_seq;
+        uint64_t offset;
+        uint64_t seq = 0;
+        int count;
+
+        count = list_segments(dir, &segments);
+        if (count < 0) {
+                return count;
+        }
+        if (count > 0) {
+                segment_seq(segments[count - 1]->d_name, &seq);
+        }
+        free_segments(segments, count);
+
+        /* telempostd may have removed every segment it read */
+        if (load_cursor(dir, &cursor_seq, &offset) == 0 && cursor_seq > seq) {
+                seq = cursor_seq;
+        }
+
+        log->dir = strdup(dir);
+        if (log->dir == NULL) {
+                return -ENOMEM;
+        }
+        pthread_mutex_init(&log->lock, NULL);
+        log->fd = -1;
+        log->seq = seq;
+        log->size = 0;
+        log->max_size = max_size;
+
+        return 0;
+}
+
+static int next_segment(struct staging_log *log)
+{
+        char *path;
+        int fd;
+
+        if (log->fd >= 0) {
+                close(log->fd);
+                log->fd = -1;
+        }
+
+        do {
+                log->seq++;
+                path = segment_path(log->dir, log->seq);
+                if (path == NULL) {
+                        return -ENOMEM;
+                }
+                fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+                          S_IRUSR | S_IWUSR);
+                free(path);
+        } while (fd < 0 && errno == EEXIST);
+
+        if (fd < 0) {
+                return -errno;
+        }
+        log->fd = fd;
+        log->size = 0;
+
+        return 0;
+}
+
+int staging_log_append(struct staging_log *log, const void *record, size_t size)
+{
+        struct staging_log_record header;
+        struct iovec iov[2];
+        ssize_t written;
+        int ret = 0;
+
+        if (size > STAGING_LOG_MAX_RECORD) {
+                return -EMSGSIZE;
+        }
+
+        header.size = (uint32_t)size;
+        header.check = checksum(record, size);
+        header.time = (int64_t)time(NULL);
+        iov[0].iov_base = &header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = (void *)record;
+        iov[1].iov_len = size;
+
+        pthread_mutex_lock(&log->lock);
+
+        if (log->fd < 0 || log->size >= log->max_size) {
+                ret = next_segment(log);
+                if (ret < 0) {
+                        goto out;
+                }
+        }
+
+        written = writev(log->fd, iov, 2);
+        if (written != (ssize_t)(sizeof(header) + size)) {
+                ret = written < 0 ? -errno : -ENOSPC;
+                /* Past a torn record, telempostd skips to the next segment */
+                if (ftruncate(log->fd, (off_t)log->size) != 0) {
+                        close(log->fd);
+                        log->fd = -1;
+                }
+                goto out;
+        }
+        log->size += (uint64_t)written;
+
+out:
+        pthread_mutex_unlock(&log->lock);
+
+        return ret;
+}
+
+void staging_log_close(struct staging_log *log)
+{
+        if (log->fd >= 0) {
+                close(log->fd);
+                log->fd = -1;
+        }
+        pthread_mutex_destroy(&log->lock);
+        free(log->dir);
+        log->dir = NULL;
+}
+
+int staging_cursor_open(struct staging_cursor *cursor, const char *dir)
+{
+        char *path;
+
+        if (asprintf(&path, "%s/" STAGING_LOG_CURSOR, dir) < 0) {
+                return -ENOMEM;
+        }
+        cursor->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        free(path);
+        if (cursor->fd < 0) {
+                return -errno;
+        }
+
+        cursor->dir = strdup(dir);
+        if (cursor->dir == NULL) {
+                close(cursor->fd);
+                return -ENOMEM;
+        }
+
+        if (read_cursor(cursor->fd, &cursor->seq, &cursor->offset) < 0) {
+                cursor->seq = 0;
+                cursor->offset = 0;
+        }
+
+        return 0;
+}
+
+void staging_cursor_close(struct staging_cursor *cursor)
+{
+        close(cursor->fd);
+        cursor->fd = -1;
+        free(cursor->dir);
+        cursor->dir = NULL;
+}
+
+static int save_cursor(struct staging_cursor *cursor)
+{
+        struct cursor_data data = {
+                .seq = cursor->seq,
+                .offset = cursor->offset,
+        };
+
+        data.check = checksum(&data, offsetof(struct cursor_data, check));
+        if (pwrite(cursor->fd, &data, sizeof(data), 0) != sizeof(data)) {
+                return -errno;
+        }
+
+        return 0;
+}
+
+/* Saves the cursor once the records read are done with */
+static int sync_cursor(struct staging_cursor *cursor, staging_sync_fn sync, void *data)
+{
+        if (sync != NULL) {
+                sync(data);
+        }
+
+        return save_cursor(cursor);
+}
+
+/*
+ * Reads the records of a segment from the cursor, and returns how many were
+ * read. A segment ends with an incomplete or damaged record when a record is
+ * still being appended to the last segment, or when telemprobd stopped while
+ * appending one.
+ */
+static int read_segment(struct staging_cursor *cursor, const char *name, bool last,
+                        staging_log_fn fn, staging_sync_fn sync, void *data)
+{
+        struct staging_log_record header;
+        struct stat st;
+        char *buf;
+        char *path;
+        ssize_t len;
+        size_t pos = 0;
+        int records = 0;
+        int fd;
+
+        if (asprintf(&path, "%s/%s", cursor->dir, name) < 0) {
+                return -ENOMEM;
+        }
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        free(path);
+        if (fd < 0) {
+                return -errno;
+        }
+
+        /* Only telemprobd may stage records */
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+                telem_log(LOG_WARNING, "Ignoring staging log segment %s\n", name);
+                close(fd);
+                return 0;
+        }
+
+        buf = malloc(READ_BUF_SIZE);
+        if (buf == NULL) {
+                close(fd);
+                return -ENOMEM;
+        }
+
+        do {
+                len = pread(fd, buf, READ_BUF_SIZE, (off_t)cursor->offset);
+                if (len < 0) {
+                        records = -errno;
+                        break;
+                }
+
+                for (pos = 0; (size_t)len - pos >= sizeof(header);) {
+                        memcpy(&header, buf + pos, sizeof(header));
+                        if (header.size > STAGING_LOG_MAX_RECORD) {
+                                goto damaged;
+                        }
+                        if ((size_t)len - pos - sizeof(header) < header.size) {
+                                break;
+                        }
+                        if (checksum(buf + pos + sizeof(header), header.size) != header.check) {
+                                goto damaged;
+                        }
+
+                        fn(data, buf + pos + sizeof(header), header.size, (time_t)header.time);
+                        pos += sizeof(header) + header.size;
+                        cursor->offset += sizeof(header) + header.size;
+
+                        if (++records % CURSOR_SAVE_INTERVAL == 0) {
+                                sync_cursor(cursor, sync, data);
+                        }
+                }
+        } while (pos > 0);
+
+        goto out;
+
+damaged:
+        if (!last) {
+                telem_log(LOG_WARNING, "Skipping damaged end of staging log segment %s\n",
+                          name);
+        }
+out:
+        free(buf);
+        close(fd);
+
+        return records;
+}
+
+static void remove_segment(struct staging_cursor *cursor, const char *name)
+{
+        char *path;
+
+        if (asprintf(&path, "%s/%s", cursor->dir, name) < 0) {
+                return;
+        }
+        unlink(path);
+        free(path);
+}
+
+int staging_log_consume(struct staging_cursor *cursor, staging_log_fn fn,
+                        staging_sync_fn sync, void *data)
+{
+        struct dirent **segments;
+        uint64_t seq;
+        int records = 0;
+        int count;
+        int ret;
+
+        count = list_segments(cursor->dir, &segments);
+        if (count < 0) {
+                return count;
+        }
+
+        for (int i = 0; i < count; i++) {
+                bool last = (i == count - 1);
+
+                segment_seq(segments[i]->d_name, &seq);
+                if (seq > cursor->seq) {
+                        cursor->seq = seq;
+                        cursor->offset = 0;
+                }
+
+                if (seq == cursor->seq) {
+                        ret = read_segment(cursor, segments[i]->d_name, last, fn, sync,
+                                           data);
+                        if (ret < 0) {
+                                telem_log(LOG_ERR, "Failed to read staging log segment %s: %s\n",
+                                          segments[i]->d_name, strerror(-ret));
+                                break;
+                        }
+                        records += ret;
+                }
+
+                /* Nothing is appended to a segment once a later one exists */
+                if (!last) {
+                        if (seq == cursor->seq) {
+                                cursor->seq++;
+                                cursor->offset = 0;
+                        }
+                        sync_cursor(cursor, sync, data);
+                        remove_segment(cursor, segments[i]->d_name);
+                }
+        }
+        free_segments(segments, count);
+
+        ret = sync_cursor(cursor, sync, data);
+        if (ret < 0) {
+                return ret;
+        }
+
+        return records;
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
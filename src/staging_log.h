@@ -0,0 +1,175 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Append-only staging log between telemprobd and telempostd.
+ *
+ * Rather than creating a file per record, telemprobd may append records to
+ * segment files in the spool directory, named STAGING_LOG_PREFIX followed
+ * by a sequence number in 16 hex digits. A segment is only written by the
+ * telemprobd instance that created it: an instance never appends to an
+ * existing segment, and it moves on to a new one once the current segment
+ * reaches its maximum size. Each record is a struct staging_log_record
+ * followed by the record exactly as it is staged in a file of its own.
+ *
+ * telempostd reads the segments in order and keeps its position in a
+ * cursor file. It removes a segment once it has read it to the end and a
+ * later one exists. Records are delivered at least once: after a crash,
+ * the records read since the cursor was last saved are read again. The
+ * reader may still be posting the records it was handed, so the cursor is
+ * only moved past them once the reader is done with them, see
+ * staging_sync_fn.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define STAGING_LOG_PREFIX "staging."
+#define STAGING_LOG_CURSOR STAGING_LOG_PREFIX "cursor"
+
+/* Longest record accepted in a segment */
+#define STAGING_LOG_MAX_RECORD (1024 * 1024)
+
+struct staging_log_record {
+        /* size of the record that follows */
+        uint32_t size;
+        /* checksum of the record */
+        uint32_t check;
+        /* when the record was staged, in seconds since the epoch */
+        int64_t time;
+};
+
+/* Writing end, shared by the threads of telemprobd */
+struct staging_log {
+        pthread_mutex_t lock;
+        char *dir;
+        /* current segment, -1 until the first record is appended */
+        int fd;
+        uint64_t seq;
+        uint64_t size;
+        uint64_t max_size;
+};
+
+/* Reading end, in telempostd */
+struct staging_cursor {
+        char *dir;
+        int fd;
+        /* next record to read */
+        uint64_t seq;
+        uint64_t offset;
+};
+
+/**
+ * Whether a file of the spool directory is part of the staging log, rather
+ * than a record.
+ *
+ * @param name Name of the file.
+ *
+ * @return true if it is a segment or the cursor.
+ */
+bool staging_log_file(const char *name);
+
+/**
+ * Prepare to append to a new segment after the existing ones, which is only
+ * created once the first record is appended.
+ *
+ * @param log The log.
+ * @param dir The directory holding the segments.
+ * @param max_size Size after which a new segment is started.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int staging_log_open(struct staging_log *log, const char *dir, uint64_t max_size);
+
+/**
+ * Append a record. A record that could not be written entirely is removed
+ * from the segment.
+ *
+ * @param log The log.
+ * @param record The record, as staged in a file of its own.
+ * @param size Size of the record, at most STAGING_LOG_MAX_RECORD.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int staging_log_append(struct staging_log *log, const void *record, size_t size);
+
+/**
+ * Close the current segment and release the log.
+ *
+ * @param log The log.
+ */
+void staging_log_close(struct staging_log *log);
+
+/**
+ * Open the cursor, creating it at the first segment if it does not exist
+ * or is damaged.
+ *
+ * @param cursor The cursor.
+ * @param dir The directory holding the segments.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ */
+int staging_cursor_open(struct staging_cursor *cursor, const char *dir);
+
+/**
+ * Close the cursor, without saving it.
+ *
+ * @param cursor The cursor.
+ */
+void staging_cursor_close(struct staging_cursor *cursor);
+
+/**
+ * Called for each record read from the log.
+ *
+ * @param data The data passed to staging_log_consume().
+ * @param record The record, as staged in a file of its own.
+ * @param size Size of the record.
+ * @param staged When the record was staged.
+ */
+typedef void (*staging_log_fn)(void *data, const char *record, size_t size,
+                               time_t staged);
+
+/**
+ * Called before the cursor is saved or a segment removed. Once it returns,
+ * the records read so far must be done with, delivered or kept elsewhere,
+ * as they are not read again after a crash.
+ *
+ * @param data The data passed to staging_log_consume().
+ */
+typedef void (*staging_sync_fn)(void *data);
+
+/**
+ * Read every record appended since the cursor, then save the cursor.
+ * Segments read to the end are removed, except for the last one, which
+ * telemprobd may still append to.
+ *
+ * @param cursor The cursor.
+ * @param fn Called for each record, in order.
+ * @param sync Called before the cursor moves past the records read, or
+ *    NULL if fn is done with each record once it returns.
+ * @param data Passed to fn and sync.
+ *
+ * @return The number of records read, or a negative errno-style value if
+ *    the cursor could not be saved.
+ */
+int staging_log_consume(struct staging_cursor *cursor, staging_log_fn fn,
+                        staging_sync_fn sync, void *data);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -26,37 +26,88 @@
 #include <string.h>
 #include <fcntl.h>
 #include <time.h>
-#include <malloc.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
 
+#include "admission.h"
 #include "iorecord.h"
 #include "telemdaemon.h"
 #include "common.h"
 #include "util.h"
 #include "log.h"
 #include "configuration.h"
+#include "shm_ring.h"
+#include "random_id.h"
+#include "wire.h"
 
-static void process_record(TelemDaemon *daemon, client *cl);
+/* A record whose headers were parsed in place */
+struct received_record {
+        struct wire_headers headers;
+        char *body;
+        char *cfg_file;
+};
+
+static bool parse_received_record(uint8_t *buf, size_t size, struct received_record *record);
+static void stage_received_record(TelemDaemon *daemon, struct received_record *record);
+static void process_record(TelemDaemon *daemon, uint8_t *buf, size_t size);
+static void init_client_bufs(TelemDaemon *daemon);
+
+/* A record copied out of the buffer it was received in */
+struct record_job {
+        size_t size;
+        uint8_t data[];
+};
 
 void initialize_probe_daemon(TelemDaemon *daemon)
 {
         client_list_head head;
         LIST_INIT(&head);
+        daemon->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (daemon->epfd < 0) {
+                telem_perror("Failed to create the epoll instance");
+                exit(EXIT_FAILURE);
+        }
         daemon->nfds = 0;
-        daemon->pollfds = NULL;
         daemon->client_head = head;
+        TAILQ_INIT(&daemon->partial_head);
         daemon->machine_id_override = NULL;
+        strcpy(daemon->machine_id, "0");
+        daemon->machine_id_len = 1;
+        pthread_rwlock_init(&daemon->machine_id_lock, NULL);
+        daemon->machine_id_watch.fd = -1;
+        daemon->msg_buf = NULL;
+        init_client_bufs(daemon);
+        daemon->ring = NULL;
+        daemon->ring_stall = 0;
+        daemon->workers = NULL;
+        daemon->nworkers = 0;
+        daemon->staging_log = NULL;
+        daemon->handoff = NULL;
+        daemon->admission = NULL;
 }
 
 client *add_client(client_list_head *client_head, int fd)
 {
+        socklen_t cred_len = sizeof(struct ucred);
         client *cl;
 
         cl = (client *)malloc(sizeof(client));
         if (cl) {
                 cl->fd = fd;
+                cl->watch.type = WATCH_CLIENT;
+                cl->watch.fd = fd;
+                cl->seqpacket = false;
+                if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cl->cred, &cred_len) < 0) {
+                        memset(&cl->cred, 0, sizeof(cl->cred));
+                }
                 cl->offset = 0;
+                cl->size = 0;
                 cl->buf = NULL;
+                cl->state = CLIENT_READ_SIZE;
+                cl->record_size = 0;
+                cl->deadline = 0;
+                cl->partial = false;
 
                 LIST_INSERT_HEAD(client_head, cl, client_ptrs);
         }
@@ -83,23 +134,31 @@ bool is_client_list_empty(client_list_head *client_head)
 }
 
 
-static void terminate_client(TelemDaemon *daemon, client *cl, nfds_t index)
+static void terminate_client(TelemDaemon *daemon, client *cl)
 {
-        /* Remove fd from the pollfds array */
-        del_pollfd(daemon, index);
+        /* Stop watching the fd before it is closed */
+        unwatch_fd(daemon, &cl->watch);
+
+        if (cl->partial) {
+                TAILQ_REMOVE(&daemon->partial_head, cl, partial_ptrs);
+        }
 
         telem_log(LOG_INFO, "Removing client: %d\n", cl->fd);
 
+        buffer_pool_put(&daemon->client_bufs, cl->buf);
+        cl->buf = NULL;
+
         /* Remove client from the client list */
         remove_client(&(daemon->client_head), cl);
 }
 
 /*
- See "tm_send_record" for record retails.
+ See "tm_frame_record" for record retails.
 
  recv buffer layout:
          * <uint32_t record_size>    : so recv knows how much to read
          * <custom cfg file field>   : optional, variable size (string)
+         * <uint32_t WIRE_V5_MAGIC>   : binary headers only, see wire.h
          * <uint32_t header_size>
          * <headers + Payload>
          * <null-byte>
@@ -111,71 +170,521 @@ static void terminate_client(TelemDaemon *daemon, client *cl, nfds_t index)
  
 */
 
-#define MAX_RECORD_SIZE (2*sizeof(uint32_t) + CFG_PREFIX_LENGTH + PATH_MAX + \
+#define MAX_RECORD_SIZE (3*sizeof(uint32_t) + CFG_PREFIX_LENGTH + PATH_MAX + \
         MAX_PAYLOAD_LENGTH + NUM_HEADERS*80)
-bool handle_client(TelemDaemon *daemon, nfds_t index, client *cl)
+
+/* Read buffer for a client, large enough for a batch of records */
+#define CLIENT_BUF_SIZE (4 * MAX_RECORD_SIZE)
+
+/* Number of messages received at once from a SOCK_SEQPACKET client */
+#define RECV_MSG_BATCH 16
+
+static void init_client_bufs(TelemDaemon *daemon)
 {
-        /* For now  read data from fd */
-        ssize_t len;
-        size_t buf_size;
-        bool processed = false;
-        uint32_t record_size;
+        buffer_pool_init(&daemon->client_bufs, CLIENT_BUF_SIZE,
+                         (size_t)buffer_pool_size_config());
+}
 
-        if (cl->buf != NULL) {
-                free(cl->buf);
-                cl->buf = NULL;
+static void *worker_main(void *arg)
+{
+        worker *w = arg;
+        struct record_job *job;
+
+        while (1) {
+                while (sem_wait(&w->used_jobs) != 0) {
+                        ;
+                }
+
+                job = w->jobs[w->head % TM_WORKER_QUEUE_LEN];
+                w->head++;
+                sem_post(&w->free_jobs);
+
+                /* Queued by stop_workers() after every record */
+                if (job == NULL) {
+                        break;
+                }
+
+                process_record(w->daemon, job->data, job->size);
+                free(job);
         }
 
-        malloc_trim(0);
-        len = recv(cl->fd, &record_size, RECORD_SIZE_LEN, MSG_PEEK | MSG_DONTWAIT);
-        if (len < 0) {
-                telem_log(LOG_ERR, "Failed to talk to client %d: %s\n", cl->fd,
-                          strerror(errno));
-                goto end_client;
-        } else if (len == 0) {
-                /* Connection closed by client, most likely */
-                telem_log(LOG_INFO, "No data to receive from client %d\n",
-                          cl->fd);
-                goto end_client;
+        return NULL;
+}
+
+static void queue_job(worker *w, struct record_job *job)
+{
+        while (sem_wait(&w->free_jobs) != 0) {
+                ;
         }
 
-        /* Read the record size first */
-        len = recv(cl->fd, &record_size, RECORD_SIZE_LEN, 0);
-        if (len < 0) {
-                telem_log(LOG_ERR, "Failed to receive data from client"
-                                  " %d: %s\n", cl->fd, strerror(errno));
-                goto end_client;
-        } else if (len == 0) {
-                telem_log(LOG_DEBUG, "End of transmission for client"
-                          " %d\n", cl->fd);
-                goto end_client;
+        w->jobs[w->tail % TM_WORKER_QUEUE_LEN] = job;
+        w->tail++;
+        sem_post(&w->used_jobs);
+}
+
+void start_workers(TelemDaemon *daemon, int count)
+{
+        worker *w;
+        int ret;
+
+        assert(daemon->nworkers == 0);
+
+        if (count <= 0) {
+                return;
+        }
+
+        daemon->workers = calloc((size_t)count, sizeof(worker));
+        if (!daemon->workers) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < count; i++) {
+                w = &daemon->workers[i];
+                w->daemon = daemon;
+                if (sem_init(&w->free_jobs, 0, TM_WORKER_QUEUE_LEN) != 0 ||
+                    sem_init(&w->used_jobs, 0, 0) != 0) {
+                        telem_perror("Failed to initialize worker semaphores");
+                        exit(EXIT_FAILURE);
+                }
+
+                ret = pthread_create(&w->thread, NULL, worker_main, w);
+                if (ret != 0) {
+                        telem_log(LOG_ERR, "Failed to start staging worker: %s\n",
+                                  strerror(ret));
+                        exit(EXIT_FAILURE);
+                }
+        }
+        daemon->nworkers = count;
+
+        telem_log(LOG_INFO, "Staging records with %d workers\n", count);
+}
+
+void stop_workers(TelemDaemon *daemon)
+{
+        worker *w;
+
+        for (int i = 0; i < daemon->nworkers; i++) {
+                queue_job(&daemon->workers[i], NULL);
+        }
+
+        for (int i = 0; i < daemon->nworkers; i++) {
+                w = &daemon->workers[i];
+                pthread_join(w->thread, NULL);
+                sem_destroy(&w->free_jobs);
+                sem_destroy(&w->used_jobs);
+        }
+
+        free(daemon->workers);
+        daemon->workers = NULL;
+        daemon->nworkers = 0;
+}
+
+/**
+ * Stage a complete record, or queue a copy of it to the worker of the file
+ * descriptor it was received on. Admission control runs here, on the event
+ * loop, so that a client is told to wait as soon as it is done sending and
+ * nothing is copied for a dropped record.
+ *
+ * @param daemon The pointer to the daemon
+ * @param fd The file descriptor the record was received on
+ * @param cred The peer that sent the record, or NULL if it is not known
+ * @param buf The record, without its size prefix
+ * @param size Size of the record
+ */
+static void submit_record(TelemDaemon *daemon, int fd, const struct ucred *cred,
+                          uint8_t *buf, size_t size)
+{
+        struct received_record record;
+        struct record_job *job;
+
+        if (cred != NULL && cred->pid == 0) {
+                cred = NULL;
         }
 
-        /* Now that we know the record size, allocate a new buffer
-         * for the record body. We don't need to record size itself in the body.
-         */
+        if (daemon->admission != NULL) {
+                if (!parse_received_record(buf, size, &record)) {
+                        return;
+                }
 
-        if (record_size <= RECORD_SIZE_LEN || record_size > MAX_RECORD_SIZE) {
-                telem_log(LOG_ERR, "Record size %u greater tham maximum allowed %lu."
-                                    "Recored ignored\n", record_size,
-                                    MAX_RECORD_SIZE);
-                goto end_client;      
+                /* Dropped before anything is written for it */
+                if (!admission_admit(daemon->admission, cred,
+                                     record.headers.value[TM_CLASSIFICATION],
+                                     record.headers.len[TM_CLASSIFICATION])) {
+                        return;
+                }
+
+                if (daemon->nworkers == 0) {
+                        stage_received_record(daemon, &record);
+                        return;
+                }
+        } else if (daemon->nworkers == 0) {
+                process_record(daemon, buf, size);
+                return;
         }
 
-        buf_size = record_size - RECORD_SIZE_LEN;
-        cl->buf = calloc(1, buf_size);
-        if (!cl->buf) {
+        /* The worker parses its copy of the record again */
+        job = malloc(sizeof(struct record_job) + size);
+        if (!job) {
                 telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
                 exit(EXIT_FAILURE);
         }
-        cl->size = buf_size;
-        cl->offset = 0;
+        job->size = size;
+        memcpy(job->data, buf, size);
 
-        /* Read the actual record*/
-        do {
-                malloc_trim(0);
+        queue_job(&daemon->workers[fd % daemon->nworkers], job);
+}
+
+static void alloc_msg_buf(TelemDaemon *daemon)
+{
+        if (daemon->msg_buf == NULL) {
+                /* One spare byte per slot to detect oversized messages */
+                daemon->msg_buf = malloc(RECV_MSG_BATCH * (MAX_RECORD_SIZE + 1));
+                if (!daemon->msg_buf) {
+                        telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+}
+
+/**
+ * Answer a client asking for the shared memory ring. The reply is the
+ * status as an int32_t, with the memfd and the eventfd of the ring
+ * attached if it is 0. The ring is created on the first request.
+ *
+ * @param daemon The pointer to the daemon
+ * @param cl Pointer to the client structure
+ */
+static void handle_ring_request(TelemDaemon *daemon, client *cl)
+{
+        union {
+                struct cmsghdr align;
+                char buf[CMSG_SPACE(2 * sizeof(int))];
+        } control;
+        struct msghdr msg;
+        struct iovec iov;
+        struct cmsghdr *cmsg;
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        int32_t status = 0;
+        int fds[2];
+        int ret;
+
+        if (!shm_ring_enabled_config()) {
+                status = -EOPNOTSUPP;
+        } else if (getsockopt(cl->fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0) {
+                status = -errno;
+        } else if (cred.uid != 0 && cred.uid != geteuid()) {
+                /* Anyone may connect to the socket, but the ring is shared
+                 * by all of its writers, so only trusted ones get it */
+                status = -EPERM;
+        } else if (daemon->ring == NULL) {
+                ret = shm_ring_create(&daemon->ring, (uint32_t)shm_ring_slots_config(),
+                                      (uint32_t)MAX_RECORD_SIZE);
+                if (ret < 0) {
+                        telem_log(LOG_ERR, "Failed to create the shared memory ring: %s\n",
+                                  strerror(-ret));
+                        daemon->ring = NULL;
+                        status = ret;
+                } else {
+                        daemon->ring_watch.type = WATCH_RING;
+                        daemon->ring_watch.fd = daemon->ring->efd;
+                        watch_fd(daemon, &daemon->ring_watch, EPOLLIN);
+                }
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = &status;
+        iov.iov_len = sizeof(status);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        if (status == 0) {
+                fds[0] = daemon->ring->memfd;
+                fds[1] = daemon->ring->efd;
+                memset(&control, 0, sizeof(control));
+                msg.msg_control = control.buf;
+                msg.msg_controllen = sizeof(control.buf);
+                cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+                memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        }
+
+        if (sendmsg(cl->fd, &msg, MSG_NOSIGNAL) < 0) {
+                telem_log(LOG_ERR, "Failed to answer ring request of client %d: %s\n",
+                          cl->fd, strerror(errno));
+        } else {
+                telem_log(LOG_INFO, "Ring request of client %d: %s\n", cl->fd,
+                          status == 0 ? "granted" : strerror(-status));
+        }
+}
+
+/**
+ * Process every complete record held in the client buffer, and move any
+ * trailing partial record to the start of the buffer. The size prefix of
+ * a record is validated as soon as it is received, and the client then
+ * waits in CLIENT_READ_RECORD until the rest of the record is buffered.
+ *
+ * @param daemon The pointer to the daemon
+ * @param cl Pointer to the client structure
+ * @param processed Set to true if a record was processed
+ *
+ * @return true if the buffered data is valid, false otherwise
+ */
+static bool process_client_buffer(TelemDaemon *daemon, client *cl, bool *processed)
+{
+        size_t pos = 0;
+        bool valid = true;
+
+        while (1) {
+                if (cl->state == CLIENT_READ_SIZE) {
+                        uint32_t record_size;
+
+                        if (cl->offset - pos < RECORD_SIZE_LEN) {
+                                break;
+                        }
+
+                        memcpy(&record_size, cl->buf + pos, RECORD_SIZE_LEN);
+
+                        if (record_size == SHM_RING_REQUEST) {
+                                handle_ring_request(daemon, cl);
+                                pos += RECORD_SIZE_LEN;
+                                continue;
+                        }
+
+                        if (record_size <= RECORD_SIZE_LEN || record_size > MAX_RECORD_SIZE) {
+                                telem_log(LOG_ERR, "Record size %u greater tham maximum allowed %lu."
+                                          "Recored ignored\n", record_size,
+                                          MAX_RECORD_SIZE);
+                                valid = false;
+                                break;
+                        }
+
+                        cl->record_size = record_size;
+                        cl->state = CLIENT_READ_RECORD;
+                }
+
+                if (cl->offset - pos < cl->record_size) {
+                        /* Rest of the record is still in flight */
+                        break;
+                }
+
+                /* We don't need to record size itself in the body */
+                submit_record(daemon, cl->fd, &cl->cred, cl->buf + pos + RECORD_SIZE_LEN,
+                              cl->record_size - RECORD_SIZE_LEN);
+                *processed = true;
+                telem_debug("DEBUG: Record processed for client %d\n", cl->fd);
+                pos += cl->record_size;
+                cl->state = CLIENT_READ_SIZE;
+        }
+
+        if (pos > 0) {
+                memmove(cl->buf, cl->buf + pos, cl->offset - pos);
+                cl->offset -= pos;
+        }
+
+        return valid;
+}
+
+/**
+ * Keep the client on the partial list, with a new deadline, while it holds
+ * part of a record, or take it off once it does not. Moving a client that
+ * made progress to the tail keeps the list sorted by deadline.
+ *
+ * @param daemon The pointer to the daemon
+ * @param cl Pointer to the client structure
+ */
+static void update_client_deadline(TelemDaemon *daemon, client *cl)
+{
+        if (cl->partial) {
+                TAILQ_REMOVE(&daemon->partial_head, cl, partial_ptrs);
+                cl->partial = false;
+        }
+
+        if (cl->offset > 0) {
+                cl->deadline = time(NULL) + TM_CLIENT_RECV_TIME;
+                TAILQ_INSERT_TAIL(&daemon->partial_head, cl, partial_ptrs);
+                cl->partial = true;
+        }
+}
+
+int expire_clients(TelemDaemon *daemon, time_t now)
+{
+        client *cl;
+
+        while ((cl = TAILQ_FIRST(&daemon->partial_head)) != NULL) {
+                if (cl->deadline > now) {
+                        return (int)(cl->deadline - now);
+                }
+
+                telem_log(LOG_ERR, "Client %d did not complete its record in time\n",
+                          cl->fd);
+                terminate_client(daemon, cl);
+        }
+
+        return -1;
+}
+
+/**
+ * Tell a client to wait if admission control dropped records it sent. The
+ * notice is only sent if the socket has room for it right away, since the
+ * next dropped record brings another one.
+ *
+ * @param daemon The pointer to the daemon
+ * @param cl Pointer to the client structure
+ */
+static void notify_backoff(TelemDaemon *daemon, client *cl)
+{
+        struct admission_notice notice = { .magic = ADMISSION_NOTICE };
+
+        if (daemon->admission == NULL || cl->cred.pid == 0) {
+                return;
+        }
+
+        notice.wait = admission_notice(daemon->admission, &cl->cred);
+        if (notice.wait == 0) {
+                return;
+        }
+
+        if (send(cl->fd, &notice, sizeof(notice), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+                telem_debug("DEBUG: Could not notify client %d: %s\n", cl->fd,
+                            strerror(errno));
+        }
+}
+
+/**
+ * Receive the records queued on a SOCK_SEQPACKET connection. Each message
+ * is one record, so there is no reassembly: messages land directly in the
+ * slots of a buffer shared by all such clients and are processed in place.
+ *
+ * @param daemon The pointer to the daemon
+ * @param cl Pointer to the client structure
+ *
+ * @return true if at least one record was processed, false otherwise
+ */
+static bool handle_seqpacket_client(TelemDaemon *daemon, client *cl)
+{
+        struct mmsghdr msgs[RECV_MSG_BATCH];
+        struct iovec iov[RECV_MSG_BATCH];
+        bool processed = false;
+        int count;
+        int i;
+
+        alloc_msg_buf(daemon);
+
+        while (1) {
+                memset(msgs, 0, sizeof(msgs));
+                for (i = 0; i < RECV_MSG_BATCH; i++) {
+                        iov[i].iov_base = daemon->msg_buf + (size_t)i * (MAX_RECORD_SIZE + 1);
+                        iov[i].iov_len = MAX_RECORD_SIZE + 1;
+                        msgs[i].msg_hdr.msg_iov = &iov[i];
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                count = recvmmsg(cl->fd, msgs, RECV_MSG_BATCH, MSG_DONTWAIT, NULL);
+                if (count < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                notify_backoff(daemon, cl);
+                                /* Wait for more records */
+                                return processed;
+                        } else if (errno == EINTR) {
+                                continue;
+                        }
+                        telem_log(LOG_ERR, "Failed to receive data from client"
+                                  " %d: %s\n", cl->fd, strerror(errno));
+                        goto end_client;
+                }
+
+                for (i = 0; i < count; i++) {
+                        uint8_t *buf = iov[i].iov_base;
+                        size_t len = msgs[i].msg_len;
+                        uint32_t record_size;
+
+                        if (len == 0) {
+                                telem_log(LOG_DEBUG, "End of transmission for client"
+                                          " %d\n", cl->fd);
+                                goto end_client;
+                        }
+
+                        if (len == RECORD_SIZE_LEN) {
+                                memcpy(&record_size, buf, RECORD_SIZE_LEN);
+                                if (record_size == SHM_RING_REQUEST) {
+                                        handle_ring_request(daemon, cl);
+                                        continue;
+                                }
+                        }
+
+                        if (len <= RECORD_SIZE_LEN || len > MAX_RECORD_SIZE ||
+                            (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                                telem_log(LOG_ERR, "Invalid message of %zu bytes from"
+                                          " client %d\n", len, cl->fd);
+                                goto end_client;
+                        }
+
+                        /* The size prefix is kept so that both transports
+                         * share the record layout; it must match */
+                        memcpy(&record_size, buf, RECORD_SIZE_LEN);
+                        if (record_size != len) {
+                                telem_log(LOG_ERR, "Record size %u does not match message"
+                                          " size %zu\n", record_size, len);
+                                goto end_client;
+                        }
+
+                        submit_record(daemon, cl->fd, &cl->cred, buf + RECORD_SIZE_LEN,
+                                      len - RECORD_SIZE_LEN);
+                        processed = true;
+                        telem_debug("DEBUG: Record processed for client %d\n", cl->fd);
+                }
+        }
+
+end_client:
+        telem_log(LOG_DEBUG, "Processed client %d: %s\n", cl->fd, processed ? "true" : "false");
+        terminate_client(daemon, cl);
+        return processed;
+}
+
+bool handle_client(TelemDaemon *daemon, client *cl)
+{
+        ssize_t len;
+        bool processed = false;
+        bool received = false;
+
+        if (cl->seqpacket) {
+                return handle_seqpacket_client(daemon, cl);
+        }
+
+        if (cl->buf == NULL) {
+                cl->buf = buffer_pool_get(&daemon->client_bufs);
+                if (!cl->buf) {
+                        telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                        exit(EXIT_FAILURE);
+                }
+                cl->size = CLIENT_BUF_SIZE;
+                cl->offset = 0;
+        }
+
+        while (1) {
+                /* The buffer always has room left, since it can hold more
+                 * than one record of the maximum size */
                 len = recv(cl->fd, cl->buf + cl->offset, cl->size - cl->offset, 0);
                 if (len < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                /* Don't hold on to the buffer of an idle client */
+                                if (cl->offset == 0) {
+                                        buffer_pool_put(&daemon->client_bufs, cl->buf);
+                                        cl->buf = NULL;
+                                }
+                                if (received) {
+                                        update_client_deadline(daemon, cl);
+                                }
+                                notify_backoff(daemon, cl);
+                                /* Resume on the next readiness event */
+                                return processed;
+                        }
                         telem_log(LOG_ERR, "Failed to receive data from client"
                                   " %d: %s\n", cl->fd, strerror(errno));
                         goto end_client;
@@ -186,23 +695,121 @@ bool handle_client(TelemDaemon *daemon, nfds_t index, client *cl)
                 }
 
                 cl->offset += (size_t)len;
+                received = true;
 
-                if (cl->offset == cl->size) {
-                        process_record(daemon, cl);
-                        free(cl->buf);
-                        cl->buf = NULL;
-                        processed = true;
-                        telem_debug("DEBUG: Record processed for client %d\n", cl->fd);
-                        break;
+                if (!process_client_buffer(daemon, cl, &processed)) {
+                        goto end_client;
                 }
-        } while (len > 0);
+        }
 
 end_client:
         telem_log(LOG_DEBUG, "Processed client %d: %s\n", cl->fd, processed ? "true" : "false");
-        terminate_client(daemon, cl, index);
+        terminate_client(daemon, cl);
         return processed;
 }
 
+/* Processes the records of the ring up to the first slot not written yet */
+static bool drain_ring(TelemDaemon *daemon)
+{
+        struct shm_ring *ring = daemon->ring;
+        const uint8_t *data;
+        uint32_t record_size = 0;
+        size_t len;
+        bool processed = false;
+
+        alloc_msg_buf(daemon);
+
+        do {
+                while ((data = shm_ring_peek(ring, &len)) != NULL) {
+                        /* Clients can still write to the slot, so the record
+                         * is validated and parsed from a private copy */
+                        memcpy(daemon->msg_buf, data, len);
+                        shm_ring_release(ring);
+
+                        if (len > RECORD_SIZE_LEN) {
+                                memcpy(&record_size, daemon->msg_buf, RECORD_SIZE_LEN);
+                        }
+                        if (len <= RECORD_SIZE_LEN || len > MAX_RECORD_SIZE ||
+                            record_size != len) {
+                                telem_log(LOG_ERR, "Invalid record of %zu bytes in the"
+                                          " ring, dropped\n", len);
+                                continue;
+                        }
+
+                        submit_record(daemon, ring->efd, NULL,
+                                      daemon->msg_buf + RECORD_SIZE_LEN,
+                                      len - RECORD_SIZE_LEN);
+                        processed = true;
+                }
+        } while (!shm_ring_sleep(ring));
+
+        return processed;
+}
+
+bool handle_ring(TelemDaemon *daemon)
+{
+        struct shm_ring *ring = daemon->ring;
+        uint64_t events;
+        bool processed = false;
+
+        if (ring == NULL) {
+                return false;
+        }
+
+        /* Producers only signal again once we announce that we sleep */
+        if (read(ring->efd, &events, sizeof(events)) < 0 && errno != EAGAIN) {
+                telem_perror("Failed to read the ring eventfd");
+        }
+
+drain:
+        processed |= drain_ring(daemon);
+
+        if (!shm_ring_stalled(ring)) {
+                daemon->ring_stall = 0;
+        } else if (daemon->ring_stall == 0) {
+                daemon->ring_stall = time(NULL);
+        } else if (difftime(time(NULL), daemon->ring_stall) >= TM_RING_STALL_TIME) {
+                daemon->ring_stall = 0;
+                if (!shm_ring_skip(ring)) {
+                        goto drain;
+                }
+
+                /* Its producer most likely died while writing it. If not, it
+                 * may still write the slot, so the slot is not reused and
+                 * the ring is replaced once the records after it are read;
+                 * the next ring request gets a new one. */
+                telem_log(LOG_ERR, "Skipped a ring slot that was never written,"
+                          " replacing the ring\n");
+                shm_ring_close(ring);
+                processed |= drain_ring(daemon);
+                close_ring(daemon);
+        }
+
+        return processed;
+}
+
+void close_ring(TelemDaemon *daemon)
+{
+        if (daemon->ring == NULL) {
+                return;
+        }
+
+        shm_ring_close(daemon->ring);
+        drain_ring(daemon);
+
+        /* A producer still writing a slot finds it skipped, and sends its
+         * record over the socket */
+        while (shm_ring_stalled(daemon->ring)) {
+                shm_ring_skip(daemon->ring);
+                drain_ring(daemon);
+        }
+
+        unwatch_fd(daemon, &daemon->ring_watch);
+        shm_ring_free(daemon->ring);
+        daemon->ring = NULL;
+        daemon->ring_stall = 0;
+}
+
 char *read_machine_id_override()
 {
         char *machine_override = NULL;
@@ -249,32 +856,261 @@ char *read_machine_id_override()
         return machine_override;
 }
 
-static void machine_id_replace(char **machine_header, char *machine_id_override)
+void refresh_machine_id(TelemDaemon *daemon)
 {
-        char machine_id[33] = { 0 };
-        char *old_header;
-        int ret;
+        char machine_id[TM_MACHINE_ID_LEN + 1] = { 0 };
 
-        if (machine_id_override) {
-                strncpy(machine_id, machine_id_override, sizeof(machine_id)-1);
-        } else {
-                if (!get_machine_id(machine_id)) {
-                        // TODO: decide if error handling is needed here
-                        machine_id[0] = '0';
+        if (daemon->machine_id_override) {
+                strncpy(machine_id, daemon->machine_id_override, TM_MACHINE_ID_LEN);
+        } else if (!get_machine_id(machine_id)) {
+                // TODO: decide if error handling is needed here
+                strcpy(machine_id, "0");
+        }
+
+        pthread_rwlock_wrlock(&daemon->machine_id_lock);
+        memcpy(daemon->machine_id, machine_id, sizeof(machine_id));
+        daemon->machine_id_len = strlen(machine_id);
+        pthread_rwlock_unlock(&daemon->machine_id_lock);
+}
+
+/* Basename of path, which must contain a slash */
+static const char *file_name(const char *path)
+{
+        return strrchr(path, '/') + 1;
+}
+
+static int watch_dir_of(int fd, const char *path)
+{
+        char dir[PATH_MAX];
+        size_t len = (size_t)(file_name(path) - path - 1);
+
+        if (len >= sizeof(dir)) {
+                return -1;
+        }
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+
+        return inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+                                 IN_MOVED_FROM | IN_DELETE);
+}
+
+void watch_machine_id(TelemDaemon *daemon)
+{
+        int fd;
+        int watched = 0;
+
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) {
+                telem_perror("Failed to initialize inotify for the machine id");
+                return;
+        }
+
+        /* Watch the directories, as both files may be replaced or created */
+        if (watch_dir_of(fd, TM_MACHINE_ID_FILE) >= 0) {
+                watched++;
+        }
+        if (watch_dir_of(fd, TM_MACHINE_ID_OVERRIDE) >= 0) {
+                watched++;
+        }
+        if (watched == 0) {
+                telem_log(LOG_WARNING, "Not watching the machine id files for changes\n");
+                close(fd);
+                return;
+        }
+
+        daemon->machine_id_watch.type = WATCH_MACHINE_ID;
+        daemon->machine_id_watch.fd = fd;
+        watch_fd(daemon, &daemon->machine_id_watch, EPOLLIN);
+}
+
+void handle_machine_id_change(TelemDaemon *daemon)
+{
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        const struct inotify_event *event;
+        bool changed = false;
+        ssize_t len;
+
+        while ((len = read(daemon->machine_id_watch.fd, buf, sizeof(buf))) > 0) {
+                for (char *p = buf; p < buf + len; p += sizeof(*event) + event->len) {
+                        event = (const struct inotify_event *)p;
+                        if (event->len == 0) {
+                                continue;
+                        }
+                        if (strcmp(event->name, file_name(TM_MACHINE_ID_FILE)) == 0 ||
+                            strcmp(event->name, file_name(TM_MACHINE_ID_OVERRIDE)) == 0) {
+                                changed = true;
+                        }
                 }
         }
 
-        old_header = *machine_header;
-        ret = asprintf(machine_header, "%s: %s", TM_MACHINE_ID_STR, machine_id);
+        if (!changed) {
+                return;
+        }
 
-        if (ret == -1) {
-                telem_log(LOG_ERR, "Failed to write machine id header\n");
+        telem_log(LOG_INFO, "Machine id file changed, reloading it\n");
+        free(daemon->machine_id_override);
+        daemon->machine_id_override = read_machine_id_override();
+        refresh_machine_id(daemon);
+}
+
+void close_machine_id_watch(TelemDaemon *daemon)
+{
+        if (daemon->machine_id_watch.fd < 0) {
+                return;
+        }
+
+        unwatch_fd(daemon, &daemon->machine_id_watch);
+        close(daemon->machine_id_watch.fd);
+        daemon->machine_id_watch.fd = -1;
+}
+
+void open_staging_log(TelemDaemon *daemon)
+{
+        struct staging_log *log;
+        int ret;
+
+        if (daemon->staging_log != NULL || strcmp(staging_backend_config(), "log") != 0) {
+                return;
+        }
+
+        log = malloc(sizeof(struct staging_log));
+        if (!log) {
+                telem_log(LOG_ERR, "Failed to allocate the staging log, aborting\n");
                 exit(EXIT_FAILURE);
         }
-        free(old_header);
+
+        ret = staging_log_open(log, spool_dir_config(),
+                               (uint64_t)staging_segment_size_config() * 1024);
+        if (ret < 0) {
+                telem_log(LOG_ERR, "Failed to open the staging log, staging files: %s\n",
+                          strerror(-ret));
+                free(log);
+                return;
+        }
+        daemon->staging_log = log;
+}
+
+void close_staging_log(TelemDaemon *daemon)
+{
+        if (daemon->staging_log == NULL) {
+                return;
+        }
+
+        staging_log_close(daemon->staging_log);
+        free(daemon->staging_log);
+        daemon->staging_log = NULL;
 }
 
-static void stage_record(char *filepath, char *headers[], char *body, char *cfg_file)
+void open_handoff(TelemDaemon *daemon)
+{
+        struct handoff *handoff;
+        int ret;
+
+        if (daemon->handoff != NULL || !handoff_enabled_config()) {
+                return;
+        }
+
+        handoff = malloc(sizeof(struct handoff));
+        if (!handoff) {
+                telem_log(LOG_ERR, "Failed to allocate the record hand-off, aborting\n");
+                exit(EXIT_FAILURE);
+        }
+
+        ret = handoff_init(handoff, handoff_socket_path_config());
+        if (ret < 0) {
+                telem_log(LOG_ERR, "Failed to set up the record hand-off: %s\n",
+                          strerror(-ret));
+                free(handoff);
+                return;
+        }
+        daemon->handoff = handoff;
+}
+
+void close_handoff(TelemDaemon *daemon)
+{
+        if (daemon->handoff == NULL) {
+                return;
+        }
+
+        handoff_close(daemon->handoff);
+        free(daemon->handoff);
+        daemon->handoff = NULL;
+}
+
+void open_admission(TelemDaemon *daemon)
+{
+        struct admission *adm;
+        int ret;
+
+        if (daemon->admission != NULL || !admission_enabled_config()) {
+                return;
+        }
+
+        adm = malloc(sizeof(struct admission));
+        if (!adm) {
+                telem_log(LOG_ERR, "Failed to allocate admission control, aborting\n");
+                exit(EXIT_FAILURE);
+        }
+
+        ret = admission_init(adm, admission_client_limit_config(),
+                             admission_classification_limit_config(),
+                             admission_window_length_config());
+        if (ret < 0) {
+                telem_log(LOG_ERR, "Failed to set up admission control: %s\n",
+                          strerror(-ret));
+                free(adm);
+                return;
+        }
+        daemon->admission = adm;
+}
+
+void close_admission(TelemDaemon *daemon)
+{
+        if (daemon->admission == NULL) {
+                return;
+        }
+
+        if (daemon->admission->rejected > 0) {
+                telem_log(LOG_INFO, "Admission control dropped %" PRIu64 " records\n",
+                          daemon->admission->rejected);
+        }
+        admission_free(daemon->admission);
+        free(daemon->admission);
+        daemon->admission = NULL;
+}
+
+static void machine_id_replace(TelemDaemon *daemon, struct wire_headers *headers,
+                               char *machine_id)
+{
+        /* Copied, since the id may be refreshed while the record is staged */
+        pthread_rwlock_rdlock(&daemon->machine_id_lock);
+        memcpy(machine_id, daemon->machine_id, daemon->machine_id_len + 1);
+        headers->len[TM_MACHINE_ID] = daemon->machine_id_len;
+        pthread_rwlock_unlock(&daemon->machine_id_lock);
+
+        headers->value[TM_MACHINE_ID] = machine_id;
+}
+
+static void write_record(FILE *fp, const struct wire_headers *headers,
+                         char *body, char *cfg_file)
+{
+        // write cfg info if exists
+        if (cfg_file != NULL) {
+                fprintf(fp, "%s%s\n", CFG_PREFIX, cfg_file);
+        }
+
+        // write headers, always in the same order whatever the client sent
+        for (int i = 0; i < NUM_HEADERS; i++) {
+                fprintf(fp, "%s: %.*s\n", get_header_name(i),
+                        (int)headers->len[i], headers->value[i]);
+        }
+
+        // write body
+        fprintf(fp, "%s\n", body);
+}
+
+static void stage_record(char *filepath, const struct wire_headers *headers,
+                         char *body, char *cfg_file)
 {
         int tmpfd;
         FILE *tmpfile = NULL;
@@ -305,18 +1141,7 @@ static void stage_record(char *filepath, char *headers[], char *body, char *cfg_
                 goto clean_exit;
         }
 
-        // write cfg info if exists
-        if (cfg_file != NULL) {
-                fprintf(tmpfile, "%s%s\n", CFG_PREFIX, cfg_file);
-        }
-
-        // write headers
-        for (int i = 0; i < NUM_HEADERS; i++) {
-                fprintf(tmpfile, "%s\n", headers[i]);
-        }
-
-        // write body
-        fprintf(tmpfile, "%s\n", body);
+        write_record(tmpfile, headers, body, cfg_file);
         fflush(tmpfile);
         fclose(tmpfile);
 
@@ -325,27 +1150,91 @@ clean_exit:
         return;
 }
 
-static void process_record(TelemDaemon *daemon, client *cl)
+/* Formats a record in memory, as it is staged in a file */
+static char *format_record(const struct wire_headers *headers, char *body,
+                           char *cfg_file, size_t *size)
+{
+        char *record = NULL;
+        FILE *fp;
+
+        fp = open_memstream(&record, size);
+        if (!fp) {
+                telem_perror("Error formatting record");
+                return NULL;
+        }
+        write_record(fp, headers, body, cfg_file);
+        fclose(fp);
+
+        return record;
+}
+
+static bool hand_off_record(struct handoff *handoff, const struct wire_headers *headers,
+                            char *body, char *cfg_file)
+{
+        char *record;
+        size_t size = 0;
+        int ret;
+
+        record = format_record(headers, body, cfg_file, &size);
+        if (!record) {
+                return false;
+        }
+
+        ret = handoff_send(handoff, record, size);
+        if (ret < 0) {
+                telem_debug("DEBUG: staging record, telempostd did not take it: %s\n",
+                            strerror(-ret));
+        }
+        free(record);
+
+        return ret == 0;
+}
+
+static void append_record(struct staging_log *log, const struct wire_headers *headers,
+                          char *body, char *cfg_file)
+{
+        char *record;
+        size_t size = 0;
+        int ret;
+
+        record = format_record(headers, body, cfg_file, &size);
+        if (!record) {
+                return;
+        }
+
+        ret = staging_log_append(log, record, size);
+        if (ret < 0) {
+                telem_log(LOG_ERR, "Failed to append record to the staging log: %s\n",
+                          strerror(-ret));
+        }
+        free(record);
+}
+
+/**
+ * Parse the headers of a record in place.
+ *
+ * @param buf The record, without its size prefix
+ * @param size Size of the record
+ * @param record Set to the headers, body and configuration file of the record
+ *
+ * @return true if the record is well formed, false if it is to be dropped
+ */
+static bool parse_received_record(uint8_t *buf, size_t size, struct received_record *record)
 {
-        int i = 0;
         int ret = 0;
-        char *headers[NUM_HEADERS];
-        char *tok = NULL;
         size_t header_size = 0;
         size_t message_size = 0;
-        char *temp_headers = NULL;
+        size_t fields_size = sizeof(uint32_t);
         char *msg;
-        char *body;
-        char *recordpath = NULL;
         char *cfg_file = NULL;;
         size_t cfg_info_size = 0;
-        uint8_t *buf;
-
-        buf = cl->buf;
+        uint32_t prefix;
+        bool binary = false;
 
         /* Check for an optional CFG_PREFIX in the first 32 bits */
-        if (*(uint32_t *)buf == CFG_PREFIX_32BIT) {
-                char *cfg  = (char *)cl->buf;
+        memcpy(&prefix, buf, sizeof(uint32_t));
+        if (prefix == CFG_PREFIX_32BIT) {
+                char *cfg  = (char *)buf;
 
                 cfg_file = cfg + CFG_PREFIX_LENGTH;
                 cfg_info_size = CFG_PREFIX_LENGTH + strlen(cfg_file) + 1;
@@ -353,44 +1242,71 @@ static void process_record(TelemDaemon *daemon, client *cl)
         }
 
         buf += cfg_info_size;
-        header_size = *(uint32_t *)buf;
+        memcpy(&prefix, buf, sizeof(uint32_t));
+        /* Binary records (v5) announce themselves in place of the header
+         * size of text records */
+        if (prefix == WIRE_V5_MAGIC) {
+                binary = true;
+                buf += sizeof(uint32_t);
+                fields_size += sizeof(uint32_t);
+                memcpy(&prefix, buf, sizeof(uint32_t));
+        }
+        header_size = prefix;
         /* Header size can not be bigger than buffer size bail out early */
-        if ((uint32_t)header_size >= (uint32_t)cl->size) {
-                return;
+        if (cfg_info_size + fields_size > size ||
+            header_size >= size - cfg_info_size - fields_size) {
+                return false;
         }
-        message_size = cl->size - (cfg_info_size + header_size);
-        telem_debug("DEBUG: cl->size: %ld\n", cl->size);
+        message_size = size - (cfg_info_size + fields_size + header_size);
+        telem_debug("DEBUG: size: %ld\n", size);
         telem_debug("DEBUG: header_size: %ld\n", header_size);
         telem_debug("DEBUG: message_size: %ld\n", message_size);
         telem_debug("DEBUG: cfg_info_size: %ld\n", cfg_info_size);
-        telem_debug("Total: %zu\n", header_size + cfg_info_size + message_size);
-        /* Check message size bounds */
-        if (message_size <= 0 || message_size > MAX_PAYLOAD_LENGTH) {
+        telem_debug("Total: %zu\n", header_size + cfg_info_size + fields_size + message_size);
+        /* Check message size bounds, the payload is followed by a null byte */
+        if (message_size > MAX_PAYLOAD_LENGTH + 1) {
                 telem_log(LOG_INFO, "Record message size out of bounds\n");
-                return;
+                return false;
         }
         msg = (char *)buf + sizeof(uint32_t);
 
-        /* Copying the headers as strtok modifies the orginal buffer */
-        temp_headers = strndup(msg, header_size);
-        tok = strtok(temp_headers, "\n");
+        /* Headers are parsed in place, in whatever order they come */
+        if (binary) {
+                ret = wire_parse_binary(msg, header_size, &record->headers);
+        } else {
+                ret = wire_parse_text(msg, header_size, &record->headers);
+        }
+        if (ret < 0) {
+                telem_log(LOG_ERR, "process_record: Incorrect headers in record\n");
+                return false;
+        }
 
-        for (i = 0; i < NUM_HEADERS; i++) {
-                const char *header_name = get_header_name(i);
+        /* TODO : check if the body is within the limits. */
+        record->body = msg + header_size;
+        record->cfg_file = cfg_file;
 
-                if (get_header(tok, header_name, &headers[i])) {
-                        if (strcmp(header_name, TM_MACHINE_ID_STR) == 0) {
-                                machine_id_replace(&headers[i], daemon->machine_id_override);
-                        }
+        return true;
+}
 
-                        tok = strtok(NULL, "\n");
-                } else {
-                        telem_log(LOG_ERR, "process_record: Incorrect headers in record\n");
-                        goto end;
-                }
+static void stage_received_record(TelemDaemon *daemon, struct received_record *record)
+{
+        struct wire_headers *headers = &record->headers;
+        char machine_id[TM_MACHINE_ID_LEN + 1];
+        char *recordpath = NULL;
+        int ret;
+
+        machine_id_replace(daemon, headers, machine_id);
+
+        /* Staged only if telempostd does not take it right away */
+        if (daemon->handoff != NULL &&
+            hand_off_record(daemon->handoff, headers, record->body, record->cfg_file)) {
+                return;
+        }
+
+        if (daemon->staging_log != NULL) {
+                append_record(daemon->staging_log, headers, record->body, record->cfg_file);
+                return;
         }
-        /* TODO : check if the body is within the limits. */
-        body = msg + header_size;
 
         /* Save record to stage */
         ret = asprintf(&recordpath, "%s/XXXXXX", spool_dir_config());
@@ -399,52 +1315,44 @@ static void process_record(TelemDaemon *daemon, client *cl)
                 exit(EXIT_FAILURE);
         }
 
-        stage_record(recordpath, headers, body, cfg_file);
+        stage_record(recordpath, headers, record->body, record->cfg_file);
         free(recordpath);
-end:
-        free(temp_headers);
-        for (int k = 0; k < i; k++)
-                free(headers[k]);
-        return;
 }
 
-void add_pollfd(TelemDaemon *daemon, int fd, short events)
+static void process_record(TelemDaemon *daemon, uint8_t *buf, size_t size)
 {
-        assert(daemon);
-        assert(fd >= 0);
+        struct received_record record;
 
-        if (!daemon->pollfds) {
-                daemon->pollfds = (struct pollfd *)malloc(sizeof(struct pollfd));
-                if (!daemon->pollfds) {
-                        telem_log(LOG_ERR, "Unable to allocate memory for"
-                                  " pollfds array, exiting\n");
-                        exit(EXIT_FAILURE);
-                }
-                daemon->current_alloc = sizeof(struct pollfd);
-        } else {
-                /* Reallocate here */
-                if (!reallocate((void **)&(daemon->pollfds),
-                                &(daemon->current_alloc),
-                                ((daemon->nfds + 1) * sizeof(struct pollfd)))) {
-                        telem_log(LOG_ERR, "Unable to realloc, exiting\n");
-                        exit(EXIT_FAILURE);
-                }
+        if (parse_received_record(buf, size, &record)) {
+                stage_received_record(daemon, &record);
         }
+}
+
+void watch_fd(TelemDaemon *daemon, watch *w, uint32_t events)
+{
+        struct epoll_event ev;
+
+        assert(daemon);
+        assert(w->fd >= 0);
 
-        daemon->pollfds[daemon->nfds].fd = fd;
-        daemon->pollfds[daemon->nfds].events = events;
-        daemon->pollfds[daemon->nfds].revents = 0;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.ptr = w;
+
+        if (epoll_ctl(daemon->epfd, EPOLL_CTL_ADD, w->fd, &ev) < 0) {
+                telem_perror("Unable to watch file descriptor, exiting");
+                exit(EXIT_FAILURE);
+        }
         daemon->nfds++;
 }
 
-void del_pollfd(TelemDaemon *daemon, nfds_t i)
+void unwatch_fd(TelemDaemon *daemon, watch *w)
 {
         assert(daemon);
-        assert(i < daemon->nfds);
+        assert(daemon->nfds > 0);
 
-        if (i < daemon->nfds - 1) {
-                memmove(&(daemon->pollfds[i]), &(daemon->pollfds[i + 1]),
-                        (sizeof(struct pollfd) * (daemon->nfds - i - 1)));
+        if (epoll_ctl(daemon->epfd, EPOLL_CTL_DEL, w->fd, NULL) < 0) {
+                telem_perror("Failed to stop watching file descriptor");
         }
         daemon->nfds--;
 }
@@ -501,18 +1409,13 @@ file_error:
 
 int generate_machine_id(void)
 {
-        int result = 0;
-        char *new_id = NULL;
+        char new_id[RANDOM_ID_LEN + 1];
 
-        if ((result = get_random_id(&new_id)) != 0) {
-                goto rand_err;
+        if (random_id(new_id) != 0) {
+                return -1;
         }
 
-        result = machine_id_write(new_id);
-rand_err:
-        free(new_id);
-
-        return result;
+        return machine_id_write(new_id);
 }
 
 int update_machine_id()
@@ -527,7 +1430,7 @@ int update_machine_id()
         if (ret == -1) {
                 if (errno == ENOENT) {
                         telem_log(LOG_INFO, "Machine id file does not exist\n");
-                        result = generate_machine_id();
+                        result = generate_machine_id() < 0 ? -1 : 1;
                 } else {
                         telem_log(LOG_ERR, "Unable to stat machine id file\n");
                         result = -1;
@@ -537,7 +1440,7 @@ int update_machine_id()
 
                 if ((current_time - buf.st_mtime) > TM_MACHINE_ID_EXPIRY) {
                         telem_log(LOG_INFO, "Machine id file has expired\n");
-                        result = generate_machine_id();
+                        result = generate_machine_id() < 0 ? -1 : 1;
                 }
         }
         return result;
@@ -18,10 +18,19 @@
 #define _GNU_SOURCE     /* for strchrnul() */
 #define __STDC_FORMAT_MACROS    /* for PRIu64 */
 
-#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/queue.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/socket.h>
+
+#include "buffer_pool.h"
+#include "handoff.h"
+#include "staging_log.h"
 
 #define TM_MACHINE_ID_EXPIRY (3 /*d*/ * 24 /*h*/ * 60 /*m*/ * 60 /*s*/)
 
@@ -29,32 +38,138 @@
 
 #define TM_MACHINE_ID_OVERRIDE "/etc/telemetrics/opt-in-static-machine-id"
 
+/* Longest machine id, which is a random id (see random_id.h) */
+#define TM_MACHINE_ID_LEN 32
+
 #define TM_REFRESH_RATE (1 /*h*/ * 60 /*m*/ * 60 /*s*/)
 
 #define TM_RATE_LIMIT_SLOTS (1 /*h*/ * 60 /*m*/)
 
 #define TM_RECORD_COUNTER (1)
 
+/* How long a claimed ring slot may stay unwritten before it is skipped
+ * and the ring replaced */
+#define TM_RING_STALL_TIME 5
+
+/* Number of events handled per epoll_wait() */
+#define TM_EPOLL_EVENTS 64
+
+/* How long a client may take to send the rest of a record it started */
+#define TM_CLIENT_RECV_TIME 10
+
+/* Number of records queued to a staging worker at most */
+#define TM_WORKER_QUEUE_LEN 64
+
+struct admission;
+struct shm_ring;
+struct record_job;
+struct TelemDaemon;
+
+/* What a file descriptor watched by the daemon is used for */
+enum watch_type {
+        WATCH_SIGNAL,
+        WATCH_LISTENER,
+        WATCH_RING,
+        WATCH_CLIENT,
+        WATCH_MACHINE_ID
+};
+
+/* Registered as the epoll data of a watched file descriptor, so that an
+ * event leads straight to its owner */
+typedef struct watch {
+        enum watch_type type;
+        int fd;
+} watch;
+
+/* Where a stream client is in the record it is sending */
+enum client_state {
+        /* waiting for the size prefix of the next record */
+        CLIENT_READ_SIZE,
+        /* size prefix validated, waiting for the rest of the record */
+        CLIENT_READ_RECORD
+};
+
 typedef struct client {
         int fd;
+        /* epoll registration of fd, see client_of() */
+        watch watch;
+        /* connected through the SOCK_SEQPACKET listener, one record per message */
+        bool seqpacket;
+        /* peer of the connection, with a pid of 0 if it is not known */
+        struct ucred cred;
+        /* data received from the client that was not processed yet */
         uint8_t *buf;
+        /* number of bytes held in buf */
         size_t offset;
+        /* allocated size of buf */
         size_t size;
+        enum client_state state;
+        /* size of the record being received, in CLIENT_READ_RECORD */
+        uint32_t record_size;
+        /* when the client is dropped if the record in buf is still partial */
+        time_t deadline;
+        /* on the daemon's partial list, see expire_clients() */
+        bool partial;
         LIST_ENTRY(client) client_ptrs;
+        TAILQ_ENTRY(client) partial_ptrs;
 } client;
 
 typedef LIST_HEAD (client_list_head, client) client_list_head;
 
+typedef TAILQ_HEAD (client_partial_head, client) client_partial_head;
+
+/* Thread validating and staging the records of some of the clients. Its
+ * queue has a single producer, the thread running the event loop, and the
+ * semaphores count the free and the queued records. */
+typedef struct worker {
+        pthread_t thread;
+        struct TelemDaemon *daemon;
+        /* records to stage, in the order they were received */
+        struct record_job *jobs[TM_WORKER_QUEUE_LEN];
+        /* next record to stage, only used by the worker */
+        size_t head;
+        /* next free slot, only used by the event loop */
+        size_t tail;
+        sem_t free_jobs;
+        sem_t used_jobs;
+} worker;
+
 typedef struct TelemDaemon {
-        /* array of fd's being polled */
-        struct pollfd  *pollfds;
-        /* number of fds being polled */
-        nfds_t nfds;
-        /* current number of allocated fds */
-        size_t current_alloc;
+        /* epoll instance watching the listeners, clients, signals and ring */
+        int epfd;
+        /* number of fds being watched */
+        size_t nfds;
         /* client list head */
         client_list_head client_head;
+        /* clients holding a partial record, by increasing deadline */
+        client_partial_head partial_head;
         char *machine_id_override;
+        /* machine id substituted into every record, see refresh_machine_id() */
+        char machine_id[TM_MACHINE_ID_LEN + 1];
+        size_t machine_id_len;
+        /* the workers read machine_id while the event loop refreshes it */
+        pthread_rwlock_t machine_id_lock;
+        /* inotify instance watching the machine id files */
+        watch machine_id_watch;
+        /* receive buffer shared by SOCK_SEQPACKET clients */
+        uint8_t *msg_buf;
+        /* receive buffers of stream clients */
+        struct buffer_pool client_bufs;
+        /* shared memory ring handed out to clients, see shm_ring.h */
+        struct shm_ring *ring;
+        /* epoll registration of the ring's eventfd */
+        watch ring_watch;
+        /* when the ring was first seen stalled, 0 if it is not */
+        time_t ring_stall;
+        /* staging workers, records are staged inline if there are none */
+        worker *workers;
+        int nworkers;
+        /* staging log records are appended to, NULL to stage files */
+        struct staging_log *staging_log;
+        /* connection records are handed to telempostd on, NULL to stage them */
+        struct handoff *handoff;
+        /* admission control of records, NULL to admit them all */
+        struct admission *admission;
 } TelemDaemon;
 
 /**
@@ -65,35 +180,109 @@ typedef struct TelemDaemon {
 void initialize_probe_daemon(TelemDaemon *daemon);
 
 /**
- * Add poll fd struct to the array of pollfds.
+ * Start watching a file descriptor. The watch is returned as is by
+ * epoll_wait() when the descriptor is ready, so it must stay valid until
+ * unwatch_fd() is called.
  *
  * @param daemon The pointer to the daemon struct
- * @param fd The file descriptor to add
- * @param events The events to poll for
+ * @param w The watch, with its type and fd set
+ * @param events The epoll events to watch for
  *
  */
-void add_pollfd(TelemDaemon *daemon, int fd, short events);
+void watch_fd(TelemDaemon *daemon, watch *w, uint32_t events);
 
 /**
- *  Delete poll fd struct at index i of the array
+ * Stop watching a file descriptor.
  *
  * @param daemon The pointer to the daemon
- * @param i The index of the file decriptor to be deleted
+ * @param w The watch passed to watch_fd()
+ *
+ */
+void unwatch_fd(TelemDaemon *daemon, watch *w);
+
+/**
+ * Get the client a watch belongs to.
+ *
+ * @param w A watch of type WATCH_CLIENT
  *
+ * @return The client
  */
-void del_pollfd(TelemDaemon *daemon, nfds_t i);
+static inline client *client_of(watch *w)
+{
+        return (client *)((char *)w - offsetof(client, watch));
+}
 
 /**
- * Handle data received on a client connection
+ * Handle data received on a client connection. A client may send any
+ * number of records over the same connection. Data is read from the socket
+ * in large chunks and every complete record in a chunk is processed in one
+ * pass; a partially received record is kept in the client buffer until
+ * more data arrives, within a deadline (see expire_clients()). On a
+ * SOCK_SEQPACKET connection every message holds exactly one record, and
+ * several messages are received per system call.
+ * The client is terminated when it closes the connection or sends an
+ * invalid record.
  *
  * @param daemon The pointer to the daemon
- * @param ind The index of the client's file desciptor in the
- *    pollfd array
  * @param cl Pointer to the client structure in the client list
  *
- * @return true on success, false on failure
+ * @return true if at least one record was processed, false otherwise
+ */
+bool handle_client(TelemDaemon *daemon, client *cl);
+
+/**
+ * Terminate the clients that did not finish sending a record in time.
+ * A client gets TM_CLIENT_RECV_TIME seconds from the last data it sent
+ * to complete a record it started; idle clients are kept.
+ *
+ * @param daemon The pointer to the daemon
+ * @param now The current time
+ *
+ * @return The number of seconds until the next deadline, or -1 if no
+ *    client is sending a record
  */
-bool handle_client(TelemDaemon *daemon, nfds_t ind, client *cl);
+int expire_clients(TelemDaemon *daemon, time_t now);
+
+/**
+ * Process the records written to the shared memory ring, until it is
+ * empty. Called when the ring's eventfd is signaled, and periodically, so
+ * that a slot left unwritten by a producer that died is eventually skipped.
+ * The ring is then closed, and a new one created on the next ring request.
+ *
+ * @param daemon The pointer to the daemon
+ *
+ * @return true if at least one record was processed, false otherwise
+ */
+bool handle_ring(TelemDaemon *daemon);
+
+/**
+ * Close the shared memory ring, if one was created, process what is left
+ * in it and release it. Clients stop writing to a closed ring and fall
+ * back to the socket, as do those still writing a slot of it.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void close_ring(TelemDaemon *daemon);
+
+/**
+ * Start the threads that validate and stage records. Complete records are
+ * then queued to a worker by the thread that received them, which waits
+ * only if that worker is TM_WORKER_QUEUE_LEN records behind. All records
+ * received on one file descriptor go to the same worker, so the records
+ * of a client are staged in the order it sent them.
+ *
+ * @param daemon The pointer to the daemon
+ * @param count Number of workers, 0 to keep staging records inline
+ */
+void start_workers(TelemDaemon *daemon, int count);
+
+/**
+ * Stage every queued record and stop the workers. Records are staged
+ * inline until start_workers() is called again.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void stop_workers(TelemDaemon *daemon);
 
 /**
  *  Add a client to the client list
@@ -135,10 +324,93 @@ bool get_machine_id(char *machine_id);
 /**
  *  Update machine id periodically
  *
- * @return 0 on success, -1 on failure
+ * @return 1 if a new machine id was generated, 0 if the current one is
+ *    kept, -1 on failure
  */
 int update_machine_id(void);
 
+/**
+ * Reload the machine id substituted into records, which is the static
+ * override if there is one, or the id in the machine id file. Records do
+ * not read the file themselves, so this must be called whenever it
+ * changes.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void refresh_machine_id(TelemDaemon *daemon);
+
+/**
+ * Watch the machine id file and the override file with inotify, so that
+ * changes made by other processes are picked up. Does nothing but log an
+ * error if they cannot be watched.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void watch_machine_id(TelemDaemon *daemon);
+
+/**
+ * Read the pending inotify events of the machine id watch, and reload the
+ * override and the machine id if either file changed.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void handle_machine_id_change(TelemDaemon *daemon);
+
+/**
+ * Stop watching the machine id files.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void close_machine_id_watch(TelemDaemon *daemon);
+
+/**
+ * Open the staging log if the configuration selects it, so that records
+ * are appended to it rather than staged in files of their own. The workers
+ * must be stopped.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void open_staging_log(TelemDaemon *daemon);
+
+/**
+ * Close the staging log, if it is open. The workers must be stopped.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void close_staging_log(TelemDaemon *daemon);
+
+/**
+ * Prepare to hand records to telempostd if the configuration enables it.
+ * The workers must be stopped.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void open_handoff(TelemDaemon *daemon);
+
+/**
+ * Stop handing records to telempostd. The workers must be stopped.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void close_handoff(TelemDaemon *daemon);
+
+/**
+ * Set up admission control if the configuration enables it, so that
+ * records of clients and classifications sending too many are dropped
+ * before they are staged. The workers must be stopped.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void open_admission(TelemDaemon *daemon);
+
+/**
+ * Release admission control, logging how many records it dropped. The
+ * workers must be stopped.
+ *
+ * @param daemon The pointer to the daemon
+ */
+void close_admission(TelemDaemon *daemon);
+
 /**
  * Reads the machine id from the machine id override file if it exists.
  *
@@ -27,16 +27,70 @@
 #include <errno.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <limits.h>
 #include <inttypes.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "common.h"
 #include "configuration.h"
 #include "telemetry.h"
+#include "shm_ring.h"
+#include "random_id.h"
+#include "wire.h"
 #include "log.h"
 
+/* Default for how long a send may wait for the daemon to drain its socket */
+#define TM_WRITE_TIMEOUT_MS 1000
+
+/* A connection to telemprobd that is reused for many records */
+struct telem_session {
+        int fd;
+        /* SOCK_SEQPACKET if connected to the message oriented socket */
+        int type;
+        /* send deadline in milliseconds, 0 for non-blocking, -1 for none */
+        int timeout_ms;
+        /* rest of a non-blocking send the socket did not take yet */
+        char *pending;
+        size_t pending_len;
+        size_t pending_off;
+        /* ask the daemon for its shared memory ring on (re)connect */
+        bool use_ring;
+        /* ring obtained over the current connection, or NULL */
+        struct shm_ring *ring;
+        /* CLOCK_MONOTONIC second until which the daemon asked us to wait */
+        time_t backoff_until;
+        /* notice being read, which a SOCK_STREAM connection may split */
+        struct admission_notice notice;
+        size_t notice_len;
+};
+
+/*
+ * Number of iovec entries needed to frame one record: the record size,
+ * the optional CFG prefix and path, the wire format magic and header size,
+ * and the record's arena (headers and payload including its terminating
+ * null byte).
+ */
+#define TM_FRAME_IOV 5
+
+/* A reference and the record it points to share one allocation */
+struct record_block {
+        struct telem_ref ref;
+        struct telem_record record;
+};
+
+/* A record framed for the wire, pointing into the record's own storage */
+struct tm_frame {
+        uint32_t record_size;
+        /* WIRE_V5_MAGIC and the header size, sent together */
+        uint32_t header_fields[2];
+        struct iovec iov[TM_FRAME_IOV];
+        size_t iovcnt;
+};
+
 /**
  * Return a file descriptor to either site's version file
  * or the distributions version file, in that order of
@@ -58,94 +112,77 @@ static int version_file(void)
 }
 
 /**
- * Helper function for the set_*_header functions that actually sets
- * the header and increments the header size. These headers become attributes
- * on an HTTP_POST transaction.
+ * Length of a string header value in the wire format. Longer values would
+ * not fit in a record telemprobd accepts anyway.
  *
- * @param dest The header string, which will be "prefix: dest\n"
- * @param prefix Identifies the header.
- * @param value The value of this particular header.
- * @param header_size Is incremented if header is successfully initialized.
+ * @param value The value of the header.
  *
- * @return 0 if successful, or a negative errno-style value if not.
+ * @return The length of the value that is sent.
  *
  */
-static int set_header(char **dest, const char *prefix, char *value, size_t *header_size)
+static size_t header_value_length(const char *value)
 {
-        int rc;
-
-        rc = asprintf(dest, "%s: %s\n", prefix, value);
-
-        if (rc < 0) {
-                telem_log(LOG_CRIT, "CRIT: Out of memory\n");
-                return -ENOMEM;
-        } else {
-                *header_size += (size_t)rc;
-                return 0;
-        }
+        size_t len = strlen(value);
 
+        return len < WIRE_MAX_STR_LEN ? len : WIRE_MAX_STR_LEN;
 }
 
 /**
- * Sets the severity header.  Severity is clamped to a ranage of 1-4.
+ * Append room for one encoded header to the record's arena, which is kept
+ * null-terminated.
  *
- * @param t_ref Reference to a Telemetry record.
- * @param severity Severity of issue this telemetry record pertains to.
- *     Severity is clamped to a range of 1-4.
+ * @param record The record to append the header to.
+ * @param id Index of the header, one of the TM_* header ids.
+ * @param len Encoded size of the header.
  *
- * @return 0 if successful, or a negative errno-style value if not.
+ * @return Where to encode the header, or NULL if out of memory.
  *
  */
-static int set_severity_header(struct telem_ref *t_ref, uint32_t severity)
+static char *reserve_header(struct telem_record *record, int id, size_t len)
 {
-        char *buf = NULL;
-        int status = 0;
-        int rc = 0;
+        char *arena;
 
-        /* clamp severity to 1-4 */
-
-        if (severity > 4) {
-                severity = 4;
-        }
-
-        if (severity < 1) {
-                severity = 1;
+        arena = realloc(record->arena, record->header_size + len + 1);
+        if (arena == NULL) {
+                telem_log(LOG_CRIT, "CRIT: Out of memory\n");
+                return NULL;
         }
 
-        rc = asprintf(&buf, "%" PRIu32, severity);
-
-        if (rc < 0) {
-                return -ENOMEM;
-        } else {
-                status = set_header(&(t_ref->record->headers[TM_SEVERITY]),
-                                    TM_SEVERITY_STR, buf, &(t_ref->record->header_size));
-                free(buf);
-        }
+        record->arena = arena;
+        record->header_off[id] = record->header_size;
+        record->header_len[id] = len;
+        record->header_size += len;
+        arena[record->header_size] = '\0';
 
-        return status;
+        return arena + record->header_off[id];
 }
 
 /**
- * Sets the classification header.
+ * Helper function for the set_*_header functions that actually sets
+ * the header and increments the header size. These headers become attributes
+ * on an HTTP_POST transaction. The header is appended to the record's arena
+ * in the binary wire format (see wire.h), so it is only used to build the
+ * host header snapshot; records themselves are laid out in one go by
+ * allocate_header().
  *
- * @param t_ref Reference to a Telemetry record.
- * @param classification Classification header is confirmed to
- *     to at least contain two / characters, and should be of the format
- *     <string>/<string>/<string>.
+ * @param record The record to append the header to.
+ * @param id Index of the header, one of the TM_* header ids.
+ * @param value The value of this particular header.
  *
  * @return 0 if successful, or a negative errno-style value if not.
  *
  */
-static int set_classification_header(struct telem_ref *t_ref, char *classification)
+static int set_header(struct telem_record *record, int id, const char *value)
 {
+        size_t len = header_value_length(value);
+        char *dest;
 
-        if (validate_classification(classification) == 1) {
-                return -EINVAL;
+        if ((dest = reserve_header(record, id, wire_str_size(len))) == NULL) {
+                return -ENOMEM;
         }
+        wire_put_str(dest, id, value, len);
 
-        return set_header(&(t_ref->record->headers[TM_CLASSIFICATION]),
-                          TM_CLASSIFICATION_STR, classification,
-                          &(t_ref->record->header_size));
+        return 0;
 }
 
 /**
@@ -161,23 +198,16 @@ static int set_classification_header(struct telem_ref *t_ref, char *classificati
  */
 static int set_record_format_header(struct telem_ref *t_ref)
 {
-        char *buf = NULL;
-        int rc;
-        int status = 0;
+        char *dest;
 
-        rc = asprintf(&buf, "%" PRIu32, RECORD_FORMAT_VERSION);
-
-        if (rc < 0) {
+        dest = reserve_header(t_ref->record, TM_RECORD_VERSION,
+                              wire_num_size(TM_RECORD_VERSION));
+        if (dest == NULL) {
                 return -ENOMEM;
-        } else {
-                status = set_header(&(t_ref->record->headers[TM_RECORD_VERSION]),
-                                    TM_RECORD_VERSION_STR, buf,
-                                    &(t_ref->record->header_size));
-
-                free(buf);
         }
+        wire_put_num(dest, TM_RECORD_VERSION, RECORD_FORMAT_VERSION);
 
-        return status;
+        return 0;
 }
 
 /**
@@ -207,8 +237,7 @@ static int set_arch_header(struct telem_ref *t_ref)
         if (rc < 0) {
                 return -ENOMEM;
         } else {
-                status = set_header(&(t_ref->record->headers[TM_ARCH]), TM_ARCH_STR,
-                                    buf, &(t_ref->record->header_size));
+                status = set_header(t_ref->record, TM_ARCH, buf);
 
                 free(buf);
         }
@@ -273,9 +302,7 @@ static int set_system_name_header(struct telem_ref *t_ref)
                 }
         }
 
-        return set_header(&(t_ref->record->headers[TM_SYSTEM_NAME]),
-                          TM_SYSTEM_NAME_STR, buf,
-                          &(t_ref->record->header_size));
+        return set_header(t_ref->record, TM_SYSTEM_NAME, buf);
 
 }
 
@@ -318,8 +345,7 @@ static int set_system_build_header(struct telem_ref *t_ref)
                 fclose(fs);
         }
 
-        return set_header(&(t_ref->record->headers[TM_SYSTEM_BUILD]),
-                          TM_SYSTEM_BUILD_STR, version, &(t_ref->record->header_size));
+        return set_header(t_ref->record, TM_SYSTEM_BUILD, version);
 
 }
 
@@ -348,39 +374,8 @@ static int set_machine_id_header(struct telem_ref *t_ref)
         if (rc < 0) {
                 return -ENOMEM;
         } else {
-                status = set_header(&(t_ref->record->headers[TM_MACHINE_ID]),
-                                    TM_MACHINE_ID_STR, buf, &(t_ref->record->header_size));
-
-                free(buf);
-        }
-
-        return status;
-}
-
-/**
- * Sets the header reporting the timestamp for the creation of the telemetry
- * record.
- *
- * @param t_ref Telemetry Record reference obtained from tm_create_record.
- *
- * @return 0 if successful, or a negative errno-style value if not.
- *
- */
-static int set_timestamp_header(struct telem_ref *t_ref)
-{
-
-        time_t *t = NULL;
-        char *buf;
-        int rc = 0;
-        int status = 0;
+                status = set_header(t_ref->record, TM_MACHINE_ID, buf);
 
-        rc = asprintf(&buf, "%zd", time(t));
-
-        if (rc < 0) {
-                return -ENOMEM;
-        } else {
-                status = set_header(&(t_ref->record->headers[TM_TIMESTAMP]),
-                                    TM_TIMESTAMP_STR, buf, &(t_ref->record->header_size));
                 free(buf);
         }
 
@@ -428,10 +423,7 @@ static int set_cpu_model_header(struct telem_ref *t_ref)
                         telem_log(LOG_NOTICE, "NOTICE: Unable to find attribute:%s\n", attr_name);
                 }
 
-                status = set_header(
-                        &(t_ref->record->headers[TM_CPU_MODEL]),
-                        TM_CPU_MODEL_STR, model_name,
-                        &(t_ref->record->header_size));
+                status = set_header(t_ref->record, TM_CPU_MODEL, model_name);
 
         } else {
                 telem_log(LOG_NOTICE, "NOTICE: Unable to open /proc/cpuinfo\n");
@@ -564,10 +556,7 @@ static int set_board_name_header(struct telem_ref *t_ref)
                 status = -ENOMEM;
                 goto cleanup;
         } else {
-                status = set_header(
-                        &(t_ref->record->headers[TM_BOARD_NAME]),
-                        TM_BOARD_NAME_STR, buf,
-                        &(t_ref->record->header_size));
+                status = set_header(t_ref->record, TM_BOARD_NAME, buf);
                 free(buf);
         }
 
@@ -602,44 +591,13 @@ static int set_bios_version_header(struct telem_ref *t_ref)
         if (rc < 0) {
                 status = rc;
         } else {
-                status = set_header(
-                        &(t_ref->record->headers[TM_BIOS_VERSION]),
-                        TM_BIOS_VERSION_STR, bios_version,
-                        &(t_ref->record->header_size));
+                status = set_header(t_ref->record, TM_BIOS_VERSION, bios_version);
                 free(bios_version);
         }
 
         return status;
 }
 
-/**
- * Sets the event_id header, this id is an identifier that multiple
- * records can share. This means that one event can lead to multiple
- * records.
- *
- * @param t_ref Telemetry Record reference obtained from tm_create_record.
- *
- * @return 0 if successful, -1 on failure
- *
- */
-static int set_event_id_header(struct telem_ref *t_ref)
-{
-        int rc = 0;
-        char *buff = NULL;
-
-        rc = get_random_id(&buff);
-
-        if (rc == 0) {
-                rc = set_header(
-                        &(t_ref->record->headers[TM_EVENT_ID]),
-                        TM_EVENT_ID_STR, buff,
-                        &(t_ref->record->header_size));
-        }
-        free(buff);
-
-        return rc;
-}
-
 /**
  * Sets the hosttype header, which is a tuple of three values looked for
  * in the dmi filesystem.  System Vendor (sys_vendor), Product Name
@@ -684,8 +642,7 @@ static int set_host_type_header(struct telem_ref *t_ref)
                 status = -ENOMEM;
                 goto cleanup;
         } else {
-                status = set_header(&(t_ref->record->headers[TM_HOST_TYPE]),
-                                    TM_HOST_TYPE_STR, buf, &(t_ref->record->header_size));
+                status = set_header(t_ref->record, TM_HOST_TYPE, buf);
                 free(buf);
         }
 
@@ -733,60 +690,140 @@ static int set_kernel_version_header(struct telem_ref *t_ref)
         if (rc < 0) {
                 return -ENOMEM;
         } else {
-                status = set_header(
-                        &(t_ref->record->headers[TM_KERNEL_VERSION]),
-                        TM_KERNEL_VERSION_STR, buf,
-                        &(t_ref->record->header_size));
+                status = set_header(t_ref->record, TM_KERNEL_VERSION, buf);
                 free(buf);
         }
 
         return status;
 }
 
+int tm_set_config_file(const char *c_file)
+{
+        return set_config_file(c_file);
+}
+
+/* Headers describing the host (architecture, DMI values, os-release data,
+ * kernel version, cpu model) only change across reboots or system updates,
+ * so they are generated once per process and copied into every new record.
+ * The snapshot is rebuilt when the os-release file is replaced or modified.
+ * Only its arena, header_off and header_len are used.
+ */
+struct host_headers {
+        bool valid;
+        dev_t version_dev;
+        ino_t version_ino;
+        struct timespec version_mtime;
+        struct telem_record record;
+};
+
+static struct host_headers host_cache;
+static pthread_mutex_t host_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
- * Sets the payload format header, which is a probe-specific version number
- * for the format of the payload. This is a hint to the back-end that parses records.
+ * Stat the os-release file used by version_file(), so that the host header
+ * snapshot can be invalidated whenever that file changes.
  *
- * @param t_ref Telemetry Record reference obtained from tm_create_record.
- * @param payload_version Version number provided by probe.
+ * @param buf Stat buffer to fill.
  *
- * @return 0 if successful, or a negative errno-style value if not.
+ * @return 0 if successful, or -1 if neither os-release file exists.
  *
  */
-static int set_payload_format_header(struct telem_ref *t_ref, uint32_t payload_version)
+static int version_file_stat(struct stat *buf)
 {
-        char *buf = NULL;
-        int rc;
-        int status = 0;
+        if (stat(TM_SITE_VERSION_FILE, buf) == 0) {
+                return 0;
+        }
 
-        rc = asprintf(&buf, "%" PRIu32, payload_version);
+        return stat(TM_DIST_VERSION_FILE, buf);
+}
 
-        if (rc < 0) {
-                return -ENOMEM;
-        } else {
-                status = set_header(
-                        &(t_ref->record->headers[TM_PAYLOAD_VERSION]),
-                        TM_PAYLOAD_VERSION_STR, buf,
-                        &(t_ref->record->header_size));
-                free(buf);
+static void free_host_headers(void)
+{
+        free(host_cache.record.arena);
+        memset(&host_cache.record, 0, sizeof(host_cache.record));
+        host_cache.valid = false;
+}
+
+__attribute__((destructor))
+static void release_host_headers(void)
+{
+        free_host_headers();
+}
+
+/**
+ * Generate the host headers into the process wide snapshot. Must be called
+ * with host_cache_lock held.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ *
+ */
+static int build_host_headers(void)
+{
+        struct telem_ref host_ref = { &host_cache.record };
+        int ret = 0;
+
+        free_host_headers();
+
+        if ((ret = set_record_format_header(&host_ref)) < 0 ||
+            (ret = set_machine_id_header(&host_ref)) < 0 ||
+            (ret = set_arch_header(&host_ref)) < 0 ||
+            (ret = set_host_type_header(&host_ref)) < 0 ||
+            (ret = set_system_build_header(&host_ref)) < 0 ||
+            (ret = set_kernel_version_header(&host_ref)) < 0 ||
+            (ret = set_system_name_header(&host_ref)) < 0 ||
+            (ret = set_board_name_header(&host_ref)) < 0 ||
+            (ret = set_cpu_model_header(&host_ref)) < 0 ||
+            (ret = set_bios_version_header(&host_ref)) < 0) {
+                free_host_headers();
+                return ret;
         }
 
-        return status;
+        host_cache.valid = true;
+
+        return 0;
 }
 
-int tm_set_config_file(const char *c_file)
+/**
+ * Refresh the host header snapshot if it was never built or if the
+ * os-release file changed since. Must be called with host_cache_lock held.
+ *
+ * @param buf Current stat of the os-release file, see version_file_stat().
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ *
+ */
+static int refresh_host_headers(const struct stat *buf)
 {
-        return set_config_file(c_file);
+        int ret = 0;
+
+        if (!host_cache.valid ||
+            buf->st_dev != host_cache.version_dev ||
+            buf->st_ino != host_cache.version_ino ||
+            buf->st_mtim.tv_sec != host_cache.version_mtime.tv_sec ||
+            buf->st_mtim.tv_nsec != host_cache.version_mtime.tv_nsec) {
+                if ((ret = build_host_headers()) < 0) {
+                        return ret;
+                }
+                host_cache.version_dev = buf->st_dev;
+                host_cache.version_ino = buf->st_ino;
+                host_cache.version_mtime = buf->st_mtim;
+        }
+
+        return 0;
 }
 
 /**
- * Helper function for tm_create_record().  Allocate all of the headers
- * for a new telemetrics record. The parameters are passed through from
- * tm_create_record to this function.
+ * Helper function for tm_create_record().  Lay out all of the headers
+ * for a new telemetrics record in its arena, in the binary wire format
+ * (see wire.h). The parameters
+ * are passed through from tm_create_record to this function. Headers that
+ * only depend on the host are copied from a per-process snapshot; see
+ * refresh_host_headers().
  *
  * @param t_ref Telemetry Record reference obtained from tm_create_record.
  * @param severity Severity field value. Accepted values are in the range 1-4,
  *     with 1 being the lowest severity, and 4 being the highest severity.
+ *     Values out of that range are clamped to it.
  * @param classification Classification field value. It should have the form
  *     DOMAIN/PROBENAME/REST: DOMAIN is the reverse domain to use as a namespace
  *     for the probe (e.g. org.clearlinux); PROBENAME is the name of the probe;
@@ -803,143 +840,125 @@ int tm_set_config_file(const char *c_file)
 int allocate_header(struct telem_ref *t_ref, uint32_t severity,
                     char *classification, uint32_t payload_version)
 {
-
-        int k, i = 0;
+        struct telem_record *record = t_ref->record;
+        const char *values[NUM_HEADERS] = { NULL };
+        uint64_t numbers[NUM_HEADERS] = { 0 };
+        bool is_number[NUM_HEADERS] = { false };
+        char event_id[RANDOM_ID_LEN + 1];
+        struct stat buf;
+        size_t size = 0;
+        size_t len;
+        char *p;
         int ret = 0;
+        int k;
 
-        /* The order we create the headers matters */
-
-        if ((ret = set_record_format_header(t_ref)) < 0) {
-                goto free_and_fail;
-        }
-
-        i++;
-
-        if ((ret = set_classification_header(t_ref, classification)) < 0) {
-                goto free_and_fail;
-        }
-
-        i++;
-
-        if ((ret = set_severity_header(t_ref, severity)) < 0) {
-                goto free_and_fail;
-        }
-
-        i++;
-
-        if ((ret = set_machine_id_header(t_ref)) < 0) {
-                goto free_and_fail;
-        }
-
-        i++;
-
-        if ((ret = set_timestamp_header(t_ref)) < 0) {
-                goto free_and_fail;
-        }
-
-        i++;
-
-        if ((ret = set_arch_header(t_ref)) < 0) {
-                goto free_and_fail;
-        }
-
-        i++;
-
-        if ((ret = set_host_type_header(t_ref)) < 0) {
-                goto free_and_fail;
+        if (validate_classification(classification) == 1) {
+                return -EINVAL;
         }
 
-        i++;
-
-        if ((ret = set_system_build_header(t_ref)) < 0) {
-                goto free_and_fail;
+        /* clamp severity to 1-4 */
+        if (severity > 4) {
+                severity = 4;
         }
 
-        i++;
-
-        if ((ret = set_kernel_version_header(t_ref)) < 0) {
-                goto free_and_fail;
+        if (severity < 1) {
+                severity = 1;
         }
 
-        i++;
-
-        if ((ret = set_payload_format_header(t_ref, payload_version)) < 0) {
-                goto free_and_fail;
+        if ((ret = random_id(event_id)) != 0) {
+                return ret;
         }
 
-        i++;
+        /* Headers describing the record itself; the others describe the host */
+        values[TM_CLASSIFICATION] = classification;
+        values[TM_EVENT_ID] = event_id;
+        numbers[TM_SEVERITY] = severity;
+        numbers[TM_TIMESTAMP] = (uint64_t)time(NULL);
+        numbers[TM_PAYLOAD_VERSION] = payload_version;
+        is_number[TM_SEVERITY] = true;
+        is_number[TM_TIMESTAMP] = true;
+        is_number[TM_PAYLOAD_VERSION] = true;
 
-        if ((ret = set_system_name_header(t_ref)) < 0) {
-                goto free_and_fail;
-        }
+        memset(&buf, 0, sizeof(buf));
+        version_file_stat(&buf);
 
-        i++;
+        pthread_mutex_lock(&host_cache_lock);
 
-        if ((ret = set_board_name_header(t_ref)) < 0) {
-                goto free_and_fail;
+        if ((ret = refresh_host_headers(&buf)) < 0) {
+                goto unlock;
         }
 
-        i++;
-
-        if ((ret = set_cpu_model_header(t_ref)) < 0) {
-                goto free_and_fail;
+        for (k = 0; k < NUM_HEADERS; k++) {
+                if (is_number[k]) {
+                        size += wire_num_size(k);
+                } else if (values[k] != NULL) {
+                        size += wire_str_size(header_value_length(values[k]));
+                } else {
+                        size += host_cache.record.header_len[k];
+                }
         }
 
-        i++;
-
-        if ((ret = set_bios_version_header(t_ref)) < 0) {
-                goto free_and_fail;
+        /* Room for the null byte terminating a record without payload */
+        record->arena = malloc(size + 1);
+        if (record->arena == NULL) {
+                telem_log(LOG_CRIT, "CRIT: Out of memory\n");
+                ret = -ENOMEM;
+                goto unlock;
         }
 
-        i++;
-
-        if ((ret = set_event_id_header(t_ref)) < 0) {
-                goto free_and_fail;
+        p = record->arena;
+        for (k = 0; k < NUM_HEADERS; k++) {
+                if (is_number[k]) {
+                        len = wire_put_num(p, k, numbers[k]);
+                } else if (values[k] != NULL) {
+                        len = wire_put_str(p, k, values[k],
+                                           header_value_length(values[k]));
+                } else {
+                        len = host_cache.record.header_len[k];
+                        memcpy(p, host_cache.record.arena +
+                               host_cache.record.header_off[k], len);
+                }
+                record->header_off[k] = (size_t)(p - record->arena);
+                record->header_len[k] = len;
+                p += len;
         }
+        *p = '\0';
 
-        i++; /* Not necessary, but including for future expansion */
+        record->header_size = size;
 
-        return ret;
+unlock:
+        pthread_mutex_unlock(&host_cache_lock);
 
-free_and_fail:
-        for (k = 0; k < i; k++) {
-                free(t_ref->record->headers[k]);
-        }
         return ret;
-
 }
 
 int tm_create_record(struct telem_ref **t_ref, uint32_t severity,
                      char *classification, uint32_t payload_version)
 {
+        struct record_block *block;
         int ret = 0;
 
-        *t_ref = (struct telem_ref *)malloc(sizeof(struct telem_ref));
-        if (*t_ref == NULL) {
-                telem_log(LOG_CRIT, "CRIT: Out of memory\n");
-                return -ENOMEM;
-        }
-
-        (*t_ref)->record = (struct telem_record *)malloc(sizeof(struct telem_record));
-        if ((*t_ref)->record == NULL) {
+        block = (struct record_block *)malloc(sizeof(struct record_block));
+        if (block == NULL) {
                 telem_log(LOG_CRIT, "CRIT: Out of memory\n");
-                free(*t_ref);
                 return -ENOMEM;
         }
 
-        // Need to initialize header size, since it is only incremented elsewhere
-        (*t_ref)->record->header_size = 0;
+        block->ref.record = &block->record;
+        *t_ref = &block->ref;
 
         /* tm_set_payload() may not be called (e.g. in our test suite); in this
-         * case, initialize the payload member to NULL so that we can properly
-         * detect a non-NULL value in tm_free_record().
+         * case the payload is empty and the arena only holds the headers.
          */
-        (*t_ref)->record->payload = NULL;
+        block->record.arena = NULL;
+        block->record.header_size = 0;
+        block->record.payload = NULL;
+        block->record.payload_size = 0;
 
         /* Set up the headers */
         if ((ret = allocate_header(*t_ref, severity, classification, payload_version)) < 0) {
-                free((*t_ref)->record);
-                free(*t_ref);
+                free(block);
+                *t_ref = NULL;
         }
 
         return ret;
@@ -971,10 +990,11 @@ int payload_is_ascii(char *payload, size_t len)
         return ret;
 }
 
-// TODO: Consider simply setting a pointer to point to data provide in payload instead of copying it?
 int tm_set_payload(struct telem_ref *t_ref, char *payload)
 {
+        struct telem_record *record = t_ref->record;
         size_t payload_len;
+        char *arena;
         int ret = 0;
 
         if (payload == NULL) {
@@ -988,14 +1008,18 @@ int tm_set_payload(struct telem_ref *t_ref, char *payload)
                 return -EINVAL;
         }
 
-        t_ref->record->payload = strndup(payload, payload_len);
-
-        if (!t_ref->record->payload) {
+        /* The payload goes right after the headers, in the same arena */
+        arena = realloc(record->arena, record->header_size + payload_len + 1);
+        if (!arena) {
                 telem_log(LOG_CRIT, "CRIT: Out of memory\n");
                 return -ENOMEM;
         }
 
-        t_ref->record->payload_size = payload_len;
+        record->arena = arena;
+        record->payload = arena + record->header_size;
+        memcpy(record->payload, payload, payload_len);
+        record->payload[payload_len] = '\0';
+        record->payload_size = payload_len;
 
         return ret;
 }
@@ -1039,11 +1063,14 @@ int tm_set_event_id(struct telem_ref *t_ref, char *event_id)
 
         if (!validate_event_id(event_id)) {
                 if (t_ref && t_ref->record) {
-                        // free default id before overriding
-                        free(t_ref->record->headers[TM_EVENT_ID]);
-                        // set new event_id
-                        if (asprintf(&(t_ref->record->headers[TM_EVENT_ID]),
-                                     "%s: %s\n", TM_EVENT_ID_STR, event_id) > 0) {
+                        struct telem_record *record = t_ref->record;
+
+                        // ids have a fixed length, overwrite the default one in place
+                        if (record->header_len[TM_EVENT_ID] ==
+                            wire_str_size(EVENT_ID_LEN)) {
+                                wire_put_str(record->arena +
+                                             record->header_off[TM_EVENT_ID],
+                                             TM_EVENT_ID, event_id, EVENT_ID_LEN);
                                 rc = 0;
                         }
                 }
@@ -1053,64 +1080,234 @@ int tm_set_event_id(struct telem_ref *t_ref, char *event_id)
 }
 
 /**
- * Write nbytes from buf to fd. Used to send records to telemprobd.
+ * Milliseconds left until a deadline.
+ *
+ * @param deadline Absolute CLOCK_MONOTONIC time.
+ *
+ * @return The remaining time, or 0 if the deadline has passed.
+ *
+ */
+static int remaining_ms(const struct timespec *deadline)
+{
+        struct timespec now;
+        long long ms;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ms = (long long)(deadline->tv_sec - now.tv_sec) * 1000 +
+             (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+        if (ms <= 0) {
+                return 0;
+        }
+
+        return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+/**
+ * Compute the deadline for a write that may wait timeout_ms in total.
+ *
+ * @param timeout_ms Timeout in milliseconds, only used if positive.
+ * @param deadline Set to the absolute CLOCK_MONOTONIC deadline.
+ *
+ */
+static void write_deadline(int timeout_ms, struct timespec *deadline)
+{
+        if (timeout_ms > 0) {
+                clock_gettime(CLOCK_MONOTONIC, deadline);
+                deadline->tv_sec += timeout_ms / 1000;
+                deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+                if (deadline->tv_nsec >= 1000000000L) {
+                        deadline->tv_sec++;
+                        deadline->tv_nsec -= 1000000000L;
+                }
+        }
+}
+
+/**
+ * Wait for a full socket to become writable again.
+ *
+ * @param fd The socket.
+ * @param timeout_ms Timeout of the whole write, see tm_write_socket().
+ * @param deadline Deadline computed by write_deadline() for that timeout.
+ *
+ * @return 0 if the write may be retried, -EAGAIN if timeout_ms is 0,
+ *     -ETIMEDOUT if the deadline passed, or a negative errno-style value on
+ *     any other error.
+ *
+ */
+static int tm_wait_writable(int fd, int timeout_ms,
+                            const struct timespec *deadline)
+{
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+        int wait_ms = timeout_ms;
+        int res;
+
+        if (timeout_ms == 0) {
+                return -EAGAIN;
+        } else if (timeout_ms > 0) {
+                wait_ms = remaining_ms(deadline);
+        }
+
+        /* Wait for the daemon to drain the socket */
+        res = wait_ms == 0 ? 0 : poll(&pfd, 1, wait_ms);
+
+        if (res == 0) {
+                telem_log(LOG_ERR, "Timed out writing to daemon socket\n");
+                return -ETIMEDOUT;
+        } else if (res < 0 && errno != EINTR) {
+                res = -errno;
+                telem_perror("Error waiting for daemon socket");
+                return res;
+        }
+
+        return 0;
+}
+
+/**
+ * Write a vector of buffers to fd. Used to send records to telemprobd.
+ * Entries of iov are advanced in place as data is written out. When the
+ * socket is full, wait for it to become writable again until the timeout
+ * expires.
  *
  * @param fd Socket fd obtained from tm_get_socket.
- * @param buf Data to be written to the socket.
- * @param nbytes Number of bytes to write out of buf.
+ * @param iov Buffers to be written to the socket.
+ * @param iovcnt Number of entries in iov.
+ * @param timeout_ms How long to wait in total for the socket to drain, 0
+ *     to not wait at all, or -1 to wait indefinitely.
+ * @param iov_done Set to the number of entries that were written out
+ *     completely, including on failure.
  *
- * @return 0 if successful, or a negative errno-style value if not.
+ * @return 0 if successful, -EAGAIN if the socket is full and timeout_ms is
+ *     0, -ETIMEDOUT if the timeout expired, or a negative errno-style value
+ *     on any other error.
  *
  */
-static int tm_write_socket(int fd, char *buf, size_t nbytes)
+static int tm_write_socket(int fd, struct iovec *iov, size_t iovcnt,
+                           int timeout_ms, size_t *iov_done)
 {
-        size_t nbytes_out = 0;
-        int k = 0;
+        size_t i = 0;
         int ret = 0;
+        struct timespec deadline;
+
+        write_deadline(timeout_ms, &deadline);
 
-        while (nbytes_out != nbytes) {
+        while (i < iovcnt) {
+                struct msghdr msg;
                 ssize_t b;
-                b = write(fd, buf + nbytes_out, nbytes - nbytes_out);
 
-                if (b == -1 && errno != EAGAIN) {
-                        ret = -errno;
-                        telem_perror("Error writing to daemon socket");
-                        return ret;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov + i;
+                msg.msg_iovlen = iovcnt - i > IOV_MAX ? IOV_MAX : iovcnt - i;
+
+                b = sendmsg(fd, &msg, MSG_NOSIGNAL);
+
+                if (b == -1 && errno == EINTR) {
+                        continue;
                 } else if (b == -1 &&
                            (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                        if (++k > 100) {
-                                ret = -errno;
-                                return ret;
+                        if ((ret = tm_wait_writable(fd, timeout_ms, &deadline)) < 0) {
+                                break;
                         }
+                } else if (b == -1) {
+                        ret = -errno;
+                        telem_perror("Error writing to daemon socket");
+                        break;
                 } else {
-                        nbytes_out += (size_t)b;
-                        k = 0;
+                        size_t n = (size_t)b;
+
+                        while (i < iovcnt && n >= iov[i].iov_len) {
+                                n -= iov[i].iov_len;
+                                i++;
+                        }
+                        if (n > 0) {
+                                iov[i].iov_base = (char *)iov[i].iov_base + n;
+                                iov[i].iov_len -= n;
+                        }
                 }
         }
 
+        *iov_done = i;
+
         return ret;
 }
 
 /**
- * Obtain a file descriptor for a unix domain socket.
- * Connect to the socket in a non-blocking fashion.
+ * Send messages on a SOCK_SEQPACKET socket, one record per message, as
+ * few system calls as possible. Messages are never split, so the socket
+ * either takes a message in full or not at all.
  *
- * @return A valid file descriptor, or a negative errno-style value on error.
+ * @param fd Socket fd obtained from tm_get_socket.
+ * @param msgs The messages to send.
+ * @param count Number of messages.
+ * @param timeout_ms How long to wait in total for the socket to drain, see
+ *     tm_write_socket().
+ * @param msgs_done Set to the number of messages that were sent, including
+ *     on failure.
+ *
+ * @return 0 if successful, -EAGAIN if the socket is full and timeout_ms is
+ *     0, -ETIMEDOUT if the timeout expired, or a negative errno-style value
+ *     on any other error.
  *
  */
-static int tm_get_socket(void)
+static int tm_write_messages(int fd, struct mmsghdr *msgs, size_t count,
+                             int timeout_ms, size_t *msgs_done)
 {
-        int sfd = -1;
+        size_t i = 0;
         int ret = 0;
-        struct sockaddr_un addr;
-        long sflags = 0;
-        int res = 0;
-        struct timeval tv;
+        struct timespec deadline;
+
+        write_deadline(timeout_ms, &deadline);
+
+        while (i < count) {
+                int n;
+
+                n = sendmmsg(fd, msgs + i,
+                             count - i > UIO_MAXIOV ? UIO_MAXIOV : (unsigned int)(count - i),
+                             MSG_NOSIGNAL);
+
+                if (n == -1 && errno == EINTR) {
+                        continue;
+                } else if (n == -1 &&
+                           (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        if ((ret = tm_wait_writable(fd, timeout_ms, &deadline)) < 0) {
+                                break;
+                        }
+                } else if (n == -1) {
+                        ret = -errno;
+                        telem_perror("Error writing to daemon socket");
+                        break;
+                } else {
+                        i += (size_t)n;
+                }
+        }
+
+        *msgs_done = i;
+
+        return ret;
+}
+
+/**
+ * Connect to a unix domain socket in a non-blocking fashion.
+ *
+ * @param path Path of the socket.
+ * @param type SOCK_STREAM or SOCK_SEQPACKET.
+ *
+ * @return A valid file descriptor, or a negative errno-style value on error.
+ *
+ */
+static int tm_connect_socket(const char *path, int type)
+{
+        int sfd = -1;
+        int ret = 0;
+        struct sockaddr_un addr;
+        long sflags = 0;
+        int res = 0;
+        struct timeval tv;
         fd_set fdset;
         socklen_t lon = 0;
         int valopt = 0;
 
-        sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sfd = socket(AF_UNIX, type, 0);
 
         if (sfd == -1) {
                 ret = -errno;
@@ -1132,8 +1329,7 @@ static int tm_get_socket(void)
         /* Construct server address, and make the connection */
         memset(&addr, 0, sizeof(struct sockaddr_un));
         addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, socket_path_config(),
-                sizeof(addr.sun_path) - 1);
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
 
         res = connect(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un));
 
@@ -1200,6 +1396,36 @@ out1:
         return ret;
 }
 
+/**
+ * Obtain a file descriptor for a unix domain socket connected to telemprobd.
+ * The message oriented socket is preferred, and the stream socket is used
+ * if it is disabled or the daemon does not listen on it.
+ *
+ * @param type Set to the type of the connected socket.
+ *
+ * @return A valid file descriptor, or a negative errno-style value on error.
+ *
+ */
+static int tm_get_socket(int *type)
+{
+        const char *seqpacket_path = seqpacket_socket_path_config();
+        int sfd;
+
+        if (seqpacket_path[0] != '\0') {
+                sfd = tm_connect_socket(seqpacket_path, SOCK_SEQPACKET);
+                if (sfd >= 0) {
+                        *type = SOCK_SEQPACKET;
+                        return sfd;
+                }
+                telem_debug("DEBUG: Falling back to stream socket: %s\n",
+                            strerror(-sfd));
+        }
+
+        *type = SOCK_STREAM;
+
+        return tm_connect_socket(socket_path_config(), SOCK_STREAM);
+}
+
 int tm_is_opted_in(void)
 {
         struct stat unused;
@@ -1211,31 +1437,25 @@ int tm_is_opted_in(void)
         return 1;
 }
 
-int tm_send_record(struct telem_ref *t_ref)
+/**
+ * Describe the wire layout of a record as a vector of buffers, without
+ * copying the headers or the payload.
+ *
+ * @param t_ref The record to frame.
+ * @param frame The frame to initialize. It references t_ref, which must
+ *     outlive it.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ *
+ */
+static int tm_frame_record(struct telem_ref *t_ref, struct tm_frame *frame)
 {
-        int i;
         size_t record_size = 0;
         size_t total_size = 0;
-        int sfd;
-        char *data = NULL;
-        size_t offset = 0;
-        int ret = 0;
+        size_t n = 0;
         size_t cfg_file_name_size = 0;
         const char *cfg_file_name = NULL;
 
-        if (tm_is_opted_in() == 0) {
-                // Bail early if opt-in is not existent
-                return -ECONNREFUSED;
-        }
-
-        sfd = tm_get_socket();
-
-        if (sfd < 0) {
-                telem_log(LOG_ERR, "Failed to get socket fd: %s\n",
-                          strerror(-sfd));
-                return sfd;
-        }
-
         total_size = t_ref->record->header_size + t_ref->record->payload_size;
 
         /*
@@ -1264,80 +1484,810 @@ int tm_send_record(struct telem_ref *t_ref)
         telem_debug("DEBUG: Total size : %zu\n", total_size);
 
         /*
-         * Allocating buffer for what we intend to send.  Buffer layout is:
+         * Wire layout of a record is:
          * <uint32_t record_size>     : so recv knows how much to read
          * <custom cfg file field>    : optional
+         * <uint32_t WIRE_V5_MAGIC>   : the headers are binary
          * <uint32_t header_size>
          * <headers + Payload>
          * <null-byte>
          * The additional char at the end ensures null termination
          */
-        record_size = (2 * sizeof(uint32_t)) + total_size + 1;
+        record_size = sizeof(uint32_t) + sizeof(frame->header_fields) +
+                      total_size + 1;
+        if (record_size > UINT32_MAX) {
+                return -EMSGSIZE;
+        }
+
+        frame->record_size = (uint32_t)record_size;
+        frame->header_fields[0] = WIRE_V5_MAGIC;
+        frame->header_fields[1] = (uint32_t)t_ref->record->header_size;
+
+        frame->iov[n].iov_base = &frame->record_size;
+        frame->iov[n++].iov_len = sizeof(uint32_t);
+
+        if (cfg_file_name != NULL) {
+                frame->iov[n].iov_base = CFG_PREFIX;
+                frame->iov[n++].iov_len = CFG_PREFIX_LENGTH;
+                frame->iov[n].iov_base = (char *)cfg_file_name;
+                frame->iov[n++].iov_len = cfg_file_name_size;
+        }
+
+        frame->iov[n].iov_base = frame->header_fields;
+        frame->iov[n++].iov_len = sizeof(frame->header_fields);
 
-        data = (char *)calloc(sizeof(char), record_size);
-        if (!data) {
+        /* Headers and payload are already laid out in wire order, and the
+         * arena always ends with a null byte */
+        frame->iov[n].iov_base = t_ref->record->arena;
+        frame->iov[n++].iov_len = t_ref->record->header_size +
+                                  t_ref->record->payload_size + 1;
+
+        frame->iovcnt = n;
+
+        telem_debug("DEBUG: Payload to be sent :\n\n%s\n",
+                    t_ref->record->arena + t_ref->record->header_size);
+
+        return 0;
+}
+
+/**
+ * Ask the daemon for its shared memory ring over the session socket. The
+ * answer is a status, with the ring's memfd and eventfd attached if it is 0.
+ *
+ * @param session A connected session.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ *
+ */
+static int tm_session_request_ring(struct telem_session *session)
+{
+        union {
+                struct cmsghdr align;
+                char buf[CMSG_SPACE(2 * sizeof(int))];
+        } control;
+        uint32_t request = SHM_RING_REQUEST;
+        int32_t status = 0;
+        struct pollfd pfd = { .fd = session->fd, .events = POLLIN };
+        struct iovec iov = { .iov_base = &request, .iov_len = sizeof(request) };
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+        int fds[2] = { -1, -1 };
+        size_t done = 0;
+        ssize_t len;
+        int res;
+
+        res = tm_write_socket(session->fd, &iov, 1, TM_WRITE_TIMEOUT_MS, &done);
+        if (res < 0) {
+                return res;
+        }
+
+        do {
+                res = poll(&pfd, 1, TM_WRITE_TIMEOUT_MS);
+        } while (res < 0 && errno == EINTR);
+
+        if (res < 0) {
+                return -errno;
+        } else if (res == 0) {
+                return -ETIMEDOUT;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = &status;
+        iov.iov_len = sizeof(status);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        len = recvmsg(session->fd, &msg, MSG_CMSG_CLOEXEC);
+        if (len < 0) {
+                return -errno;
+        } else if (len != sizeof(status)) {
+                /* A daemon without ring support drops the connection */
+                return len == 0 ? -ECONNRESET : -EPROTO;
+        }
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+                memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        } else if (status == 0) {
+                status = -EPROTO;
+        }
+
+        if (status != 0) {
+                if (fds[0] >= 0) {
+                        close(fds[0]);
+                        close(fds[1]);
+                }
+                return status;
+        }
+
+        return shm_ring_attach(&session->ring, fds[0], fds[1]);
+}
+
+/**
+ * Obtain the shared memory ring for a freshly connected session, if the
+ * session uses one. Records are sent over the socket when this fails, and
+ * the session does not ask again.
+ *
+ * @param session A connected session.
+ *
+ */
+static void tm_session_attach_ring(struct telem_session *session)
+{
+        int ret;
+
+        if (!session->use_ring) {
+                return;
+        }
+
+        ret = tm_session_request_ring(session);
+        if (ret < 0) {
+                telem_log(LOG_INFO, "Not using the shared memory ring: %s\n",
+                          strerror(-ret));
+                session->ring = NULL;
+                session->use_ring = false;
+        }
+}
+
+/**
+ * Copy as many frames as possible into the shared memory ring of a session.
+ *
+ * @param session An open session.
+ * @param frames The frames to send.
+ * @param count Number of frames.
+ *
+ * @return The number of leading frames that were written to the ring. The
+ *     others are to be written to the socket.
+ *
+ */
+static size_t tm_session_push_ring(struct telem_session *session,
+                                   const struct tm_frame *frames, size_t count)
+{
+        size_t i;
+        int ret = 0;
+
+        /* Data left over from a non-blocking send goes out first, and a
+         * batch that can not be sent yet is handed back whole */
+        if (session->ring == NULL || session->pending != NULL) {
+                return 0;
+        }
+
+        for (i = 0; i < count; i++) {
+                ret = shm_ring_push(session->ring, frames[i].iov, frames[i].iovcnt,
+                                    frames[i].record_size);
+                if (ret < 0) {
+                        break;
+                }
+        }
+
+        if (ret == -EPIPE) {
+                /* The daemon is exiting, or gave up on a slot of the ring and
+                 * replaced it; the next connection gets the new ring */
+                shm_ring_free(session->ring);
+                session->ring = NULL;
+        }
+
+        return i;
+}
+
+/**
+ * Open a session, see tm_session_open().
+ *
+ * @param session Set to the new session.
+ * @param use_ring Whether to ask the daemon for its shared memory ring. A
+ *     session sending a single record does not gain from it.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ *
+ */
+static int session_open(struct telem_session **session, bool use_ring)
+{
+        struct telem_session *s = NULL;
+        int sfd;
+        int type;
+
+        if (session == NULL) {
+                return -EINVAL;
+        }
+
+        if (tm_is_opted_in() == 0) {
+                // Bail early if opt-in is not existent
+                return -ECONNREFUSED;
+        }
+
+        sfd = tm_get_socket(&type);
+
+        if (sfd < 0) {
+                telem_log(LOG_ERR, "Failed to get socket fd: %s\n",
+                          strerror(-sfd));
+                return sfd;
+        }
+
+        s = (struct telem_session *)malloc(sizeof(struct telem_session));
+        if (!s) {
                 telem_log(LOG_CRIT, "CRIT: Out of memory\n");
                 close(sfd);
                 return -ENOMEM;
         }
 
-        memcpy(data, &record_size, sizeof(uint32_t));
-        offset += sizeof(uint32_t);
+        s->fd = sfd;
+        s->type = type;
+        s->timeout_ms = TM_WRITE_TIMEOUT_MS;
+        s->pending = NULL;
+        s->pending_len = 0;
+        s->pending_off = 0;
+        s->use_ring = use_ring;
+        s->ring = NULL;
+        s->backoff_until = 0;
+        s->notice_len = 0;
+        tm_session_attach_ring(s);
+        *session = s;
+
+        return 0;
+}
 
-        if (cfg_file_name != NULL) {
-                memcpy(data + offset, CFG_PREFIX, CFG_PREFIX_LENGTH);
-                offset += CFG_PREFIX_LENGTH;
-                memcpy(data + offset, cfg_file_name, cfg_file_name_size);
-                offset += cfg_file_name_size;
+int tm_session_open(struct telem_session **session)
+{
+        return session_open(session, shm_ring_enabled_config());
+}
+
+/**
+ * Drop the connection of a session, along with any data still pending on
+ * it. The next send reconnects.
+ *
+ * @param session An open session.
+ *
+ */
+static void tm_session_disconnect(struct telem_session *session)
+{
+        if (session->pending != NULL) {
+                telem_log(LOG_ERR, "Dropping %zu unsent bytes\n",
+                          session->pending_len - session->pending_off);
+                free(session->pending);
+                session->pending = NULL;
+        }
+
+        if (session->fd >= 0) {
+                close(session->fd);
+                session->fd = -1;
         }
+        session->notice_len = 0;
 
-        memcpy(data + offset, &t_ref->record->header_size, sizeof(uint32_t));
-        offset += sizeof(uint32_t);
+        /* The ring may belong to a daemon that is gone */
+        shm_ring_free(session->ring);
+        session->ring = NULL;
+}
 
-        size_t len = 0;
-        for (i = 0; i < NUM_HEADERS; i++) {
-                len = strlen(t_ref->record->headers[i]);
-                memcpy(data + offset, t_ref->record->headers[i], len);
-                offset += len;
+/**
+ * Send the records left over from an earlier non-blocking send on a
+ * SOCK_SEQPACKET session. Only whole records are ever kept pending there,
+ * each starting with its size, so they are sent again one per message.
+ *
+ * @param session An open session with pending data.
+ * @param timeout_ms How long to wait for the socket to drain, see
+ *     tm_write_socket().
+ *
+ * @return 0 if all pending records were sent, or a negative errno-style
+ *     value if not.
+ *
+ */
+static int tm_session_flush_messages(struct telem_session *session,
+                                     int timeout_ms)
+{
+        struct mmsghdr *msgs;
+        struct iovec *iov;
+        size_t count = 0;
+        size_t done = 0;
+        size_t off;
+        size_t i;
+        uint32_t record_size;
+        int ret;
+
+        for (off = session->pending_off; off < session->pending_len; off += record_size) {
+                memcpy(&record_size, session->pending + off, sizeof(uint32_t));
+                count++;
+        }
+
+        msgs = (struct mmsghdr *)calloc(count, sizeof(struct mmsghdr) + sizeof(struct iovec));
+        if (!msgs) {
+                telem_log(LOG_CRIT, "CRIT: Out of memory\n");
+                return -ENOMEM;
+        }
+        iov = (struct iovec *)(msgs + count);
+
+        off = session->pending_off;
+        for (i = 0; i < count; i++) {
+                memcpy(&record_size, session->pending + off, sizeof(uint32_t));
+                iov[i].iov_base = session->pending + off;
+                iov[i].iov_len = record_size;
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                off += record_size;
+        }
+
+        ret = tm_write_messages(session->fd, msgs, count, timeout_ms, &done);
+
+        for (i = 0; i < done; i++) {
+                session->pending_off += iov[i].iov_len;
         }
+        free(msgs);
+
+        return ret;
+}
+
+/**
+ * Write out the data left over from an earlier non-blocking send.
+ *
+ * @param session An open session.
+ * @param timeout_ms How long to wait for the socket to drain, see
+ *     tm_write_socket().
+ *
+ * @return 0 if nothing is pending anymore, or a negative errno-style value
+ *     if not.
+ *
+ */
+static int tm_session_flush(struct telem_session *session, int timeout_ms)
+{
+        struct iovec iov;
+        size_t done = 0;
+        int ret;
 
-        memcpy(data + offset, t_ref->record->payload, t_ref->record->payload_size);
+        if (session->pending == NULL) {
+                return 0;
+        }
 
-        telem_debug("DEBUG: Data to be sent :\n\n%s\n", data + 2 * sizeof(uint32_t));
-        if ((ret = tm_write_socket(sfd, data, record_size)) == 0) {
-                telem_log(LOG_INFO, "INFO: Successfully sent record over the socket\n");
+        if (session->type == SOCK_SEQPACKET) {
+                ret = tm_session_flush_messages(session, timeout_ms);
         } else {
-                telem_log(LOG_ERR, "Error while writing data to socket\n");
+                iov.iov_base = session->pending + session->pending_off;
+                iov.iov_len = session->pending_len - session->pending_off;
+
+                ret = tm_write_socket(session->fd, &iov, 1, timeout_ms, &done);
+                session->pending_off = session->pending_len - iov.iov_len;
         }
 
-        close(sfd);
-        free(data);
+        if (ret == 0) {
+                free(session->pending);
+                session->pending = NULL;
+        } else if (ret != -EAGAIN) {
+                tm_session_disconnect(session);
+        }
 
         return ret;
 }
 
-void tm_free_record(struct telem_ref *t_ref)
+/**
+ * Keep what the socket did not take from a non-blocking send, so that it
+ * can be written before anything else.
+ *
+ * @param session An open session.
+ * @param iov The entries that were not written, first one possibly in part.
+ * @param iovcnt Number of entries in iov.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ *
+ */
+static int tm_session_keep_pending(struct telem_session *session,
+                                   const struct iovec *iov, size_t iovcnt)
 {
+        size_t len = 0;
+        size_t i;
+        char *p;
 
-        int k;
+        for (i = 0; i < iovcnt; i++) {
+                len += iov[i].iov_len;
+        }
+
+        session->pending = (char *)malloc(len);
+        if (!session->pending) {
+                telem_log(LOG_CRIT, "CRIT: Out of memory\n");
+                tm_session_disconnect(session);
+                return -ENOMEM;
+        }
+
+        p = session->pending;
+        for (i = 0; i < iovcnt; i++) {
+                memcpy(p, iov[i].iov_base, iov[i].iov_len);
+                p += iov[i].iov_len;
+        }
+        session->pending_len = len;
+        session->pending_off = 0;
+
+        return 0;
+}
+
+/**
+ * Write complete frames to the session socket, reconnecting once if
+ * the daemon went away since the last write (e.g. it was recycled).
+ * After a reconnect, sending resumes with the first frame that was not
+ * written out completely.
+ *
+ * In non-blocking mode, nothing is written if the socket is full. If the
+ * socket takes only part of the frames, the rest is kept in the session
+ * and written ahead of the next send.
+ *
+ * On a SOCK_SEQPACKET session each frame is sent as one message.
+ *
+ * @param session An open session.
+ * @param frames The frames to write.
+ * @param count Number of frames.
+ * @param iov Scratch vector, large enough for the entries of all frames.
+ * @param msgs Scratch messages, one per frame.
+ *
+ * @return 0 if successful, or a negative errno-style value if not.
+ *
+ */
+static int tm_session_write(struct telem_session *session,
+                            const struct tm_frame *frames, size_t count,
+                            struct iovec *iov, struct mmsghdr *msgs)
+{
+        int ret = 0;
+        int attempt;
+        size_t first = 0;
+        size_t done = 0;
+        size_t sent = 0;
+        size_t iovcnt;
+        size_t i;
+
+        if (session->pending != NULL) {
+                ret = tm_session_flush(session, session->timeout_ms);
+                if (ret == -EAGAIN) {
+                        return ret;
+                }
+        }
+
+        for (attempt = 0; attempt < 2; attempt++) {
+                if (session->fd < 0) {
+                        session->fd = tm_get_socket(&session->type);
+                        if (session->fd < 0) {
+                                ret = session->fd;
+                                telem_log(LOG_ERR, "Failed to get socket fd: %s\n",
+                                          strerror(-ret));
+                                return ret;
+                        }
+                        tm_session_attach_ring(session);
+                }
+
+                /* tm_write_socket advances the entries, so work on a copy */
+                iovcnt = 0;
+                for (i = first; i < count; i++) {
+                        memcpy(iov + iovcnt, frames[i].iov,
+                               frames[i].iovcnt * sizeof(struct iovec));
+                        memset(&msgs[i - first], 0, sizeof(struct mmsghdr));
+                        msgs[i - first].msg_hdr.msg_iov = iov + iovcnt;
+                        msgs[i - first].msg_hdr.msg_iovlen = frames[i].iovcnt;
+                        iovcnt += frames[i].iovcnt;
+                }
+
+                if (session->type == SOCK_SEQPACKET) {
+                        ret = tm_write_messages(session->fd, msgs, count - first,
+                                                session->timeout_ms, &sent);
+                        /* Count the entries of the messages that went out */
+                        for (i = first, done = 0; i < first + sent; i++) {
+                                done += frames[i].iovcnt;
+                        }
+                } else {
+                        ret = tm_write_socket(session->fd, iov, iovcnt,
+                                              session->timeout_ms, &done);
+                }
+                if (ret == 0) {
+                        return 0;
+                }
+
+                if (ret == -EAGAIN) {
+                        if (done == 0 && iov[0].iov_base == frames[first].iov[0].iov_base) {
+                                /* Nothing was written, the caller may retry */
+                                return ret;
+                        }
+                        return tm_session_keep_pending(session, iov + done,
+                                                       iovcnt - done);
+                }
+
+                /*
+                 * A failed write may have left part of a frame on the
+                 * stream, so the connection can not be reused either way.
+                 * The interrupted frame is resent in full.
+                 */
+                tm_session_disconnect(session);
+
+                while (first < count && done >= frames[first].iovcnt) {
+                        done -= frames[first].iovcnt;
+                        first++;
+                }
+
+                if (ret != -EPIPE && ret != -ECONNRESET && ret != -ENOTCONN) {
+                        break;
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * Read the notices the daemon sent since the last send, if any, and tell
+ * whether the session should wait before sending again. The daemon sends
+ * one when it dropped records of this process, see common.h. Part of a
+ * notice read from a SOCK_STREAM connection is kept until the rest comes.
+ *
+ * @param session An open session.
+ *
+ * @return true if records should not be sent yet.
+ *
+ */
+static bool tm_session_backed_off(struct telem_session *session)
+{
+        struct admission_notice *notice = &session->notice;
+        struct timespec now;
+        ssize_t len;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        while (session->fd >= 0) {
+                len = recv(session->fd, (char *)notice + session->notice_len,
+                           sizeof(*notice) - session->notice_len, MSG_DONTWAIT);
+                if (len <= 0) {
+                        break;
+                }
+
+                session->notice_len += (size_t)len;
+                if (session->notice_len < sizeof(*notice)) {
+                        /* Messages are whole notices or nothing we know of */
+                        if (session->type == SOCK_SEQPACKET) {
+                                session->notice_len = 0;
+                        }
+                        continue;
+                }
+                session->notice_len = 0;
+
+                if (notice->magic != ADMISSION_NOTICE) {
+                        continue;
+                }
+                if (now.tv_sec + (time_t)notice->wait > session->backoff_until) {
+                        session->backoff_until = now.tv_sec + (time_t)notice->wait;
+                }
+                telem_log(LOG_WARNING, "Records were dropped by the daemon, waiting"
+                          " %" PRIu32 "s before sending more\n", notice->wait);
+        }
+
+        return now.tv_sec < session->backoff_until;
+}
+
+static bool valid_refs(struct telem_ref *t_refs[], size_t count)
+{
+        size_t i;
+
+        if (t_refs == NULL) {
+                return false;
+        }
+
+        for (i = 0; i < count; i++) {
+                if (t_refs[i] == NULL) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+int tm_session_send_records(struct telem_session *session,
+                            struct telem_ref *t_refs[], size_t count)
+{
+        struct tm_frame one_frame;
+        struct iovec one_iov[TM_FRAME_IOV];
+        struct mmsghdr one_msg;
+        struct tm_frame *frames = &one_frame;
+        struct iovec *iov = one_iov;
+        struct mmsghdr *msgs = &one_msg;
+        size_t in_ring;
+        size_t iovcnt;
+        size_t i;
+        int ret = 0;
+
+        if (session == NULL || !valid_refs(t_refs, count)) {
+                return -EINVAL;
+        }
+
+        if (count == 0) {
+                return 0;
+        }
+
+        if (tm_is_opted_in() == 0) {
+                return -ECONNREFUSED;
+        }
 
+        if (tm_session_backed_off(session)) {
+                return -EBUSY;
+        }
+
+        /* A single record is framed on the stack */
+        if (count > 1) {
+                frames = (struct tm_frame *)malloc(count * sizeof(struct tm_frame));
+                iov = (struct iovec *)malloc(count * TM_FRAME_IOV * sizeof(struct iovec));
+                msgs = (struct mmsghdr *)malloc(count * sizeof(struct mmsghdr));
+                if (!frames || !iov || !msgs) {
+                        telem_log(LOG_CRIT, "CRIT: Out of memory\n");
+                        ret = -ENOMEM;
+                        goto out;
+                }
+        }
+
+        for (i = 0; i < count; i++) {
+                ret = tm_frame_record(t_refs[i], &frames[i]);
+                if (ret < 0) {
+                        goto out;
+                }
+        }
+
+        in_ring = tm_session_push_ring(session, frames, count);
+        if (in_ring == count) {
+                telem_log(LOG_INFO, "INFO: Successfully sent %zu record(s) through the ring\n",
+                          count);
+                goto out;
+        }
+
+        ret = tm_session_write(session, frames + in_ring, count - in_ring, iov, msgs);
+        if (ret == -EAGAIN && in_ring > 0) {
+                /* Part of the batch is in the ring already, so the rest can
+                 * not be handed back to the caller for a retry */
+                iovcnt = 0;
+                for (i = in_ring; i < count; i++) {
+                        memcpy(iov + iovcnt, frames[i].iov,
+                               frames[i].iovcnt * sizeof(struct iovec));
+                        iovcnt += frames[i].iovcnt;
+                }
+                ret = tm_session_keep_pending(session, iov, iovcnt);
+        }
+
+        if (ret == 0) {
+                telem_log(LOG_INFO, "INFO: Successfully sent %zu record(s) over the socket\n",
+                          count - in_ring);
+        } else if (ret != -EAGAIN) {
+                telem_log(LOG_ERR, "Error while writing data to socket\n");
+        }
+
+out:
+        if (count > 1) {
+                free(frames);
+                free(iov);
+                free(msgs);
+        }
+
+        return ret;
+}
+
+int tm_session_send(struct telem_session *session, struct telem_ref *t_ref)
+{
         if (t_ref == NULL) {
-                return;
+                return -EINVAL;
         }
 
-        if (t_ref->record == NULL) {
+        return tm_session_send_records(session, &t_ref, 1);
+}
+
+int tm_session_set_timeout(struct telem_session *session, int timeout_ms)
+{
+        if (session == NULL || timeout_ms < -1) {
+                return -EINVAL;
+        }
+
+        session->timeout_ms = timeout_ms;
+
+        return 0;
+}
+
+int tm_session_get_fd(struct telem_session *session)
+{
+        if (session == NULL) {
+                return -EINVAL;
+        }
+
+        if (session->fd < 0) {
+                return -ENOTCONN;
+        }
+
+        return session->fd;
+}
+
+int tm_session_wait(struct telem_session *session, int timeout_ms)
+{
+        struct pollfd pfd;
+        int res;
+
+        if (session == NULL || timeout_ms < -1) {
+                return -EINVAL;
+        }
+
+        /* Not connected, the next send reconnects */
+        if (session->fd < 0) {
+                return 0;
+        }
+
+        if (session->pending != NULL) {
+                return tm_session_flush(session, timeout_ms);
+        }
+
+        pfd.fd = session->fd;
+        pfd.events = POLLOUT;
+
+        do {
+                res = poll(&pfd, 1, timeout_ms);
+        } while (res < 0 && errno == EINTR);
+
+        if (res < 0) {
+                return -errno;
+        } else if (res == 0) {
+                return -ETIMEDOUT;
+        }
+
+        return 0;
+}
+
+void tm_session_close(struct telem_session *session)
+{
+        if (session == NULL) {
                 return;
         }
 
-        for (k = 0; k < NUM_HEADERS; k++) {
-                free(t_ref->record->headers[k]);
+        /* Give the daemon a chance to take what is left */
+        if (session->pending != NULL) {
+                tm_session_flush(session, TM_WRITE_TIMEOUT_MS);
+        }
+
+        tm_session_disconnect(session);
+        free(session);
+}
+
+int tm_send_record(struct telem_ref *t_ref)
+{
+        struct telem_session *session = NULL;
+        int ret = 0;
+
+        ret = session_open(&session, false);
+        if (ret < 0) {
+                return ret;
+        }
+
+        ret = tm_session_send(session, t_ref);
+        tm_session_close(session);
+
+        return ret;
+}
+
+int tm_send_records(struct telem_ref *t_refs[], size_t count)
+{
+        struct telem_session *session = NULL;
+        int ret = 0;
+
+        if (!valid_refs(t_refs, count)) {
+                return -EINVAL;
+        }
+
+        ret = session_open(&session, false);
+        if (ret < 0) {
+                return ret;
         }
 
-        if (t_ref->record->payload) {
-                free(t_ref->record->payload);
+        ret = tm_session_send_records(session, t_refs, count);
+        tm_session_close(session);
+
+        return ret;
+}
+
+void tm_free_record(struct telem_ref *t_ref)
+{
+        if (t_ref == NULL) {
+                return;
+        }
+
+        if (t_ref->record == NULL) {
+                return;
         }
 
-        free(t_ref->record);
+        /* The record itself was allocated along with t_ref */
+        free(t_ref->record->arena);
         free(t_ref);
 }
 
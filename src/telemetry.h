@@ -48,6 +48,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -55,6 +56,9 @@ struct telem_ref {
         struct telem_record *record;
 };
 
+/* Opaque handle for a connection to the daemon, see tm_session_open() */
+struct telem_session;
+
 /**
  * Set the configuration file name to use
  *
@@ -120,6 +124,192 @@ int tm_set_payload(struct telem_ref *t_ref, char *payload);
  */
 int tm_send_record(struct telem_ref *t_ref);
 
+/**
+ * Send a batch of records to the telemetrics daemon for delivery. The
+ * records are written to the daemon with as few system calls as possible,
+ * which is much cheaper than calling tm_send_record() for each of them.
+ *
+ * @param t_refs An array of handles returned by tm_create_record()
+ * @param count Number of handles in t_refs
+ *
+ * @return 0 on success, or a negative errno-style value on error
+ */
+int tm_send_records(struct telem_ref *t_refs[], size_t count);
+
+/**
+ * Open a session with the telemetrics daemon. A session keeps a single
+ * connection open, so that probes sending many records do not have to
+ * connect to the daemon once per record. A session must not be used
+ * concurrently from more than one thread.
+ *
+ * If shm_ring_enabled is set in the configuration, the session also asks
+ * the daemon for its shared memory ring, and records are copied into the
+ * ring rather than written to the socket for as long as it has room.
+ *
+ * @param session A pointer to a telem_session struct pointer declared by the
+ *     caller. The session is initialized if the function returns success.
+ *
+ * @return 0 on success, or a negative errno-style value on error
+ */
+int tm_session_open(struct telem_session **session);
+
+/**
+ * Send a record to the telemetrics daemon over an open session. If the
+ * daemon closed the connection since the last record was sent, the session
+ * reconnects before sending.
+ *
+ * @param session The handle returned by tm_session_open()
+ * @param t_ref The handle returned by tm_create_record()
+ *
+ * @return 0 on success, -EBUSY while the daemon asked to wait (see
+ *     tm_session_send_records()), or another negative errno-style value
+ *     on error
+ */
+int tm_session_send(struct telem_session *session, struct telem_ref *t_ref);
+
+/**
+ * Send a batch of records to the telemetrics daemon over an open session.
+ * See tm_send_records().
+ *
+ * If the daemon drops records of this process because it sends too many
+ * (see admission_enabled in telemetrics.conf), it asks the session to
+ * wait, and sends fail with -EBUSY until the time it asked for is over.
+ *
+ * @param session The handle returned by tm_session_open()
+ * @param t_refs An array of handles returned by tm_create_record()
+ * @param count Number of handles in t_refs
+ *
+ * @return 0 on success, -EBUSY while the daemon asked to wait, or another
+ *     negative errno-style value on error
+ */
+int tm_session_send_records(struct telem_session *session,
+                            struct telem_ref *t_refs[], size_t count);
+
+/**
+ * Set how long sends on a session may wait for the daemon to catch up.
+ * Sends block while the daemon is not reading fast enough, until the whole
+ * batch was written or the timeout expires. The default is one second.
+ *
+ * With a timeout of 0 the session is non-blocking: tm_session_send() and
+ * tm_session_send_records() return -EAGAIN without sending anything when
+ * the daemon can not take more data. If the daemon takes only part of the
+ * data, the rest is kept by the session and sent ahead of the next records,
+ * and the call succeeds. Use tm_session_wait() or poll the descriptor
+ * returned by tm_session_get_fd() for POLLOUT before trying again.
+ *
+ * @param session The handle returned by tm_session_open()
+ * @param timeout_ms Timeout in milliseconds, 0 to never wait, or -1 to
+ *     wait indefinitely
+ *
+ * @return 0 on success, or a negative errno-style value on error
+ */
+int tm_session_set_timeout(struct telem_session *session, int timeout_ms);
+
+/**
+ * Get the file descriptor of the connection to the daemon, so that callers
+ * can watch it for POLLOUT in their own event loop. The descriptor changes
+ * when the session reconnects.
+ *
+ * @param session The handle returned by tm_session_open()
+ *
+ * @return The file descriptor, -ENOTCONN if the session is currently not
+ *     connected (the next send reconnects), or another negative errno-style
+ *     value on error
+ */
+int tm_session_get_fd(struct telem_session *session);
+
+/**
+ * Wait until the session can send again. Data left over from an earlier
+ * non-blocking send is written out first.
+ *
+ * @param session The handle returned by tm_session_open()
+ * @param timeout_ms Timeout in milliseconds, 0 to not wait, or -1 to wait
+ *     indefinitely
+ *
+ * @return 0 when the session is ready, -ETIMEDOUT (or -EAGAIN for leftover
+ *     data) if the timeout expired first, or another negative errno-style
+ *     value on error
+ */
+int tm_session_wait(struct telem_session *session, int timeout_ms);
+
+/**
+ * Close a session and release the memory allocated to it.
+ *
+ * @param session The handle returned by tm_session_open()
+ *
+ */
+void tm_session_close(struct telem_session *session);
+
+/* Policies for a full queue of records to send in the background */
+#define TM_ASYNC_DROP 0
+#define TM_ASYNC_BLOCK 1
+
+/* Counters for the records sent in the background */
+struct tm_async_stats {
+        /* records accepted by tm_send_record_async() */
+        uint64_t queued;
+        /* records still waiting to be sent */
+        uint64_t pending;
+        /* records delivered to the daemon */
+        uint64_t sent;
+        /* records rejected because the queue was full */
+        uint64_t dropped;
+        /* records that could not be delivered to the daemon */
+        uint64_t failed;
+};
+
+/**
+ * Start sending records in the background. Records passed to
+ * tm_send_record_async() are queued and sent to the daemon by a thread
+ * owned by the library, over a connection that stays open.
+ *
+ * Calling this function is optional; the first call to
+ * tm_send_record_async() starts background sending with a queue of 1024
+ * records and the TM_ASYNC_DROP policy.
+ *
+ * @param queue_len Maximum number of records waiting to be sent, or 0 for
+ *     the default.
+ * @param policy What tm_send_record_async() does when the queue is full:
+ *     TM_ASYNC_DROP to fail with -EAGAIN, or TM_ASYNC_BLOCK to wait for
+ *     room in the queue.
+ *
+ * @return 0 on success, -EALREADY if background sending was already
+ *     started, or another negative errno-style value on error
+ */
+int tm_async_init(size_t queue_len, int policy);
+
+/**
+ * Queue a record to be sent to the daemon in the background. The call
+ * returns without waiting for the record to be sent.
+ *
+ * @param t_ref The handle returned by tm_create_record(). On success the
+ *     library takes ownership of the record and frees it once it is sent;
+ *     the caller must not use or free it anymore. On error the caller keeps
+ *     ownership.
+ *
+ * @return 0 on success, -EAGAIN if the queue is full with the TM_ASYNC_DROP
+ *     policy, or another negative errno-style value on error
+ */
+int tm_send_record_async(struct telem_ref *t_ref);
+
+/**
+ * Get the counters of background sending.
+ *
+ * @param stats Filled in with the current counters, all zero if
+ *     background sending is not running.
+ *
+ * @return 0 on success, or a negative errno-style value on error
+ */
+int tm_async_stats(struct tm_async_stats *stats);
+
+/**
+ * Send every queued record and stop background sending. Must not be
+ * called concurrently with tm_send_record_async(). Records still queued
+ * when the process exits without calling this function are lost.
+ *
+ */
+void tm_async_shutdown(void);
+
 /**
  * Checks if telemetry was opted in
  *
@@ -17,13 +17,16 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <assert.h>
 #include <signal.h>
 #include <dirent.h>
-#include <malloc.h>
 #include <stdbool.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <curl/curl.h>
 #include <json-c/json.h>
 #include <sys/signalfd.h>
@@ -33,8 +36,82 @@
 #include "spool.h"
 #include "iorecord.h"
 #include "retention.h"
+#include "post_queue.h"
+#include "post_compress.h"
 #include "telempostdaemon.h"
 
+#ifdef HAVE_SYSTEMD_SD_DAEMON_H
+#include <systemd/sd-daemon.h>
+#endif
+
+/* libcurl state kept between posts while records are flowing, so that a
+ * post reuses the connection, the DNS entry and the TLS session of the
+ * previous one, see release_idle_http_delivery() */
+static struct {
+        CURL *curl;
+        struct curl_slist *headers;
+        /* tidheader, media type and encoding the headers were built with */
+        char *tid_header;
+        const char *content_type;
+        enum body_encoding encoding;
+        time_t last_post;
+} delivery;
+
+/* What becomes of a record handed to deliver_staged_record() */
+enum delivery {
+        /* done with, the record can be removed */
+        DELIVERY_DONE,
+        /* kept, to be retried */
+        DELIVERY_KEEP,
+        /* added to the batch, see finish_batched_record() */
+        DELIVERY_BATCHED
+};
+
+/* Largest answer from the server kept for a batch */
+#define MAX_RESPONSE_SIZE (1024 * 1024)
+
+/* Body of an answer from the server */
+struct http_response {
+        char *data;
+        size_t len;
+};
+
+/* A record posted in a batch, or on its own while the daemon goes on, done
+ * with once its request completed, see finish_batched_record() */
+struct batched_record {
+        TelemPostDaemon *daemon;
+        /* buffer from record_bufs the record was parsed in */
+        char *buf;
+        struct staged_record parsed;
+        /* staged file, removed once the record is done with, or NULL */
+        char *path;
+        blkcnt_t blocks;
+        /* counts the files removed, or NULL */
+        int *removed;
+        /* copy of a record held in memory, spooled if kept, or NULL */
+        char *record;
+        size_t size;
+        time_t staged;
+};
+
+/* A request body as posted, compressed as configured */
+struct encoded_body {
+        const char *data;
+        size_t size;
+        enum body_encoding encoding;
+        /* the compressed body, to be freed, or NULL */
+        char *buf;
+};
+
+/* A request in flight on the post queue, see queue_batch_http() */
+struct queued_post {
+        struct batch_request *request;
+        struct encoded_body body;
+        struct curl_slist *headers;
+        struct http_response answer;
+        char errorbuf[CURL_ERROR_SIZE];
+};
+
 /* spool window check */
 static bool inside_direct_spool_window(TelemPostDaemon *daemon, time_t current_time)
 {
@@ -175,12 +252,119 @@ static void initialize_rate_limit(TelemPostDaemon *daemon)
 
 static void initialize_record_delivery(TelemPostDaemon *daemon)
 {
+        const char *format = batch_format_config();
+        int posts_in_flight = posts_in_flight_config();
+        enum batch_format batch_format = BATCH_NONE;
+        enum body_encoding encoding;
+        int ret;
+
         daemon->record_retention_enabled = record_retention_enabled_config();
         daemon->record_server_delivery_enabled = record_server_delivery_enabled_config();
+
+        if (post_compress_encoding(compression_config(), &encoding) == -ENOTSUP) {
+                telem_log(LOG_WARNING, "Compression %s is not supported, posting as is\n",
+                          compression_config());
+        }
+
+        daemon->post_queue = NULL;
+        if (posts_in_flight > 0) {
+                daemon->post_queue = malloc(sizeof(struct post_queue));
+                if (daemon->post_queue == NULL) {
+                        telem_log(LOG_ERR, "Failed to allocate the post queue, aborting\n");
+                        exit(EXIT_FAILURE);
+                }
+                post_queue_init(daemon->post_queue, posts_in_flight);
+        }
+
+        daemon->batch = NULL;
+        if (strcmp(format, "json") == 0) {
+                batch_format = BATCH_JSON;
+        } else if (strcmp(format, "ndjson") == 0) {
+                batch_format = BATCH_NDJSON;
+        } else if (daemon->post_queue == NULL) {
+                return;
+        }
+
+        /* Posts in flight complete records the way batches do, a record at
+         * a time without batches */
+        daemon->batch = malloc(sizeof(struct post_batch));
+        if (daemon->batch == NULL) {
+                telem_log(LOG_ERR, "Failed to allocate the record batch, aborting\n");
+                exit(EXIT_FAILURE);
+        }
+        ret = post_batch_init(daemon->batch, batch_format, batch_max_records_config(),
+                              (size_t)batch_max_size_config() * 1024,
+                              daemon->post_queue != NULL ? queue_batch_http : post_batch_http,
+                              daemon->post_queue);
+        if (ret < 0) {
+                telem_log(LOG_ERR, "Failed to initialize the record batch: %s\n",
+                          strerror(-ret));
+                exit(EXIT_FAILURE);
+        }
+}
+
+static void initialize_staging_log(TelemPostDaemon *daemon)
+{
+        int ret;
+
+        daemon->staging_cursor = NULL;
+        if (strcmp(staging_backend_config(), "log") != 0) {
+                return;
+        }
+
+        daemon->staging_cursor = malloc(sizeof(struct staging_cursor));
+        if (daemon->staging_cursor == NULL) {
+                telem_log(LOG_ERR, "Failed to allocate the staging log cursor, aborting\n");
+                exit(EXIT_FAILURE);
+        }
+        ret = staging_cursor_open(daemon->staging_cursor, spool_dir_config());
+        if (ret < 0) {
+                telem_log(LOG_ERR, "Failed to open the staging log cursor: %s\n",
+                          strerror(-ret));
+                exit(EXIT_FAILURE);
+        }
+}
+
+static void initialize_handoff(TelemPostDaemon *daemon)
+{
+        int fd = -1;
+
+        set_pollfd(daemon, -1, handofflfd, POLLIN);
+        set_pollfd(daemon, -1, handofffd, POLLIN);
+        daemon->handoff_buf = NULL;
+        if (!handoff_enabled_config()) {
+                return;
+        }
+
+#ifdef HAVE_SYSTEMD_SD_DAEMON_H
+        /* Passed by telempostd.socket */
+        if (sd_listen_fds(0) > 0 &&
+            sd_is_socket_unix(SD_LISTEN_FDS_START, SOCK_SEQPACKET, 1,
+                              handoff_socket_path_config(), 0) > 0) {
+                fd = SD_LISTEN_FDS_START;
+        }
+#endif
+        if (fd < 0) {
+                fd = handoff_listen(handoff_socket_path_config());
+                if (fd < 0) {
+                        telem_log(LOG_ERR, "Failed to listen for records from telemprobd: %s\n",
+                                  strerror(-fd));
+                        return;
+                }
+        }
+
+        daemon->handoff_buf = malloc(HANDOFF_MAX_RECORD);
+        if (daemon->handoff_buf == NULL) {
+                telem_log(LOG_ERR, "Failed to allocate memory for handed off records, aborting\n");
+                exit(EXIT_FAILURE);
+        }
+        set_pollfd(daemon, fd, handofflfd, POLLIN);
 }
 
 void initialize_post_daemon(TelemPostDaemon *daemon)
 {
+        uint32_t mask = IN_CLOSE_WRITE;
+
         assert(daemon);
 
         daemon->bypass_http_post_ts = 0;
@@ -191,10 +375,16 @@ void initialize_post_daemon(TelemPostDaemon *daemon)
                 telem_perror("Error initializing inotify");
                 exit(EXIT_FAILURE);
         }
-        daemon->wd = inotify_add_watch(daemon->fd, spool_dir_config(), IN_CLOSE_WRITE);
+        initialize_staging_log(daemon);
+        /* Segments of the staging log are appended to */
+        if (daemon->staging_cursor != NULL) {
+                mask |= IN_MODIFY;
+        }
+        daemon->wd = inotify_add_watch(daemon->fd, spool_dir_config(), mask);
 
         initialize_signals(daemon);
         set_pollfd(daemon, daemon->fd, watchfd, POLLIN);
+        initialize_handoff(daemon);
 
         initialize_rate_limit(daemon);
         initialize_record_delivery(daemon);
@@ -203,15 +393,35 @@ void initialize_post_daemon(TelemPostDaemon *daemon)
                 daemon->record_journal->prune_entry_callback = &delete_record_by_id;
         }
         daemon->current_spool_size = 0;
+        buffer_pool_init(&daemon->record_bufs, STAGED_RECORD_SIZE + 1,
+                         (size_t)buffer_pool_size_config());
 }
 
 size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
-        telem_log(LOG_DEBUG, "Received data:\n%s\n", ptr);
-        return size * nmemb;
+        struct http_response *response = userdata;
+        size_t len = size * nmemb;
+        char *data;
+
+        telem_log(LOG_DEBUG, "Received data:\n%.*s\n", (int)len, ptr);
+
+        /* Only the answer to a batch is looked at */
+        if (response == NULL || response->len + len > MAX_RESPONSE_SIZE) {
+                return len;
+        }
+        data = realloc(response->data, response->len + len + 1);
+        if (data == NULL) {
+                return len;
+        }
+        memcpy(data + response->len, ptr, len);
+        response->len += len;
+        data[response->len] = '\0';
+        response->data = data;
+
+        return len;
 }
 
-char *create_json_message(char *tm_headers[], char *tm_payload)
+char *create_json_message(const struct wire_headers *tm_headers, char *tm_payload)
 {
         /*
          * Embed the telemetry record headers and the telemetry payload into a
@@ -223,12 +433,9 @@ char *create_json_message(char *tm_headers[], char *tm_payload)
         /* Add the telemetry record headers */
 
         for (int i = 0; i < NUM_HEADERS; i++) {
-                /* ex: arch: x86_64 */
-
-                /* Split the header field into name/value */
-                strtok(tm_headers[i], ":");
-                json_object *value = json_object_new_string(strtok(NULL, " "));
-                json_object_object_add(root, tm_headers[i], value);
+                json_object *value = json_object_new_string_len(tm_headers->value[i],
+                                                                (int)tm_headers->len[i]);
+                json_object_object_add(root, get_header_name(i), value);
         }
         json_object *payload = json_object_new_string(tm_payload);
         json_object_object_add(root, "payload", payload);
@@ -244,58 +451,133 @@ char *create_json_message(char *tm_headers[], char *tm_payload)
         return json_string;
 }
 
-bool post_record_http(char *headers[], char *body, char *cfg)
+/* Request headers for the tidheader and the media type of the body */
+static struct curl_slist *new_http_headers(const char *tid_header, const char *content_type,
+                                           enum body_encoding encoding)
 {
-        CURL *curl;
-        int res = 0;
-        char *content = "Content-Type: application/json";
-        struct curl_slist *custom_headers = NULL;
-        char errorbuf[CURL_ERROR_SIZE];
-        char *json_body = NULL;
-        long http_response = 0;
-        const char *cert_file = get_cainfo_config();
-        const char *tid_header = get_tidheader_config();
-        const char *saved_config_file = NULL;
+        struct curl_slist *headers;
+        char *content = NULL;
+        char *content_encoding = NULL;
 
-        if (cfg != NULL) {
-                saved_config_file = get_config_file();
-                if (set_config_file(cfg) != 0) {
-                       telem_log(LOG_ERR, "set-config_file(): Failed to set %s\n", cfg);
-                       // If we fail to load the specified config file, do not send the
-                       // record out. We don't want to send the record out with different
-                       // settings than explicitly requested.
-                       // However, report success so the record gets deleted.
-                       res = 0;
-                       goto done;
+        if (asprintf(&content, "Content-Type: %s", content_type) == -1) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
+        }
+        headers = curl_slist_append(NULL, tid_header);
+        // This should be set by probes/libtelemetry in the future
+        headers = curl_slist_append(headers, content);
+        free(content);
+        if (headers && encoding != ENCODING_IDENTITY) {
+                if (asprintf(&content_encoding, "Content-Encoding: %s",
+                             post_compress_name(encoding)) == -1) {
+                        telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                        exit(EXIT_FAILURE);
                 }
-                reload_config();
-                telem_debug("DEBUG: override server_addr:%s\n", server_addr_config());
+                headers = curl_slist_append(headers, content_encoding);
+                free(content_encoding);
+        }
+        if (!headers) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
         }
 
-        // Generate the JSON message body
-        json_body = create_json_message(headers, body);
+        return headers;
+}
+
+/**
+ * Get the easy handle of the delivery context, creating it along with the
+ * libcurl global environment if needed. The options of the previous post
+ * are cleared, while its connections and caches are kept.
+ *
+ * @param tid_header The tidheader of the configuration in use.
+ * @param content_type The media type of the request body.
+ * @param encoding The encoding of the request body.
+ *
+ * @return The handle, with the request headers in delivery.headers.
+ */
+static CURL *get_http_delivery(const char *tid_header, const char *content_type,
+                               enum body_encoding encoding)
+{
+        if (delivery.curl == NULL) {
+                curl_global_init(CURL_GLOBAL_ALL);
 
-        // Initialize the libcurl global environment once per POST. This lets us
-        // clean up the environment after each POST so that when the daemon is
-        // sitting idle, it will be consuming as little memory as possible.
-        curl_global_init(CURL_GLOBAL_ALL);
+                delivery.curl = curl_easy_init();
+                if (!delivery.curl) {
+                        telem_log(LOG_ERR, "curl_easy_init(): Unable to start libcurl"
+                                  " easy session, exiting\n");
+                        exit(EXIT_FAILURE);
+                }
+        } else {
+                curl_easy_reset(delivery.curl);
+        }
 
-        curl = curl_easy_init();
-        if (!curl) {
-                telem_log(LOG_ERR, "curl_easy_init(): Unable to start libcurl"
-                          " easy session, exiting\n");
-                exit(EXIT_FAILURE);
-                /* TODO: check if memory needs to be released */
+        /* A record may come with a configuration of its own */
+        if (delivery.tid_header == NULL || strcmp(delivery.tid_header, tid_header) != 0 ||
+            strcmp(delivery.content_type, content_type) != 0 ||
+            delivery.encoding != encoding) {
+                curl_slist_free_all(delivery.headers);
+                free(delivery.tid_header);
+                delivery.headers = new_http_headers(tid_header, content_type, encoding);
+                delivery.tid_header = strdup(tid_header);
+                delivery.content_type = content_type;
+                delivery.encoding = encoding;
+                if (!delivery.tid_header) {
+                        telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                        exit(EXIT_FAILURE);
+                }
         }
 
-        custom_headers = curl_slist_append(custom_headers, tid_header);
-        // This should be set by probes/libtelemetry in the future
-        custom_headers = curl_slist_append(custom_headers, content);
+        return delivery.curl;
+}
+
+void release_http_delivery(void)
+{
+        if (delivery.curl == NULL) {
+                return;
+        }
+
+        curl_slist_free_all(delivery.headers);
+        delivery.headers = NULL;
+        free(delivery.tid_header);
+        delivery.tid_header = NULL;
+        delivery.content_type = NULL;
+        curl_easy_cleanup(delivery.curl);
+        delivery.curl = NULL;
+        curl_global_cleanup();
+}
+
+void release_idle_http_delivery(int idle_time)
+{
+        if (delivery.curl != NULL && idle_time > 0 &&
+            difftime(time(NULL), delivery.last_post) >= idle_time) {
+                telem_log(LOG_DEBUG, "Closing idle connection to the server\n");
+                release_http_delivery();
+        }
+}
+
+/**
+ * Set the options of a post.
+ *
+ * @param curl The easy handle.
+ * @param headers The request headers.
+ * @param body The request body, which must outlive the transfer.
+ * @param size Size of the body.
+ * @param errorbuf Receives the error message of libcurl.
+ * @param answer Receives the answer of the server, or NULL.
+ * @param cfg The configuration of the record, or NULL for the one in use.
+ *
+ * @return false if one of the options could not be set.
+ */
+static bool set_post_options(CURL *curl, struct curl_slist *headers, const char *body,
+                             size_t size, char *errorbuf, struct http_response *answer,
+                             const struct config_snapshot *cfg)
+{
+        const char *cert_file = config_snapshot_cainfo(cfg);
 
         // Errors for any curl_easy_* functions will store nice error messages
         // in errorbuf, so send log messages with errorbuf contents
         if (curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorbuf) != CURLE_OK ||
-            curl_easy_setopt(curl, CURLOPT_URL, server_addr_config()) != CURLE_OK ||
+            curl_easy_setopt(curl, CURLOPT_URL, config_snapshot_server_addr(cfg)) != CURLE_OK ||
             curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L) != CURLE_OK ||
             curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L) != CURLE_OK ||
             curl_easy_setopt(curl, CURLOPT_POST, 1) != CURLE_OK ||
@@ -303,27 +585,82 @@ bool post_record_http(char *headers[], char *body, char *cfg)
             curl_easy_setopt(curl, CURLOPT_VERBOSE, 1) != CURLE_OK ||
 #endif
             curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback) != CURLE_OK ||
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, custom_headers) != CURLE_OK ||
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_body) != CURLE_OK ||
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(json_body)) != CURLE_OK ||
-            curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_TRY) != CURLE_OK) {
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, answer) != CURLE_OK ||
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers) != CURLE_OK ||
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body) != CURLE_OK ||
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)size) != CURLE_OK ||
+            curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_TRY) != CURLE_OK ||
+            curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L) != CURLE_OK ||
+            // Posts in flight together share the connection if the server
+            // negotiates HTTP/2
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS) != CURLE_OK ||
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L) != CURLE_OK) {
                 telem_log(LOG_ERR, "curl_easy_setopt(): Failed to set one or more options\n");
-                goto exit;
+                return false;
         }
 
         if (strlen(cert_file) > 0) {
                 if (access(cert_file, F_OK) != -1) {
                         if (curl_easy_setopt(curl, CURLOPT_CAINFO, cert_file) != CURLE_OK) {
                                 telem_log(LOG_ERR, "curl_easy_setopt(): Failed to set CAINFO\n");
-                                goto exit;
+                                return false;
                         }
                         telem_log(LOG_INFO, "cafile was set to %s\n", cert_file);
                 }
         }
-
-        telem_log(LOG_DEBUG, "Executing curl operation...\n");
         errorbuf[0] = 0;
-        res = curl_easy_perform(curl);
+
+        return true;
+}
+
+/**
+ * Compress a request body as the configuration asks. A body that does not
+ * shrink, or could not be compressed, is posted as is.
+ *
+ * @param encoded Set to the body as posted, encoded->buf to be freed.
+ * @param body The request body.
+ * @param size Size of the body.
+ * @param cfg The configuration to post with, or NULL for the one in use.
+ */
+static void encode_body(struct encoded_body *encoded, const char *body, size_t size,
+                        const struct config_snapshot *cfg)
+{
+        enum body_encoding encoding;
+        char *buf = NULL;
+        size_t buf_size = 0;
+        int ret;
+
+        encoded->data = body;
+        encoded->size = size;
+        encoded->encoding = ENCODING_IDENTITY;
+        encoded->buf = NULL;
+
+        ret = post_compress_encoding(config_snapshot_compression(cfg), &encoding);
+        if (ret < 0 || encoding == ENCODING_IDENTITY) {
+                return;
+        }
+
+        ret = post_compress(encoding, config_snapshot_compression_level(cfg), body, size,
+                            &buf, &buf_size);
+        if (ret < 0) {
+                telem_log(LOG_DEBUG, "Unable to compress the request body: %s\n",
+                          strerror(-ret));
+                return;
+        } else if (buf_size >= size) {
+                free(buf);
+                return;
+        }
+        encoded->data = buf;
+        encoded->size = buf_size;
+        encoded->encoding = encoding;
+        encoded->buf = buf;
+}
+
+/* Logs how a post went, returns true if the server accepted it */
+static bool post_result(CURL *curl, CURLcode res, const char *errorbuf)
+{
+        long http_response = 0;
+
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_response);
 
         if (res) {
@@ -335,6 +672,7 @@ bool post_record_http(char *headers[], char *body, char *cfg)
                         telem_log(LOG_DEBUG, "Failed sending record: %s\n",
                                   curl_easy_strerror(res));
                 }
+                return false;
         } else if (http_response != 201 && http_response != 200) {
                 /*  201 means the record was  successfully created
                  *  200 is a generic "ok".
@@ -342,33 +680,144 @@ bool post_record_http(char *headers[], char *body, char *cfg)
                 telem_log(LOG_ERR, "Encountered error %ld on the server\n",
                           http_response);
                 // We treat HTTP error codes the same as libcurl errors
-                res = 1;
-        } else {
-                telem_log(LOG_INFO, "Record sent successfully\n");
+                return false;
         }
+        telem_log(LOG_INFO, "Record sent successfully\n");
 
-exit:
-        curl_slist_free_all(custom_headers);
-        curl_easy_cleanup(curl);
-        curl_global_cleanup();
+        return true;
+}
+
+bool post_body_http(const char *body, size_t size, const char *content_type,
+                    char **response, const struct config_snapshot *cfg, size_t *sent_size)
+{
+        CURL *curl;
+        bool ret = true;
+        char errorbuf[CURL_ERROR_SIZE];
+        const char *tid_header = config_snapshot_tidheader(cfg);
+        struct http_response answer = { NULL, 0 };
+        struct encoded_body encoded;
+
+        encode_body(&encoded, body, size, cfg);
+
+        // The handle is kept until the daemon is idle, so that records
+        // flowing in do not each pay for a new connection and TLS handshake,
+        // while an idle daemon still consumes as little memory as possible.
+        curl = get_http_delivery(tid_header, content_type, encoded.encoding);
+        delivery.last_post = time(NULL);
+
+        if (!set_post_options(curl, delivery.headers, encoded.data, encoded.size, errorbuf,
+                              response != NULL ? &answer : NULL, cfg)) {
+                goto done;
+        }
+
+        telem_log(LOG_DEBUG, "Executing curl operation...\n");
+        ret = post_result(curl, curl_easy_perform(curl), errorbuf);
 
 done:
-        if (json_body) {
-                free(json_body);
-                json_body = NULL;
+        free(encoded.buf);
+        if (response != NULL) {
+                *response = answer.data;
+        }
+        if (sent_size != NULL) {
+                *sent_size = encoded.size;
         }
 
-        if (saved_config_file != NULL) {
-                if (set_config_file(saved_config_file) != 0) {
-                        telem_log(LOG_ERR, "set-config_file(): Failed to set %s",
-                                  saved_config_file);
-                        res = 1;
-                }
-                reload_config();
-                telem_debug("DEBUG: restored server_addr:%s\n", server_addr_config());
+        return ret;
+}
+
+void post_batch_http(struct batch_request *request, void *data)
+{
+        char *response = NULL;
+        bool posted;
+
+        /* Only the answer to a batch is looked at */
+        posted = post_body_http(request->body, request->len, request->content_type,
+                                request->format != BATCH_NONE ? &response : NULL, NULL,
+                                &request->sent_len);
+        post_batch_complete(request, posted, response);
+        free(response);
+}
+
+static void finish_queued_post(CURL *curl, CURLcode res, void *data)
+{
+        struct queued_post *post = data;
+
+        post_batch_complete(post->request, post_result(curl, res, post->errorbuf),
+                            post->answer.data);
+        free(post->body.buf);
+        curl_slist_free_all(post->headers);
+        free(post->answer.data);
+        free(post);
+}
+
+void queue_batch_http(struct batch_request *request, void *data)
+{
+        struct post_queue *queue = data;
+        struct queued_post *post;
+        CURL *curl;
+        int ret;
+
+        post = calloc(1, sizeof(struct queued_post));
+        if (post == NULL) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
+        }
+        post->request = request;
+        encode_body(&post->body, request->body, request->len, NULL);
+        request->sent_len = post->body.size;
+        post->headers = new_http_headers(get_tidheader_config(), request->content_type,
+                                         post->body.encoding);
+
+        curl = post_queue_handle(queue);
+        if (curl == NULL) {
+                telem_log(LOG_ERR, "curl_easy_init(): Unable to start libcurl easy session\n");
+                goto failed;
+        }
+        if (!set_post_options(curl, post->headers, post->body.data, post->body.size,
+                              post->errorbuf,
+                              request->format != BATCH_NONE ? &post->answer : NULL,
+                              NULL)) {
+                goto failed;
+        }
+
+        telem_log(LOG_DEBUG, "Queueing curl operation...\n");
+        ret = post_queue_add(queue, curl, finish_queued_post, post);
+        if (ret == 0) {
+                return;
+        }
+        telem_log(LOG_ERR, "Failed to start a post: %s\n", strerror(-ret));
+
+failed:
+        curl_easy_cleanup(curl);
+        curl_slist_free_all(post->headers);
+        free(post->body.buf);
+        free(post);
+        post_batch_complete(request, false, NULL);
+}
+
+bool post_record_http(const struct wire_headers *headers, char *body,
+                      const struct config_snapshot *cfg, size_t *sent_size)
+{
+        bool ret;
+        char *json_body = NULL;
+
+        if (cfg != NULL) {
+                telem_debug("DEBUG: override server_addr:%s\n",
+                            config_snapshot_server_addr(cfg));
         }
 
-        return res ? false : true;
+        // Generate the JSON message body
+        json_body = create_json_message(headers, body);
+        if (json_body == NULL) {
+                telem_log(LOG_ERR, "Unable to allocate memory for the record\n");
+                return false;
+        }
+
+        ret = post_body_http(json_body, strlen(json_body), "application/json", NULL, cfg,
+                             sent_size);
+        free(json_body);
+
+        return ret;
 }
 
 static void save_local_copy(TelemPostDaemon *daemon, char *body)
@@ -404,13 +853,15 @@ save_err:
         return;
 }
 
-static void save_entry_to_journal(TelemPostDaemon *daemon, time_t t_stamp, char *headers[])
+static void save_entry_to_journal(TelemPostDaemon *daemon, time_t t_stamp,
+                                  const struct wire_headers *headers)
 {
-        char *classification_value = NULL;
-        char *event_id_value = NULL;
+        char *classification_value = strndup(headers->value[TM_CLASSIFICATION],
+                                             headers->len[TM_CLASSIFICATION]);
+        char *event_id_value = strndup(headers->value[TM_EVENT_ID],
+                                       headers->len[TM_EVENT_ID]);
 
-        if (get_header_value(headers[TM_CLASSIFICATION], &classification_value) &&
-            get_header_value(headers[TM_EVENT_ID], &event_id_value)) {
+        if (classification_value != NULL && event_id_value != NULL) {
                 if (new_journal_entry(daemon->record_journal, classification_value, t_stamp, event_id_value) != 0) {
                         telem_log(LOG_INFO, "new_journal_entry in process_record: failed saving record entry\n");
                 }
@@ -452,10 +903,12 @@ static void rate_limit_checks(TelemPostDaemon *daemon, bool *record_check_passed
                                                                 daemon->record_burst_limit, daemon->record_window_length,
                                                                 daemon->record_burst_array, TM_RECORD_COUNTER);
                 }
+                /* The size of a post is only known once its body is
+                 * compressed, records go while the window is within limits */
                 if (byte_burst_enabled) {
                         *byte_check_passed = rate_limit_check(current_minute,
                                                               daemon->byte_burst_limit, daemon->byte_window_length,
-                                                              daemon->byte_burst_array, RECORD_SIZE_LEN);
+                                                              daemon->byte_burst_array, 0);
                 }
                 /* If both record and byte burst disabled, rate limiting disabled */
                 if (!record_burst_enabled && !byte_burst_enabled) {
@@ -473,37 +926,51 @@ static void apply_retention_policies(TelemPostDaemon *daemon, char *body)
         }
 }
 
-/* Deliver record to backend if rate limiting policies are met otherwise
- * spool record for future delivery */
-static bool deliver_record(TelemPostDaemon *daemon, char *headers[], char *body, char* cfg_file)
+/* Writes a record the daemon keeps, read from the staging log or handed
+ * off, to a file of its own that is retried like any staged record */
+static void spool_record(const char *record, size_t size, time_t staged)
 {
+        struct timespec times[2] = { { .tv_sec = staged }, { .tv_sec = staged } };
+        char *record_path = NULL;
+        int fd;
 
-        bool ret = false;
+        if (asprintf(&record_path, "%s/XXXXXX", spool_dir_config()) == -1) {
+                telem_log(LOG_ERR, "Failed to allocate memory for record name in staging folder, aborting\n");
+                exit(EXIT_FAILURE);
+        }
+
+        fd = mkstemp(record_path);
+        if (fd < 0) {
+                telem_perror("Error spooling record");
+                free(record_path);
+                return;
+        }
+
+        if (write(fd, record, size) != (ssize_t)size) {
+                telem_perror("Error spooling record");
+                unlink(record_path);
+        } else {
+                /* Expires as if it had been staged in this file */
+                futimens(fd, times);
+        }
+        close(fd);
+        free(record_path);
+}
+
+/* Applies the rate limiting strategy to a record that was posted, or could
+ * not be, and returns true once the record is done with. A record sent
+ * counts the bytes posted for it, compressed or not. */
+static bool record_delivered(TelemPostDaemon *daemon, bool record_sent, size_t size)
+{
+        bool ret = record_sent;
         int current_minute;
         bool do_spool = false;
-        bool record_sent = false;
         time_t temp = time(NULL);
         struct tm *tm_s = localtime(&temp);
         current_minute = tm_s->tm_min;
-        /* Checks flags */
-        bool record_check_passed = true;
-        bool byte_check_passed = true;
         bool record_burst_enabled = burst_limit_enabled(daemon->record_burst_limit);
         bool byte_burst_enabled =  burst_limit_enabled(daemon->byte_burst_limit);
 
-        /* Perform record and byte rate limiting checks */
-        rate_limit_checks(daemon, &record_check_passed, &byte_check_passed);
-
-        /* Sends record if rate limiting is disabled, or all checks passed */
-        if (!daemon->rate_limit_enabled || (record_check_passed && byte_check_passed)) {
-                /* Send the record as https post */
-                record_sent = post_record_ptr(headers, body, cfg_file);
-                /**
-                 * This is the only point where an error condition could be returned
-                 * if the record was not sent
-                 * */
-                ret = record_sent;
-        }
         // Get rate-limit strategy
         do_spool = spool_strategy_selected(daemon);
 
@@ -526,58 +993,150 @@ static bool deliver_record(TelemPostDaemon *daemon, char *headers[], char *body,
                 }
                 if (byte_burst_enabled) {
                         rate_limit_update(current_minute, daemon->byte_window_length,
-                                          daemon->byte_burst_array, RECORD_SIZE_LEN);
+                                          daemon->byte_burst_array, size);
                 }
         }
 
         return ret;
 }
 
-bool process_staged_record(char *filename, TelemPostDaemon *daemon)
+static void free_batched_record(struct batched_record *batched)
 {
-        int k;
-        bool ret = false;
-        char *headers[NUM_HEADERS];
-        char *body = NULL;
-        struct stat buf = { 0 };
-        time_t current_time = time(NULL);
-        int64_t max_spool_size = 0;
-        char *cfg_file = NULL;
+        if (batched == NULL) {
+                return;
+        }
+        free(batched->path);
+        free(batched->record);
+        free(batched);
+}
 
-        for (k = 0; k < NUM_HEADERS; k++) {
-                headers[k] = NULL;
+/* Completes a record once its request completed */
+static void finish_batched_record(void *data, bool sent, size_t size)
+{
+        struct batched_record *batched = data;
+        TelemPostDaemon *daemon = batched->daemon;
+
+        if (record_delivered(daemon, sent, size)) {
+                save_entry_to_journal(daemon, time(NULL), &batched->parsed.headers);
+                apply_retention_policies(daemon, batched->parsed.body);
+                if (batched->path != NULL) {
+                        unlink(batched->path);
+                        daemon->current_spool_size -= (batched->blocks * 512);
+                        if (batched->removed != NULL) {
+                                (*batched->removed)++;
+                        }
+                }
+        } else if (batched->record != NULL) {
+                spool_record(batched->record, batched->size, batched->staged);
         }
 
-        /** Load record **/
-        if ((ret = read_record(filename, headers, &body, &cfg_file)) == false) {
-                telem_log(LOG_WARNING, "unable to read record\n");
-                ret = true; // Record corrupted? true will remove record
-                goto end_processing_file;
+        buffer_pool_put(&daemon->record_bufs, batched->buf);
+        free_batched_record(batched);
+}
+
+/* Prepares a record parsed in buf to be posted in a batch, returns NULL if
+ * records are posted one by one while the daemon waits, or this one has a
+ * configuration of its own */
+static struct batched_record *new_batched_record(TelemPostDaemon *daemon, char *buf,
+                                                 const struct staged_record *parsed)
+{
+        struct batched_record *batched;
+
+        if (daemon->batch == NULL || parsed->cfg_file != NULL) {
+                return NULL;
         }
 
-        /** Get file information  **/
-        if (stat(filename, &buf) == -1) {
-                telem_perror("Processing staged file unable to stat record in spool");
-                ret = true; // true to remove it
-                goto end_processing_file;
+        batched = calloc(1, sizeof(struct batched_record));
+        if (batched == NULL) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
         }
+        batched->daemon = daemon;
+        batched->buf = buf;
+        batched->parsed = *parsed;
 
-        /** Update spool directory size **/
-        daemon->current_spool_size += (buf.st_blocks * 512);
+        return batched;
+}
+
+static int batch_record(TelemPostDaemon *daemon, struct batched_record *batched)
+{
+        char *json_body;
+        int ret;
+
+        json_body = create_json_message(&batched->parsed.headers, batched->parsed.body);
+        if (json_body == NULL) {
+                return -ENOMEM;
+        }
+        ret = post_batch_add(daemon->batch, json_body, strlen(json_body),
+                             finish_batched_record, batched);
+        free(json_body);
+
+        return ret;
+}
+
+static void flush_batch(TelemPostDaemon *daemon)
+{
+        if (daemon->batch != NULL) {
+                post_batch_flush(daemon->batch);
+        }
+}
+
+void complete_record_delivery(TelemPostDaemon *daemon)
+{
+        flush_batch(daemon);
+        if (daemon->post_queue != NULL) {
+                post_queue_wait(daemon->post_queue);
+        }
+}
+
+/* Deliver record to backend if rate limiting policies are met otherwise
+ * spool record for future delivery. A record that can be batched is added
+ * to the batch, and completed once the batch is posted. */
+static enum delivery deliver_record(TelemPostDaemon *daemon,
+                                    const struct wire_headers *headers, char *body,
+                                    const struct config_snapshot *cfg,
+                                    struct batched_record *batched)
+{
+        bool record_sent = false;
+        size_t sent_size = 0;
+        /* Checks flags */
+        bool record_check_passed = true;
+        bool byte_check_passed = true;
+
+        /* Perform record and byte rate limiting checks */
+        rate_limit_checks(daemon, &record_check_passed, &byte_check_passed);
+
+        /* Sends record if rate limiting is disabled, or all checks passed */
+        if (!daemon->rate_limit_enabled || (record_check_passed && byte_check_passed)) {
+                if (batched != NULL && batch_record(daemon, batched) == 0) {
+                        return DELIVERY_BATCHED;
+                }
+                /* Send the record as https post */
+                record_sent = post_record_ptr(headers, body, cfg, &sent_size);
+        }
+
+        return record_delivered(daemon, record_sent, sent_size) ? DELIVERY_DONE : DELIVERY_KEEP;
+}
+
+static enum delivery deliver_staged_record(TelemPostDaemon *daemon,
+                                           const struct wire_headers *headers, char *body,
+                                           const struct config_snapshot *cfg,
+                                           time_t staged, struct batched_record *batched)
+{
+        enum delivery ret = DELIVERY_KEEP;
+        time_t current_time = time(NULL);
+        int64_t max_spool_size = 0;
 
         /** Check that record is not expired **/
-        if (!S_ISREG(buf.st_mode) ||
-            (current_time - buf.st_mtime > (record_expiry_config() * 60)) ||
-            (buf.st_uid  != getuid())) {
-                ret = true; // Expired, true to remove it
-                goto end_processing_file;
+        if (current_time - staged > (record_expiry_config() * 60)) {
+                return DELIVERY_DONE; // Expired, done to remove it
         }
 
         /** Record delivery **/
         if (!daemon->record_server_delivery_enabled) {
                 telem_log(LOG_INFO, "record server delivery disabled\n");
                 // Not an error condition
-                ret = true;
+                ret = DELIVERY_DONE;
                 goto end_record_delivery;
         }
 
@@ -590,12 +1149,12 @@ bool process_staged_record(char *filename, TelemPostDaemon *daemon)
                     daemon->current_spool_size >= (max_spool_size * 1024)) {
                         // Drop record
                         telem_log(LOG_INFO, "Spool dir full, dropping record\n");
-                        ret = true;
+                        ret = DELIVERY_DONE;
                 } else {
                         // Keep record, non error condition
-                        ret = false;
+                        ret = DELIVERY_KEEP;
                 }
-                goto end_processing_file;
+                return ret;
         }
 
         /** Check window_length **/
@@ -604,40 +1163,260 @@ bool process_staged_record(char *filename, TelemPostDaemon *daemon)
         }
 
         /** Deliver or spool **/
-        ret = deliver_record(daemon, headers, body, cfg_file);
+        ret = deliver_record(daemon, headers, body, cfg, batched);
 
 end_record_delivery:
         /** Save record once it is properly delivered, if record
          *  is spooled the record is not saved to journal until
          *  delievered on a re-try **/
-        if (ret) {
+        if (ret == DELIVERY_DONE) {
                 /** Save to journal **/
                 save_entry_to_journal(daemon, current_time, headers);
                 /** Record retention **/
                 apply_retention_policies(daemon, body);
         }
 
+        return ret;
+}
+
+/* Gets the configuration a record comes with, returns false if the record
+ * is to be removed without being sent */
+static bool record_config(const struct staged_record *record, struct config_snapshot **cfg)
+{
+        *cfg = NULL;
+        if (record->cfg_file == NULL) {
+                return true;
+        }
+
+        *cfg = config_snapshot_get(record->cfg_file);
+        if (*cfg == NULL) {
+                // If we fail to load the specified config file, do not send the
+                // record out. We don't want to send the record out with different
+                // settings than explicitly requested.
+                telem_log(LOG_ERR, "Failed to load configuration %s, record dropped\n",
+                          record->cfg_file);
+                return false;
+        }
+
+        return true;
+}
+
+/* Returns true once the record is done with and the file can be removed,
+ * a batched record removes its file itself and counts it in removed */
+static bool process_staged_file(char *filename, TelemPostDaemon *daemon, int *removed)
+{
+        bool ret = false;
+        enum delivery delivery;
+        struct staged_record record;
+        struct batched_record *batched;
+        struct config_snapshot *cfg;
+        char *buf = NULL;
+        struct stat st = { 0 };
+
+        buf = buffer_pool_get(&daemon->record_bufs);
+        if (buf == NULL) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
+        }
+
+        /** Load record **/
+        if ((ret = read_record(filename, buf, &record)) == false) {
+                telem_log(LOG_WARNING, "unable to read record\n");
+                ret = true; // Record corrupted? true will remove record
+                goto end_processing_file;
+        }
+
+        /** Get file information  **/
+        if (stat(filename, &st) == -1) {
+                telem_perror("Processing staged file unable to stat record in spool");
+                ret = true; // true to remove it
+                goto end_processing_file;
+        }
+
+        /** Update spool directory size **/
+        daemon->current_spool_size += (st.st_blocks * 512);
+
+        /** Only records staged by telemprobd are delivered **/
+        if (!S_ISREG(st.st_mode) || (st.st_uid  != getuid())) {
+                ret = true; // true to remove it
+                goto end_processing_file;
+        }
+
+        if (!record_config(&record, &cfg)) {
+                ret = true; // true to remove it
+                goto end_processing_file;
+        }
+
+        batched = new_batched_record(daemon, buf, &record);
+        if (batched != NULL) {
+                batched->path = strdup(filename);
+                if (batched->path == NULL) {
+                        telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                        exit(EXIT_FAILURE);
+                }
+                batched->blocks = st.st_blocks;
+                batched->removed = removed;
+        }
+
+        delivery = deliver_staged_record(daemon, &record.headers, record.body,
+                                         cfg, st.st_mtime, batched);
+        config_snapshot_put(cfg);
+        if (delivery == DELIVERY_BATCHED) {
+                /* The buffer and the file are now the batch's */
+                return false;
+        }
+        free_batched_record(batched);
+        ret = (delivery == DELIVERY_DONE);
+
 end_processing_file:
         /** Update spool size if record will be removed **/
         if (ret) {
-                daemon->current_spool_size -= (buf.st_blocks * 512);
+                daemon->current_spool_size -= (st.st_blocks * 512);
         }
         telem_log(LOG_DEBUG, "spool_size: %ld\n", daemon->current_spool_size);
-        free(body);
+        buffer_pool_put(&daemon->record_bufs, buf);
 
-        for (k = 0; k < NUM_HEADERS; k++) {
-                free(headers[k]);
+        return ret;
+}
+
+bool process_staged_record(char *filename, TelemPostDaemon *daemon)
+{
+        return process_staged_file(filename, daemon, NULL);
+}
+
+static void process_record_in_memory(void *data, const char *record, size_t size,
+                                     time_t staged)
+{
+        TelemPostDaemon *daemon = data;
+        struct staged_record parsed;
+        struct batched_record *batched;
+        struct config_snapshot *cfg;
+        enum delivery delivery;
+        char *buf;
+
+        if (size > STAGED_RECORD_SIZE) {
+                telem_log(LOG_WARNING, "Record of %zu bytes is too large, dropped\n", size);
+                return;
         }
 
-        if (cfg_file != NULL) {
-                free(cfg_file);
+        /* Parsed from a copy, the record is spooled as is if not delivered */
+        buf = buffer_pool_get(&daemon->record_bufs);
+        if (buf == NULL) {
+                telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                exit(EXIT_FAILURE);
         }
-        return ret;
+        memcpy(buf, record, size);
+
+        if (!parse_record(buf, size, &parsed)) {
+                telem_log(LOG_WARNING, "unable to read record\n");
+                goto done;
+        }
+        if (!record_config(&parsed, &cfg)) {
+                goto done;
+        }
+
+        batched = new_batched_record(daemon, buf, &parsed);
+        if (batched != NULL) {
+                batched->record = malloc(size);
+                if (batched->record == NULL) {
+                        telem_log(LOG_ERR, "Unable to allocate memory, exiting\n");
+                        exit(EXIT_FAILURE);
+                }
+                memcpy(batched->record, record, size);
+                batched->size = size;
+                batched->staged = staged;
+        }
+
+        delivery = deliver_staged_record(daemon, &parsed.headers, parsed.body,
+                                         cfg, staged, batched);
+        config_snapshot_put(cfg);
+        if (delivery == DELIVERY_BATCHED) {
+                /* The buffer is now the batch's */
+                return;
+        }
+        free_batched_record(batched);
+        if (delivery == DELIVERY_KEEP) {
+                spool_record(record, size, staged);
+        }
+
+done:
+        buffer_pool_put(&daemon->record_bufs, buf);
+}
+
+/* The records read from the staging log are delivered or spooled before
+ * the cursor moves past them */
+static void sync_staging_log(void *data)
+{
+        complete_record_delivery(data);
+}
+
+void consume_staging_log(TelemPostDaemon *daemon)
+{
+        int ret;
+
+        if (daemon->staging_cursor == NULL) {
+                return;
+        }
+
+        ret = staging_log_consume(daemon->staging_cursor, process_record_in_memory,
+                                  sync_staging_log, daemon);
+        if (ret < 0) {
+                telem_log(LOG_ERR, "Failed to read the staging log: %s\n", strerror(-ret));
+        }
+}
+
+/* Processes the records telemprobd handed off, up to max of them, and
+ * returns how many */
+static int receive_handoff(TelemPostDaemon *daemon, int max)
+{
+        int fd = daemon->pollfds[handofffd].fd;
+        int records = 0;
+        ssize_t len;
+
+        while (records < max) {
+                len = recv(fd, daemon->handoff_buf, HANDOFF_MAX_RECORD, MSG_DONTWAIT);
+                if (len <= 0) {
+                        /* telemprobd connects again for its next record */
+                        if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                                close(fd);
+                                set_pollfd(daemon, -1, handofffd, POLLIN);
+                        }
+                        break;
+                }
+                process_record_in_memory(daemon, daemon->handoff_buf, (size_t)len, time(NULL));
+                records++;
+        }
+
+        return records;
+}
+
+static void accept_handoff(TelemPostDaemon *daemon)
+{
+        int fd;
+
+        fd = handoff_accept(daemon->pollfds[handofflfd].fd);
+        if (fd < 0) {
+                if (fd != -EAGAIN && fd != -EWOULDBLOCK) {
+                        telem_log(LOG_WARNING, "Refused connection on the hand-off socket: %s\n",
+                                  strerror(-fd));
+                }
+                return;
+        }
+
+        /* Only one telemprobd runs, the previous connection is gone */
+        if (daemon->pollfds[handofffd].fd >= 0) {
+                receive_handoff(daemon, INT_MAX);
+                if (daemon->pollfds[handofffd].fd >= 0) {
+                        close(daemon->pollfds[handofffd].fd);
+                }
+        }
+        set_pollfd(daemon, fd, handofffd, POLLIN);
 }
 
 static int directory_dot_filter(const struct dirent *entry)
 {
-        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
+        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0) ||
+            staging_log_file(entry->d_name)) {
                 return 0;
         } else {
                 return 1;
@@ -651,6 +1430,11 @@ int staging_records_loop(TelemPostDaemon *daemon)
         int numentries;
         struct dirent **namelist;
 
+        /* Records kept from the log are picked up below, and records still
+         * in flight are not posted twice */
+        consume_staging_log(daemon);
+        complete_record_delivery(daemon);
+
         numentries = scandir(spool_dir_config(), &namelist, directory_dot_filter, NULL);
         processed = 0;
 
@@ -671,12 +1455,14 @@ int staging_records_loop(TelemPostDaemon *daemon)
                         telem_log(LOG_ERR, "Failed to allocate memory for staging record full path\n");
                         exit(EXIT_FAILURE);
                 }
-                if (process_staged_record(record_path, daemon)) {
+                if (process_staged_file(record_path, daemon, &processed)) {
                         unlink(record_path);
                         processed++;
                 }
                 free(record_path);
         }
+        /* Counts the batched records that were removed */
+        complete_record_delivery(daemon);
 
         for (int i = 0; i < numentries; i++) {
                 free(namelist[i]);
@@ -695,6 +1481,8 @@ void run_daemon(TelemPostDaemon *daemon)
         bool daemon_recycling_enabled = daemon_recycling_enabled_config();
         time_t last_spool_run_time = time(NULL);
         time_t last_record_received = time(NULL);
+        int idle_trim_time = idle_trim_time_config();
+        bool trimmed = false;
 
         assert(daemon);
         assert(daemon->pollfds);
@@ -708,7 +1496,6 @@ void run_daemon(TelemPostDaemon *daemon)
 
         while (1) {
                 int retry_delay = spool_process_time;
-                malloc_trim(0);
 
                 /* check if we need to retry sending spooled records */
                 if (retry_attempt > 0) {
@@ -718,7 +1505,13 @@ void run_daemon(TelemPostDaemon *daemon)
                                   retry_delay);
                 }
 
-                ret = poll(daemon->pollfds, NFDS, retry_delay * 1000);
+                /* Posts in flight make progress meanwhile */
+                if (daemon->post_queue != NULL) {
+                        ret = post_queue_poll(daemon->post_queue, daemon->pollfds, NFDS,
+                                              retry_delay * 1000);
+                } else {
+                        ret = poll(daemon->pollfds, NFDS, retry_delay * 1000);
+                }
                 if (ret == -1) {
                         telem_perror("Failed to poll daemon file descriptors");
                         break;
@@ -745,6 +1538,7 @@ void run_daemon(TelemPostDaemon *daemon)
                                 ssize_t i = 0;
                                 ssize_t length = 0;
                                 char buffer[BUFFER_LEN];
+                                bool log_changed = false;
 
                                 length = read(daemon->fd, buffer, BUFFER_LEN);
                                 if (length < 0) {
@@ -757,7 +1551,10 @@ void run_daemon(TelemPostDaemon *daemon)
                                         struct inotify_event *event = (struct inotify_event *)&buffer[i];
 
                                         if (event->len) {
-                                                if (event->mask & IN_CLOSE_WRITE && !(event->mask & IN_ISDIR)) {
+                                                if (staging_log_file(event->name)) {
+                                                        /* Read once all events are */
+                                                        log_changed = true;
+                                                } else if (event->mask & IN_CLOSE_WRITE && !(event->mask & IN_ISDIR)) {
                                                         char *record_name = NULL;
 
                                                         /* Retrieve foldername from watch id?  */
@@ -772,12 +1569,31 @@ void run_daemon(TelemPostDaemon *daemon)
                                                         }
                                                         free(record_name);
                                                         last_record_received = time(NULL);
+                                                        trimmed = false;
                                                 }
                                         }
 
                                         i += (ssize_t)EVENT_SIZE + event->len;
                                 }
+
+                                if (log_changed && daemon->staging_cursor != NULL) {
+                                        consume_staging_log(daemon);
+                                        last_record_received = time(NULL);
+                                        trimmed = false;
+                                }
+                        }
+
+                        if (daemon->pollfds[handofflfd].revents != 0) {
+                                accept_handoff(daemon);
+                        }
+                        if (daemon->pollfds[handofffd].revents != 0 &&
+                            receive_handoff(daemon, TM_HANDOFF_BATCH) > 0) {
+                                last_record_received = time(NULL);
+                                trimmed = false;
                         }
+
+                        /* No record waits in the batch for the next event */
+                        flush_batch(daemon);
                 } else {
                         time_t now = time(NULL);
                         /* time to recycle the daemon has elapsed*/
@@ -806,9 +1622,18 @@ void run_daemon(TelemPostDaemon *daemon)
 
                         /* Check spool  */
                         if (difftime(now, last_spool_run_time) >= spool_process_time) {
-                                spool_records_loop(&(daemon->current_spool_size));
+                                spool_records_loop(daemon);
                                 last_spool_run_time = time(NULL);
                         }
+
+                        /* Release memory once idle, checked on timeouts only
+                         * so that retries keep their schedule */
+                        release_idle_http_delivery(idle_trim_time);
+                        if (daemon->post_queue != NULL) {
+                                post_queue_release_idle(daemon->post_queue, idle_trim_time);
+                        }
+                        buffer_pool_idle_trim(&daemon->record_bufs, last_record_received,
+                                              idle_trim_time, &trimmed);
                 }
 
                 /* Check journal records and prune if needed */
@@ -829,7 +1654,36 @@ void close_daemon(TelemPostDaemon *daemon)
                 close(daemon->fd);
         }
 
+        for (int i = handofflfd; i <= handofffd; i++) {
+                if (daemon->pollfds[i].fd >= 0) {
+                        close(daemon->pollfds[i].fd);
+                        daemon->pollfds[i].fd = -1;
+                }
+        }
+        free(daemon->handoff_buf);
+        daemon->handoff_buf = NULL;
+
+        complete_record_delivery(daemon);
+        if (daemon->batch != NULL) {
+                post_batch_free(daemon->batch);
+                free(daemon->batch);
+                daemon->batch = NULL;
+        }
+        if (daemon->post_queue != NULL) {
+                post_queue_release(daemon->post_queue);
+                free(daemon->post_queue);
+                daemon->post_queue = NULL;
+        }
+        release_http_delivery();
+
+        if (daemon->staging_cursor != NULL) {
+                staging_cursor_close(daemon->staging_cursor);
+                free(daemon->staging_cursor);
+                daemon->staging_cursor = NULL;
+        }
+
         close_journal(daemon->record_journal);
+        buffer_pool_trim(&daemon->record_bufs);
 }
 
 /* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
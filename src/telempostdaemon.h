@@ -16,11 +16,13 @@
 
 #define EVENT_SIZE sizeof(struct inotify_event)
 #define BUFFER_LEN 1024 * (EVENT_SIZE + 16)
-#define NFDS 2
+#define NFDS 4
 #define TM_RATE_LIMIT_SLOTS (1 /*h*/ * 60 /*m*/)
 #define TM_RECORD_COUNTER (1)
 #define MAX_RETRY_ATTEMPTS 8
 #define NETWORK_BYPASS_DURATION TM_DAEMON_EXIT_TIME
+/* Records taken from telemprobd before polling again */
+#define TM_HANDOFF_BATCH 64
 
 #include <poll.h>
 #include <stdbool.h>
@@ -29,8 +31,14 @@
 #include "common.h"
 #include "journal/journal.h"
 #include "configuration.h"
+#include "buffer_pool.h"
+#include "staging_log.h"
+#include "handoff.h"
+#include "post_batch.h"
+#include "post_queue.h"
+#include "wire.h"
 
-enum fdindex {signlfd, watchfd};
+enum fdindex {signlfd, watchfd, handofflfd, handofffd};
 
 typedef struct TelemPostDaemon {
         int fd;
@@ -58,6 +66,17 @@ typedef struct TelemPostDaemon {
         /* Record local copy and delivery  */
         bool record_retention_enabled;
         bool record_server_delivery_enabled;
+        /* records posted together, or posted one by one while the daemon
+         * goes on, NULL when posted one by one while it waits */
+        struct post_batch *batch;
+        /* posts in flight, NULL when made one at a time */
+        struct post_queue *post_queue;
+        /* bodies of staged records being processed */
+        struct buffer_pool record_bufs;
+        /* position in the staging log, NULL when records are staged in files */
+        struct staging_cursor *staging_cursor;
+        /* record received from telemprobd, see handoff.h */
+        char *handoff_buf;
 } TelemPostDaemon;
 
 /**
@@ -86,9 +105,27 @@ void close_daemon(TelemPostDaemon *daemon);
  *
  * @param filename a pointor to record on disk
  * @param daemon post to telemetry post daemon
+ * @return true if the record can be removed, false if it is kept or added
+ *         to the batch, which removes it once posted
  */
 bool process_staged_record(char *filename, TelemPostDaemon *daemon);
 
+/**
+ * Processes the records appended to the staging log since it was last
+ * read, if records are staged in a log
+ *
+ * @param daemon a pointer to telemetry post daemon
+ */
+void consume_staging_log(TelemPostDaemon *daemon);
+
+/**
+ * Posts the records waiting in the batch, and waits for the posts in flight
+ * to complete
+ *
+ * @param daemon a pointer to telemetry post daemon
+ */
+void complete_record_delivery(TelemPostDaemon *daemon);
+
 /**
  * Scans staging directory to process files that were
  * missed by file watcher
@@ -101,22 +138,81 @@ int staging_records_loop(TelemPostDaemon *daemon);
 /**
  * Posts a record to backend
  *
- * @param headers a pointer to an array with keys and values
+ * @param headers the header values
  * @param body a pointer to the payload
- * @param cfg_file a pointer to a non-default configuration
- *        file to be used.
+ * @param cfg the configuration the record comes with, or NULL for the one
+ *        in use
+ * @param sent_size set to the size of the request body as sent, or NULL
+ * @return true if successful, false otherwise
+ */
+bool post_record_http(const struct wire_headers *headers, char *body,
+                      const struct config_snapshot *cfg, size_t *sent_size);
+
+/**
+ * Embeds the headers and the payload of a record in a JSON object
+ *
+ * @param tm_headers the header values
+ * @param tm_payload the payload
+ * @return the JSON object as a string to be freed, or NULL
+ */
+char *create_json_message(const struct wire_headers *tm_headers, char *tm_payload);
+
+/**
+ * Posts a request body to the backend
+ *
+ * @param body the request body
+ * @param size size of the body
+ * @param content_type media type of the body
+ * @param response set to the answer of the backend, or NULL if not needed
+ * @param cfg the configuration to post with, or NULL for the one in use
+ * @param sent_size set to the size of the body as sent, once compressed as
+ *        the configuration asks, or NULL
  * @return true if successful, false otherwise
  */
-bool post_record_http(char *headers[], char *body, char *cfg_file);
+bool post_body_http(const char *body, size_t size, const char *content_type,
+                    char **response, const struct config_snapshot *cfg, size_t *sent_size);
+
+/**
+ * Posts a batch to the backend and completes it, see batch_post_fn in
+ * post_batch.h
+ *
+ * @param request the batch
+ * @param data unused
+ */
+void post_batch_http(struct batch_request *request, void *data);
+
+/**
+ * Starts posting a batch to the backend, completed once the post is, see
+ * batch_post_fn in post_batch.h
+ *
+ * @param request the batch
+ * @param data the post queue
+ */
+void queue_batch_http(struct batch_request *request, void *data);
+
+/**
+ * Close the connection to the backend and release the libcurl handle kept
+ * by post_record_http(), if any. The next post starts over.
+ */
+void release_http_delivery(void);
+
+/**
+ * Release the libcurl handle kept by post_record_http() once nothing was
+ * posted for a while.
+ *
+ * @param idle_time Seconds without a post, 0 to keep the handle
+ */
+void release_idle_http_delivery(int idle_time);
 
 /**
  * Pointer to function to isolate backend call during
  * unit testing.
  *
- * @param headers pointer to array of keys
+ * @param headers the header values
  * @param body a pinter to payload
  * */
-extern bool (*post_record_ptr)(char *headers[], char *body, char *cfg_file);
+extern bool (*post_record_ptr)(const struct wire_headers *headers, char *body,
+                               const struct config_snapshot *cfg, size_t *sent_size);
 
 /** Helper functions **/
 /* rate limit check */
@@ -16,8 +16,6 @@
 
 #define _GNU_SOURCE
 
-#define RANDOM_ID_LEN 32
-
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
@@ -35,39 +33,6 @@
 #include "util.h"
 #include "log.h"
 
-bool get_header(const char *haystack, const char *needle, char **line)
-{
-        size_t len = strlen(needle);
-
-        if (haystack && !strncmp(haystack, needle, len)) {
-                *line = strdup(haystack);
-                return true;
-        }
-        return false;
-}
-
-bool get_header_value(const char *header, char **value)
-{
-        char *sep = NULL;
-
-        *value = NULL;
-
-        if (header == NULL) {
-                return false;
-        }
-
-        if ((sep = strchr(header, ':')) != NULL) {
-                sep++;
-                // skip space after colon if there's one
-                if (*sep == ' ') {
-                        sep++;
-                }
-                *value = strdup(sep);
-        }
-
-        return (bool)(*value != NULL);
-}
-
 void *reallocate(void **addr, size_t *allocated, size_t requested)
 {
         void *newaddr;
@@ -131,34 +96,6 @@ long get_directory_size(const char *dir_path)
         return total_size;
 }
 
-/**
- * Generates a 32 characters random id
- *
- * @param buffer pointer to allocate and copy data
- *
- */
-int get_random_id(char **buff)
-{
-        int result = -1;
-        int frandom = -1;
-        uint64_t random_id[2] = { '\0' };
-
-        frandom = open("/dev/urandom", O_RDONLY|O_NOFOLLOW);
-        if (frandom < 0) {
-                return -1;
-        }
-
-        if (read(frandom, &random_id, sizeof(random_id)) == sizeof(random_id)) {
-                if (asprintf(buff, "%.16" PRIx64 "%.16" PRIx64, random_id[0], random_id[1]) == RANDOM_ID_LEN) {
-                        result = 0;
-                }
-        }
-
-        close(frandom);
-
-        return result;
-}
-
 /**
  * Validate classification value. A valid classification
  * is a string with 2 slashes, with max length of
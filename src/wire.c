@@ -0,0 +1,182 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "wire.h"
+
+size_t wire_header_width(int id)
+{
+        switch (id) {
+        case TM_RECORD_VERSION:
+        case TM_SEVERITY:
+        case TM_PAYLOAD_VERSION:
+                return sizeof(uint32_t);
+        case TM_TIMESTAMP:
+                return sizeof(uint64_t);
+        default:
+                return 0;
+        }
+}
+
+size_t wire_str_size(size_t len)
+{
+        return 1 + sizeof(uint16_t) + len;
+}
+
+size_t wire_num_size(int id)
+{
+        return 1 + wire_header_width(id);
+}
+
+size_t wire_put_str(char *dest, int id, const char *value, size_t len)
+{
+        uint16_t len16 = (uint16_t)len;
+
+        dest[0] = (char)id;
+        memcpy(dest + 1, &len16, sizeof(len16));
+        memcpy(dest + 1 + sizeof(len16), value, len);
+
+        return wire_str_size(len);
+}
+
+size_t wire_put_num(char *dest, int id, uint64_t value)
+{
+        uint32_t value32 = (uint32_t)value;
+
+        dest[0] = (char)id;
+        if (wire_header_width(id) == sizeof(uint64_t)) {
+                memcpy(dest + 1, &value, sizeof(value));
+        } else {
+                memcpy(dest + 1, &value32, sizeof(value32));
+        }
+
+        return wire_num_size(id);
+}
+
+static int check_complete(const struct wire_headers *headers)
+{
+        for (int i = 0; i < NUM_HEADERS; i++) {
+                if (headers->value[i] == NULL) {
+                        return -EINVAL;
+                }
+        }
+
+        return 0;
+}
+
+int wire_parse_binary(const char *buf, size_t size, struct wire_headers *headers)
+{
+        size_t pos = 0;
+        size_t width;
+        uint64_t value64;
+        uint32_t value32;
+        uint16_t len16;
+        int id;
+
+        memset(headers->value, 0, sizeof(headers->value));
+
+        while (pos < size) {
+                id = (unsigned char)buf[pos++];
+                if (id >= NUM_HEADERS || headers->value[id] != NULL) {
+                        return -EINVAL;
+                }
+
+                width = wire_header_width(id);
+                if (width != 0) {
+                        if (size - pos < width) {
+                                return -EINVAL;
+                        }
+                        if (width == sizeof(uint64_t)) {
+                                memcpy(&value64, buf + pos, sizeof(value64));
+                        } else {
+                                memcpy(&value32, buf + pos, sizeof(value32));
+                                value64 = value32;
+                        }
+                        headers->len[id] = (size_t)snprintf(headers->num[id],
+                                                            sizeof(headers->num[id]),
+                                                            "%" PRIu64, value64);
+                        headers->value[id] = headers->num[id];
+                        pos += width;
+                        continue;
+                }
+
+                if (size - pos < sizeof(len16)) {
+                        return -EINVAL;
+                }
+                memcpy(&len16, buf + pos, sizeof(len16));
+                pos += sizeof(len16);
+
+                /* Values end up as lines of the staged record */
+                if (size - pos < len16 || memchr(buf + pos, '\n', len16) ||
+                    memchr(buf + pos, '\0', len16)) {
+                        return -EINVAL;
+                }
+                headers->value[id] = buf + pos;
+                headers->len[id] = len16;
+                pos += len16;
+        }
+
+        return check_complete(headers);
+}
+
+int wire_parse_text(const char *buf, size_t size, struct wire_headers *headers)
+{
+        const char *end = buf + size;
+        const char *line = buf;
+        const char *eol;
+        const char *sep;
+        int id;
+
+        memset(headers->value, 0, sizeof(headers->value));
+
+        for (; line < end; line = eol + 1) {
+                eol = memchr(line, '\n', (size_t)(end - line));
+                if (eol == NULL) {
+                        eol = end;
+                }
+                if (eol == line) {
+                        continue;
+                }
+
+                sep = memchr(line, ':', (size_t)(eol - line));
+                if (sep == NULL) {
+                        return -EINVAL;
+                }
+
+                id = get_header_id(line, (size_t)(sep - line));
+                if (id < 0 || headers->value[id] != NULL) {
+                        return -EINVAL;
+                }
+
+                // skip space after colon if there's one
+                sep++;
+                if (sep < eol && *sep == ' ') {
+                        sep++;
+                }
+                headers->value[id] = sep;
+                headers->len[id] = (size_t)(eol - sep);
+        }
+
+        return check_complete(headers);
+}
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
@@ -0,0 +1,131 @@
+/*
+ * This program is part of the Clear Linux Project
+ *
+ * Copyright 2026 Intel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms and conditions of the GNU Lesser General Public License, as
+ * published by the Free Software Foundation; either version 2.1 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Record headers as sent from the library to telemprobd.
+ *
+ * Wire format v5 encodes the headers in binary. Records are framed as
+ * before (see tm_frame_record), except that WIRE_V5_MAGIC precedes the
+ * header size. The older text format (v4, "name: value\n" lines) has the
+ * header size in its place, which is always far smaller than the magic, so
+ * telemprobd tells both apart from the first 32 bits after the optional
+ * CFG prefix.
+ *
+ * A binary header is its id (TM_RECORD_VERSION, TM_CLASSIFICATION, ...) in
+ * one byte, followed by its value. The value of a numeric header (see
+ * wire_header_width()) has a fixed width: 64 bits for creation_timestamp,
+ * 32 bits for the others. Any other value is a 16 bit length followed by
+ * that many bytes, which may be neither newlines nor null bytes. Numbers
+ * are in host byte order, as both ends run on the same host.
+ *
+ * In both formats, each header must be present exactly once, in any order.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#define WIRE_V5_MAGIC 0x35765754        /* "TWv5" */
+
+/* Longest value of a string header */
+#define WIRE_MAX_STR_LEN UINT16_MAX
+
+/* Header values of one record, pointing into the record itself */
+struct wire_headers {
+        const char *value[NUM_HEADERS];
+        size_t len[NUM_HEADERS];
+        /* numeric values of a binary record, formatted as text */
+        char num[NUM_HEADERS][21];
+};
+
+/**
+ * Width of the value of a numeric header.
+ *
+ * @param id The header id.
+ *
+ * @return The number of bytes of the value, or 0 if the header is a string.
+ */
+size_t wire_header_width(int id);
+
+/**
+ * Encoded size of a string header.
+ *
+ * @param len Length of the value, at most WIRE_MAX_STR_LEN.
+ *
+ * @return The number of bytes wire_put_str() writes.
+ */
+size_t wire_str_size(size_t len);
+
+/**
+ * Encoded size of a numeric header.
+ *
+ * @param id The header id.
+ *
+ * @return The number of bytes wire_put_num() writes.
+ */
+size_t wire_num_size(int id);
+
+/**
+ * Encode a string header.
+ *
+ * @param dest Where to write the header, at least wire_str_size(len) bytes.
+ * @param id The header id.
+ * @param value The value, without newlines or null bytes.
+ * @param len Length of the value, at most WIRE_MAX_STR_LEN.
+ *
+ * @return The number of bytes written.
+ */
+size_t wire_put_str(char *dest, int id, const char *value, size_t len);
+
+/**
+ * Encode a numeric header.
+ *
+ * @param dest Where to write the header, at least wire_num_size(id) bytes.
+ * @param id The header id.
+ * @param value The value, truncated to the width of the header.
+ *
+ * @return The number of bytes written.
+ */
+size_t wire_put_num(char *dest, int id, uint64_t value);
+
+/**
+ * Parse the binary headers of a record. Nothing is copied except for
+ * numeric values, which are formatted into headers->num.
+ *
+ * @param buf The headers.
+ * @param size Size of the headers.
+ * @param headers Set to the value of every header.
+ *
+ * @return 0 if successful, or -EINVAL if a header is malformed, unknown,
+ *    repeated or missing.
+ */
+int wire_parse_binary(const char *buf, size_t size, struct wire_headers *headers);
+
+/**
+ * Parse the text headers of a record. Values point into buf.
+ *
+ * @param buf The headers.
+ * @param size Size of the headers.
+ * @param headers Set to the value of every header.
+ *
+ * @return 0 if successful, or -EINVAL if a header is malformed, unknown,
+ *    repeated or missing.
+ */
+int wire_parse_text(const char *buf, size_t size, struct wire_headers *headers);
+
+/* vi: set ts=8 sw=8 sts=4 et tw=80 cino=(0: */
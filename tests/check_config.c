@@ -14,7 +14,12 @@
  * details.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <check.h>
 #include "configuration.h"
 #include "configuration_check.h"
@@ -39,6 +44,8 @@ START_TEST(check_read_valid_config)
 
         ck_assert_str_eq(config.strValues[CONF_SERVER_ADDR], "http://127.0.0.1");
         ck_assert_str_eq(config.strValues[CONF_SOCKET_PATH], "/tmp/test_telem_socket");
+        ck_assert_str_eq(config.strValues[CONF_SEQPACKET_SOCKET_PATH],
+                         "/tmp/test_telem_socket_seq");
         ck_assert_str_eq(config.strValues[CONF_SPOOL_DIR], "/tmp/spool");
         ck_assert_int_eq(config.intValues[CONF_RECORD_EXPIRY], 1200);
         ck_assert_int_eq(config.intValues[CONF_SPOOL_MAX_SIZE], 1024);
@@ -70,6 +77,12 @@ START_TEST(check_default_config)
         ck_assert_str_eq(config.strValues[CONF_RATE_LIMIT_STRATEGY], DEFAULT_RATE_LIMIT_STRATEGY);
         ck_assert_str_eq(config.strValues[CONF_CAINFO], DEFAULT_CAINFO);
         ck_assert_str_eq(config.strValues[CONF_TIDHEADER], DEFAULT_TIDHEADER);
+        ck_assert_str_eq(config.strValues[CONF_SEQPACKET_SOCKET_PATH],
+                         DEFAULT_SEQPACKET_SOCKET_PATH);
+        ck_assert_str_eq(config.strValues[CONF_STAGING_BACKEND], DEFAULT_STAGING_BACKEND);
+        ck_assert_str_eq(config.strValues[CONF_HANDOFF_SOCKET_PATH], DEFAULT_HANDOFF_SOCKET_PATH);
+        ck_assert_str_eq(config.strValues[CONF_BATCH_FORMAT], DEFAULT_BATCH_FORMAT);
+        ck_assert_str_eq(config.strValues[CONF_COMPRESSION], DEFAULT_COMPRESSION);
 
         ck_assert_int_eq(config.intValues[CONF_RECORD_EXPIRY], DEFAULT_RECORD_EXPIRY);
         ck_assert_int_eq(config.intValues[CONF_SPOOL_MAX_SIZE], DEFAULT_SPOOL_MAX_SIZE);
@@ -78,11 +91,30 @@ START_TEST(check_default_config)
         ck_assert_int_eq(config.intValues[CONF_BYTE_WINDOW_LENGTH], DEFAULT_BYTE_WINDOW_LENGTH);
         ck_assert_int_eq(config.intValues[CONF_RECORD_BURST_LIMIT], DEFAULT_RECORD_BURST_LIMIT);
         ck_assert_int_eq(config.intValues[CONF_BYTE_BURST_LIMIT], DEFAULT_BYTE_BURST_LIMIT);
+        ck_assert_int_eq(config.intValues[CONF_SHM_RING_SLOTS], DEFAULT_SHM_RING_SLOTS);
+        ck_assert_int_eq(config.intValues[CONF_BUFFER_POOL_SIZE], DEFAULT_BUFFER_POOL_SIZE);
+        ck_assert_int_eq(config.intValues[CONF_IDLE_TRIM_TIME], DEFAULT_IDLE_TRIM_TIME);
+        ck_assert_int_eq(config.intValues[CONF_STAGING_WORKERS], DEFAULT_STAGING_WORKERS);
+        ck_assert_int_eq(config.intValues[CONF_STAGING_SEGMENT_SIZE],
+                         DEFAULT_STAGING_SEGMENT_SIZE);
+        ck_assert_int_eq(config.intValues[CONF_ADMISSION_CLIENT_LIMIT],
+                         DEFAULT_ADMISSION_CLIENT_LIMIT);
+        ck_assert_int_eq(config.intValues[CONF_ADMISSION_CLASSIFICATION_LIMIT],
+                         DEFAULT_ADMISSION_CLASSIFICATION_LIMIT);
+        ck_assert_int_eq(config.intValues[CONF_ADMISSION_WINDOW_LENGTH],
+                         DEFAULT_ADMISSION_WINDOW_LENGTH);
+        ck_assert_int_eq(config.intValues[CONF_BATCH_MAX_RECORDS], DEFAULT_BATCH_MAX_RECORDS);
+        ck_assert_int_eq(config.intValues[CONF_BATCH_MAX_SIZE], DEFAULT_BATCH_MAX_SIZE);
+        ck_assert_int_eq(config.intValues[CONF_POSTS_IN_FLIGHT], DEFAULT_POSTS_IN_FLIGHT);
+        ck_assert_int_eq(config.intValues[CONF_COMPRESSION_LEVEL], DEFAULT_COMPRESSION_LEVEL);
 
         ck_assert(config.boolValues[CONF_RATE_LIMIT_ENABLED] == DEFAULT_RATE_LIMIT_ENABLED);
         ck_assert(config.boolValues[CONF_DAEMON_RECYCLING_ENABLED] == DEFAULT_DAEMON_RECYCLING_ENABLED);
         ck_assert(config.boolValues[CONF_RECORD_RETENTION_ENABLED] == DEFAULT_RECORD_RETENTION_ENABLED);
         ck_assert(config.boolValues[CONF_RECORD_SERVER_DELIVERY_ENABLED] == DEFAULT_RECORD_SERVER_DELIVERY_ENABLED);
+        ck_assert(config.boolValues[CONF_SHM_RING_ENABLED] == DEFAULT_SHM_RING_ENABLED);
+        ck_assert(config.boolValues[CONF_HANDOFF_ENABLED] == DEFAULT_HANDOFF_ENABLED);
+        ck_assert(config.boolValues[CONF_ADMISSION_ENABLED] == DEFAULT_ADMISSION_ENABLED);
 
         free_config_struct(&config);
 }
@@ -130,6 +162,25 @@ START_TEST(check_read_valid_config_record_retention_delivery)
 
         ck_assert(config.boolValues[CONF_RECORD_RETENTION_ENABLED] == true);
         ck_assert(config.boolValues[CONF_RECORD_SERVER_DELIVERY_ENABLED] == false);
+        ck_assert(config.boolValues[CONF_SHM_RING_ENABLED] == true);
+        ck_assert_int_eq(config.intValues[CONF_SHM_RING_SLOTS], 32);
+        ck_assert_int_eq(config.intValues[CONF_BUFFER_POOL_SIZE], 0);
+        ck_assert_int_eq(config.intValues[CONF_IDLE_TRIM_TIME], 5);
+        ck_assert_int_eq(config.intValues[CONF_STAGING_WORKERS], 4);
+        ck_assert_str_eq(config.strValues[CONF_STAGING_BACKEND], "log");
+        ck_assert_int_eq(config.intValues[CONF_STAGING_SEGMENT_SIZE], 64);
+        ck_assert(config.boolValues[CONF_ADMISSION_ENABLED] == true);
+        ck_assert_int_eq(config.intValues[CONF_ADMISSION_CLIENT_LIMIT], 20);
+        ck_assert_int_eq(config.intValues[CONF_ADMISSION_CLASSIFICATION_LIMIT], -1);
+        ck_assert_int_eq(config.intValues[CONF_ADMISSION_WINDOW_LENGTH], 3600);
+        ck_assert(config.boolValues[CONF_HANDOFF_ENABLED] == true);
+        ck_assert_str_eq(config.strValues[CONF_HANDOFF_SOCKET_PATH], "/tmp/test_telem_handoff");
+        ck_assert_str_eq(config.strValues[CONF_BATCH_FORMAT], "ndjson");
+        ck_assert_int_eq(config.intValues[CONF_BATCH_MAX_RECORDS], 10);
+        ck_assert_int_eq(config.intValues[CONF_BATCH_MAX_SIZE], 64);
+        ck_assert_int_eq(config.intValues[CONF_POSTS_IN_FLIGHT], 8);
+        ck_assert_str_eq(config.strValues[CONF_COMPRESSION], "gzip");
+        ck_assert_int_eq(config.intValues[CONF_COMPRESSION_LEVEL], 6);
 
         free_config_struct(&config);
 }
@@ -160,6 +211,66 @@ START_TEST(check_config_initialised)
 }
 END_TEST
 
+START_TEST(check_config_snapshot)
+{
+        char *config_file = ABSTOPSRCDIR "/src/data/example.1.conf";
+        char path[] = "/tmp/check_config_XXXXXX";
+        struct timespec times[2] = { { 0, UTIME_OMIT }, { 1000, 0 } };
+        struct config_snapshot *snapshot, *again, *changed;
+        char *content = NULL;
+        size_t size = 0;
+        FILE *in, *out;
+        int fd;
+
+        set_config_file(ABSTOPSRCDIR "/src/data/example.conf");
+
+        snapshot = config_snapshot_get(config_file);
+        ck_assert_ptr_ne(snapshot, NULL);
+        ck_assert_str_eq(config_snapshot_server_addr(snapshot), "http://127.0.0.1");
+        ck_assert_int_eq(snapshot->config.intValues[CONF_POSTS_IN_FLIGHT], 8);
+        ck_assert_str_eq(config_snapshot_compression(snapshot), "gzip");
+        ck_assert_int_eq(config_snapshot_compression_level(snapshot), 6);
+        /* The configuration in use is left alone */
+        ck_assert_int_eq(posts_in_flight_config(), 0);
+        ck_assert_str_eq(compression_config(), "none");
+        ck_assert_str_eq(get_config_file(), ABSTOPSRCDIR "/src/data/example.conf");
+
+        /* Parsed once */
+        again = config_snapshot_get(config_file);
+        ck_assert_ptr_eq(again, snapshot);
+        config_snapshot_put(again);
+        config_snapshot_put(snapshot);
+
+        ck_assert_ptr_eq(config_snapshot_get("somefile"), NULL);
+        ck_assert_ptr_eq(config_snapshot_get(ABSTOPSRCDIR "/src/data"), NULL);
+        ck_assert_str_eq(config_snapshot_tidheader(NULL), get_tidheader_config());
+
+        /* Parsed again once the file changes */
+        fd = mkstemp(path);
+        ck_assert_int_ne(fd, -1);
+        in = fopen(config_file, "r");
+        out = fdopen(fd, "w");
+        ck_assert_ptr_ne(in, NULL);
+        ck_assert_ptr_ne(out, NULL);
+        ck_assert_int_ne(getdelim(&content, &size, '\0', in), -1);
+        fputs(content, out);
+        fclose(out);
+        fclose(in);
+        free(content);
+
+        snapshot = config_snapshot_get(path);
+        ck_assert_ptr_ne(snapshot, NULL);
+        ck_assert_int_eq(utimensat(AT_FDCWD, path, times, 0), 0);
+        changed = config_snapshot_get(path);
+        ck_assert_ptr_ne(changed, NULL);
+        ck_assert_ptr_ne(changed, snapshot);
+        ck_assert_str_eq(config_snapshot_server_addr(snapshot), "http://127.0.0.1");
+        config_snapshot_put(snapshot);
+        config_snapshot_put(changed);
+        unlink(path);
+}
+END_TEST
+
 Suite *config_suite(void)
 {
         // A suite is comprised of test cases, defined below
@@ -173,6 +284,7 @@ Suite *config_suite(void)
         tcase_add_test(t, check_layered_config);
         tcase_add_test(t, check_read_valid_config_record_retention_delivery);
         tcase_add_test(t, check_config_initialised);
+        tcase_add_test(t, check_config_snapshot);
 
         // add more TCases here
 
@@ -20,12 +20,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
 #include "common.h"
 #include "telemetry.h"
+#include "wire.h"
 
 static struct telem_ref *ref = NULL;
 static char *original_event_id = NULL;
 
+/* Headers are binary in the record's arena; return one as a text line,
+ * valid until the function has been called four more times. */
+static const char *header(struct telem_ref *t_ref, int id)
+{
+        static char bufs[4][512];
+        static int next = 0;
+        char *buf = bufs[next++ % 4];
+        struct wire_headers headers;
+
+        ck_assert_int_eq(wire_parse_binary(t_ref->record->arena,
+                                           t_ref->record->header_size,
+                                           &headers), 0);
+        snprintf(buf, sizeof(bufs[0]), "%s: %.*s\n", get_header_name(id),
+                 (int)headers.len[id], headers.value[id]);
+
+        return buf;
+}
+
 void create_setup(void)
 {
         int ret;
@@ -63,7 +87,7 @@ START_TEST(record_create_severity)
         if (asprintf(&result, "%s: %u\n", TM_SEVERITY_STR, 1) < 0) {
                 return;
         }
-        ck_assert_str_eq(ref->record->headers[TM_SEVERITY], result);
+        ck_assert_str_eq(header(ref, TM_SEVERITY), result);
         free(result);
 }
 END_TEST
@@ -74,7 +98,7 @@ START_TEST(record_create_classification)
         if (asprintf(&result, "%s: %s\n", TM_CLASSIFICATION_STR, "t/t/t") < 0) {
                 return;
         }
-        ck_assert_str_eq(ref->record->headers[TM_CLASSIFICATION], result);
+        ck_assert_str_eq(header(ref, TM_CLASSIFICATION), result);
         free(result);
 }
 END_TEST
@@ -85,11 +109,121 @@ START_TEST(record_create_version)
         if (asprintf(&result, "%s: %u\n", TM_PAYLOAD_VERSION_STR, 2000) < 0) {
                 return;
         }
-        ck_assert_str_eq(ref->record->headers[TM_PAYLOAD_VERSION], result);
+        ck_assert_str_eq(header(ref, TM_PAYLOAD_VERSION), result);
         free(result);
 }
 END_TEST
 
+START_TEST(record_create_host_headers_cached)
+{
+        struct telem_ref *second = NULL;
+        size_t size = 0;
+        int ret;
+
+        ret = tm_create_record(&second, 2, "t/t/u", 1);
+        ck_assert_msg(ret != -ECONNREFUSED,
+                      "First time opt-in required to run test");
+        ck_assert_int_eq(ret, 0);
+
+        /* Host headers come from the same per-process snapshot */
+        ck_assert_str_eq(header(ref, TM_ARCH),
+                         header(second, TM_ARCH));
+        ck_assert_str_eq(header(ref, TM_HOST_TYPE),
+                         header(second, TM_HOST_TYPE));
+        ck_assert_str_eq(header(ref, TM_SYSTEM_BUILD),
+                         header(second, TM_SYSTEM_BUILD));
+        ck_assert_str_eq(header(ref, TM_KERNEL_VERSION),
+                         header(second, TM_KERNEL_VERSION));
+        ck_assert_str_eq(header(ref, TM_CPU_MODEL),
+                         header(second, TM_CPU_MODEL));
+        ck_assert_str_eq(header(ref, TM_BIOS_VERSION),
+                         header(second, TM_BIOS_VERSION));
+
+        for (int i = 0; i < NUM_HEADERS; i++) {
+                size += second->record->header_len[i];
+        }
+        ck_assert_int_eq(size, second->record->header_size);
+
+        /* Per-record headers are still generated for every record */
+        ck_assert_str_ne(header(ref, TM_EVENT_ID),
+                         header(second, TM_EVENT_ID));
+
+        tm_free_record(second);
+}
+END_TEST
+
+START_TEST(record_create_arena_layout)
+{
+        struct telem_ref *t_ref = NULL;
+        size_t off = 0;
+        int ret;
+
+        ret = tm_create_record(&t_ref, 2, "t/t/v", 1);
+        ck_assert_int_eq(ret, 0);
+
+        /* Headers are back to back in id order, followed by a null byte */
+        for (int i = 0; i < NUM_HEADERS; i++) {
+                ck_assert_int_eq(t_ref->record->header_off[i], off);
+                ck_assert_int_eq(t_ref->record->arena[off], i);
+                off += t_ref->record->header_len[i];
+        }
+        ck_assert_int_eq(off, t_ref->record->header_size);
+        ck_assert_int_eq(t_ref->record->payload_size, 0);
+        ck_assert_int_eq(t_ref->record->arena[off], '\0');
+
+        /* The payload follows the headers in the same arena */
+        ck_assert_int_eq(tm_set_payload(t_ref, "hello"), 0);
+        ck_assert_ptr_eq(t_ref->record->payload, t_ref->record->arena + off);
+        ck_assert_str_eq(t_ref->record->payload, "hello");
+        ck_assert_int_eq(t_ref->record->payload_size, 5);
+
+        tm_free_record(t_ref);
+}
+END_TEST
+
+START_TEST(record_event_id_unique_after_fork)
+{
+        struct telem_ref *t_ref = NULL;
+        const size_t prefix = strlen(TM_EVENT_ID_STR ": ");
+        char parent_id[EVENT_ID_LEN + 1] = { 0 };
+        char child_id[EVENT_ID_LEN + 1] = { 0 };
+        int fds[2];
+        int status;
+        pid_t pid;
+
+        /* Ids come from a pool of random bytes that the child inherits */
+        ck_assert_int_eq(tm_create_record(&t_ref, 1, "t/t/t", 1), 0);
+        tm_free_record(t_ref);
+
+        ck_assert(pipe(fds) == 0);
+        pid = fork();
+        ck_assert(pid >= 0);
+        if (pid == 0) {
+                close(fds[0]);
+                if (tm_create_record(&t_ref, 1, "t/t/t", 1) == 0 &&
+                    write(fds[1], header(t_ref, TM_EVENT_ID) + prefix,
+                          EVENT_ID_LEN) == EVENT_ID_LEN) {
+                        _exit(EXIT_SUCCESS);
+                }
+                _exit(EXIT_FAILURE);
+        }
+        close(fds[1]);
+
+        ck_assert_int_eq(tm_create_record(&t_ref, 1, "t/t/t", 1), 0);
+        memcpy(parent_id, header(t_ref, TM_EVENT_ID) + prefix, EVENT_ID_LEN);
+        tm_free_record(t_ref);
+
+        ck_assert(read(fds[0], child_id, EVENT_ID_LEN) == EVENT_ID_LEN);
+        close(fds[0]);
+        ck_assert(waitpid(pid, &status, 0) == pid);
+        ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+        ck_assert_int_eq(strspn(parent_id, EVENT_ID_ALPHAB), EVENT_ID_LEN);
+        ck_assert_int_eq(strspn(child_id, EVENT_ID_ALPHAB), EVENT_ID_LEN);
+        ck_assert_str_ne(parent_id, child_id);
+}
+END_TEST
+
 void create_teardown(void)
 {
         if (ref) {
@@ -141,7 +275,7 @@ START_TEST(record_create_severity_underflow)
         if (asprintf(&result, "%s: %u\n", TM_SEVERITY_STR, 1) < 0) {
                 return;
         }
-        ck_assert_str_eq(ref->record->headers[TM_SEVERITY], result);
+        ck_assert_str_eq(header(ref, TM_SEVERITY), result);
         free(result);
 
         create_teardown();
@@ -161,7 +295,7 @@ START_TEST(record_create_severity_overflow)
         if (asprintf(&result, "%s: %u\n", TM_SEVERITY_STR, 4) < 0) {
                 return;
         }
-        ck_assert_str_eq(ref->record->headers[TM_SEVERITY], result);
+        ck_assert_str_eq(header(ref, TM_SEVERITY), result);
         free(result);
 
         create_teardown();
@@ -177,7 +311,7 @@ void event_id_setup(void)
         }
 
         ret = tm_create_record(&ref, 1, "t/t/t", 2000);
-        original_event_id = strdup(ref->record->headers[TM_EVENT_ID]);
+        original_event_id = strdup(header(ref, TM_EVENT_ID));
         if (!original_event_id) {
                 return;
         }
@@ -193,10 +327,10 @@ START_TEST(record_set_event_id)
         if (asprintf(&result, "%s: %s\n", TM_EVENT_ID_STR, event_id) < 0) {
                 return;
         }
-        ck_assert_str_ne(ref->record->headers[TM_EVENT_ID], result);
+        ck_assert_str_ne(header(ref, TM_EVENT_ID), result);
         ret = tm_set_event_id(ref, event_id);
         ck_assert_int_eq(ret, 0);
-        ck_assert_str_eq(ref->record->headers[TM_EVENT_ID], result);
+        ck_assert_str_eq(header(ref, TM_EVENT_ID), result);
         free(result);
 }
 END_TEST
@@ -207,7 +341,7 @@ START_TEST(record_set_event_id_invalid_chars)
         char *event_id = "aaaaaa000000333333444444666666ZZ";
         ret = tm_set_event_id(ref, event_id);
         ck_assert_int_eq(ret, -1);
-        ck_assert_str_eq(ref->record->headers[TM_EVENT_ID], original_event_id);
+        ck_assert_str_eq(header(ref, TM_EVENT_ID), original_event_id);
 }
 END_TEST
 
@@ -217,7 +351,7 @@ START_TEST(record_set_event_id_null)
         char *event_id = NULL;
         ret = tm_set_event_id(ref, event_id);
         ck_assert_int_eq(ret, -1);
-        ck_assert_str_eq(ref->record->headers[TM_EVENT_ID], original_event_id);
+        ck_assert_str_eq(header(ref, TM_EVENT_ID), original_event_id);
 }
 END_TEST
 
@@ -227,7 +361,7 @@ START_TEST(record_set_event_id_short)
         char *event_id = "aaaa";
         ret = tm_set_event_id(ref, event_id);
         ck_assert_int_eq(ret, -1);
-        ck_assert_str_eq(ref->record->headers[TM_EVENT_ID], original_event_id);
+        ck_assert_str_eq(header(ref, TM_EVENT_ID), original_event_id);
 }
 END_TEST
 
@@ -237,7 +371,207 @@ START_TEST(record_set_event_id_long)
         char *event_id = "0000000000000000000000000000000000000000000";
         ret = tm_set_event_id(ref, event_id);
         ck_assert_int_eq(ret, -1);
-        ck_assert_str_eq(ref->record->headers[TM_EVENT_ID], original_event_id);
+        ck_assert_str_eq(header(ref, TM_EVENT_ID), original_event_id);
+}
+END_TEST
+
+START_TEST(session_invalid_args)
+{
+        struct telem_session *session = NULL;
+
+        ck_assert_int_eq(tm_session_open(NULL), -EINVAL);
+        ck_assert_int_eq(tm_session_send(NULL, ref), -EINVAL);
+        ck_assert_int_eq(tm_session_send(session, ref), -EINVAL);
+
+        /* Closing a NULL session is a no-op */
+        tm_session_close(session);
+}
+END_TEST
+
+START_TEST(session_send_records_invalid_args)
+{
+        struct telem_ref *refs[2] = { ref, NULL };
+
+        ck_assert_int_eq(tm_send_records(NULL, 1), -EINVAL);
+        ck_assert_int_eq(tm_session_send_records(NULL, refs, 1), -EINVAL);
+        ck_assert_int_eq(tm_send_records(refs, 2), -EINVAL);
+}
+END_TEST
+
+START_TEST(session_nonblocking_send)
+{
+        struct telem_session *session = NULL;
+        struct sockaddr_un addr;
+        char buf[4096];
+        int lfd, cfd;
+        int sent = 0;
+        int ret;
+
+        /* The example configuration points to a socket under /tmp */
+        ret = tm_set_config_file(ABSTOPSRCDIR "/src/data/example.conf");
+        ck_assert_int_eq(ret, 0);
+
+        /* Stand-in for a daemon that does not read until told to, and
+         * only listens on the stream socket */
+        unlink("/tmp/test_telem_socket_seq");
+        lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        ck_assert_int_ge(lfd, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, "/tmp/test_telem_socket", sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        ck_assert_int_eq(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+        ck_assert_int_eq(listen(lfd, 1), 0);
+
+        ck_assert_int_eq(tm_session_open(&session), 0);
+        ck_assert_int_ge(tm_session_get_fd(session), 0);
+        ck_assert_int_eq(tm_session_set_timeout(session, 0), 0);
+
+        /* Send until the socket is full */
+        while ((ret = tm_session_send(session, ref)) == 0 && sent < 100000) {
+                sent++;
+        }
+        ck_assert_int_eq(ret, -EAGAIN);
+        ck_assert_int_gt(sent, 0);
+        ck_assert_int_ne(tm_session_wait(session, 0), 0);
+
+        /* Once the daemon catches up, the session is ready again */
+        cfd = accept(lfd, NULL, NULL);
+        ck_assert_int_ge(cfd, 0);
+        ck_assert_int_eq(fcntl(cfd, F_SETFL, O_NONBLOCK), 0);
+        while (read(cfd, buf, sizeof(buf)) > 0) {
+                ;
+        }
+        ck_assert_int_eq(tm_session_wait(session, 1000), 0);
+        ck_assert_int_eq(tm_session_send(session, ref), 0);
+
+        tm_session_close(session);
+        close(cfd);
+        close(lfd);
+        unlink(addr.sun_path);
+}
+END_TEST
+
+START_TEST(session_seqpacket_send)
+{
+        struct telem_session *session = NULL;
+        struct telem_ref *t_refs[3] = { ref, ref, ref };
+        struct sockaddr_un addr;
+        char buf[16384];
+        uint32_t record_size;
+        ssize_t len;
+        int lfd, cfd;
+        int i;
+
+        ck_assert_int_eq(tm_set_config_file(ABSTOPSRCDIR "/src/data/example.conf"), 0);
+
+        lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        ck_assert_int_ge(lfd, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, "/tmp/test_telem_socket_seq", sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        ck_assert_int_eq(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+        ck_assert_int_eq(listen(lfd, 1), 0);
+
+        ck_assert_int_eq(tm_session_open(&session), 0);
+        cfd = accept(lfd, NULL, NULL);
+        ck_assert_int_ge(cfd, 0);
+
+        ck_assert_int_eq(tm_session_send_records(session, t_refs, 3), 0);
+
+        /* Every record of the batch arrives as a message of its own */
+        for (i = 0; i < 3; i++) {
+                len = recv(cfd, buf, sizeof(buf), MSG_DONTWAIT);
+                ck_assert_int_gt(len, sizeof(uint32_t));
+                memcpy(&record_size, buf, sizeof(uint32_t));
+                ck_assert_int_eq(record_size, len);
+        }
+        ck_assert_int_lt(recv(cfd, buf, sizeof(buf), MSG_DONTWAIT), 0);
+
+        tm_session_close(session);
+        close(cfd);
+        close(lfd);
+        unlink(addr.sun_path);
+}
+END_TEST
+
+START_TEST(session_split_backoff_notice)
+{
+        struct telem_session *session = NULL;
+        struct admission_notice notice = { .magic = ADMISSION_NOTICE, .wait = 60 };
+        struct sockaddr_un addr;
+        size_t half = sizeof(notice) / 2;
+        int lfd, cfd;
+
+        ck_assert_int_eq(tm_set_config_file(ABSTOPSRCDIR "/src/data/example.conf"), 0);
+
+        /* Stand-in for a daemon that only listens on the stream socket */
+        unlink("/tmp/test_telem_socket_seq");
+        lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        ck_assert_int_ge(lfd, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, "/tmp/test_telem_socket", sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        ck_assert_int_eq(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+        ck_assert_int_eq(listen(lfd, 1), 0);
+
+        ck_assert_int_eq(tm_session_open(&session), 0);
+        cfd = accept(lfd, NULL, NULL);
+        ck_assert_int_ge(cfd, 0);
+
+        /* Half a notice does not hold the session back */
+        ck_assert_int_eq(write(cfd, &notice, half), half);
+        ck_assert_int_eq(tm_session_send(session, ref), 0);
+
+        /* and is not lost once the rest of it comes */
+        ck_assert_int_eq(write(cfd, (char *)&notice + half, sizeof(notice) - half),
+                         sizeof(notice) - half);
+        ck_assert_int_eq(tm_session_send(session, ref), -EBUSY);
+
+        tm_session_close(session);
+        close(cfd);
+        close(lfd);
+        unlink(addr.sun_path);
+}
+END_TEST
+
+START_TEST(session_set_timeout_invalid_args)
+{
+        ck_assert_int_eq(tm_session_set_timeout(NULL, 0), -EINVAL);
+        ck_assert_int_eq(tm_session_get_fd(NULL), -EINVAL);
+        ck_assert_int_eq(tm_session_wait(NULL, 0), -EINVAL);
+}
+END_TEST
+
+START_TEST(async_init_and_shutdown)
+{
+        struct tm_async_stats stats;
+        struct telem_ref *async_ref = NULL;
+
+        ck_assert_int_eq(tm_async_init(4, 42), -EINVAL);
+        ck_assert_int_eq(tm_async_init(4, TM_ASYNC_DROP), 0);
+        ck_assert_int_eq(tm_async_init(4, TM_ASYNC_DROP), -EALREADY);
+        ck_assert_int_eq(tm_send_record_async(NULL), -EINVAL);
+        ck_assert_int_eq(tm_async_stats(NULL), -EINVAL);
+
+        ck_assert_int_eq(tm_create_record(&async_ref, 1, "t/t/a", 1), 0);
+        ck_assert_int_eq(tm_send_record_async(async_ref), 0);
+
+        ck_assert_int_eq(tm_async_stats(&stats), 0);
+        ck_assert(stats.queued == 1);
+        ck_assert(stats.dropped == 0);
+        ck_assert(stats.pending + stats.sent + stats.failed == 1);
+
+        /* The queued record is owned and released by the library */
+        tm_async_shutdown();
+        ck_assert_int_eq(tm_async_stats(&stats), 0);
+        ck_assert(stats.queued == 0);
+
+        /* Background sending can be started again */
+        ck_assert_int_eq(tm_async_init(0, TM_ASYNC_BLOCK), 0);
+        tm_async_shutdown();
 }
 END_TEST
 
@@ -259,6 +593,8 @@ Suite *lib_suite(void)
         tcase_add_test(t, record_create_severity);
         tcase_add_test(t, record_create_classification);
         tcase_add_test(t, record_create_version);
+        tcase_add_test(t, record_create_host_headers_cached);
+        tcase_add_test(t, record_create_arena_layout);
         suite_add_tcase(s, t);
 
         t = tcase_create("Opt-in");
@@ -282,6 +618,22 @@ Suite *lib_suite(void)
         tcase_add_test(t, record_set_event_id_null);
         tcase_add_test(t, record_set_event_id_short);
         tcase_add_test(t, record_set_event_id_long);
+        tcase_add_test(t, record_event_id_unique_after_fork);
+        suite_add_tcase(s, t);
+
+        t = tcase_create("session");
+        tcase_add_unchecked_fixture(t, create_setup, create_teardown);
+        tcase_add_test(t, session_invalid_args);
+        tcase_add_test(t, session_send_records_invalid_args);
+        tcase_add_test(t, session_set_timeout_invalid_args);
+        tcase_add_test(t, session_nonblocking_send);
+        tcase_add_test(t, session_seqpacket_send);
+        tcase_add_test(t, session_split_backoff_notice);
+        suite_add_tcase(s, t);
+
+        t = tcase_create("async");
+        tcase_add_unchecked_fixture(t, create_setup, create_teardown);
+        tcase_add_test(t, async_init_and_shutdown);
         suite_add_tcase(s, t);
 
         return s;
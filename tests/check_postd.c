@@ -20,19 +20,34 @@
 #include <stdlib.h>
 #include <sys/queue.h>
 #include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "config.h"
+
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
 
 #include "configuration.h"
 #include "telempostdaemon.h"
 #include "common.h"
+#include "iorecord.h"
+#include "post_compress.h"
 
 TelemPostDaemon tdaemon;
 
-bool dummy_post(char *headers[], char *body, char *cfg_file)
+bool dummy_post(const struct wire_headers *headers, char *body,
+                const struct config_snapshot *cfg, size_t *sent_size)
 {
         return true;
 }
 
-bool (*post_record_ptr)(char *headers[], char *body, char *cfg_file) = dummy_post;
+bool (*post_record_ptr)(const struct wire_headers *headers, char *body,
+                        const struct config_snapshot *cfg, size_t *sent_size) = dummy_post;
 
 void setup(void)
 {
@@ -106,6 +121,41 @@ START_TEST(check_process_record_with_incorrect_headers)
 }
 END_TEST
 
+START_TEST(check_parse_record_in_any_order)
+{
+        struct staged_record record;
+        char buf[1024];
+        size_t skip;
+        char *text = "CFG:/etc/telemetrics/example.conf\n"
+                     "event_id: 3a2d799826edc6266d72824d2aac6763\n"
+                     "bios_version: Qemu\nseverity: 0\n"
+                     "cpu_model: Intel(R) Core(TM) i7-5650U CPU @ 2.20GHz\n"
+                     "board_name: Qemu|Intel\nsystem_name: clear-linux-os\n"
+                     "payload_format_version: 1\nkernel_version: 3.15\n"
+                     "build: 200\nhost_type: macbookpro\narch: x86_64\n"
+                     "creation_timestamp: 1418672344\nmachine_id: 1234\n"
+                     "classification: crash/kernel/bug\nrecord_format_version: 1\n"
+                     "test message\n";
+
+        strcpy(buf, text);
+        ck_assert(parse_record(buf, strlen(text), &record));
+        ck_assert_str_eq(record.cfg_file, "/etc/telemetrics/example.conf");
+        ck_assert_str_eq(record.body, "test message\n");
+        ck_assert_int_eq(record.headers.len[TM_CPU_MODEL],
+                         strlen("Intel(R) Core(TM) i7-5650U CPU @ 2.20GHz"));
+        ck_assert(strncmp(record.headers.value[TM_CLASSIFICATION], "crash/kernel/bug",
+                          record.headers.len[TM_CLASSIFICATION]) == 0);
+
+        /* Headers only, or a header missing */
+        strcpy(buf, text);
+        ck_assert(!parse_record(buf, strlen(text) - strlen("test message\n"), &record));
+        strcpy(buf, text);
+        skip = strlen("CFG:/etc/telemetrics/example.conf\n"
+                      "event_id: 3a2d799826edc6266d72824d2aac6763\n");
+        ck_assert(!parse_record(buf + skip, strlen(text) - skip, &record));
+}
+END_TEST
+
 START_TEST(check_rate_limit_enabled_functions)
 {
         setup();
@@ -389,6 +439,548 @@ START_TEST(check_strategy_if_record_sent)
 }
 END_TEST
 
+struct logged_records {
+        const char *record;
+        size_t size;
+        int count;
+};
+
+static void count_logged_record(void *data, const char *record, size_t size, time_t staged)
+{
+        struct logged_records *logged = data;
+
+        ck_assert(size == logged->size);
+        ck_assert(memcmp(record, logged->record, size) == 0);
+        ck_assert(time(NULL) - staged < 60);
+        logged->count++;
+}
+
+static int count_files(const char *path)
+{
+        struct dirent *entry;
+        DIR *dir;
+        int count = 0;
+
+        dir = opendir(path);
+        ck_assert(dir != NULL);
+        while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] != '.') {
+                        count++;
+                }
+        }
+        closedir(dir);
+
+        return count;
+}
+
+static void remove_files(const char *path)
+{
+        struct dirent *entry;
+        char name[PATH_MAX];
+        DIR *dir;
+
+        dir = opendir(path);
+        ck_assert(dir != NULL);
+        while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] != '.') {
+                        snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+                        unlink(name);
+                }
+        }
+        closedir(dir);
+        rmdir(path);
+}
+
+START_TEST(check_consume_staging_log)
+{
+        char spool[] = "/tmp/check_postd.XXXXXX";
+        char record[1024];
+        struct logged_records logged = { .record = record };
+        struct staging_log_record header = { .size = 100 };
+        struct staging_log log;
+        struct staging_cursor cursor;
+        FILE *fp;
+
+        fp = fopen(ABSTOPSRCDIR "/tests/telempostd/correct_message", "r");
+        ck_assert(fp != NULL);
+        logged.size = fread(record, 1, sizeof(record), fp);
+        fclose(fp);
+        ck_assert(mkdtemp(spool) != NULL);
+
+        /* Every record starts a new segment */
+        ck_assert_int_eq(staging_log_open(&log, spool, 0), 0);
+        for (int i = 0; i < 3; i++) {
+                ck_assert_int_eq(staging_log_append(&log, record, logged.size), 0);
+        }
+        staging_log_close(&log);
+        ck_assert_int_eq(count_files(spool), 3);
+
+        /* Read segments are removed, except for the last one and the cursor */
+        ck_assert_int_eq(staging_cursor_open(&cursor, spool), 0);
+        ck_assert_int_eq(staging_log_consume(&cursor, count_logged_record, NULL, &logged), 3);
+        ck_assert_int_eq(logged.count, 3);
+        ck_assert_int_eq(count_files(spool), 2);
+        staging_cursor_close(&cursor);
+
+        /* A new writer starts a segment of its own, and a record it did not
+         * finish to append is not read */
+        ck_assert_int_eq(staging_log_open(&log, spool, 1024 * 1024), 0);
+        ck_assert_int_eq(staging_log_append(&log, record, logged.size), 0);
+        ck_assert(write(log.fd, &header, sizeof(header)) == sizeof(header));
+        staging_log_close(&log);
+
+        /* Reading starts from the saved cursor */
+        ck_assert_int_eq(staging_cursor_open(&cursor, spool), 0);
+        ck_assert_int_eq(staging_log_consume(&cursor, count_logged_record, NULL, &logged), 1);
+        ck_assert_int_eq(staging_log_consume(&cursor, count_logged_record, NULL, &logged), 0);
+        ck_assert_int_eq(logged.count, 4);
+        ck_assert_int_eq(count_files(spool), 2);
+        staging_cursor_close(&cursor);
+
+        remove_files(spool);
+}
+END_TEST
+
+/* Records read from the log, done with once synced */
+struct synced_records {
+        char segments[3][PATH_MAX];
+        int read;
+        int done;
+};
+
+/* The segment of a record is kept until the record is done with */
+static void check_segments_kept(struct synced_records *synced)
+{
+        for (int i = synced->done; i < synced->read; i++) {
+                ck_assert(access(synced->segments[i], F_OK) == 0);
+        }
+}
+
+static void hold_logged_record(void *data, const char *record, size_t size, time_t staged)
+{
+        struct synced_records *synced = data;
+
+        check_segments_kept(synced);
+        synced->read++;
+}
+
+static void sync_logged_records(void *data)
+{
+        struct synced_records *synced = data;
+
+        check_segments_kept(synced);
+        synced->done = synced->read;
+}
+
+static int segment_filter(const struct dirent *entry)
+{
+        return staging_log_file(entry->d_name) &&
+               strcmp(entry->d_name, STAGING_LOG_CURSOR) != 0;
+}
+
+START_TEST(check_staging_log_kept_until_synced)
+{
+        char spool[] = "/tmp/check_postd.XXXXXX";
+        struct synced_records synced = { .read = 0, .done = 0 };
+        struct staging_log log;
+        struct staging_cursor cursor;
+        struct dirent **segments;
+
+        ck_assert(mkdtemp(spool) != NULL);
+
+        /* Every record starts a new segment */
+        ck_assert_int_eq(staging_log_open(&log, spool, 0), 0);
+        for (int i = 0; i < 3; i++) {
+                ck_assert_int_eq(staging_log_append(&log, "record", 6), 0);
+        }
+        staging_log_close(&log);
+        ck_assert_int_eq(scandir(spool, &segments, segment_filter, alphasort), 3);
+        for (int i = 0; i < 3; i++) {
+                snprintf(synced.segments[i], PATH_MAX, "%s/%s", spool, segments[i]->d_name);
+                free(segments[i]);
+        }
+        free(segments);
+
+        /* Segments go only once the records read from them are done with */
+        ck_assert_int_eq(staging_cursor_open(&cursor, spool), 0);
+        ck_assert_int_eq(staging_log_consume(&cursor, hold_logged_record, sync_logged_records,
+                                             &synced), 3);
+        ck_assert_int_eq(synced.done, 3);
+        ck_assert(access(synced.segments[0], F_OK) != 0);
+        ck_assert(access(synced.segments[2], F_OK) == 0);
+        staging_cursor_close(&cursor);
+
+        remove_files(spool);
+}
+END_TEST
+
+/* Stands in for the backend */
+static struct {
+        char body[8192];
+        const char *content_type;
+        /* answer to a batch */
+        const char *response;
+        bool accept;
+        /* size of the body as sent, if compressed */
+        size_t sent_len;
+        int posts;
+        /* requests left in flight, completed by the test */
+        bool in_flight;
+        struct batch_request *requests[4];
+} backend;
+
+static void mock_post(struct batch_request *request, void *data)
+{
+        ck_assert(request->len < sizeof(backend.body));
+        memcpy(backend.body, request->body, request->len + 1);
+        backend.content_type = request->content_type;
+        if (backend.sent_len > 0) {
+                request->sent_len = backend.sent_len;
+        }
+        if (backend.in_flight) {
+                backend.requests[backend.posts++] = request;
+                return;
+        }
+        backend.posts++;
+        post_batch_complete(request, backend.accept, backend.response);
+}
+
+static void save_result(void *data, bool sent, size_t size)
+{
+        int *result = data;
+
+        *result = sent ? 1 : 0;
+}
+
+START_TEST(check_batch_maps_results_per_record)
+{
+        struct post_batch batch;
+        int results[3] = { -1, -1, -1 };
+        char record[16];
+
+        memset(&backend, 0, sizeof(backend));
+        backend.accept = true;
+        backend.response = "[201, {\"status\": 500}, true]";
+        ck_assert_int_eq(post_batch_init(&batch, BATCH_JSON, 10, 1024, mock_post, NULL), 0);
+
+        for (int i = 0; i < 3; i++) {
+                snprintf(record, sizeof(record), "{\"a\":%d}", i);
+                ck_assert_int_eq(post_batch_add(&batch, record, strlen(record),
+                                                save_result, &results[i]), 0);
+        }
+        ck_assert_int_eq(backend.posts, 0);
+        post_batch_flush(&batch);
+        ck_assert_str_eq(backend.body, "[{\"a\":0},{\"a\":1},{\"a\":2}]");
+        ck_assert_str_eq(backend.content_type, "application/json");
+        ck_assert(results[0] == 1 && results[1] == 0 && results[2] == 1);
+
+        /* Without a result per record, the whole batch is accepted */
+        backend.response = "{\"status\": 201}";
+        for (int i = 0; i < 2; i++) {
+                ck_assert_int_eq(post_batch_add(&batch, "{}", 2, save_result, &results[i]), 0);
+        }
+        post_batch_flush(&batch);
+        ck_assert_str_eq(backend.body, "[{},{}]");
+        ck_assert(results[0] == 1 && results[1] == 1);
+
+        /* A batch the server did not accept fails every record */
+        backend.accept = false;
+        backend.response = "[201]";
+        ck_assert_int_eq(post_batch_add(&batch, "{}", 2, save_result, &results[0]), 0);
+        post_batch_flush(&batch);
+        ck_assert_int_eq(results[0], 0);
+
+        /* Nothing is posted for an empty batch */
+        post_batch_flush(&batch);
+        ck_assert_int_eq(backend.posts, 3);
+
+        post_batch_free(&batch);
+}
+END_TEST
+
+static void save_size(void *data, bool sent, size_t size)
+{
+        size_t *result = data;
+
+        *result = size;
+}
+
+START_TEST(check_batch_shares_bytes_sent)
+{
+        struct post_batch batch;
+        size_t sizes[3] = { 0, 0, 0 };
+
+        memset(&backend, 0, sizeof(backend));
+        backend.accept = true;
+        ck_assert_int_eq(post_batch_init(&batch, BATCH_JSON, 10, 1024, mock_post, NULL), 0);
+
+        /* Each record counts its share of the body as sent */
+        ck_assert_int_eq(post_batch_add(&batch, "{\"a\":0}", 7, save_size, &sizes[0]), 0);
+        ck_assert_int_eq(post_batch_add(&batch, "{\"a\":\"1234567\"}", 15, save_size,
+                                        &sizes[1]), 0);
+        post_batch_flush(&batch);
+        ck_assert_int_eq(sizes[0], 8);
+        ck_assert_int_eq(sizes[1], 18);
+
+        backend.sent_len = 11;
+        ck_assert_int_eq(post_batch_add(&batch, "{\"a\":0}", 7, save_size, &sizes[0]), 0);
+        ck_assert_int_eq(post_batch_add(&batch, "{\"a\":\"1234567\"}", 15, save_size,
+                                        &sizes[1]), 0);
+        post_batch_flush(&batch);
+        ck_assert_int_eq(sizes[0], 4);
+        ck_assert_int_eq(sizes[1], 8);
+        backend.sent_len = 12;
+        post_batch_free(&batch);
+
+        /* A record posted alone counts the whole body */
+        ck_assert_int_eq(post_batch_init(&batch, BATCH_NONE, 10, 1024, mock_post, NULL), 0);
+        ck_assert_int_eq(post_batch_add(&batch, "{\"a\":0}", 7, save_size, &sizes[2]), 0);
+        ck_assert_int_eq(sizes[2], 12);
+        post_batch_free(&batch);
+}
+END_TEST
+
+/* Fills body with records, which repeat most of their text */
+static size_t fill_records(char *body, size_t size)
+{
+        size_t len = 0;
+
+        while (len + 64 < size) {
+                len += (size_t)sprintf(body + len, "{\"classification\":\"org.clearlinux/%zu\"}\n",
+                                       len % 7);
+        }
+
+        return len;
+}
+
+START_TEST(check_compress_request_body)
+{
+        enum body_encoding encoding;
+        char body[4096];
+        char plain[4096];
+        char *out = NULL;
+        size_t size = 0;
+        size_t len;
+        z_stream stream;
+
+        ck_assert_int_eq(post_compress_encoding("none", &encoding), 0);
+        ck_assert_int_eq(encoding, ENCODING_IDENTITY);
+        ck_assert_int_eq(post_compress_encoding("gzip", &encoding), 0);
+        ck_assert_int_eq(encoding, ENCODING_GZIP);
+        ck_assert_int_eq(post_compress_encoding("brotli", &encoding), -EINVAL);
+        ck_assert_str_eq(post_compress_name(ENCODING_GZIP), "gzip");
+        ck_assert(post_compress_name(ENCODING_IDENTITY) == NULL);
+#ifndef HAVE_ZSTD_H
+        ck_assert_int_eq(post_compress_encoding("zstd", &encoding), -ENOTSUP);
+#endif
+
+        len = fill_records(body, sizeof(body));
+        ck_assert_int_eq(post_compress(ENCODING_GZIP, 9, body, len, &out, &size), 0);
+        ck_assert(size < len / 4);
+        ck_assert(out[0] == (char)0x1f && out[1] == (char)0x8b);
+
+        memset(&stream, 0, sizeof(stream));
+        ck_assert_int_eq(inflateInit2(&stream, MAX_WBITS + 16), Z_OK);
+        stream.next_in = (Bytef *)out;
+        stream.avail_in = (uInt)size;
+        stream.next_out = (Bytef *)plain;
+        stream.avail_out = sizeof(plain);
+        ck_assert_int_eq(inflate(&stream, Z_FINISH), Z_STREAM_END);
+        ck_assert_int_eq(stream.total_out, len);
+        ck_assert(memcmp(plain, body, len) == 0);
+        inflateEnd(&stream);
+        free(out);
+}
+END_TEST
+
+#ifdef HAVE_ZSTD_H
+START_TEST(check_compress_request_body_zstd)
+{
+        enum body_encoding encoding;
+        char body[4096];
+        char plain[4096];
+        char *out = NULL;
+        size_t size = 0;
+        size_t len;
+
+        ck_assert_int_eq(post_compress_encoding("zstd", &encoding), 0);
+        ck_assert_int_eq(encoding, ENCODING_ZSTD);
+        ck_assert_str_eq(post_compress_name(ENCODING_ZSTD), "zstd");
+
+        /* Levels past the range of zstd are clamped */
+        len = fill_records(body, sizeof(body));
+        ck_assert_int_eq(post_compress(ENCODING_ZSTD, 99, body, len, &out, &size), 0);
+        ck_assert(size < len / 4);
+
+        ck_assert_int_eq(ZSTD_decompress(plain, sizeof(plain), out, size), len);
+        ck_assert(memcmp(plain, body, len) == 0);
+        free(out);
+}
+END_TEST
+#endif
+
+START_TEST(check_batch_limits)
+{
+        struct post_batch batch;
+        int results[4] = { -1, -1, -1, -1 };
+        const char *large = "{\"a\":\"123456789012345678901234\"}";
+
+        memset(&backend, 0, sizeof(backend));
+        backend.accept = true;
+        ck_assert_int_eq(post_batch_init(&batch, BATCH_NDJSON, 2, 24, mock_post, NULL), 0);
+
+        /* Posted once full */
+        ck_assert_int_eq(post_batch_add(&batch, "{\"a\":0}", 7, save_result, &results[0]), 0);
+        ck_assert_int_eq(backend.posts, 0);
+        ck_assert_int_eq(post_batch_add(&batch, "{\"a\":1}", 7, save_result, &results[1]), 0);
+        ck_assert_int_eq(backend.posts, 1);
+        ck_assert_str_eq(backend.body, "{\"a\":0}\n{\"a\":1}\n");
+        ck_assert_str_eq(backend.content_type, "application/x-ndjson");
+        ck_assert(results[0] == 1 && results[1] == 1);
+
+        /* Posted before a record that does not fit, which goes alone */
+        ck_assert_int_eq(post_batch_add(&batch, "{\"a\":2}", 7, save_result, &results[2]), 0);
+        ck_assert_int_eq(post_batch_add(&batch, large, strlen(large), save_result,
+                                        &results[3]), 0);
+        ck_assert_int_eq(backend.posts, 2);
+        ck_assert_str_eq(backend.body, "{\"a\":2}\n");
+        post_batch_flush(&batch);
+        ck_assert_int_eq(backend.posts, 3);
+        ck_assert(strncmp(backend.body, large, strlen(large)) == 0);
+        ck_assert(results[2] == 1 && results[3] == 1);
+
+        post_batch_free(&batch);
+}
+END_TEST
+
+START_TEST(check_post_queue_shares_tls_sessions)
+{
+        struct post_queue queue;
+        CURL *curl;
+
+        post_queue_init(&queue, 2);
+        ck_assert_ptr_eq(queue.share, NULL);
+
+        /* Set up with the multi handle, for every transfer */
+        curl = post_queue_handle(&queue);
+        ck_assert_ptr_ne(curl, NULL);
+        ck_assert_ptr_ne(queue.multi, NULL);
+        ck_assert_ptr_ne(queue.share, NULL);
+        curl_easy_cleanup(curl);
+
+        post_queue_release(&queue);
+        ck_assert_ptr_eq(queue.multi, NULL);
+        ck_assert_ptr_eq(queue.share, NULL);
+}
+END_TEST
+
+START_TEST(check_staged_records_posted_in_batch)
+{
+        char spool[] = "/tmp/check_postd.XXXXXX";
+        char paths[3][PATH_MAX];
+        char record[1024];
+        struct post_batch batch;
+        const char *body;
+        size_t size;
+        int payloads = 0;
+        FILE *fp;
+
+        setup();
+        tdaemon.rate_limit_enabled = false;
+        ck_assert_int_eq(post_batch_init(&batch, BATCH_JSON, 10, 64 * 1024, mock_post, NULL), 0);
+        tdaemon.batch = &batch;
+        memset(&backend, 0, sizeof(backend));
+        backend.accept = true;
+        backend.response = "[201, 500, 200]";
+
+        fp = fopen(ABSTOPSRCDIR "/tests/telempostd/correct_message", "r");
+        ck_assert(fp != NULL);
+        size = fread(record, 1, sizeof(record), fp);
+        fclose(fp);
+        ck_assert(mkdtemp(spool) != NULL);
+
+        /* Records wait in the batch until it is posted */
+        for (int i = 0; i < 3; i++) {
+                snprintf(paths[i], PATH_MAX, "%s/record%d", spool, i);
+                fp = fopen(paths[i], "w");
+                ck_assert(fp != NULL);
+                ck_assert(fwrite(record, 1, size, fp) == size);
+                fclose(fp);
+                ck_assert(process_staged_record(paths[i], &tdaemon) == false);
+        }
+        ck_assert_int_eq(backend.posts, 0);
+        ck_assert_int_eq(count_files(spool), 3);
+
+        /* Only the record the server accepted is kept */
+        post_batch_flush(&batch);
+        ck_assert_int_eq(backend.posts, 1);
+        ck_assert(backend.body[0] == '[');
+        for (body = backend.body; (body = strstr(body, "\"payload\"")) != NULL; body++) {
+                payloads++;
+        }
+        ck_assert_int_eq(payloads, 3);
+        ck_assert_int_eq(count_files(spool), 1);
+        ck_assert(access(paths[1], F_OK) == 0);
+
+        tdaemon.batch = NULL;
+        post_batch_free(&batch);
+        remove_files(spool);
+}
+END_TEST
+
+START_TEST(check_records_completed_once_posted)
+{
+        char spool[] = "/tmp/check_postd.XXXXXX";
+        char paths[3][PATH_MAX];
+        char record[1024];
+        struct post_batch batch;
+        size_t size;
+        FILE *fp;
+
+        setup();
+        tdaemon.rate_limit_enabled = false;
+        ck_assert_int_eq(post_batch_init(&batch, BATCH_NONE, 10, 64 * 1024, mock_post, NULL), 0);
+        tdaemon.batch = &batch;
+        memset(&backend, 0, sizeof(backend));
+        backend.in_flight = true;
+
+        fp = fopen(ABSTOPSRCDIR "/tests/telempostd/correct_message", "r");
+        ck_assert(fp != NULL);
+        size = fread(record, 1, sizeof(record), fp);
+        fclose(fp);
+        ck_assert(mkdtemp(spool) != NULL);
+
+        /* Without batches, each record is posted alone and as is */
+        for (int i = 0; i < 3; i++) {
+                snprintf(paths[i], PATH_MAX, "%s/record%d", spool, i);
+                fp = fopen(paths[i], "w");
+                ck_assert(fp != NULL);
+                ck_assert(fwrite(record, 1, size, fp) == size);
+                fclose(fp);
+                ck_assert(process_staged_record(paths[i], &tdaemon) == false);
+        }
+        ck_assert_int_eq(backend.posts, 3);
+        ck_assert(backend.body[0] == '{');
+        ck_assert_str_eq(backend.content_type, "application/json");
+        ck_assert_int_eq(count_files(spool), 3);
+
+        /* Records are done with as their posts complete, in any order */
+        post_batch_complete(backend.requests[2], true, "[500]");
+        ck_assert(access(paths[2], F_OK) != 0);
+        post_batch_complete(backend.requests[0], true, NULL);
+        ck_assert(access(paths[0], F_OK) != 0);
+        ck_assert_int_eq(count_files(spool), 1);
+
+        /* A record that failed to post is kept */
+        post_batch_complete(backend.requests[1], false, NULL);
+        ck_assert(access(paths[1], F_OK) == 0);
+
+        tdaemon.batch = NULL;
+        post_batch_free(&batch);
+        remove_files(spool);
+}
+END_TEST
+
 Suite *config_suite(void)
 {
         // A suite is comprised of test cases, defined below
@@ -401,6 +993,7 @@ Suite *config_suite(void)
         tcase_add_test(t, check_handle_client_with_incorrect_data);
         tcase_add_test(t, check_process_record_with_correct_size_and_data);
         tcase_add_test(t, check_process_record_with_incorrect_headers);
+        tcase_add_test(t, check_parse_record_in_any_order);
         tcase_add_test(t, check_rate_limit_enabled_functions);
         tcase_add_test(t, check_rate_limit_records_that_pass);
         tcase_add_test(t, check_rate_limit_records_that_do_not_pass);
@@ -411,6 +1004,18 @@ Suite *config_suite(void)
         tcase_add_test(t, check_strategy_spool_option);
         tcase_add_test(t, check_strategy_drop_option);
         tcase_add_test(t, check_strategy_if_record_sent);
+        tcase_add_test(t, check_consume_staging_log);
+        tcase_add_test(t, check_staging_log_kept_until_synced);
+        tcase_add_test(t, check_batch_maps_results_per_record);
+        tcase_add_test(t, check_batch_limits);
+        tcase_add_test(t, check_post_queue_shares_tls_sessions);
+        tcase_add_test(t, check_batch_shares_bytes_sent);
+        tcase_add_test(t, check_compress_request_body);
+#ifdef HAVE_ZSTD_H
+        tcase_add_test(t, check_compress_request_body_zstd);
+#endif
+        tcase_add_test(t, check_staged_records_posted_in_batch);
+        tcase_add_test(t, check_records_completed_once_posted);
 
         suite_add_tcase(s, t);
 
@@ -14,20 +14,40 @@
  * details.
  */
 
+#define _GNU_SOURCE
 #include <check.h>
 #include <sys/socket.h>
 #include <sys/fcntl.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/queue.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 #include "configuration.h"
 #include "configuration_check.h"
 #include "telemdaemon.h"
+#include "admission.h"
 #include "common.h"
+#include "shm_ring.h"
+#include "wire.h"
 
 TelemDaemon tdaemon;
 
+/* Headers of a well-formed text record */
+static char record_headers[] = "record_format_version: 1\nclassification: crash/kernel/bug\n"
+                               "severity: 0\nmachine_id: 1234\ncreation_timestamp: 1418672344\n"
+                               "arch:x86_64\nhost_type: macbookpro\nbuild: 200\n"
+                               "kernel_version: 3.15\npayload_format_version: 1\n"
+                               "system_name: clear-linux-os\n"
+                               "board_name: Qemu|Intel\n"
+                               "cpu_model: Intel(R) Core(TM) i7-5650U CPU @ 2.20GHz\n"
+                               "bios_version: Qemu\n"
+                               "event_id: 3a2d799826edc6266d72824d2aac6763\n";
+
 char *get_serialized_record(char *headers, char *post_body, size_t *record_size)
 {
         size_t totalsize, headersize, payloadsize, offset;
@@ -41,7 +61,7 @@ char *get_serialized_record(char *headers, char *post_body, size_t *record_size)
         *record_size = 2 * sizeof(uint32_t) + totalsize + 1;
         data = malloc(*record_size);
         memset(data, 0, *record_size);
-        memcpy(data, &totalsize, sizeof(uint32_t));
+        memcpy(data, record_size, sizeof(uint32_t));
         offset += sizeof(uint32_t);
 
         memcpy(data + offset, &headersize, sizeof(uint32_t));
@@ -64,63 +84,90 @@ void setup(void)
 
 void teardown(void)
 {
+        buffer_pool_trim(&tdaemon.client_bufs);
+        close(tdaemon.epfd);
         free_config_file();
 }
 
+/**
+ * Write a configuration for one test, with the spool directory and the
+ * settings the test is about, the rest left to their defaults, and use it.
+ *
+ * @param path A mkstemp() template, set to the name of the file.
+ * @param settings Lines to add to the settings.
+ */
+static void set_test_config(char *path, const char *settings)
+{
+        FILE *fp;
+        int fd;
+
+        fd = mkstemp(path);
+        ck_assert_int_ne(fd, -1);
+        fp = fdopen(fd, "w");
+        ck_assert_ptr_ne(fp, NULL);
+        fprintf(fp, "[settings]\nspool_dir=/tmp/spool\n%s", settings);
+        fclose(fp);
+
+        ck_assert_int_eq(set_config_file(path), 0);
+}
+
 START_TEST(check_daemon_is_initialized)
 {
         setup();
 
         ck_assert(tdaemon.nfds == 0);
-        ck_assert(tdaemon.pollfds == NULL);
+        ck_assert(tdaemon.epfd >= 0);
 
         teardown();
 }
 END_TEST
 
-int get_poll_fd(TelemDaemon *tdaemon, nfds_t i)
+START_TEST(check_watch_unwatch_fd)
 {
-        if (i >= 0 && i < tdaemon->nfds) {
-                return tdaemon->pollfds[i].fd;
+        setup();
+
+        struct epoll_event events[4];
+        uint64_t one = 1;
+        watch w[3];
+        client *cl;
+        int i;
+
+        for (i = 0; i < 3; i++) {
+                w[i].type = WATCH_RING;
+                w[i].fd = eventfd(0, EFD_NONBLOCK);
+                ck_assert(w[i].fd >= 0);
+                watch_fd(&tdaemon, &w[i], EPOLLIN);
         }
-        return -1;
-}
+        ck_assert_msg(tdaemon.nfds == 3, "Failed to watch fd");
 
-START_TEST(check_add_del_poll_fd)
-{
-        setup();
+        /* An event leads to the watch of its fd */
+        ck_assert(write(w[1].fd, &one, sizeof(one)) == sizeof(one));
+        ck_assert_int_eq(epoll_wait(tdaemon.epfd, events, 4, 0), 1);
+        ck_assert_ptr_eq(events[0].data.ptr, &w[1]);
+
+        unwatch_fd(&tdaemon, &w[1]);
+        ck_assert_msg(tdaemon.nfds == 2, "Failed to unwatch fd");
+        ck_assert_int_eq(epoll_wait(tdaemon.epfd, events, 4, 0), 0);
+
+        ck_assert(write(w[2].fd, &one, sizeof(one)) == sizeof(one));
+        ck_assert_int_eq(epoll_wait(tdaemon.epfd, events, 4, 0), 1);
+        ck_assert_ptr_eq(events[0].data.ptr, &w[2]);
+
+        unwatch_fd(&tdaemon, &w[0]);
+        unwatch_fd(&tdaemon, &w[2]);
+        ck_assert_msg(tdaemon.nfds == 0, "Failed to unwatch fd");
+
+        for (i = 0; i < 3; i++) {
+                close(w[i].fd);
+        }
+
+        /* The watch of a client leads back to the client */
+        cl = add_client(&(tdaemon.client_head), -1);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        ck_assert(cl->watch.type == WATCH_CLIENT);
+        ck_assert_ptr_eq(client_of(&cl->watch), cl);
+        remove_client(&(tdaemon.client_head), cl);
 
-        int fd = 1;
-        int short events = 1;
-        add_pollfd(&tdaemon, 1, events);
-        add_pollfd(&tdaemon, 2, events);
-        add_pollfd(&tdaemon, 3, events);
-        ck_assert_msg(tdaemon.nfds == 3, "Failed to add pollfd");
-
-        fd = get_poll_fd(&tdaemon, 0);
-        ck_assert(fd == 1);
-        fd = get_poll_fd(&tdaemon, 1);
-        ck_assert(fd == 2);
-        fd = get_poll_fd(&tdaemon, 2);
-        ck_assert(fd == 3);
-
-        del_pollfd(&tdaemon, 1);
-        ck_assert_msg(tdaemon.nfds == 2, "Failed to delete pollfd");
-        fd = get_poll_fd(&tdaemon, 1);
-        ck_assert(fd == 3);
-
-        del_pollfd(&tdaemon, 1);
-        ck_assert_msg(tdaemon.nfds == 1, "Failed to delete pollfd");
-        fd = get_poll_fd(&tdaemon, 1);
-        ck_assert(fd == -1);
-
-        del_pollfd(&tdaemon, 0);
-        ck_assert_msg(tdaemon.nfds == 0, "Failed to delete pollfd");
-        fd = get_poll_fd(&tdaemon, 0);
-        ck_assert(fd == -1);
-
-        /* Cleaning alloctions */
-        free(tdaemon.pollfds);
         teardown();
 }
 END_TEST
@@ -178,13 +225,18 @@ START_TEST(check_handle_client_with_no_data)
         set_up_socket_pair(&client_fd, &server_fd);
         cl = add_client(&(tdaemon.client_head), client_fd);
         ck_assert_msg(cl != NULL, "failed to malloc client");
-        add_pollfd(&tdaemon, client_fd, POLLIN | POLLPRI);
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
 
-        processed = handle_client(&tdaemon, 0, cl);
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == false);
+        ck_assert_msg(!is_client_list_empty(&(tdaemon.client_head)), "Removed client still connected\n");
+        ck_assert_msg(tdaemon.nfds == 1, "Removed poll fd for client still connected\n");
+
+        close(server_fd);
+        processed = handle_client(&tdaemon, cl);
         ck_assert(processed == false);
         ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client with no data\n");
         ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client with n data\n");
-        close(server_fd);
 
         teardown();
 }
@@ -203,16 +255,21 @@ START_TEST(check_handle_client_with_incorrect_data)
         set_up_socket_pair(&client_fd, &server_fd);
         cl = add_client(&(tdaemon.client_head), client_fd);
         ck_assert_msg(cl != NULL, "failed to malloc client");
-        add_pollfd(&tdaemon, client_fd, POLLIN | POLLPRI);
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
 
         ssize_t ret = write(server_fd, buf, 2);
         ck_assert(ret == 2);
 
-        processed = handle_client(&tdaemon, 0, cl);
+        /* Incomplete record size, wait for the rest of it */
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == false);
+        ck_assert_msg(tdaemon.nfds == 1, "Removed poll fd for client still connected\n");
+
+        close(server_fd);
+        processed = handle_client(&tdaemon, cl);
         ck_assert(processed == false);
         ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client with no data\n");
         ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client with n data\n");
-        close(server_fd);
 
         teardown();
 }
@@ -232,16 +289,16 @@ START_TEST(check_handle_client_with_incorrect_size)
         set_up_socket_pair(&client_fd, &server_fd);
         cl = add_client(&(tdaemon.client_head), client_fd);
         ck_assert_msg(cl != NULL, "failed to malloc client");
-        add_pollfd(&tdaemon, client_fd, POLLIN | POLLPRI);
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
 
-        int size = 10;
+        int size = 2;
         memset(buf, 0, 4096);
         memcpy(buf, &size, RECORD_SIZE_LEN);
         memcpy(buf + RECORD_SIZE_LEN, data, sizeof(uint32_t));
-        ssize_t ret = write(server_fd, buf, 2);
-        ck_assert(ret == 2);
+        ssize_t ret = write(server_fd, buf, RECORD_SIZE_LEN + sizeof(uint32_t));
+        ck_assert(ret == RECORD_SIZE_LEN + sizeof(uint32_t));
 
-        processed = handle_client(&tdaemon, 0, cl);
+        processed = handle_client(&tdaemon, cl);
         ck_assert(processed == false);
         ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client with no data\n");
         ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client with n data\n");
@@ -265,23 +322,24 @@ START_TEST(check_handle_client_with_correct_size)
         set_up_socket_pair(&client_fd, &server_fd);
         cl = add_client(&(tdaemon.client_head), client_fd);
         ck_assert_msg(cl != NULL, "failed to malloc client");
-        add_pollfd(&tdaemon, client_fd, POLLIN | POLLPRI);
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
 
         size_t size = strlen(data);
+        size_t record_size = 2 * sizeof(uint32_t) + size + 1;
         memset(buf, 0, 256);
-        memcpy(buf, &size, RECORD_SIZE_LEN);
+        memcpy(buf, &record_size, RECORD_SIZE_LEN);
         memcpy(buf + RECORD_SIZE_LEN, &size, sizeof(uint32_t));
         memcpy(buf + 2 * sizeof(uint32_t), data, strlen(data) + 1);
         ck_assert(strcmp(data, buf + 2 * sizeof(int32_t)) == 0);
 
-        ssize_t ret = write(server_fd, buf, 2 * sizeof(uint32_t) + size + 1);
+        ssize_t ret = write(server_fd, buf, record_size);
         ck_assert(ret != -1);
-        processed = handle_client(&tdaemon, 0, cl);
+        close(server_fd);
+        processed = handle_client(&tdaemon, cl);
         ck_assert(processed == true);
 
         ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client with no data\n");
         ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client with n data\n");
-        close(server_fd);
 }
 END_TEST
 
@@ -294,32 +352,786 @@ START_TEST(check_process_record_with_correct_size_and_data)
         bool processed;
         char *record;
         size_t record_size;
-        char *headers = "record_format_version: 1\nclassification: crash/kernel/bug\nseverity: 0\n"
-                        "machine_id: 1234\ncreation_timestamp: 1418672344\narch:x86_64\n"
-                        "host_type: macbookpro\nbuild: 200\nkernel_version: 3.15\n"
-                        "payload_format_version: 1\n"
-                        "system_name: clear-linux-os\n"
-                        "board_name: Qemu|Intel\n"
-                        "cpu_model: Intel(R) Core(TM) i7-5650U CPU @ 2.20GHz\n"
-                        "bios_version: Qemu\n"
-                        "event_id: 3a2d799826edc6266d72824d2aac6763\n";
         char *post_body = "test message";
 
         set_up_socket_pair(&client_fd, &server_fd);
         cl = add_client(&(tdaemon.client_head), client_fd);
         ck_assert_msg(cl != NULL, "failed to malloc client");
-        add_pollfd(&tdaemon, client_fd, POLLIN | POLLPRI);
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
 
-        record = get_serialized_record(headers, post_body, &record_size);
+        record = get_serialized_record(record_headers, post_body, &record_size);
         ssize_t ret = write(server_fd, record, record_size);
         ck_assert(ret == record_size);
+        close(server_fd);
 
-        processed = handle_client(&tdaemon, 0, cl);
+        processed = handle_client(&tdaemon, cl);
         ck_assert(processed == true);
         ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client with correct data\n");
         ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client with correct data\n");
+        free(record);
+}
+END_TEST
+
+START_TEST(check_process_multiple_records_on_one_connection)
+{
+        setup();
+
+        client *cl;
+        int server_fd, client_fd;
+        bool processed;
+        char *record;
+        size_t record_size;
+        char *post_body = "test message";
+        ssize_t ret;
+
+        set_up_socket_pair(&client_fd, &server_fd);
+        cl = add_client(&(tdaemon.client_head), client_fd);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        record = get_serialized_record(record_headers, post_body, &record_size);
+
+        /* Two complete records in a row */
+        ret = write(server_fd, record, record_size);
+        ck_assert(ret == record_size);
+        ret = write(server_fd, record, record_size);
+        ck_assert(ret == record_size);
+
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == true);
+        ck_assert_msg(tdaemon.nfds == 1, "Removed poll fd for client still connected\n");
+        ck_assert(cl->buf == NULL);
+        ck_assert(tdaemon.client_bufs.nfree == 1);
+
+        /* A record split across two reads */
+        ret = write(server_fd, record, 2);
+        ck_assert(ret == 2);
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == false);
+
+        ret = write(server_fd, record + 2, record_size / 2);
+        ck_assert(ret == record_size / 2);
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == false);
+        ck_assert(cl->buf != NULL);
+        ck_assert(tdaemon.client_bufs.nfree == 0);
+
+        ret = write(server_fd, record + 2 + record_size / 2, record_size - 2 - record_size / 2);
+        ck_assert(ret == record_size - 2 - record_size / 2);
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == true);
+        ck_assert_msg(tdaemon.nfds == 1, "Removed poll fd for client still connected\n");
+
+        close(server_fd);
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == false);
+        ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client on end of transmission\n");
+        ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client on end of transmission\n");
+        free(record);
+
+        teardown();
+}
+END_TEST
+
+static int count_staged_records(void)
+{
+        struct dirent *entry;
+        DIR *dir;
+        int count = 0;
+
+        dir = opendir(spool_dir_config());
+        ck_assert(dir != NULL);
+        while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] != '.') {
+                        count++;
+                }
+        }
+        closedir(dir);
+
+        return count;
+}
+
+static bool find_staged_line(const char *line)
+{
+        struct dirent *entry;
+        char path[PATH_MAX];
+        char buf[256];
+        bool found = false;
+        FILE *fp;
+        DIR *dir;
+
+        dir = opendir(spool_dir_config());
+        ck_assert(dir != NULL);
+        while (!found && (entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.') {
+                        continue;
+                }
+                snprintf(path, sizeof(path), "%s/%s", spool_dir_config(), entry->d_name);
+                fp = fopen(path, "r");
+                if (fp == NULL) {
+                        continue;
+                }
+                while (fgets(buf, sizeof(buf), fp) != NULL) {
+                        if (strcmp(buf, line) == 0) {
+                                found = true;
+                                break;
+                        }
+                }
+                fclose(fp);
+        }
+        closedir(dir);
+
+        return found;
+}
+
+static void count_logged_record(void *data, const char *record, size_t size, time_t staged)
+{
+        int *logged = data;
+
+        ck_assert(size > 14 && memcmp(record + size - 14, "\ntest message\n", 14) == 0);
+        (*logged)++;
+}
+
+START_TEST(check_stage_records_with_cached_machine_id)
+{
+        setup();
+
+        client *cl;
+        int server_fd, client_fd;
+        char *record;
+        size_t record_size;
+        char *post_body = "test message";
+        ssize_t ret;
+
+        ck_assert(mkdir(spool_dir_config(), 0700) == 0 || errno == EEXIST);
+
+        /* Until it is refreshed, the id is the one of an unreadable file */
+        ck_assert_str_eq(tdaemon.machine_id, "0");
+
+        tdaemon.machine_id_override = strdup("5eedc0de5eedc0de5eedc0de5eedc0de");
+        refresh_machine_id(&tdaemon);
+        ck_assert_str_eq(tdaemon.machine_id, "5eedc0de5eedc0de5eedc0de5eedc0de");
+        ck_assert_int_eq(tdaemon.machine_id_len, TM_MACHINE_ID_LEN);
+
+        set_up_socket_pair(&client_fd, &server_fd);
+        cl = add_client(&(tdaemon.client_head), client_fd);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        record = get_serialized_record(record_headers, post_body, &record_size);
+        ret = write(server_fd, record, record_size);
+        ck_assert(ret == record_size);
+        close(server_fd);
+
+        ck_assert(handle_client(&tdaemon, cl) == true);
+        ck_assert(find_staged_line("machine_id: 5eedc0de5eedc0de5eedc0de5eedc0de\n"));
+
+        free(tdaemon.machine_id_override);
+        tdaemon.machine_id_override = NULL;
+        free(record);
+
+        teardown();
+}
+END_TEST
+
+START_TEST(check_stage_records_with_workers)
+{
+        setup();
+
+        client *cl[2];
+        int server_fd[2], client_fd;
+        char *record;
+        size_t record_size;
+        char *post_body = "test message";
+        int staged;
+        ssize_t ret;
+
+        ck_assert(mkdir(spool_dir_config(), 0700) == 0 || errno == EEXIST);
+        staged = count_staged_records();
+
+        start_workers(&tdaemon, 2);
+        ck_assert(tdaemon.nworkers == 2);
+
+        record = get_serialized_record(record_headers, post_body, &record_size);
+        for (int i = 0; i < 2; i++) {
+                set_up_socket_pair(&client_fd, &server_fd[i]);
+                cl[i] = add_client(&(tdaemon.client_head), client_fd);
+                ck_assert_msg(cl[i] != NULL, "failed to malloc client");
+                watch_fd(&tdaemon, &cl[i]->watch, EPOLLIN | EPOLLPRI);
+
+                for (int j = 0; j < 3; j++) {
+                        ret = write(server_fd[i], record, record_size);
+                        ck_assert(ret == record_size);
+                }
+                ck_assert(handle_client(&tdaemon, cl[i]) == true);
+        }
+
+        /* Every queued record is staged before the workers stop */
+        stop_workers(&tdaemon);
+        ck_assert(tdaemon.nworkers == 0);
+        ck_assert_int_eq(count_staged_records(), staged + 6);
+
+        /* and records are staged inline again */
+        ret = write(server_fd[0], record, record_size);
+        ck_assert(ret == record_size);
+        ck_assert(handle_client(&tdaemon, cl[0]) == true);
+        ck_assert_int_eq(count_staged_records(), staged + 7);
+
+        for (int i = 0; i < 2; i++) {
+                close(server_fd[i]);
+                handle_client(&tdaemon, cl[i]);
+        }
+        ck_assert(is_client_list_empty(&(tdaemon.client_head)));
+        free(record);
+
+        teardown();
+}
+END_TEST
+
+START_TEST(check_stage_records_to_staging_log)
+{
+        char config[] = "/tmp/check_probd.XXXXXX";
+
+        set_test_config(config, "staging_backend=log\n");
+        initialize_probe_daemon(&tdaemon);
+
+        struct staging_cursor cursor;
+        int logged = 0;
+        client *cl;
+        int server_fd, client_fd;
+        char *record;
+        size_t record_size;
+        char *post_body = "test message";
+        ssize_t ret;
+
+        ck_assert(mkdir(spool_dir_config(), 0700) == 0 || errno == EEXIST);
+
+        /* Skip whatever earlier runs left in the log */
+        ck_assert_int_eq(staging_cursor_open(&cursor, spool_dir_config()), 0);
+        ck_assert(staging_log_consume(&cursor, count_logged_record, NULL, &logged) >= 0);
+        logged = 0;
+
+        open_staging_log(&tdaemon);
+        ck_assert(tdaemon.staging_log != NULL);
+
+        set_up_socket_pair(&client_fd, &server_fd);
+        cl = add_client(&(tdaemon.client_head), client_fd);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        record = get_serialized_record(record_headers, post_body, &record_size);
+        for (int i = 0; i < 2; i++) {
+                ret = write(server_fd, record, record_size);
+                ck_assert(ret == record_size);
+        }
+        close(server_fd);
+        ck_assert(handle_client(&tdaemon, cl) == true);
+
+        close_staging_log(&tdaemon);
+        ck_assert(tdaemon.staging_log == NULL);
+
+        ck_assert_int_eq(staging_log_consume(&cursor, count_logged_record, NULL, &logged), 2);
+        ck_assert_int_eq(logged, 2);
+        staging_cursor_close(&cursor);
+        free(record);
+
+        teardown();
+        unlink(config);
+}
+END_TEST
+
+START_TEST(check_hand_off_records_to_telempostd)
+{
+        char config[] = "/tmp/check_probd.XXXXXX";
+
+        set_test_config(config, "staging_backend=log\n"
+                        "handoff_enabled=true\n"
+                        "handoff_socket_path=/tmp/test_telem_handoff\n");
+        initialize_probe_daemon(&tdaemon);
+
+        struct staging_cursor cursor;
+        int logged = 0;
+        client *cl;
+        int server_fd, client_fd;
+        int listenfd, fd;
+        char *record;
+        size_t record_size;
+        char buf[HANDOFF_MAX_RECORD];
+        char *post_body = "test message";
+        ssize_t ret;
+
+        ck_assert(mkdir(spool_dir_config(), 0700) == 0 || errno == EEXIST);
+
+        /* Skip whatever earlier runs left in the log */
+        ck_assert_int_eq(staging_cursor_open(&cursor, spool_dir_config()), 0);
+        ck_assert(staging_log_consume(&cursor, count_logged_record, NULL, &logged) >= 0);
+        logged = 0;
+
+        listenfd = handoff_listen(handoff_socket_path_config());
+        ck_assert(listenfd >= 0);
+
+        open_staging_log(&tdaemon);
+        open_handoff(&tdaemon);
+        ck_assert(tdaemon.handoff != NULL);
+
+        set_up_socket_pair(&client_fd, &server_fd);
+        cl = add_client(&(tdaemon.client_head), client_fd);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        /* telempostd takes the first record, so it is not staged */
+        record = get_serialized_record(record_headers, post_body, &record_size);
+        ret = write(server_fd, record, record_size);
+        ck_assert(ret == record_size);
+        ck_assert(handle_client(&tdaemon, cl) == true);
+
+        fd = handoff_accept(listenfd);
+        ck_assert(fd >= 0);
+        ret = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        ck_assert(ret > 0);
+        count_logged_record(&logged, buf, (size_t)ret, 0);
+        ck_assert_int_eq(logged, 1);
+        ck_assert_int_eq(staging_log_consume(&cursor, count_logged_record, NULL, &logged), 0);
+
+        /* Once telempostd is gone, the next record is staged */
+        close(fd);
+        close(listenfd);
+        ret = write(server_fd, record, record_size);
+        ck_assert(ret == record_size);
+        close(server_fd);
+        ck_assert(handle_client(&tdaemon, cl) == true);
+
+        close_handoff(&tdaemon);
+        ck_assert(tdaemon.handoff == NULL);
+        close_staging_log(&tdaemon);
+
+        ck_assert_int_eq(staging_log_consume(&cursor, count_logged_record, NULL, &logged), 1);
+        ck_assert_int_eq(logged, 2);
+        staging_cursor_close(&cursor);
+        unlink(handoff_socket_path_config());
+        free(record);
+
+        teardown();
+        unlink(config);
+}
+END_TEST
+
+/* Whether records a client sends past its limit are dropped and the client
+ * told to wait once it is done sending, with workers staging records or not */
+static void drop_records_past_client_limit(int workers)
+{
+        char config[] = "/tmp/check_probd.XXXXXX";
+
+        /* 20 records per client and hour are admitted */
+        set_test_config(config, "staging_backend=log\n"
+                        "admission_enabled=true\n"
+                        "admission_client_limit=20\n"
+                        "admission_classification_limit=-1\n"
+                        "admission_window_length=3600\n");
+        initialize_probe_daemon(&tdaemon);
+
+        struct staging_cursor cursor;
+        struct admission_notice notice;
+        int logged = 0;
+        client *cl;
+        int server_fd, client_fd;
+        char *record;
+        size_t record_size;
+        char *post_body = "test message";
+        ssize_t ret;
+
+        ck_assert(mkdir(spool_dir_config(), 0700) == 0 || errno == EEXIST);
+
+        /* Skip whatever earlier runs left in the log */
+        ck_assert_int_eq(staging_cursor_open(&cursor, spool_dir_config()), 0);
+        ck_assert(staging_log_consume(&cursor, count_logged_record, NULL, &logged) >= 0);
+        logged = 0;
+
+        open_staging_log(&tdaemon);
+        open_admission(&tdaemon);
+        ck_assert(tdaemon.admission != NULL);
+        start_workers(&tdaemon, workers);
+
+        set_up_socket_pair(&client_fd, &server_fd);
+        cl = add_client(&(tdaemon.client_head), client_fd);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        ck_assert(cl->cred.pid == getpid());
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        record = get_serialized_record(record_headers, post_body, &record_size);
+        for (int i = 0; i < 25; i++) {
+                ret = write(server_fd, record, record_size);
+                ck_assert(ret == record_size);
+        }
+        ck_assert(handle_client(&tdaemon, cl) == true);
+        ck_assert(tdaemon.admission->rejected == 5);
+
+        /* The client is told to wait until it gets a token back */
+        ret = recv(server_fd, &notice, sizeof(notice), MSG_DONTWAIT);
+        ck_assert(ret == sizeof(notice));
+        ck_assert(notice.magic == ADMISSION_NOTICE);
+        ck_assert(notice.wait > 0 && notice.wait <= 3600 / 20 + 1);
+
+        /* and only once */
+        ck_assert(handle_client(&tdaemon, cl) == false);
+        ret = recv(server_fd, &notice, sizeof(notice), MSG_DONTWAIT);
+        ck_assert(ret < 0 && errno == EAGAIN);
+
+        close(server_fd);
+        ck_assert(handle_client(&tdaemon, cl) == false);
+
+        /* Only admitted records were queued to the workers */
+        stop_workers(&tdaemon);
+        close_admission(&tdaemon);
+        ck_assert(tdaemon.admission == NULL);
+        close_staging_log(&tdaemon);
+
+        ck_assert_int_eq(staging_log_consume(&cursor, count_logged_record, NULL, &logged), 20);
+        staging_cursor_close(&cursor);
+        free(record);
+
+        teardown();
+        unlink(config);
+}
+
+START_TEST(check_drop_records_past_client_limit)
+{
+        drop_records_past_client_limit(0);
+}
+END_TEST
+
+START_TEST(check_drop_records_past_client_limit_with_workers)
+{
+        drop_records_past_client_limit(2);
+}
+END_TEST
+
+START_TEST(check_buffer_pool_reuse_and_trim)
+{
+        struct buffer_pool pool;
+        bool trimmed = false;
+        void *a, *b, *c;
+        int ret;
+
+        buffer_pool_init(&pool, 64, 2);
+
+        a = buffer_pool_get(&pool);
+        b = buffer_pool_get(&pool);
+        c = buffer_pool_get(&pool);
+        ck_assert(a != NULL && b != NULL && c != NULL);
+        ck_assert(pool.nfree == 0);
+
+        /* Only max_free buffers are kept */
+        buffer_pool_put(&pool, a);
+        buffer_pool_put(&pool, b);
+        buffer_pool_put(&pool, c);
+        buffer_pool_put(&pool, NULL);
+        ck_assert(pool.nfree == 2);
+
+        /* and handed out again, most recent first */
+        ck_assert(buffer_pool_get(&pool) == b);
+        ck_assert(pool.nfree == 1);
+        buffer_pool_put(&pool, b);
+
+        /* Not idle long enough yet */
+        ret = buffer_pool_idle_trim(&pool, time(NULL), 60, &trimmed);
+        ck_assert(ret > 0 && ret <= 60);
+        ck_assert(pool.nfree == 2);
+        ck_assert(trimmed == false);
+
+        ck_assert_int_eq(buffer_pool_idle_trim(&pool, time(NULL) - 60, 60, &trimmed), -1);
+        ck_assert(pool.nfree == 0);
+        ck_assert(trimmed == true);
+
+        /* Once per idle period, and never with a zero idle time */
+        ck_assert_int_eq(buffer_pool_idle_trim(&pool, time(NULL) - 60, 60, &trimmed), -1);
+        trimmed = false;
+        buffer_pool_put(&pool, buffer_pool_get(&pool));
+        ck_assert_int_eq(buffer_pool_idle_trim(&pool, time(NULL) - 60, 0, &trimmed), -1);
+        ck_assert(pool.nfree == 1);
+
+        buffer_pool_trim(&pool);
+        ck_assert(pool.nfree == 0);
+}
+END_TEST
+
+START_TEST(check_client_deadline_for_partial_record)
+{
+        setup();
+
+        client *cl;
+        int server_fd, client_fd;
+        bool processed;
+        char *record;
+        size_t record_size;
+        time_t deadline;
+        char *post_body = "test message";
+        ssize_t ret;
+
+        set_up_socket_pair(&client_fd, &server_fd);
+        cl = add_client(&(tdaemon.client_head), client_fd);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        record = get_serialized_record(record_headers, post_body, &record_size);
+
+        /* Nothing sent yet, nothing to expire */
+        ck_assert_int_eq(expire_clients(&tdaemon, time(NULL)), -1);
+
+        /* Size prefix and part of the record */
+        ret = write(server_fd, record, record_size / 2);
+        ck_assert(ret == record_size / 2);
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == false);
+        ck_assert(cl->state == CLIENT_READ_RECORD);
+        ck_assert(cl->record_size == record_size);
+        ck_assert(cl->partial);
+        deadline = cl->deadline;
+        ck_assert(deadline >= time(NULL) + TM_CLIENT_RECV_TIME - 1);
+
+        /* The client is kept until its deadline */
+        ck_assert_int_gt(expire_clients(&tdaemon, time(NULL)), 0);
+        ck_assert_msg(tdaemon.nfds == 1, "Removed client before its deadline\n");
+
+        /* Completing the record takes the client off the partial list */
+        ret = write(server_fd, record + record_size / 2, record_size - record_size / 2);
+        ck_assert(ret == record_size - record_size / 2);
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == true);
+        ck_assert(cl->state == CLIENT_READ_SIZE);
+        ck_assert(!cl->partial);
+        ck_assert_int_eq(expire_clients(&tdaemon, deadline), -1);
+
+        /* A client stuck in a record is dropped at its deadline */
+        ret = write(server_fd, record, 2);
+        ck_assert(ret == 2);
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == false);
+        ck_assert(cl->state == CLIENT_READ_SIZE);
+        ck_assert(cl->partial);
+        ck_assert_int_eq(expire_clients(&tdaemon, cl->deadline), -1);
+        ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client past its deadline\n");
+        ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client past its deadline\n");
+        ck_assert(TAILQ_EMPTY(&tdaemon.partial_head));
+
         close(server_fd);
         free(record);
+
+        teardown();
+}
+END_TEST
+
+START_TEST(check_process_records_on_seqpacket_connection)
+{
+        setup();
+
+        client *cl;
+        int sv[2];
+        bool processed;
+        char *record;
+        size_t record_size;
+        uint32_t bad_size;
+        char *post_body = "test message";
+        ssize_t ret;
+
+        ck_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == 0);
+        ck_assert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+        cl = add_client(&(tdaemon.client_head), sv[0]);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        cl->seqpacket = true;
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        record = get_serialized_record(record_headers, post_body, &record_size);
+
+        /* One record per message */
+        ret = write(sv[1], record, record_size);
+        ck_assert(ret == record_size);
+        ret = write(sv[1], record, record_size);
+        ck_assert(ret == record_size);
+
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == true);
+        ck_assert_msg(tdaemon.nfds == 1, "Removed poll fd for client still connected\n");
+
+        /* A message must hold exactly the record announced by its size */
+        bad_size = (uint32_t)record_size + 1;
+        memcpy(record, &bad_size, sizeof(uint32_t));
+        ret = write(sv[1], record, record_size);
+        ck_assert(ret == record_size);
+
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == false);
+        ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client sending an invalid message\n");
+        ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client sending an invalid message\n");
+
+        close(sv[1]);
+        free(record);
+        free(tdaemon.msg_buf);
+
+        teardown();
+}
+END_TEST
+
+/* Asks for the ring over a client connection, as the library does */
+static struct shm_ring *request_ring(client *cl, int fd)
+{
+        union {
+                struct cmsghdr align;
+                char buf[CMSG_SPACE(2 * sizeof(int))];
+        } control;
+        int fds[2];
+        uint32_t request = SHM_RING_REQUEST;
+        int32_t status = -1;
+        struct iovec iov = { .iov_base = &status, .iov_len = sizeof(status) };
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+        struct shm_ring *ring = NULL;
+        ssize_t ret;
+
+        /* The request is answered, and is not a record */
+        ret = write(fd, &request, sizeof(request));
+        ck_assert(ret == sizeof(request));
+        ck_assert(handle_client(&tdaemon, cl) == false);
+        ck_assert_msg(tdaemon.nfds == 2, "Ring eventfd not watched\n");
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ret = recvmsg(fd, &msg, 0);
+        ck_assert(ret == sizeof(status));
+        ck_assert_int_eq(status, 0);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        ck_assert(cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS);
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        ck_assert_int_eq(shm_ring_attach(&ring, fds[0], fds[1]), 0);
+
+        return ring;
+}
+
+START_TEST(check_process_records_from_shm_ring)
+{
+        char config[] = "/tmp/check_probd.XXXXXX";
+
+        set_test_config(config, "shm_ring_enabled=true\nshm_ring_slots=32\n");
+        initialize_probe_daemon(&tdaemon);
+
+        client *cl;
+        int sv[2];
+        bool processed;
+        char *record;
+        size_t record_size;
+        struct shm_ring *ring;
+        char *post_body = "test message";
+        struct iovec record_iov;
+        int i;
+
+        ck_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == 0);
+        ck_assert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+        cl = add_client(&(tdaemon.client_head), sv[0]);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        cl->seqpacket = true;
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        ring = request_ring(cl, sv[1]);
+
+        record = get_serialized_record(record_headers, post_body, &record_size);
+        record_iov.iov_base = record;
+        record_iov.iov_len = record_size;
+
+        /* 32 slots were configured */
+        for (i = 0; i < 32; i++) {
+                ck_assert_int_eq(shm_ring_push(ring, &record_iov, 1, record_size), 0);
+        }
+        ck_assert_int_eq(shm_ring_push(ring, &record_iov, 1, record_size), -EAGAIN);
+
+        processed = handle_ring(&tdaemon);
+        ck_assert(processed == true);
+        ck_assert_int_eq(shm_ring_push(ring, &record_iov, 1, record_size), 0);
+
+        /* Whatever is left is processed when the daemon exits */
+        close_ring(&tdaemon);
+        ck_assert(tdaemon.ring == NULL);
+        ck_assert_int_eq(shm_ring_push(ring, &record_iov, 1, record_size), -EPIPE);
+
+        shm_ring_free(ring);
+        close(sv[1]);
+        free(record);
+        free(tdaemon.msg_buf);
+        remove_client(&(tdaemon.client_head), cl);
+
+        teardown();
+        unlink(config);
+}
+END_TEST
+
+START_TEST(check_replace_stalled_shm_ring)
+{
+        char config[] = "/tmp/check_probd.XXXXXX";
+
+        set_test_config(config, "shm_ring_enabled=true\nshm_ring_slots=32\n");
+        initialize_probe_daemon(&tdaemon);
+
+        client *cl;
+        int sv[2];
+        char *record;
+        size_t record_size;
+        struct shm_ring *ring;
+        char *post_body = "test message";
+        struct iovec record_iov;
+        uint64_t late;
+
+        ck_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == 0);
+        ck_assert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+        cl = add_client(&(tdaemon.client_head), sv[0]);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        cl->seqpacket = true;
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        ring = request_ring(cl, sv[1]);
+        record = get_serialized_record(record_headers, post_body, &record_size);
+        record_iov.iov_base = record;
+        record_iov.iov_len = record_size;
+
+        /* A producer claims a slot and stops before writing it, holding up
+         * the record after it */
+        ck_assert_int_eq(shm_ring_claim(ring, record_size, &late), 0);
+        ck_assert_int_eq(shm_ring_push(ring, &record_iov, 1, record_size), 0);
+        ck_assert(handle_ring(&tdaemon) == false);
+        ck_assert(tdaemon.ring_stall != 0);
+
+        /* Once it stalled long enough, the slot is skipped, the record after
+         * it processed, and the ring closed */
+        tdaemon.ring_stall = time(NULL) - TM_RING_STALL_TIME;
+        ck_assert(handle_ring(&tdaemon) == true);
+        ck_assert(tdaemon.ring == NULL);
+        ck_assert_int_eq(tdaemon.nfds, 1);
+
+        /* The producer finds out when it resumes, and the ring is not used
+         * anymore */
+        ck_assert_int_eq(shm_ring_commit(ring, late, &record_iov, 1, record_size), -EPIPE);
+        ck_assert_int_eq(shm_ring_push(ring, &record_iov, 1, record_size), -EPIPE);
+        shm_ring_free(ring);
+
+        /* The next request gets a new ring */
+        ring = request_ring(cl, sv[1]);
+        ck_assert_int_eq(shm_ring_push(ring, &record_iov, 1, record_size), 0);
+        ck_assert(handle_ring(&tdaemon) == true);
+
+        /* A producer still writing a slot when the ring closes finds out too */
+        ck_assert_int_eq(shm_ring_claim(ring, record_size, &late), 0);
+        close_ring(&tdaemon);
+        ck_assert_int_eq(shm_ring_commit(ring, late, &record_iov, 1, record_size), -EPIPE);
+
+        shm_ring_free(ring);
+        close(sv[1]);
+        free(record);
+        free(tdaemon.msg_buf);
+        remove_client(&(tdaemon.client_head), cl);
+
+        teardown();
+        unlink(config);
 }
 END_TEST
 
@@ -340,23 +1152,178 @@ START_TEST(check_process_record_with_incorrect_headers)
         set_up_socket_pair(&client_fd, &server_fd);
         cl = add_client(&(tdaemon.client_head), client_fd);
         ck_assert_msg(cl != NULL, "failed to malloc client");
-        add_pollfd(&tdaemon, client_fd, POLLIN | POLLPRI);
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
 
         record = get_serialized_record(headers, post_body, &record_size);
         ssize_t ret = write(server_fd, record, record_size);
         ck_assert(ret == record_size);
+        close(server_fd);
 
-        processed = handle_client(&tdaemon, 0, cl);
+        processed = handle_client(&tdaemon, cl);
         ck_assert(processed == true);
         ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client with incorrect headers\n");
         ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client with incorrect headers\n");
-        close(server_fd);
         free(record);
 
         teardown();
 }
 END_TEST
 
+/* Encode the headers of a record in binary, last header first */
+static size_t put_binary_headers(char *buf, const char *classification)
+{
+        const char *strings[NUM_HEADERS] = {
+                [TM_CLASSIFICATION] = classification,
+                [TM_MACHINE_ID] = "1234",
+                [TM_ARCH] = "x86_64",
+                [TM_HOST_TYPE] = "macbookpro",
+                [TM_SYSTEM_BUILD] = "200",
+                [TM_KERNEL_VERSION] = "3.15",
+                [TM_SYSTEM_NAME] = "clear-linux-os",
+                [TM_BOARD_NAME] = "Qemu|Intel",
+                [TM_CPU_MODEL] = "Intel(R) Core(TM) i7-5650U CPU @ 2.20GHz",
+                [TM_BIOS_VERSION] = "Qemu",
+                [TM_EVENT_ID] = "3a2d799826edc6266d72824d2aac6763",
+        };
+        const uint64_t numbers[NUM_HEADERS] = {
+                [TM_RECORD_VERSION] = 4,
+                [TM_SEVERITY] = 2,
+                [TM_TIMESTAMP] = 1418672344,
+                [TM_PAYLOAD_VERSION] = 1,
+        };
+        size_t size = 0;
+
+        for (int i = NUM_HEADERS - 1; i >= 0; i--) {
+                if (wire_header_width(i) != 0) {
+                        size += wire_put_num(buf + size, i, numbers[i]);
+                } else {
+                        size += wire_put_str(buf + size, i, strings[i],
+                                             strlen(strings[i]));
+                }
+        }
+
+        return size;
+}
+
+START_TEST(check_wire_binary_headers_in_any_order)
+{
+        struct wire_headers headers;
+        char buf[512];
+        size_t size;
+
+        size = put_binary_headers(buf, "crash/kernel/bug");
+        ck_assert_int_eq(wire_parse_binary(buf, size, &headers), 0);
+
+        ck_assert_int_eq(headers.len[TM_CLASSIFICATION], strlen("crash/kernel/bug"));
+        ck_assert(strncmp(headers.value[TM_CLASSIFICATION], "crash/kernel/bug",
+                          headers.len[TM_CLASSIFICATION]) == 0);
+        /* String values point into the record */
+        ck_assert(headers.value[TM_CLASSIFICATION] > buf &&
+                  headers.value[TM_CLASSIFICATION] < buf + size);
+        ck_assert_str_eq(headers.value[TM_SEVERITY], "2");
+        ck_assert_str_eq(headers.value[TM_TIMESTAMP], "1418672344");
+        ck_assert_str_eq(headers.value[TM_RECORD_VERSION], "4");
+
+        /* Truncated, repeated and missing headers are all rejected */
+        ck_assert_int_eq(wire_parse_binary(buf, size - 1, &headers), -EINVAL);
+        memcpy(buf + size, buf, wire_num_size(TM_PAYLOAD_VERSION));
+        ck_assert_int_eq(wire_parse_binary(buf, size + wire_num_size(TM_PAYLOAD_VERSION),
+                                           &headers), -EINVAL);
+        ck_assert_int_eq(wire_parse_binary(buf + wire_str_size(EVENT_ID_LEN),
+                                           size - wire_str_size(EVENT_ID_LEN),
+                                           &headers), -EINVAL);
+
+        /* Values become lines of the staged record */
+        size = put_binary_headers(buf, "crash/kernel\nbug");
+        ck_assert_int_eq(wire_parse_binary(buf, size, &headers), -EINVAL);
+}
+END_TEST
+
+START_TEST(check_wire_text_headers_in_any_order)
+{
+        struct wire_headers headers;
+        char *text = "event_id: 3a2d799826edc6266d72824d2aac6763\n"
+                     "bios_version: Qemu\nseverity: 0\n"
+                     "cpu_model: Intel(R) Core(TM) i7-5650U CPU @ 2.20GHz\n"
+                     "board_name: Qemu|Intel\nsystem_name: clear-linux-os\n"
+                     "payload_format_version: 1\nkernel_version: 3.15\n"
+                     "build: 200\nhost_type: macbookpro\narch:x86_64\n"
+                     "creation_timestamp: 1418672344\nmachine_id: 1234\n"
+                     "classification: crash/kernel/bug\nrecord_format_version: 1\n";
+        char *repeated = "severity: 0\nseverity: 1\n";
+
+        ck_assert_int_eq(wire_parse_text(text, strlen(text), &headers), 0);
+        ck_assert_int_eq(headers.len[TM_ARCH], strlen("x86_64"));
+        ck_assert(strncmp(headers.value[TM_ARCH], "x86_64", headers.len[TM_ARCH]) == 0);
+        ck_assert_int_eq(headers.len[TM_RECORD_VERSION], 1);
+        ck_assert(headers.value[TM_RECORD_VERSION][0] == '1');
+
+        /* The last header may lack its newline */
+        ck_assert_int_eq(wire_parse_text(text, strlen(text) - 1, &headers), 0);
+        ck_assert_int_eq(wire_parse_text(text, strlen(text) / 2, &headers), -EINVAL);
+        ck_assert_int_eq(wire_parse_text(repeated, strlen(repeated), &headers), -EINVAL);
+}
+END_TEST
+
+START_TEST(check_header_ids)
+{
+        const char *name;
+
+        for (int i = 0; i < NUM_HEADERS; i++) {
+                name = get_header_name(i);
+                ck_assert_int_eq(get_header_id(name, strlen(name)), i);
+                /* A prefix of a name, or a longer one, is not the name */
+                ck_assert_int_eq(get_header_id(name, strlen(name) - 1), -1);
+        }
+        ck_assert_int_eq(get_header_id("buildx", 6), -1);
+        ck_assert_int_eq(get_header_id("serenity", 8), -1);
+        ck_assert_int_eq(get_header_id("", 0), -1);
+}
+END_TEST
+
+START_TEST(check_process_binary_record)
+{
+        setup();
+
+        client *cl;
+        int server_fd, client_fd;
+        bool processed;
+        char record[1024];
+        char *post_body = "test message";
+        uint32_t field;
+        size_t header_size;
+        size_t record_size;
+
+        set_up_socket_pair(&client_fd, &server_fd);
+        cl = add_client(&(tdaemon.client_head), client_fd);
+        ck_assert_msg(cl != NULL, "failed to malloc client");
+        watch_fd(&tdaemon, &cl->watch, EPOLLIN | EPOLLPRI);
+
+        header_size = put_binary_headers(record + 3 * sizeof(uint32_t),
+                                         "crash/kernel/bug");
+        record_size = 3 * sizeof(uint32_t) + header_size + strlen(post_body) + 1;
+        field = (uint32_t)record_size;
+        memcpy(record, &field, sizeof(uint32_t));
+        field = WIRE_V5_MAGIC;
+        memcpy(record + sizeof(uint32_t), &field, sizeof(uint32_t));
+        field = (uint32_t)header_size;
+        memcpy(record + 2 * sizeof(uint32_t), &field, sizeof(uint32_t));
+        memcpy(record + 3 * sizeof(uint32_t) + header_size, post_body,
+               strlen(post_body) + 1);
+
+        ssize_t ret = write(server_fd, record, record_size);
+        ck_assert(ret == record_size);
+        close(server_fd);
+
+        processed = handle_client(&tdaemon, cl);
+        ck_assert(processed == true);
+        ck_assert_msg(is_client_list_empty(&(tdaemon.client_head)), "Failed to remove client with binary record\n");
+        ck_assert_msg(tdaemon.nfds == 0, "Failed to remove poll fd for client with binary record\n");
+
+        teardown();
+}
+END_TEST
+
 Suite *config_suite(void)
 {
         // A suite is comprised of test cases, defined below
@@ -364,7 +1331,7 @@ Suite *config_suite(void)
 
         // Individual unit tests are added to "test cases"
         TCase *t = tcase_create("probd");
-        tcase_add_test(t, check_add_del_poll_fd);
+        tcase_add_test(t, check_watch_unwatch_fd);
         tcase_add_test(t, check_daemon_is_initialized);
         tcase_add_test(t, check_add_remove_client);
         tcase_add_test(t, check_handle_client_with_no_data);
@@ -372,7 +1339,23 @@ Suite *config_suite(void)
         tcase_add_test(t, check_handle_client_with_incorrect_size);
         tcase_add_test(t, check_handle_client_with_correct_size);
         tcase_add_test(t, check_process_record_with_correct_size_and_data);
+        tcase_add_test(t, check_process_multiple_records_on_one_connection);
+        tcase_add_test(t, check_stage_records_with_cached_machine_id);
+        tcase_add_test(t, check_stage_records_with_workers);
+        tcase_add_test(t, check_stage_records_to_staging_log);
+        tcase_add_test(t, check_hand_off_records_to_telempostd);
+        tcase_add_test(t, check_drop_records_past_client_limit);
+        tcase_add_test(t, check_drop_records_past_client_limit_with_workers);
+        tcase_add_test(t, check_buffer_pool_reuse_and_trim);
+        tcase_add_test(t, check_client_deadline_for_partial_record);
+        tcase_add_test(t, check_process_records_on_seqpacket_connection);
+        tcase_add_test(t, check_process_records_from_shm_ring);
+        tcase_add_test(t, check_replace_stalled_shm_ring);
         tcase_add_test(t, check_process_record_with_incorrect_headers);
+        tcase_add_test(t, check_wire_binary_headers_in_any_order);
+        tcase_add_test(t, check_wire_text_headers_in_any_order);
+        tcase_add_test(t, check_header_ids);
+        tcase_add_test(t, check_process_binary_record);
 
         suite_add_tcase(s, t);
 
@@ -59,7 +59,8 @@ endif
 %C%_check_probd_LDADD = \
 	@CHECK_LIBS@ \
 	@CURL_LIBS@ \
-	$(top_builddir)/src/libtelem-shared.la
+	$(top_builddir)/src/libtelem-shared.la \
+	-lpthread
 
 if LOG_SYSTEMD
 if HAVE_SYSTEMD_JOURNAL
@@ -75,6 +76,9 @@ endif
 	src/spool.c \
 	src/iorecord.c \
 	src/retention.c \
+	src/post_batch.c \
+	src/post_queue.c \
+	src/post_compress.c \
         src/telempostdaemon.c \
         src/telempostdaemon.h \
         src/journal/journal.c \
@@ -89,13 +93,22 @@ EXTRA_DIST += \
 %C%_check_postd_CFLAGS = \
         $(AM_CFLAGS) \
         @CHECK_CFLAGS@ \
-        @CURL_CFLAGS@
+        @CURL_CFLAGS@ \
+        @ZLIB_CFLAGS@
 %C%_check_postd_LDADD = \
         @CHECK_LIBS@ \
         @CURL_LIBS@ \
         @JSON_C_LIBS@ \
+        @ZLIB_LIBS@ \
         $(top_builddir)/src/libtelem-shared.la
 
+if HAVE_ZSTD
+%C%_check_postd_CFLAGS += \
+        $(ZSTD_CFLAGS)
+%C%_check_postd_LDADD += \
+        $(ZSTD_LIBS)
+endif
+
 if LOG_SYSTEMD
 if HAVE_SYSTEMD_JOURNAL
 %C%_check_postd_CFLAGS += \
@@ -162,6 +175,8 @@ endif
 %C%_check_journal_SOURCES = \
 	%D%/check_journal.c \
 	src/journal/journal.c \
+	src/random_id.c \
+	src/random_id.h \
 	src/util.h \
 	src/util.c
 